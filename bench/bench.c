@@ -0,0 +1,436 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+#include "bench.h"
+
+void bench_init(struct bench *b)
+{
+	memset(b, 0, sizeof(*b));
+	b->repetitions = 5;
+	b->min_time = 0.2;
+	b->threshold = 0.1;
+}
+
+int bench_option(struct bench *b, int argc, char **argv, int *i)
+{
+	const char *option = argv[*i];
+	const char *value = *i + 1 < argc ? argv[*i + 1] : NULL;
+	int error;
+
+	if (strcmp(option, "--counters") == 0) {
+		if (!b->counters && bench_counters_open(&b->pmu, &error) == 0) {
+			fprintf(stderr, "# hardware counters unavailable: %s\n", strerror(error));
+			bench_counters_close(&b->pmu);
+		} else {
+			b->counters = 1;
+		}
+		return 1;
+	}
+	if (value == NULL)
+		return 0;
+	if (strcmp(option, "--repetitions") == 0)
+		b->repetitions = atoi(value) > 0 ? atoi(value) : 1;
+	else if (strcmp(option, "--min-time") == 0)
+		b->min_time = atof(value);
+	else if (strcmp(option, "--threshold") == 0)
+		b->threshold = atof(value);
+	else if (strcmp(option, "--filter") == 0)
+		b->filter = value;
+	else if (strcmp(option, "--baseline") == 0)
+		b->baseline = value;
+	else if (strcmp(option, "--save") == 0)
+		b->save = value;
+	else
+		return 0;
+	(*i)++;
+	return 1;
+}
+
+void bench_usage(void)
+{
+	fprintf(stderr,
+		"  --repetitions N   keep the best of N runs (5)\n"
+		"  --min-time S      run each case at least S seconds (0.2)\n"
+		"  --filter TEXT     only run the cases containing TEXT\n"
+		"  --save FILE       save the results to FILE\n"
+		"  --baseline FILE   compare the results to FILE, saved with --save\n"
+		"  --threshold F     a case slower than the baseline by more than F is a regression (0.1)\n"
+		"  --counters        also report hardware counters per operation and per bucket visit\n");
+}
+
+void bench_header(const struct bench *b)
+{
+	int i;
+
+	printf("# name\tns/op\top/s");
+	if (b->counters) {
+		for (i = 0; i < BENCH_COUNTERS; i++)
+			printf("\t%s/op", bench_counter_name(i));
+		printf("\tvisits/op");
+		for (i = 0; i < BENCH_COUNTERS; i++)
+			printf("\t%s/visit", bench_counter_name(i));
+	}
+	printf("\n");
+}
+
+int bench_selected(const struct bench *b, const char *name)
+{
+	return b->filter == NULL || strstr(name, b->filter) != NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct worker {
+	pthread_t thread;
+	bench_fn fn;
+	void *arg;
+	int index;
+	__u64 iterations;
+	pthread_barrier_t *barrier;
+};
+
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+
+	pthread_barrier_wait(w->barrier);
+	w->fn(w->arg, w->index, w->iterations);
+	return NULL;
+}
+
+/* the seconds it takes each of __threads__ threads to run __iterations__ */
+static double measure(int threads, bench_fn fn, void *arg, __u64 iterations)
+{
+	struct worker workers[threads];
+	pthread_barrier_t barrier;
+	double start;
+	int t;
+
+	if (threads == 1) {
+		start = now();
+		fn(arg, 0, iterations);
+		return now() - start;
+	}
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+	for (t = 0; t < threads; t++) {
+		workers[t].fn = fn;
+		workers[t].arg = arg;
+		workers[t].index = t;
+		workers[t].iterations = iterations;
+		workers[t].barrier = &barrier;
+		pthread_create(&workers[t].thread, NULL, work, &workers[t]);
+	}
+	start = now();
+	pthread_barrier_wait(&barrier);
+	for (t = 0; t < threads; t++)
+		pthread_join(workers[t].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+	return now() - start;
+}
+
+static void print_count(double count, double per)
+{
+	if (count < 0 || per <= 0)
+		printf("\t-");
+	else
+		printf("\t%.2f", count / per);
+}
+
+/* the results and, if not NULL, the __counts__ of __operations__ */
+static void record_counts(struct bench *b, const char *name, double ns, double ops,
+			  const double *counts, double operations)
+{
+	struct bench_result *result;
+	int i;
+
+	if (b->count == b->capacity) {
+		b->capacity = b->capacity ? b->capacity * 2 : 32;
+		b->results = realloc(b->results, sizeof(*b->results) * b->capacity);
+		if (b->results == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	result = &b->results[b->count++];
+	result->name = strdup(name);
+	result->ns = ns;
+	result->ops = ops;
+	printf("%s\t%.2f\t%.0f", result->name, result->ns, result->ops);
+	if (b->counters) {
+		for (i = 0; i < BENCH_COUNTERS; i++)
+			print_count(counts ? counts[i] : -1, operations);
+		print_count(b->visits, 1);
+		for (i = 0; i < BENCH_COUNTERS; i++)
+			print_count(counts ? counts[i] : -1, operations * b->visits);
+	}
+	printf("\n");
+	fflush(stdout);
+	b->visits = 0;
+}
+
+void bench_record(struct bench *b, const char *name, double ns, double ops)
+{
+	record_counts(b, name, ns, ops, NULL, 0);
+}
+
+/* what is timed: a multi-threaded function or setup and steps */
+struct timed {
+	int threads;
+	bench_fn fn;
+	bench_step setup;
+	bench_step step;
+	void *arg;
+	/* if not NULL, count only the steps, not the setup */
+	struct bench_counters *counters;
+};
+
+static double measure_steps(const struct timed *t, __u64 iterations)
+{
+	double elapsed = 0, start;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++) {
+		if (t->setup != NULL)
+			t->setup(t->arg);
+		if (t->counters != NULL)
+			bench_counters_resume(t->counters);
+		start = now();
+		t->step(t->arg);
+		elapsed += now() - start;
+		if (t->counters != NULL)
+			bench_counters_stop(t->counters);
+	}
+	return elapsed;
+}
+
+static double measure_timed(const struct timed *t, __u64 iterations)
+{
+	if (t->step != NULL)
+		return measure_steps(t, iterations);
+	return measure(t->threads, t->fn, t->arg, iterations);
+}
+
+/*
+ * Grow the number of iterations until a run lasts min_time and
+ * return the shortest of the runs with this number of iterations.
+ */
+static double best_of(const struct bench *b, const struct timed *t, __u64 *iterations)
+{
+	double elapsed, best;
+	int r;
+
+	*iterations = 1;
+	for (;;) {
+		elapsed = measure_timed(t, *iterations);
+		if (elapsed >= b->min_time)
+			break;
+		if (elapsed < b->min_time / 100)
+			*iterations *= 10;
+		else
+			*iterations = *iterations * 1.2 * b->min_time / elapsed + 1;
+	}
+	best = elapsed;
+	for (r = 1; r < b->repetitions; r++) {
+		elapsed = measure_timed(t, *iterations);
+		if (elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+/*
+ * Run __iterations__ once more and store in __counts__ the hardware
+ * counters of the run.
+ */
+static void count(struct bench *b, struct timed *t, __u64 iterations,
+		  double counts[BENCH_COUNTERS])
+{
+	bench_counters_start(&b->pmu);
+	if (t->step != NULL) {
+		bench_counters_stop(&b->pmu);
+		t->counters = &b->pmu;
+	}
+	measure_timed(t, iterations);
+	bench_counters_stop(&b->pmu);
+	t->counters = NULL;
+	bench_counters_read(&b->pmu, counts);
+}
+
+void bench_run(struct bench *b, const char *name, int threads,
+	       bench_fn fn, void *arg)
+{
+	struct timed t = { threads < 1 ? 1 : threads, fn, NULL, NULL, arg, NULL };
+	double counts[BENCH_COUNTERS];
+	__u64 iterations;
+	double elapsed;
+
+	if (!bench_selected(b, name)) {
+		b->visits = 0;
+		return;
+	}
+	elapsed = best_of(b, &t, &iterations);
+	if (b->counters)
+		count(b, &t, iterations, counts);
+	record_counts(b, name, elapsed * 1e9 / iterations, iterations * t.threads / elapsed,
+		      counts, (double)iterations * t.threads);
+}
+
+void bench_run_steps(struct bench *b, const char *name, int batch,
+		     bench_step setup, bench_step fn, void *arg)
+{
+	struct timed t = { 1, NULL, setup, fn, arg, NULL };
+	double counts[BENCH_COUNTERS];
+	__u64 iterations;
+	double elapsed;
+
+	if (!bench_selected(b, name)) {
+		b->visits = 0;
+		return;
+	}
+	if (batch < 1)
+		batch = 1;
+	elapsed = best_of(b, &t, &iterations);
+	if (b->counters)
+		count(b, &t, iterations, counts);
+	record_counts(b, name, elapsed * 1e9 / iterations / batch, iterations * batch / elapsed,
+		      counts, (double)iterations * batch);
+}
+
+static int save(const struct bench *b)
+{
+	FILE *f = fopen(b->save, "w");
+	int i;
+
+	if (f == NULL) {
+		perror(b->save);
+		return 1;
+	}
+	fprintf(f, "# name\tns/op\top/s\n");
+	for (i = 0; i < b->count; i++)
+		fprintf(f, "%s\t%.2f\t%.0f\n", b->results[i].name,
+			b->results[i].ns, b->results[i].ops);
+	return fclose(f) == 0 ? 0 : 1;
+}
+
+static int compare(const struct bench *b)
+{
+	FILE *f = fopen(b->baseline, "r");
+	char line[1024], name[512];
+	double ns, ops;
+	int i, status = 0;
+
+	if (f == NULL) {
+		perror(b->baseline);
+		return 1;
+	}
+	fprintf(stderr, "# name\tbaseline ns/op\tns/op\tchange\n");
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%511[^\t]\t%lf\t%lf", name, &ns, &ops) != 3)
+			continue;
+		for (i = 0; i < b->count; i++) {
+			const struct bench_result *result = &b->results[i];
+			double change;
+
+			if (strcmp(result->name, name) != 0)
+				continue;
+			change = ns > 0 ? result->ns / ns - 1 : 0;
+			fprintf(stderr, "%s\t%.2f\t%.2f\t%+.1f%%%s\n", name, ns, result->ns,
+				change * 100, change > b->threshold ? "\tREGRESSION" : "");
+			if (change > b->threshold)
+				status = 1;
+		}
+	}
+	fclose(f);
+	return status;
+}
+
+int bench_finish(struct bench *b)
+{
+	int status = 0;
+	int i;
+
+	if (b->save != NULL)
+		status |= save(b);
+	if (b->baseline != NULL)
+		status |= compare(b);
+	for (i = 0; i < b->count; i++)
+		free(b->results[i].name);
+	free(b->results);
+	if (b->counters)
+		bench_counters_close(&b->pmu);
+	b->counters = 0;
+	b->results = NULL;
+	b->count = b->capacity = 0;
+	return status;
+}
+
+static const char *alg_names[] = {
+	[CRUSH_BUCKET_UNIFORM] = "uniform",
+	[CRUSH_BUCKET_LIST] = "list",
+	[CRUSH_BUCKET_TREE] = "tree",
+	[CRUSH_BUCKET_STRAW] = "straw",
+	[CRUSH_BUCKET_STRAW2] = "straw2",
+};
+
+const char *bench_alg_name(int alg)
+{
+	if (alg < CRUSH_BUCKET_UNIFORM || alg > CRUSH_BUCKET_STRAW2)
+		return "unknown";
+	return alg_names[alg];
+}
+
+int bench_alg_parse(const char *name)
+{
+	int alg;
+
+	for (alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++)
+		if (strcmp(name, alg_names[alg]) == 0)
+			return alg;
+	return -1;
+}
+
+void bench_generator(struct crush_generator *g, int depth, int fanout, int alg, int ec)
+{
+	long devices;
+	int l;
+
+	crush_generator_init(g);
+	g->root_type = depth;
+	g->root_alg = alg;
+	g->level_count = depth - 1;
+	for (l = 0; l < g->level_count; l++) {
+		g->levels[l].type = depth - 1 - l;
+		g->levels[l].count = fanout;
+		g->levels[l].alg = alg;
+	}
+	g->devices = fanout;
+	g->failure_domain = depth > 1 ? 1 : 0;
+	g->ec = ec;
+	/* the weight of the root must fit in 32 bits */
+	devices = crush_generator_count(g, 0);
+	if (devices > 0 && (__s64)devices * g->device_weight > INT_MAX)
+		g->device_weight = INT_MAX / devices;
+}
+
+static void count_choose(void *arg, int bucket, int x, int r, int item)
+{
+	(*(__u64 *)arg)++;
+}
+
+void bench_count_visits(void *cwin, __u64 *visits)
+{
+	static const struct crush_trace_ops ops = { .choose = count_choose };
+
+	crush_trace_attach(cwin, &ops, visits);
+}
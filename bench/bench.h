@@ -0,0 +1,135 @@
+#ifndef CEPH_CRUSH_BENCH_H
+#define CEPH_CRUSH_BENCH_H
+
+/*
+ * A minimal harness for the benchmarks: each case is timed until it
+ * ran for at least --min-time seconds, the best of --repetitions runs
+ * is kept and the results are printed, one per line, as
+ *
+ *   name<TAB>ns/op<TAB>op/s
+ *
+ * They can be saved with --save and compared with a previous run
+ * with --baseline: a case slower than the baseline by more than
+ * --threshold (a fraction, 0.1 by default) is a regression and the
+ * benchmark exits with a non zero status.
+ *
+ * With --counters the hardware counters of bench/counters.h are
+ * read during an additional run of each case and printed after the
+ * op/s column, per operation and, for the cases that set the
+ * __visits__ of the harness, per bucket visit. They are not saved.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+#include "generator.h"
+#include "counters.h"
+
+struct bench_result {
+	char *name;
+	double ns;   /* nanoseconds per operation, per thread */
+	double ops;  /* operations per second, all threads */
+};
+
+struct bench {
+	int repetitions;
+	double min_time;
+	double threshold;
+	const char *filter;
+	const char *baseline;
+	const char *save;
+	int counters;    /* true if the hardware counters are read */
+	struct bench_counters pmu;
+	/*
+	 * Bucket visits per operation of the next case, 0 if unknown.
+	 * It is reset to 0 after each case.
+	 */
+	double visits;
+	struct bench_result *results;
+	int count;
+	int capacity;
+};
+
+/*
+ * Run __iterations__ operations. The __thread__ argument is in
+ * [0,threads[ and can be used to select per thread state.
+ */
+typedef void (*bench_fn)(void *arg, int thread, __u64 iterations);
+
+extern void bench_init(struct bench *b);
+
+/*
+ * Consume the harness option at __argv[*i]__ (and its value) and
+ * return 1, or return 0 if it is not a harness option.
+ */
+extern int bench_option(struct bench *b, int argc, char **argv, int *i);
+
+/* print the harness options */
+extern void bench_usage(void);
+
+/* print the header of the results, before the first case */
+extern void bench_header(const struct bench *b);
+
+/* true if the case __name__ is selected by --filter */
+extern int bench_selected(const struct bench *b, const char *name);
+
+/*
+ * Time __fn__ on __threads__ threads and record the result of the
+ * case __name__, unless it is not selected by --filter.
+ */
+extern void bench_run(struct bench *b, const char *name, int threads,
+		      bench_fn fn, void *arg);
+
+typedef void (*bench_step)(void *arg);
+
+/*
+ * Time __fn__ on a single thread and record the result of the case
+ * __name__, divided by __batch__, the number of operations __fn__
+ * performs. Each call of __fn__ is preceded by a call to __setup__,
+ * if not NULL, which is not timed.
+ */
+extern void bench_run_steps(struct bench *b, const char *name, int batch,
+			    bench_step setup, bench_step fn, void *arg);
+
+/*
+ * Record the result of the case __name__ measured by the caller:
+ * __ns__ nanoseconds per operation and __ops__ operations per
+ * second. The caller is expected to check bench_selected().
+ */
+extern void bench_record(struct bench *b, const char *name, double ns, double ops);
+
+/*
+ * Save the results and compare them to the baseline, as
+ * requested. Return the exit status of the benchmark: 1 if a case
+ * regressed or a file could not be read or written, 0 otherwise.
+ */
+extern int bench_finish(struct bench *b);
+
+/* the hierarchies of the benchmarks */
+
+/* the name of the CRUSH_BUCKET_* algorithm __alg__ */
+extern const char *bench_alg_name(int alg);
+
+/* the CRUSH_BUCKET_* algorithm named __name__, -1 if there is none */
+extern int bench_alg_parse(const char *name);
+
+/*
+ * Describe in __g__ a hierarchy of __depth__ levels of buckets of
+ * algorithm __alg__ above the devices, each containing __fanout__
+ * items. The root has type __depth__ and the buckets containing
+ * devices type 1, which separates the replicas if __depth__ > 1. The
+ * CRUSH_GENERATOR_EC_RULE is only created if __ec__ is set. The
+ * device weights are lowered if needed for the weight of the root to
+ * fit in 32 bits.
+ */
+extern void bench_generator(struct crush_generator *g, int depth, int fanout,
+			    int alg, int ec);
+
+/*
+ * Count in __visits__ the items crush_do_rule() draws from a bucket
+ * when called with __cwin__, until crush_trace_attach(__cwin__, NULL,
+ * NULL) is called.
+ */
+extern void bench_count_visits(void *cwin, __u64 *visits);
+
+#endif
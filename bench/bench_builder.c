@@ -0,0 +1,305 @@
+/*
+ * Benchmark the construction and the modification of maps: creating
+ * buckets, adding, removing and reweighting items, computing straws,
+ * crush_finalize() and crush_make_choose_args(), for growing sizes.
+ * The per item cases (add_item, remove_item, adjust_item_weight)
+ * report the time of a single item: when it grows with the size of
+ * the bucket, building a bucket item by item is quadratic.
+ *
+ *   bench_builder [harness options]
+ *
+ * LGPL2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "hash.h"
+#include "generator.h"
+#include "bench.h"
+
+/* buckets */
+
+struct bucket_case {
+	struct crush_map *map;
+	struct crush_bucket *bucket;
+	int alg;
+	int size;
+	int *items;
+	int *weights;
+	int toggle;
+};
+
+/* an uniform bucket only accepts items of the same weight */
+static int item_weight(const struct bucket_case *c, int i)
+{
+	return c->weights[c->alg == CRUSH_BUCKET_UNIFORM ? 0 : i];
+}
+
+static struct crush_bucket *make_bucket(struct bucket_case *c, int size)
+{
+	if (c->alg == CRUSH_BUCKET_UNIFORM)
+		return (struct crush_bucket *)crush_make_uniform_bucket(
+			CRUSH_HASH_DEFAULT, 1, size, c->items, c->weights[0]);
+	return crush_make_bucket(c->map, c->alg, CRUSH_HASH_DEFAULT, 1, size,
+				 c->items, c->weights);
+}
+
+static void destroy_bucket(struct bucket_case *c)
+{
+	if (c->bucket != NULL)
+		crush_destroy_bucket(c->bucket);
+	c->bucket = NULL;
+}
+
+static void setup_none(void *arg)
+{
+	destroy_bucket(arg);
+}
+
+static void setup_empty(void *arg)
+{
+	struct bucket_case *c = arg;
+
+	destroy_bucket(c);
+	c->bucket = make_bucket(c, 0);
+}
+
+static void setup_full(void *arg)
+{
+	struct bucket_case *c = arg;
+
+	destroy_bucket(c);
+	c->bucket = make_bucket(c, c->size);
+}
+
+static void step_make_bucket(void *arg)
+{
+	struct bucket_case *c = arg;
+
+	c->bucket = make_bucket(c, c->size);
+}
+
+static void step_add_item(void *arg)
+{
+	struct bucket_case *c = arg;
+	int i;
+
+	for (i = 0; i < c->size; i++)
+		crush_bucket_add_item(c->map, c->bucket, c->items[i], item_weight(c, i));
+}
+
+static void step_remove_item(void *arg)
+{
+	struct bucket_case *c = arg;
+	int i;
+
+	/*
+	 * The first item, as when the oldest device is removed. The
+	 * last one is kept: removing it reallocates the arrays of the
+	 * bucket to zero bytes.
+	 */
+	for (i = 0; i < c->size - 1; i++)
+		crush_bucket_remove_item(c->map, c->bucket, c->items[i]);
+}
+
+static void step_adjust_item_weight(void *arg)
+{
+	struct bucket_case *c = arg;
+	int i;
+
+	c->toggle = !c->toggle;
+	for (i = 0; i < c->size; i++)
+		crush_bucket_adjust_item_weight(c->map, c->bucket, c->items[i],
+						item_weight(c, i) + c->toggle);
+}
+
+static void step_reweight_bucket(void *arg)
+{
+	struct bucket_case *c = arg;
+
+	crush_reweight_bucket(c->map, c->bucket);
+}
+
+static void step_calc_straw(void *arg)
+{
+	struct bucket_case *c = arg;
+
+	crush_calc_straw(c->map, (struct crush_bucket_straw *)c->bucket);
+}
+
+static void run_bucket(struct bench *b, int alg, int size)
+{
+	struct bucket_case c;
+	char name[128];
+	int i;
+
+	memset(&c, 0, sizeof(c));
+	c.map = crush_create();
+	c.alg = alg;
+	c.size = size;
+	c.items = malloc(sizeof(int) * size);
+	c.weights = malloc(sizeof(int) * size);
+	for (i = 0; i < size; i++) {
+		c.items[i] = i;
+		/* distinct weights, straw sorts them */
+		c.weights[i] = 0x10000 + crush_hash32(CRUSH_HASH_RJENKINS1, i) % 0x10000;
+	}
+
+#define RUN(case, batch, setup, step)					\
+	do {								\
+		snprintf(name, sizeof(name), "%s/%s/%d", case, bench_alg_name(alg), size); \
+		bench_run_steps(b, name, batch, setup, step, &c);	\
+		destroy_bucket(&c);					\
+	} while (0)
+
+	RUN("make_bucket", 1, setup_none, step_make_bucket);
+	RUN("add_item", size, setup_empty, step_add_item);
+	RUN("remove_item", size - 1, setup_full, step_remove_item);
+	setup_full(&c);
+	RUN("adjust_item_weight", size, NULL, step_adjust_item_weight);
+	setup_full(&c);
+	RUN("reweight_bucket", 1, NULL, step_reweight_bucket);
+	if (alg == CRUSH_BUCKET_STRAW) {
+		setup_full(&c);
+		RUN("calc_straw", 1, NULL, step_calc_straw);
+	}
+#undef RUN
+
+	free(c.items);
+	free(c.weights);
+	crush_destroy(c.map);
+}
+
+/* maps */
+
+struct map_case {
+	struct crush_generator generator;
+	struct crush_map *map;
+	struct crush_choose_arg *choose_args;
+};
+
+static void setup_generate(void *arg)
+{
+	struct map_case *c = arg;
+
+	if (c->map != NULL)
+		crush_destroy(c->map);
+	c->map = NULL;
+}
+
+static void step_generate(void *arg)
+{
+	struct map_case *c = arg;
+
+	crush_generate(&c->generator, &c->map);
+}
+
+static void step_finalize(void *arg)
+{
+	struct map_case *c = arg;
+
+	crush_finalize(c->map);
+}
+
+static void step_reweight_map(void *arg)
+{
+	struct map_case *c = arg;
+
+	crush_reweight_bucket(c->map, c->map->buckets[0]);
+}
+
+static void setup_choose_args(void *arg)
+{
+	struct map_case *c = arg;
+
+	if (c->choose_args != NULL)
+		crush_destroy_choose_args(c->choose_args);
+	c->choose_args = NULL;
+}
+
+static void step_make_choose_args(void *arg)
+{
+	struct map_case *c = arg;
+
+	c->choose_args = crush_make_choose_args(c->map, 2);
+}
+
+static void run_map(struct bench *b, int racks)
+{
+	struct map_case c;
+	char name[128];
+	long devices;
+
+	memset(&c, 0, sizeof(c));
+	/* racks of 16 hosts of 16 devices */
+	crush_generator_init(&c.generator);
+	c.generator.levels[2].count = racks;
+	c.generator.levels[3].count = 16;
+	c.generator.devices = 16;
+	c.generator.device_weight = 0x100;
+	devices = crush_generator_count(&c.generator, 0);
+
+	snprintf(name, sizeof(name), "generate/%ld", devices);
+	bench_run_steps(b, name, 1, setup_generate, step_generate, &c);
+	setup_generate(&c);
+	if (crush_generate(&c.generator, &c.map) < 0) {
+		fprintf(stderr, "cannot generate a map of %ld devices\n", devices);
+		exit(1);
+	}
+	snprintf(name, sizeof(name), "finalize/%ld", devices);
+	bench_run_steps(b, name, 1, NULL, step_finalize, &c);
+	snprintf(name, sizeof(name), "reweight_map/%ld", devices);
+	bench_run_steps(b, name, 1, NULL, step_reweight_map, &c);
+	snprintf(name, sizeof(name), "make_choose_args/%ld", devices);
+	bench_run_steps(b, name, 1, setup_choose_args, step_make_choose_args, &c);
+	setup_choose_args(&c);
+	crush_destroy(c.map);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench_builder [options]\n");
+	bench_usage();
+	exit(2);
+}
+
+/*
+ * num_nodes of a tree bucket is 8 bits. The straws of a straw bucket
+ * are computed in quadratic time for each change, filling a bucket of
+ * 4096 items would take minutes.
+ */
+static const int max_size[] = {
+	[CRUSH_BUCKET_UNIFORM] = 4096,
+	[CRUSH_BUCKET_LIST] = 4096,
+	[CRUSH_BUCKET_TREE] = 64,
+	[CRUSH_BUCKET_STRAW] = 1024,
+	[CRUSH_BUCKET_STRAW2] = 4096,
+};
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	int alg, size, racks;
+	int i;
+
+	bench_init(&b);
+	for (i = 1; i < argc; i++)
+		if (!bench_option(&b, argc, argv, &i))
+			usage();
+
+	bench_header(&b);
+	for (alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++)
+		for (size = 16; size <= 4096; size *= 16) {
+			if (size > max_size[alg]) {
+				run_bucket(&b, alg, max_size[alg]);
+				break;
+			}
+			run_bucket(&b, alg, size);
+		}
+	for (racks = 4; racks <= 1024; racks *= 16)
+		run_map(&b, racks);
+	return bench_finish(&b);
+}
@@ -0,0 +1,316 @@
+/*
+ * Benchmark crush_do_rule() on synthetic hierarchies, choosing from
+ * a single bucket and the hash functions.
+ *
+ *   bench_mapper [--depth N] [--fanout N] [--alg NAME] [--result-max N]
+ *                [--ec] [--out PERCENT] [--threads N] [harness options]
+ *
+ * Without hierarchy options a default set of cases is run, otherwise
+ * only crush_do_rule() is benchmarked, on the hierarchy described.
+ *
+ * LGPL2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builder.h"
+#include "hash.h"
+#include "mapper.h"
+#include "generator.h"
+#include "bench.h"
+
+/* hash */
+
+static volatile __u64 sink;
+
+static void bench_hash32_2(void *arg, int thread, __u64 iterations)
+{
+	__u32 sum = 0;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++)
+		sum += crush_hash32_2(CRUSH_HASH_RJENKINS1, i, thread);
+	sink = sum;
+}
+
+static void bench_hash32_3(void *arg, int thread, __u64 iterations)
+{
+	__u32 sum = 0;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++)
+		sum += crush_hash32_3(CRUSH_HASH_RJENKINS1, i, thread, 1);
+	sink = sum;
+}
+
+static void bench_hash32_4(void *arg, int thread, __u64 iterations)
+{
+	__u32 sum = 0;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++)
+		sum += crush_hash32_4(CRUSH_HASH_RJENKINS1, i, thread, 1, 2);
+	sink = sum;
+}
+
+/*
+ * bucket choose, through crush_do_rule() with a rule choosing one
+ * device from the bucket: the cases include the cost of a call for
+ * a single item, the same for all algorithms
+ */
+
+struct choose_case {
+	struct crush_map *map;
+	__u32 *weights;
+	void *cwin;
+};
+
+static void bench_choose(void *arg, int thread, __u64 iterations)
+{
+	struct choose_case *c = arg;
+	int result;
+	__u64 sum = 0;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++) {
+		crush_do_rule(c->map, 0, i, &result, 1, c->weights, c->map->max_devices,
+			      c->cwin, NULL);
+		sum += result;
+	}
+	sink = sum;
+}
+
+static void run_choose(struct bench *b, int alg, int size)
+{
+	struct choose_case c;
+	struct crush_bucket *bucket;
+	struct crush_rule *rule;
+	char name[128];
+	int items[size], weights[size];
+	int i, id;
+
+	snprintf(name, sizeof(name), "choose/%s/%d", bench_alg_name(alg), size);
+	if (!bench_selected(b, name))
+		return;
+	for (i = 0; i < size; i++) {
+		items[i] = i;
+		weights[i] = 0x10000;
+	}
+	c.map = crush_create();
+	bucket = crush_make_bucket(c.map, alg, CRUSH_HASH_DEFAULT, 1, size, items, weights);
+	crush_add_bucket(c.map, 0, bucket, &id);
+	rule = crush_make_rule(3, 0, 0, 1, 1);
+	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, id, 0);
+	crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+	crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+	crush_add_rule(c.map, rule, 0);
+	crush_finalize(c.map);
+	c.weights = malloc(sizeof(__u32) * size);
+	for (i = 0; i < size; i++)
+		c.weights[i] = 0x10000;
+	c.cwin = malloc(crush_work_size(c.map, 1));
+	crush_init_workspace(c.map, c.cwin);
+	b->visits = 1;
+	bench_run(b, name, 1, bench_choose, &c);
+	free(c.cwin);
+	free(c.weights);
+	crush_destroy(c.map);
+}
+
+/* crush_do_rule */
+
+struct hierarchy {
+	int depth;       /* number of bucket levels */
+	int fanout;      /* items per bucket */
+	int alg;
+	int result_max;
+	int ec;          /* indep instead of firstn */
+	int out;         /* percentage of devices out */
+	int threads;
+};
+
+struct rule_case {
+	struct crush_map *map;
+	int ruleno;
+	int result_max;
+	__u32 *weights;
+	int weight_max;
+	void **cwin;     /* one workspace per thread */
+	int **result;    /* one result per thread */
+};
+
+static void bench_do_rule(void *arg, int thread, __u64 iterations)
+{
+	struct rule_case *c = arg;
+	void *cwin = c->cwin[thread];
+	int *result = c->result[thread];
+	int x = thread << 24;
+	__u64 sum = 0;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++)
+		sum += crush_do_rule(c->map, c->ruleno, x + i, result, c->result_max,
+				     c->weights, c->weight_max, cwin, NULL);
+	sink = sum;
+}
+
+/* the mean number of buckets crush_do_rule() visits in bench_do_rule() */
+static double count_visits(const struct rule_case *c)
+{
+	void *cwin = malloc(crush_work_size(c->map, c->result_max));
+	__u64 visits = 0;
+	int x;
+
+	crush_init_workspace(c->map, cwin);
+	bench_count_visits(cwin, &visits);
+	for (x = 0; x < 1000; x++)
+		crush_do_rule(c->map, c->ruleno, x, c->result[0], c->result_max,
+			      c->weights, c->weight_max, cwin, NULL);
+	free(cwin);
+	return visits / 1000.0;
+}
+
+static void run_do_rule(struct bench *b, const struct hierarchy *h)
+{
+	struct crush_generator g;
+	struct rule_case c;
+	char name[128];
+	int i;
+
+	snprintf(name, sizeof(name), "do_rule/%s/depth:%d/fanout:%d/%s:%d/out:%d%%/threads:%d",
+		 bench_alg_name(h->alg), h->depth, h->fanout, h->ec ? "indep" : "firstn",
+		 h->result_max, h->out, h->threads);
+	if (!bench_selected(b, name))
+		return;
+	bench_generator(&g, h->depth, h->fanout, h->alg, h->ec);
+	if (crush_generate(&g, &c.map) < 0) {
+		fprintf(stderr, "cannot generate a hierarchy of depth %d and fanout %d\n",
+			h->depth, h->fanout);
+		exit(1);
+	}
+	c.ruleno = h->ec ? CRUSH_GENERATOR_EC_RULE : CRUSH_GENERATOR_REPLICATED_RULE;
+	c.result_max = h->result_max;
+	c.weight_max = c.map->max_devices;
+	c.weights = malloc(sizeof(__u32) * (c.weight_max + 1));
+	crush_generator_out(&g, 0, h->out / 100.0, 0, c.weights, c.weight_max);
+	c.cwin = malloc(sizeof(void *) * h->threads);
+	c.result = malloc(sizeof(int *) * h->threads);
+	for (i = 0; i < h->threads; i++) {
+		c.cwin[i] = malloc(crush_work_size(c.map, h->result_max));
+		crush_init_workspace(c.map, c.cwin[i]);
+		c.result[i] = malloc(sizeof(int) * h->result_max);
+	}
+	b->visits = count_visits(&c);
+	bench_run(b, name, h->threads, bench_do_rule, &c);
+	for (i = 0; i < h->threads; i++) {
+		free(c.cwin[i]);
+		free(c.result[i]);
+	}
+	free(c.cwin);
+	free(c.result);
+	free(c.weights);
+	crush_destroy(c.map);
+}
+
+static void run_defaults(struct bench *b)
+{
+	struct hierarchy h = { 3, 8, CRUSH_BUCKET_STRAW2, 3, 0, 0, 1 };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int alg, size;
+
+	bench_run(b, "hash32_2", 1, bench_hash32_2, NULL);
+	bench_run(b, "hash32_3", 1, bench_hash32_3, NULL);
+	bench_run(b, "hash32_4", 1, bench_hash32_4, NULL);
+	for (alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++)
+		for (size = 4; size <= 64; size *= 4)
+			run_choose(b, alg, size);
+	for (alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++) {
+		h.alg = alg;
+		run_do_rule(b, &h);
+	}
+	h.alg = CRUSH_BUCKET_STRAW2;
+	h.depth = 4;
+	h.fanout = 16;
+	run_do_rule(b, &h);
+	h.depth = 3;
+	h.fanout = 8;
+	h.out = 10;
+	run_do_rule(b, &h);
+	h.out = 0;
+	h.ec = 1;
+	h.result_max = 6;
+	run_do_rule(b, &h);
+	h.ec = 0;
+	h.result_max = 3;
+	if (cpus > 1) {
+		h.threads = cpus;
+		run_do_rule(b, &h);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: bench_mapper [options]\n"
+		"  --depth N         levels of buckets above the devices (3)\n"
+		"  --fanout N        items in each bucket (8)\n"
+		"  --alg NAME        uniform, list, tree, straw or straw2 (straw2)\n"
+		"  --result-max N    replicas or chunks (3)\n"
+		"  --ec              map with chooseleaf indep instead of firstn\n"
+		"  --out PERCENT     percentage of devices out (0)\n"
+		"  --threads N       map concurrently on N threads (1)\n");
+	bench_usage();
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct hierarchy h = { 3, 8, CRUSH_BUCKET_STRAW2, 3, 0, 0, 1 };
+	struct bench b;
+	int custom = 0;
+	int i;
+
+	bench_init(&b);
+	for (i = 1; i < argc; i++) {
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (bench_option(&b, argc, argv, &i))
+			continue;
+		if (strcmp(argv[i], "--ec") == 0) {
+			h.ec = 1;
+			custom = 1;
+			continue;
+		}
+		if (value == NULL)
+			usage();
+		if (strcmp(argv[i], "--depth") == 0)
+			h.depth = atoi(value);
+		else if (strcmp(argv[i], "--fanout") == 0)
+			h.fanout = atoi(value);
+		else if (strcmp(argv[i], "--alg") == 0)
+			h.alg = bench_alg_parse(value);
+		else if (strcmp(argv[i], "--result-max") == 0)
+			h.result_max = atoi(value);
+		else if (strcmp(argv[i], "--out") == 0)
+			h.out = atoi(value);
+		else if (strcmp(argv[i], "--threads") == 0)
+			h.threads = atoi(value);
+		else
+			usage();
+		custom = 1;
+		i++;
+	}
+	if (h.depth < 1 || h.fanout < 1 || h.alg < 0 || h.result_max < 1 ||
+	    h.out < 0 || h.out > 100 || h.threads < 1)
+		usage();
+
+	bench_header(&b);
+	if (custom)
+		run_do_rule(&b, &h);
+	else
+		run_defaults(&b);
+	return bench_finish(&b);
+}
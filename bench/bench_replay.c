@@ -0,0 +1,457 @@
+/*
+ * Replay a recording of crush_do_rule() calls, made with
+ * crush_recorder_attach(), against a synthetic hierarchy and report
+ * the throughput and the latency distribution of each rule.
+ *
+ *   bench_replay [--trace FILE] [--depth N] [--fanout N] [--alg NAME]
+ *                [--threads N] [harness options]
+ *   bench_replay --record FILE [--count N] [--pgs N] [--skew S] [hierarchy options]
+ *
+ * The hierarchy is the one of bench_mapper, with the
+ * CRUSH_GENERATOR_REPLICATED_RULE and CRUSH_GENERATOR_EC_RULE rules.
+ * Without --trace a synthetic trace is replayed: the placement
+ * groups are accessed with a Zipf distribution, 80% of the calls map
+ * 3 replicas and 20% map 6 erasure coded chunks, and 1% of the
+ * devices are marked out half way through. With --record the
+ * synthetic trace is written to FILE instead of being replayed.
+ *
+ * With N threads each thread replays the whole trace, starting at a
+ * different offset. The latencies are those of every call, they
+ * include the cost of __clock_gettime(2)__.
+ *
+ * LGPL2
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "hash.h"
+#include "mapper.h"
+#include "generator.h"
+#include "latency.h"
+#include "replay.h"
+#include "trace.h"
+#include "bench.h"
+
+struct options {
+	int depth;
+	int fanout;
+	int alg;
+	int threads;
+	const char *trace;
+	const char *record;
+	long count;      /* calls of the synthetic trace */
+	int pgs;         /* placement groups of the synthetic trace */
+	double skew;     /* exponent of the Zipf distribution */
+};
+
+/* the synthetic trace */
+
+/* a number in [0,1[ drawn from __i__ */
+static double uniform(__u32 i)
+{
+	return crush_hash32_2(CRUSH_HASH_RJENKINS1, i, 0x5eed) / 4294967296.0;
+}
+
+static void *synthesize(const struct options *o, struct crush_map *map,
+			const struct crush_generator *g, size_t *length)
+{
+	struct crush_recorder *recorder = crush_recorder_create();
+	double *cdf = malloc(sizeof(double) * o->pgs);
+	int weight_max = map->max_devices;
+	__u32 *weights = malloc(sizeof(__u32) * (weight_max + 1));
+	__u32 *degraded = malloc(sizeof(__u32) * (weight_max + 1));
+	void *cwin = malloc(crush_work_size(map, 6));
+	void *buffer;
+	double sum = 0;
+	int result[6];
+	long i;
+	int pg;
+
+	if (recorder == NULL || cdf == NULL || weights == NULL || degraded == NULL ||
+	    cwin == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (pg = 0; pg < o->pgs; pg++) {
+		sum += 1 / pow(pg + 1, o->skew);
+		cdf[pg] = sum;
+	}
+	crush_generator_out(g, 0, 0, 0, weights, weight_max);
+	crush_generator_out(g, 0, 0.01, 0, degraded, weight_max);
+	crush_init_workspace(map, cwin);
+	crush_recorder_attach(cwin, recorder);
+	for (i = 0; i < o->count; i++) {
+		double u = uniform(2 * i) * sum;
+		int low = 0, high = o->pgs - 1;
+		const __u32 *w = i < o->count / 2 ? weights : degraded;
+
+		while (low < high) {
+			int middle = (low + high) / 2;
+
+			if (cdf[middle] <= u)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		/* the x of a placement group is a hash of its number */
+		if (uniform(2 * i + 1) < 0.8)
+			crush_do_rule(map, CRUSH_GENERATOR_REPLICATED_RULE,
+				      crush_hash32(CRUSH_HASH_RJENKINS1, low), result, 3,
+				      w, weight_max, cwin, NULL);
+		else
+			crush_do_rule(map, CRUSH_GENERATOR_EC_RULE,
+				      crush_hash32(CRUSH_HASH_RJENKINS1, low), result, 6,
+				      w, weight_max, cwin, NULL);
+	}
+	if (crush_recorder_serialize(recorder, &buffer, length) < 0) {
+		perror("crush_recorder_serialize");
+		exit(1);
+	}
+	crush_recorder_destroy(recorder);
+	free(cdf);
+	free(weights);
+	free(degraded);
+	free(cwin);
+	return buffer;
+}
+
+static void *read_file(const char *path, size_t *length)
+{
+	FILE *f = fopen(path, "rb");
+	unsigned char *buffer = NULL;
+	size_t capacity = 0, n;
+
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	*length = 0;
+	do {
+		if (*length == capacity) {
+			capacity = capacity ? capacity * 2 : 1 << 16;
+			buffer = realloc(buffer, capacity);
+			if (buffer == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		n = fread(buffer + *length, 1, capacity - *length, f);
+		*length += n;
+	} while (n > 0);
+	if (ferror(f)) {
+		perror(path);
+		exit(1);
+	}
+	fclose(f);
+	return buffer;
+}
+
+static int write_file(const char *path, const void *buffer, size_t length)
+{
+	FILE *f = fopen(path, "wb");
+
+	if (f == NULL || fwrite(buffer, 1, length, f) != length || fclose(f) != 0) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
+
+/* the replay */
+
+struct call {
+	int ruleno;
+	int x;
+	int result_max;
+	const __u32 *weights;
+	int weight_max;
+};
+
+struct replay_case {
+	struct crush_map *map;
+	struct call *calls;
+	long count;
+	int threads;
+	void **cwin;     /* one workspace per thread */
+	int **result;    /* one result per thread */
+	struct crush_latency **latency;  /* one recorder per thread */
+};
+
+static volatile __u64 sink;
+
+static void bench_replay(void *arg, int thread, __u64 iterations)
+{
+	struct replay_case *c = arg;
+	void *cwin = c->cwin[thread];
+	int *result = c->result[thread];
+	long i = c->count / c->threads * thread;
+	__u64 sum = 0;
+	__u64 n;
+
+	for (n = 0; n < iterations; n++) {
+		const struct call *call = &c->calls[i];
+
+		sum += crush_do_rule(c->map, call->ruleno, call->x, result,
+				     call->result_max, call->weights,
+				     call->weight_max, cwin, NULL);
+		if (++i == c->count)
+			i = 0;
+	}
+	sink = sum;
+}
+
+/* the mean number of buckets crush_do_rule() visits per call of the trace */
+static double count_visits(const struct replay_case *c)
+{
+	long count = c->count < 10000 ? c->count : 10000;
+	__u64 visits = 0;
+	long i;
+
+	bench_count_visits(c->cwin[0], &visits);
+	for (i = 0; i < count; i++) {
+		const struct call *call = &c->calls[i];
+
+		crush_do_rule(c->map, call->ruleno, call->x, c->result[0],
+			      call->result_max, call->weights, call->weight_max,
+			      c->cwin[0], NULL);
+	}
+	crush_trace_attach(c->cwin[0], NULL, NULL);
+	return (double)visits / count;
+}
+
+struct latency_thread {
+	pthread_t thread;
+	struct replay_case *c;
+	int index;
+};
+
+static void *replay_latency(void *arg)
+{
+	struct latency_thread *t = arg;
+	struct replay_case *c = t->c;
+	struct crush_latency *latency = c->latency[t->index];
+	void *cwin = c->cwin[t->index];
+	int *result = c->result[t->index];
+	long i = c->count / c->threads * t->index;
+	long n;
+
+	for (n = 0; n < c->count; n++) {
+		const struct call *call = &c->calls[i];
+
+		crush_latency_do_rule(latency, c->map, call->ruleno, call->x, result,
+				      call->result_max, call->weights,
+				      call->weight_max, cwin, NULL);
+		if (++i == c->count)
+			i = 0;
+	}
+	return NULL;
+}
+
+static void run_latency(struct bench *b, struct replay_case *c, const char *prefix)
+{
+	static const struct {
+		const char *name;
+		double quantile;
+	} quantiles[] = { { "p50", 0.5 }, { "p99", 0.99 }, { "p99.9", 0.999 } };
+	struct latency_thread threads[c->threads];
+	char name[256];
+	int t, ruleno, q;
+
+	for (t = 0; t < c->threads; t++) {
+		threads[t].c = c;
+		threads[t].index = t;
+		pthread_create(&threads[t].thread, NULL, replay_latency, &threads[t]);
+	}
+	for (t = 0; t < c->threads; t++) {
+		pthread_join(threads[t].thread, NULL);
+		if (t > 0)
+			crush_latency_merge(c->latency[0], c->latency[t]);
+	}
+	for (ruleno = 0; ruleno < (int)c->map->max_rules; ruleno++) {
+		if (crush_latency_count(c->latency[0], ruleno) == 0)
+			continue;
+		for (q = 0; q < (int)(sizeof(quantiles) / sizeof(quantiles[0])); q++) {
+			double ns = crush_latency_quantile(c->latency[0], ruleno,
+							   quantiles[q].quantile);
+
+			snprintf(name, sizeof(name), "%s/rule:%d/%s", prefix, ruleno,
+				 quantiles[q].name);
+			if (bench_selected(b, name))
+				bench_record(b, name, ns, 1e9 / ns);
+		}
+	}
+}
+
+static void run_replay(struct bench *b, const struct options *o, struct crush_map *map,
+		       const void *buffer, size_t length)
+{
+	struct crush_replay *replay;
+	struct crush_replay_record record;
+	struct replay_case c;
+	long capacity = 0;
+	int result_max = 1;
+	char prefix[192], name[256];
+	const char *trace;
+	int err, t;
+
+	err = crush_replay_open(buffer, length, &replay);
+	if (err < 0) {
+		fprintf(stderr, "%s: not a recording: %s\n", o->trace, strerror(-err));
+		exit(1);
+	}
+	memset(&c, 0, sizeof(c));
+	c.map = map;
+	c.threads = o->threads;
+	while ((err = crush_replay_next(replay, &record)) > 0) {
+		if (c.count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			c.calls = realloc(c.calls, sizeof(*c.calls) * capacity);
+			if (c.calls == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		c.calls[c.count].ruleno = record.ruleno;
+		c.calls[c.count].x = record.x;
+		c.calls[c.count].result_max = record.result_max;
+		c.calls[c.count].weights = record.weights;
+		c.calls[c.count].weight_max = record.weight_max;
+		if (record.result_max > result_max)
+			result_max = record.result_max;
+		if (record.ruleno < 0 || record.ruleno >= (int)map->max_rules ||
+		    map->rules[record.ruleno] == NULL) {
+			fprintf(stderr, "the trace uses rule %d which is not in the map\n",
+				record.ruleno);
+			exit(1);
+		}
+		c.count++;
+	}
+	if (err < 0) {
+		fprintf(stderr, "%s: corrupted recording: %s\n", o->trace, strerror(-err));
+		exit(1);
+	}
+	if (c.count == 0) {
+		fprintf(stderr, "the trace is empty\n");
+		exit(1);
+	}
+
+	trace = o->trace ? strrchr(o->trace, '/') : NULL;
+	trace = trace ? trace + 1 : o->trace ? o->trace : "synthetic";
+	snprintf(prefix, sizeof(prefix), "replay/%s/%s/depth:%d/fanout:%d",
+		 trace, bench_alg_name(o->alg), o->depth, o->fanout);
+	c.cwin = malloc(sizeof(void *) * c.threads);
+	c.result = malloc(sizeof(int *) * c.threads);
+	c.latency = malloc(sizeof(struct crush_latency *) * c.threads);
+	for (t = 0; t < c.threads; t++) {
+		c.cwin[t] = malloc(crush_work_size(map, result_max));
+		crush_init_workspace(map, c.cwin[t]);
+		c.result[t] = malloc(sizeof(int) * result_max);
+		c.latency[t] = crush_latency_create(map->max_rules, 0);
+	}
+	snprintf(name, sizeof(name), "%s/threads:%d", prefix, c.threads);
+	b->visits = count_visits(&c);
+	bench_run(b, name, c.threads, bench_replay, &c);
+	snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix),
+		 "/threads:%d/latency", c.threads);
+	run_latency(b, &c, prefix);
+	for (t = 0; t < c.threads; t++) {
+		free(c.cwin[t]);
+		free(c.result[t]);
+		crush_latency_destroy(c.latency[t]);
+	}
+	free(c.cwin);
+	free(c.result);
+	free(c.latency);
+	free(c.calls);
+	/* the weights of the calls belong to the replay */
+	crush_replay_close(replay);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: bench_replay [options]\n"
+		"  --trace FILE      replay the recording in FILE (a synthetic trace)\n"
+		"  --record FILE     write the synthetic trace to FILE instead of replaying\n"
+		"  --count N         calls of the synthetic trace (1000000)\n"
+		"  --pgs N           placement groups of the synthetic trace (4096)\n"
+		"  --skew S          exponent of the Zipf distribution of the placement groups (1)\n"
+		"  --depth N         levels of buckets above the devices (3)\n"
+		"  --fanout N        items in each bucket (8)\n"
+		"  --alg NAME        uniform, list, tree, straw or straw2 (straw2)\n"
+		"  --threads N       replay concurrently on N threads (1)\n");
+	bench_usage();
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct options o = { 3, 8, CRUSH_BUCKET_STRAW2, 1, NULL, NULL, 1000000, 4096, 1 };
+	struct crush_generator g;
+	struct crush_map *map;
+	struct bench b;
+	void *buffer;
+	size_t length;
+	int status = 0;
+	int i;
+
+	bench_init(&b);
+	for (i = 1; i < argc; i++) {
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (bench_option(&b, argc, argv, &i))
+			continue;
+		if (value == NULL)
+			usage();
+		if (strcmp(argv[i], "--trace") == 0)
+			o.trace = value;
+		else if (strcmp(argv[i], "--record") == 0)
+			o.record = value;
+		else if (strcmp(argv[i], "--count") == 0)
+			o.count = atol(value);
+		else if (strcmp(argv[i], "--pgs") == 0)
+			o.pgs = atoi(value);
+		else if (strcmp(argv[i], "--skew") == 0)
+			o.skew = atof(value);
+		else if (strcmp(argv[i], "--depth") == 0)
+			o.depth = atoi(value);
+		else if (strcmp(argv[i], "--fanout") == 0)
+			o.fanout = atoi(value);
+		else if (strcmp(argv[i], "--alg") == 0)
+			o.alg = bench_alg_parse(value);
+		else if (strcmp(argv[i], "--threads") == 0)
+			o.threads = atoi(value);
+		else
+			usage();
+		i++;
+	}
+	if (o.depth < 1 || o.fanout < 1 || o.alg < 0 || o.threads < 1 ||
+	    o.count < 1 || o.pgs < 1 || o.skew < 0 || (o.trace && o.record))
+		usage();
+
+	bench_generator(&g, o.depth, o.fanout, o.alg, 1);
+	if (crush_generate(&g, &map) < 0) {
+		fprintf(stderr, "cannot generate a hierarchy of depth %d and fanout %d\n",
+			o.depth, o.fanout);
+		return 1;
+	}
+	if (o.trace)
+		buffer = read_file(o.trace, &length);
+	else
+		buffer = synthesize(&o, map, &g, &length);
+	if (o.record) {
+		status = write_file(o.record, buffer, length);
+	} else {
+		bench_header(&b);
+		run_replay(&b, &o, map, buffer, length);
+		status = bench_finish(&b);
+	}
+	free(buffer);
+	crush_destroy(map);
+	return status;
+}
@@ -0,0 +1,316 @@
+/*
+ * Measure how crush_do_rule() scales with the number of threads
+ * mapping disjoint ranges of x against the same map, and how much
+ * the instrumentation written by all threads costs:
+ *
+ *   private          per thread workspaces on their own cache lines
+ *   packed           per thread workspaces allocated back to back,
+ *                    neighbours share a cache line
+ *   choose_tries     the map->choose_tries histogram, shared by all
+ *                    threads, is updated by each mapping
+ *   stats:private    each thread has its own crush_stats
+ *   stats:shared     all threads add to the same crush_stats, which is
+ *                    racy and only shows what sharing them would cost
+ *
+ * The stats modes require libcrush to be built with -DCRUSH_STATS=ON.
+ *
+ *   bench_scaling [--max-threads N] [--mode NAME] [--min-efficiency F]
+ *                 [--depth N] [--fanout N] [--out PERCENT] [harness options]
+ *
+ * For each mode and number of threads T the throughput is reported
+ * as a case of the harness and summarized, on lines starting with #,
+ * with the speedup over one thread, the efficiency (speedup / T) and
+ * the marginal efficiency of the threads added since the previous T.
+ * A region where the marginal efficiency is below --min-efficiency
+ * is flagged as SUBLINEAR. The slowdown compared to the private
+ * mode, at the same T, shows the cost of the contention.
+ *
+ * LGPL2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mapper.h"
+#include "generator.h"
+#include "stats.h"
+#include "bench.h"
+
+#define CACHE_LINE 64
+
+enum mode {
+	MODE_PRIVATE,
+	MODE_PACKED,
+	MODE_CHOOSE_TRIES,
+	MODE_STATS_PRIVATE,
+	MODE_STATS_SHARED,
+	MODE_COUNT
+};
+
+static const char *mode_names[MODE_COUNT] = {
+	[MODE_PRIVATE] = "private",
+	[MODE_PACKED] = "packed",
+	[MODE_CHOOSE_TRIES] = "choose_tries",
+	[MODE_STATS_PRIVATE] = "stats:private",
+	[MODE_STATS_SHARED] = "stats:shared",
+};
+
+struct options {
+	int depth;
+	int fanout;
+	int out;             /* percentage of devices out */
+	int max_threads;
+	int mode;            /* -1 for all */
+	double min_efficiency;
+};
+
+struct scaling_case {
+	struct crush_map *map;
+	__u32 *weights;
+	int weight_max;
+	int result_max;
+	void **cwin;         /* one workspace per thread */
+	int **result;        /* one result per thread */
+	struct crush_stats **stats; /* the stats of each thread */
+};
+
+static volatile __u64 sink;
+
+static void bench_map(void *arg, int thread, __u64 iterations)
+{
+	struct scaling_case *c = arg;
+	void *cwin = c->cwin[thread];
+	int *result = c->result[thread];
+	int x = thread << 24;
+	__u64 sum = 0;
+	__u64 i;
+
+	for (i = 0; i < iterations; i++)
+		sum += crush_do_rule(c->map, CRUSH_GENERATOR_REPLICATED_RULE, x + i,
+				     result, c->result_max, c->weights, c->weight_max,
+				     cwin, NULL);
+	sink = sum;
+}
+
+static size_t round_up(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Prepare __threads__ workspaces for __mode__. Return 0, or
+ * -EOPNOTSUPP for the stats modes when built without CRUSH_STATS.
+ */
+static int setup(struct scaling_case *c, int mode, int threads, void **memory,
+		 struct crush_stats **stats)
+{
+	size_t size = crush_work_size(c->map, c->result_max);
+	int max_rules = c->map->max_rules;
+	int t, err;
+
+	*memory = NULL;
+	*stats = NULL;
+	if (mode == MODE_PACKED) {
+		size = round_up(size, sizeof(void *));
+		*memory = malloc(size * threads);
+	} else {
+		/* a padding line after each workspace, against the prefetcher */
+		size = round_up(size, CACHE_LINE) + CACHE_LINE;
+		*memory = aligned_alloc(CACHE_LINE, size * threads);
+	}
+	if (mode == MODE_STATS_SHARED)
+		*stats = calloc(max_rules, sizeof(struct crush_stats));
+	else if (mode == MODE_STATS_PRIVATE)
+		/* each array on its own cache lines */
+		*stats = aligned_alloc(CACHE_LINE, round_up(sizeof(struct crush_stats) * max_rules,
+							    CACHE_LINE) * threads);
+	if (*memory == NULL || ((mode == MODE_STATS_SHARED || mode == MODE_STATS_PRIVATE) &&
+				*stats == NULL)) {
+		perror("malloc");
+		exit(1);
+	}
+	for (t = 0; t < threads; t++) {
+		c->cwin[t] = (char *)*memory + size * t;
+		crush_init_workspace(c->map, c->cwin[t]);
+		if (mode == MODE_STATS_PRIVATE) {
+			c->stats[t] = (struct crush_stats *)
+				((char *)*stats + round_up(sizeof(struct crush_stats) * max_rules,
+							   CACHE_LINE) * t);
+			crush_stats_reset(c->stats[t], max_rules);
+		} else {
+			c->stats[t] = *stats;
+		}
+		if (c->stats[t] != NULL) {
+			err = crush_stats_attach(c->cwin[t], c->stats[t], max_rules);
+			if (err < 0)
+				return err;
+		}
+	}
+	if (mode == MODE_CHOOSE_TRIES)
+		c->map->choose_tries = calloc(c->map->choose_total_tries + 1, sizeof(__u32));
+	return 0;
+}
+
+static void teardown(struct scaling_case *c, void *memory, struct crush_stats *stats)
+{
+	free(memory);
+	free(stats);
+	free(c->map->choose_tries);
+	c->map->choose_tries = NULL;
+}
+
+/* print how the throughput scaled from __previous__ to __threads__ */
+static void summarize(const struct options *o, int mode, const double *ops,
+		      const double *baseline, int previous, int threads)
+{
+	double speedup = ops[threads] / ops[1];
+	double marginal = (ops[threads] - ops[previous]) / ((threads - previous) * ops[1]);
+
+	printf("# %s\tthreads:%d\tspeedup %.2f\tefficiency %.2f\tmarginal %.2f",
+	       mode_names[mode], threads, speedup, speedup / threads, marginal);
+	if (mode != MODE_PRIVATE && baseline[threads] > 0)
+		printf("\tslowdown %.2f", baseline[threads] / ops[threads]);
+	if (marginal < o->min_efficiency)
+		printf("\tSUBLINEAR from %d to %d threads", previous, threads);
+	printf("\n");
+}
+
+static void run_mode(struct bench *b, const struct options *o, struct scaling_case *c,
+		     int mode, double *baseline)
+{
+	double ops[o->max_threads + 1];
+	char name[128];
+	int threads, previous = 0;
+
+	memset(ops, 0, sizeof(ops));
+	for (threads = 1; threads <= o->max_threads; threads++) {
+		void *memory;
+		struct crush_stats *stats;
+		int err;
+
+		/* every T up to 8, then powers of two and the maximum */
+		if (threads > 8 && (threads & (threads - 1)) != 0 && threads != o->max_threads)
+			continue;
+		snprintf(name, sizeof(name), "scaling/%s/threads:%d", mode_names[mode], threads);
+		if (!bench_selected(b, name))
+			continue;
+		err = setup(c, mode, threads, &memory, &stats);
+		if (err < 0) {
+			teardown(c, memory, stats);
+			printf("# %s: %s, build with -DCRUSH_STATS=ON\n", mode_names[mode],
+			       strerror(-err));
+			return;
+		}
+		bench_run(b, name, threads, bench_map, c);
+		teardown(c, memory, stats);
+		ops[threads] = b->results[b->count - 1].ops;
+		if (mode == MODE_PRIVATE)
+			baseline[threads] = ops[threads];
+		/* nothing to compare with without one thread */
+		if (previous > 0 && ops[1] > 0)
+			summarize(o, mode, ops, baseline, previous, threads);
+		previous = threads;
+	}
+}
+
+static void usage(void)
+{
+	int mode;
+
+	fprintf(stderr,
+		"usage: bench_scaling [options]\n"
+		"  --max-threads N      from 1 to N threads (the number of processors)\n"
+		"  --mode NAME          only run this mode:");
+	for (mode = 0; mode < MODE_COUNT; mode++)
+		fprintf(stderr, " %s", mode_names[mode]);
+	fprintf(stderr, "\n"
+		"  --min-efficiency F   flag the threads added with a lower marginal efficiency (0.8)\n"
+		"  --depth N            levels of buckets above the devices (3)\n"
+		"  --fanout N           items in each bucket (8)\n"
+		"  --out PERCENT        percentage of devices out (0)\n");
+	bench_usage();
+	exit(2);
+}
+
+static int mode_parse(const char *name)
+{
+	int mode;
+
+	for (mode = 0; mode < MODE_COUNT; mode++)
+		if (strcmp(name, mode_names[mode]) == 0)
+			return mode;
+	usage();
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct options o = { 3, 8, 0, sysconf(_SC_NPROCESSORS_ONLN), -1, 0.8 };
+	struct crush_generator g;
+	struct scaling_case c;
+	struct bench b;
+	double *baseline;
+	int i, mode;
+
+	bench_init(&b);
+	for (i = 1; i < argc; i++) {
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (bench_option(&b, argc, argv, &i))
+			continue;
+		if (value == NULL)
+			usage();
+		if (strcmp(argv[i], "--max-threads") == 0)
+			o.max_threads = atoi(value);
+		else if (strcmp(argv[i], "--mode") == 0)
+			o.mode = mode_parse(value);
+		else if (strcmp(argv[i], "--min-efficiency") == 0)
+			o.min_efficiency = atof(value);
+		else if (strcmp(argv[i], "--depth") == 0)
+			o.depth = atoi(value);
+		else if (strcmp(argv[i], "--fanout") == 0)
+			o.fanout = atoi(value);
+		else if (strcmp(argv[i], "--out") == 0)
+			o.out = atoi(value);
+		else
+			usage();
+		i++;
+	}
+	if (o.depth < 1 || o.fanout < 1 || o.out < 0 || o.out > 100 || o.max_threads < 1)
+		usage();
+
+	bench_generator(&g, o.depth, o.fanout, CRUSH_BUCKET_STRAW2, 0);
+	if (crush_generate(&g, &c.map) < 0) {
+		fprintf(stderr, "cannot generate a hierarchy of depth %d and fanout %d\n",
+			o.depth, o.fanout);
+		return 1;
+	}
+	c.result_max = 3;
+	c.weight_max = c.map->max_devices;
+	c.weights = malloc(sizeof(__u32) * (c.weight_max + 1));
+	crush_generator_out(&g, 0, o.out / 100.0, 0, c.weights, c.weight_max);
+	c.cwin = malloc(sizeof(void *) * o.max_threads);
+	c.result = malloc(sizeof(int *) * o.max_threads);
+	c.stats = malloc(sizeof(struct crush_stats *) * o.max_threads);
+	baseline = calloc(o.max_threads + 1, sizeof(double));
+	for (i = 0; i < o.max_threads; i++)
+		/* results on their own cache lines too */
+		c.result[i] = aligned_alloc(CACHE_LINE, CACHE_LINE);
+
+	bench_header(&b);
+	for (mode = 0; mode < MODE_COUNT; mode++)
+		if (o.mode < 0 || o.mode == mode || mode == MODE_PRIVATE)
+			run_mode(&b, &o, &c, mode, baseline);
+
+	for (i = 0; i < o.max_threads; i++)
+		free(c.result[i]);
+	free(c.result);
+	free(c.cwin);
+	free(c.stats);
+	free(baseline);
+	free(c.weights);
+	crush_destroy(c.map);
+	return bench_finish(&b);
+}
@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <string.h>
+
+#include "counters.h"
+
+static const char *names[BENCH_COUNTERS] = {
+	[BENCH_CYCLES] = "cycles",
+	[BENCH_INSTRUCTIONS] = "instructions",
+	[BENCH_BRANCH_MISSES] = "branch-misses",
+	[BENCH_L1D_MISSES] = "L1d-misses",
+	[BENCH_LLC_MISSES] = "LLC-misses",
+	[BENCH_DTLB_MISSES] = "dTLB-misses",
+};
+
+const char *bench_counter_name(int counter)
+{
+	return names[counter];
+}
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_READ_MISS(cache)						\
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |			\
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+	int group;
+	__u32 type;
+	__u64 config;
+} events[BENCH_COUNTERS] = {
+	[BENCH_CYCLES] = { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[BENCH_INSTRUCTIONS] = { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[BENCH_BRANCH_MISSES] = { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[BENCH_L1D_MISSES] = { 1, PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	[BENCH_LLC_MISSES] = { 1, PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+	[BENCH_DTLB_MISSES] = { 1, PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+};
+
+static int open_event(int counter, int leader)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[counter].type;
+	attr.config = events[counter].config;
+	attr.disabled = leader == -1;
+	/* count the threads created by bench_run() too */
+	attr.inherit = 1;
+	/* allowed with perf_event_paranoid up to 2 */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	/* PERF_FORMAT_GROUP cannot be read from inherited events */
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+int bench_counters_open(struct bench_counters *c, int *error)
+{
+	int available = 0;
+	int i, g;
+
+	*error = 0;
+	for (g = 0; g < BENCH_COUNTER_GROUPS; g++)
+		c->leader[g] = -1;
+	for (i = 0; i < BENCH_COUNTERS; i++) {
+		g = events[i].group;
+		c->fd[i] = open_event(i, c->leader[g]);
+		if (c->fd[i] < 0) {
+			if (*error == 0)
+				*error = errno;
+			c->fd[i] = -1;
+			continue;
+		}
+		if (c->leader[g] == -1)
+			c->leader[g] = c->fd[i];
+		available++;
+	}
+	return available;
+}
+
+void bench_counters_close(struct bench_counters *c)
+{
+	int i;
+
+	for (i = 0; i < BENCH_COUNTERS; i++)
+		if (c->fd[i] >= 0)
+			close(c->fd[i]);
+}
+
+static void group_ioctl(const struct bench_counters *c, unsigned long request)
+{
+	int g;
+
+	for (g = 0; g < BENCH_COUNTER_GROUPS; g++)
+		if (c->leader[g] >= 0)
+			ioctl(c->leader[g], request, PERF_IOC_FLAG_GROUP);
+}
+
+void bench_counters_start(struct bench_counters *c)
+{
+	group_ioctl(c, PERF_EVENT_IOC_RESET);
+	group_ioctl(c, PERF_EVENT_IOC_ENABLE);
+}
+
+void bench_counters_stop(struct bench_counters *c)
+{
+	group_ioctl(c, PERF_EVENT_IOC_DISABLE);
+}
+
+void bench_counters_resume(struct bench_counters *c)
+{
+	group_ioctl(c, PERF_EVENT_IOC_ENABLE);
+}
+
+void bench_counters_read(const struct bench_counters *c, double counts[BENCH_COUNTERS])
+{
+	struct {
+		uint64_t value;
+		uint64_t enabled;
+		uint64_t running;
+	} data;
+	int i;
+
+	for (i = 0; i < BENCH_COUNTERS; i++) {
+		counts[i] = -1;
+		if (c->fd[i] < 0 || read(c->fd[i], &data, sizeof(data)) != sizeof(data))
+			continue;
+		if (data.running == 0)
+			/* never scheduled, the PMU has too few counters */
+			continue;
+		counts[i] = (double)data.value * data.enabled / data.running;
+	}
+}
+
+#else
+
+int bench_counters_open(struct bench_counters *c, int *error)
+{
+	int i, g;
+
+	for (i = 0; i < BENCH_COUNTERS; i++)
+		c->fd[i] = -1;
+	for (g = 0; g < BENCH_COUNTER_GROUPS; g++)
+		c->leader[g] = -1;
+	*error = ENOSYS;
+	return 0;
+}
+
+void bench_counters_close(struct bench_counters *c)
+{
+}
+
+void bench_counters_start(struct bench_counters *c)
+{
+}
+
+void bench_counters_stop(struct bench_counters *c)
+{
+}
+
+void bench_counters_resume(struct bench_counters *c)
+{
+}
+
+void bench_counters_read(const struct bench_counters *c, double counts[BENCH_COUNTERS])
+{
+	int i;
+
+	for (i = 0; i < BENCH_COUNTERS; i++)
+		counts[i] = -1;
+}
+
+#endif
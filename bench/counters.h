@@ -0,0 +1,60 @@
+#ifndef CEPH_CRUSH_BENCH_COUNTERS_H
+#define CEPH_CRUSH_BENCH_COUNTERS_H
+
+/*
+ * Hardware performance counters, read with perf_event_open(2), of
+ * the calling thread and of the threads it creates while counting.
+ * The counters that cannot be opened (not Linux, no PMU in a virtual
+ * machine, perf_event_paranoid too high, ...) are reported as
+ * unavailable and the others keep working.
+ *
+ * LGPL2
+ */
+
+enum bench_counter {
+	BENCH_CYCLES,
+	BENCH_INSTRUCTIONS,
+	BENCH_BRANCH_MISSES,
+	BENCH_L1D_MISSES,
+	BENCH_LLC_MISSES,
+	BENCH_DTLB_MISSES,
+	BENCH_COUNTERS
+};
+
+/* the events are opened in two groups, each scheduled as a whole */
+#define BENCH_COUNTER_GROUPS 2
+
+struct bench_counters {
+	int fd[BENCH_COUNTERS];          /* -1 if unavailable */
+	int leader[BENCH_COUNTER_GROUPS]; /* -1 if the group is empty */
+};
+
+/* the name of counter __counter__, as printed in the results */
+extern const char *bench_counter_name(int counter);
+
+/*
+ * Open the counters, disabled. Return the number of counters
+ * available, 0 if none is, in which case __error__ is set to the
+ * errno of the first failure.
+ */
+extern int bench_counters_open(struct bench_counters *c, int *error);
+
+extern void bench_counters_close(struct bench_counters *c);
+
+/* reset the counts to zero and start counting */
+extern void bench_counters_start(struct bench_counters *c);
+
+/* stop counting, the counts accumulate until the next start */
+extern void bench_counters_stop(struct bench_counters *c);
+
+/* resume counting without resetting the counts */
+extern void bench_counters_resume(struct bench_counters *c);
+
+/*
+ * Store in __counts__ the value of each counter, scaled if the
+ * kernel had to multiplex the groups, -1 if unavailable.
+ */
+extern void bench_counters_read(const struct bench_counters *c,
+				double counts[BENCH_COUNTERS]);
+
+#endif
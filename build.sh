@@ -2,23 +2,27 @@
 
 set -ex
 [ $(id -u) = 0 ] || SUDO=sudo
+case " $* " in
+    *" -DCRUSH_PYTHON=ON "*) python=yes ;;
+esac
 if hash apt-get 2> /dev/null;
 then
     $SUDO apt-get update
-    $SUDO apt-get install -y git cmake g++ doxygen
+    $SUDO apt-get install -y git cmake g++ doxygen ${python:+python3-dev python3-numpy}
 else
     $SUDO yum update -y
-    $SUDO yum install -y git cmake gcc-c++ doxygen
+    $SUDO yum install -y git cmake gcc-c++ doxygen ${python:+python3-devel python3-numpy}
 fi
 git submodule sync
 git submodule update --force --init --recursive
-mkdir -p build
+BUILD_DIR=${BUILD_DIR:-build}
+mkdir -p $BUILD_DIR
 (
    #
    # building
    #
-   cd build
-   cmake ..
+   cd $BUILD_DIR
+   cmake "$@" ..
    make VERBOSE=1 all
    #
    # testing
@@ -29,7 +33,7 @@ mkdir -p build
    #
    make VERBOSE=1 dist doc
 )
-if test -n "$CI_BUILD_REF_NAME" ; then
+if test -n "$CI_BUILD_REF_NAME" && test $# = 0 ; then
     #
     # save the build
     #
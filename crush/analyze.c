@@ -0,0 +1,1536 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analyze.h"
+#include "latency.h"
+#include "mapper.h"
+
+#define dprintk(args...) /* printf(args) */
+
+/*
+ * A sparse probability distribution over the items of a crush_map,
+ * with the estimated absolute error of each probability.
+ */
+struct crush_dist {
+	int size;
+	int *items;
+	double *p;
+	double *err;
+};
+
+struct estimator {
+	const struct crush_map *map;
+	const __u32 *weights;
+	int weight_max;
+	const struct crush_choose_arg *choose_args;
+	/* dense accumulators indexed with item + map->max_buckets */
+	double *acc;
+	double *acc_err;
+	int *touched;
+	int touched_size;
+	/* mass of the descents ending with a skipped replica */
+	double lost;
+	/* mass of the descents ending with a retry (empty bucket) */
+	double rejected;
+};
+
+/*
+ * The candidates of type @type found below a bucket, i.e. all the
+ * items a single descent from that bucket may end on.
+ */
+struct candidates {
+	int size;
+	int *items;
+	int npos;        /* number of distinct positions */
+	double **q;      /* [npos][size] probability of a single descent */
+	double *lost;    /* [npos] */
+	double *rejected; /* [npos] */
+	int leaf_npos;
+	double **accept;  /* [leaf_npos][size] probability to be accepted */
+	struct crush_dist **leaves; /* [leaf_npos][size] or NULL */
+};
+
+static inline int item_index(const struct estimator *e, int item)
+{
+	return item + e->map->max_buckets;
+}
+
+static void accumulate(struct estimator *e, int item, double p, double err)
+{
+	int i = item_index(e, item);
+	if (p == 0 && err == 0)
+		return;
+	if (e->acc[i] == 0 && e->acc_err[i] == 0)
+		e->touched[e->touched_size++] = i;
+	e->acc[i] += p;
+	e->acc_err[i] += err;
+}
+
+static void reset(struct estimator *e)
+{
+	int i;
+	for (i = 0; i < e->touched_size; i++) {
+		e->acc[e->touched[i]] = 0;
+		e->acc_err[e->touched[i]] = 0;
+	}
+	e->touched_size = 0;
+	e->lost = 0;
+	e->rejected = 0;
+}
+
+static void dist_destroy(struct crush_dist *d)
+{
+	free(d->items);
+	free(d->p);
+	free(d->err);
+	memset(d, 0, sizeof(*d));
+}
+
+/* move the content of the accumulators into @d and reset them */
+static int gather(struct estimator *e, struct crush_dist *d)
+{
+	int i;
+
+	d->size = e->touched_size;
+	d->items = malloc(sizeof(int) * (d->size + 1));
+	d->p = malloc(sizeof(double) * (d->size + 1));
+	d->err = malloc(sizeof(double) * (d->size + 1));
+	if (!d->items || !d->p || !d->err) {
+		dist_destroy(d);
+		reset(e);
+		return -ENOMEM;
+	}
+	for (i = 0; i < d->size; i++) {
+		int idx = e->touched[i];
+		d->items[i] = idx - e->map->max_buckets;
+		d->p[i] = e->acc[idx];
+		d->err[i] = e->acc_err[idx];
+	}
+	reset(e);
+	return 0;
+}
+
+/* probability that is_out() does not reject @device */
+static double device_accept(const struct estimator *e, int device)
+{
+	if (device >= e->weight_max)
+		return 0;
+	if (e->weights[device] >= 0x10000)
+		return 1;
+	return (double)e->weights[device] / 0x10000;
+}
+
+/*
+ * Absolute error of the probability @p to place a device that
+ * is_out() accepts with probability @accept. is_out() only depends
+ * on x and a device it rejects is rejected again if it is drawn on
+ * a later try, which the estimate treats as an independent event.
+ */
+static double out_error(double p, double accept)
+{
+	double relative;
+
+	if (accept <= 0 || accept >= 1)
+		return 0;
+	relative = (1 - accept) * p / accept;
+	return p * (relative < 1 ? relative : 1);
+}
+
+/* the weight bucket_*_choose() uses for the item at index @i */
+static double item_weight(const struct estimator *e,
+			  const struct crush_bucket *b, int position, int i)
+{
+	if (b->alg == CRUSH_BUCKET_UNIFORM)
+		return 1;
+	if (b->alg == CRUSH_BUCKET_STRAW2 && e->choose_args) {
+		const struct crush_choose_arg *arg = &e->choose_args[-1-b->id];
+		if (arg->weight_set && arg->weight_set_size) {
+			if ((__u32)position >= arg->weight_set_size)
+				position = arg->weight_set_size - 1;
+			return arg->weight_set[position].weights[i];
+		}
+	}
+	return (__u32)crush_get_bucket_item_weight(b, i);
+}
+
+/*
+ * Accumulate the probability to end on each item of type @type after
+ * descending from bucket @b. Items of another type are descended
+ * into, the same way crush_choose_firstn() and crush_choose_indep()
+ * do.
+ */
+static void descend(struct estimator *e, const struct crush_bucket *b,
+		    int type, int position, double mass, int depth)
+{
+	const struct crush_map *map = e->map;
+	double sum = 0;
+	__u32 i;
+
+	if (b->size == 0) {
+		e->rejected += mass;
+		return;
+	}
+	if (depth > map->max_buckets) {
+		/* there is a loop in the hierarchy */
+		e->lost += mass;
+		return;
+	}
+	for (i = 0; i < b->size; i++)
+		sum += item_weight(e, b, position, i);
+
+	for (i = 0; i < b->size; i++) {
+		int item = b->items[i];
+		double p;
+
+		if (sum > 0)
+			p = item_weight(e, b, position, i) / sum;
+		else
+			/* all weights are zero, the first item wins */
+			p = i == 0 ? 1 : 0;
+		if (p == 0)
+			continue;
+		p *= mass;
+
+		if (item >= map->max_devices) {
+			e->lost += p;
+			continue;
+		}
+		if (item < 0 && (-1-item >= map->max_buckets ||
+				 map->buckets[-1-item] == NULL)) {
+			e->lost += p;
+			continue;
+		}
+		if ((item < 0 ? map->buckets[-1-item]->type : 0) == type)
+			accumulate(e, item, p, 0);
+		else if (item >= 0)
+			/* bad item type */
+			e->lost += p;
+		else
+			descend(e, map->buckets[-1-item], type, position,
+				p, depth + 1);
+	}
+}
+
+/*
+ * Probability that a replica is placed, given the probability @s
+ * that one try succeeds and @l that the replica is skipped. Tries
+ * that neither succeed nor skip are retried, up to @tries times.
+ */
+static double place_probability(double s, double l, unsigned int tries)
+{
+	double r = 1 - s - l;
+
+	if (s <= 0 || tries == 0)
+		return 0;
+	if (r <= 0)
+		return s;
+	if (r >= 1)
+		return 0;
+	return s * (1 - pow(r, tries)) / (1 - r);
+}
+
+static void candidates_destroy(struct candidates *c)
+{
+	int p, i;
+
+	for (p = 0; p < c->npos && c->q; p++)
+		free(c->q[p]);
+	for (p = 0; p < c->leaf_npos; p++) {
+		if (c->accept)
+			free(c->accept[p]);
+		if (c->leaves && c->leaves[p]) {
+			for (i = 0; i < c->size; i++)
+				dist_destroy(&c->leaves[p][i]);
+			free(c->leaves[p]);
+		}
+	}
+	free(c->q);
+	free(c->accept);
+	free(c->leaves);
+	free(c->lost);
+	free(c->rejected);
+	free(c->items);
+	memset(c, 0, sizeof(*c));
+}
+
+static int candidates_build(struct estimator *e, struct candidates *c,
+			    const struct crush_bucket *b, int type,
+			    int npos, int leaf_npos, int recurse_to_leaf,
+			    unsigned int recurse_tries)
+{
+	const struct crush_map *map = e->map;
+	int p, i, r;
+
+	memset(c, 0, sizeof(*c));
+	/* the union of the candidates for all positions */
+	for (p = 0; p < npos; p++)
+		descend(e, b, type, p, 1, 0);
+	c->size = e->touched_size;
+	c->items = malloc(sizeof(int) * (c->size + 1));
+	if (!c->items) {
+		reset(e);
+		return -ENOMEM;
+	}
+	for (i = 0; i < c->size; i++)
+		c->items[i] = e->touched[i] - map->max_buckets;
+	reset(e);
+
+	c->npos = npos;
+	c->q = calloc(npos, sizeof(double *));
+	c->lost = calloc(npos, sizeof(double));
+	c->rejected = calloc(npos, sizeof(double));
+	if (!c->q || !c->lost || !c->rejected)
+		goto nomem;
+	for (p = 0; p < npos; p++) {
+		c->q[p] = malloc(sizeof(double) * (c->size + 1));
+		if (!c->q[p])
+			goto nomem;
+		descend(e, b, type, p, 1, 0);
+		for (i = 0; i < c->size; i++)
+			c->q[p][i] = e->acc[item_index(e, c->items[i])];
+		c->lost[p] = e->lost;
+		c->rejected[p] = e->rejected;
+		reset(e);
+	}
+
+	c->leaf_npos = leaf_npos;
+	c->accept = calloc(leaf_npos, sizeof(double *));
+	if (!c->accept)
+		goto nomem;
+	if (recurse_to_leaf) {
+		c->leaves = calloc(leaf_npos, sizeof(struct crush_dist *));
+		if (!c->leaves)
+			goto nomem;
+	}
+	for (p = 0; p < leaf_npos; p++) {
+		c->accept[p] = malloc(sizeof(double) * (c->size + 1));
+		if (!c->accept[p])
+			goto nomem;
+		if (recurse_to_leaf) {
+			c->leaves[p] = calloc(c->size + 1,
+					      sizeof(struct crush_dist));
+			if (!c->leaves[p])
+				goto nomem;
+		}
+		for (i = 0; i < c->size; i++) {
+			int item = c->items[i];
+			double s = 0;
+
+			if (item >= 0) {
+				c->accept[p][i] = device_accept(e, item);
+				continue;
+			}
+			if (!recurse_to_leaf) {
+				/* is_out() only applies to devices */
+				c->accept[p][i] = 1;
+				continue;
+			}
+			/* the leaves that survive is_out() */
+			descend(e, map->buckets[-1-item], 0, p, 1, 0);
+			for (r = 0; r < e->touched_size; r++) {
+				int idx = e->touched[r];
+				e->acc[idx] *= device_accept(
+					e, idx - map->max_buckets);
+				s += e->acc[idx];
+			}
+			c->accept[p][i] = place_probability(s, e->lost,
+							    recurse_tries);
+			if (gather(e, &c->leaves[p][i]) < 0)
+				goto nomem;
+			for (r = 0; r < c->leaves[p][i].size; r++) {
+				struct crush_dist *leaves = &c->leaves[p][i];
+				int device = leaves->items[r];
+				leaves->p[r] = s > 0 ? leaves->p[r] / s : 0;
+				leaves->err[r] = out_error(leaves->p[r],
+						device_accept(e, device));
+			}
+		}
+	}
+	return 0;
+nomem:
+	candidates_destroy(c);
+	return -ENOMEM;
+}
+
+/*
+ * Approximate the distribution of the @k-th item drawn without
+ * replacement from the @qn distribution. The first items were drawn
+ * with the inclusion probabilities @incl. The probability to draw i
+ * is q(i) / (1 - Q) where Q is the sum of the probabilities of the
+ * items already drawn. Q is estimated with the inclusion
+ * probabilities of the other items, knowing that i was not drawn.
+ */
+static void choose_ratio(const double *qn, int size, int k,
+			 const double *incl, double *cur)
+{
+	double q = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		cur[i] = incl[i] < 1 ? incl[i] : 1;
+		q += cur[i] * qn[i];
+	}
+	for (i = 0; i < size; i++) {
+		double pi = cur[i];
+		double removed;
+		if (pi >= 1) {
+			cur[i] = 0;
+			continue;
+		}
+		removed = (q - pi * qn[i]) * k / (k - pi);
+		if (removed > 1 - 1e-9)
+			removed = 1 - 1e-9;
+		cur[i] = qn[i] * (1 - pi) / (1 - removed);
+		sum += cur[i];
+	}
+	for (i = 0; i < size; i++)
+		cur[i] = sum > 0 ? cur[i] / sum : 0;
+}
+
+/*
+ * Buckets up to this size sum the w(j, l) of choose_third() pair by
+ * pair. An item is heavy if its probability to be drawn for the third
+ * position is above THIRD_HEAVY: there are at most four of them.
+ */
+#define THIRD_PAIRS_MAX 64
+#define THIRD_HEAVY 0.2
+#define THIRD_TERMS_MAX 20
+
+/* w(j, l) of choose_third(), 0 if the pair cannot be drawn */
+static double third_weight(const double *rho0, const double *q1,
+			   const double *q2, int j, int l)
+{
+	double d = 1 - q2[j] - q2[l];
+
+	if (l == j || rho0[j] == 0 || q1[j] >= 1 || q1[l] == 0 || d <= 0)
+		return 0;
+	return rho0[j] * q1[l] / (1 - q1[j]) / d;
+}
+
+/*
+ * Sum the w(j, l) = P(first = j) * q1(l) / (1 - q1(j)) /
+ * (1 - q2(j) - q2(l)) over the pairs j != l in @total and, for each
+ * item i, the w(j, l) where j or l is i in @involved.
+ *
+ * Summing pair by pair is O(size^2). On wider buckets the pairs
+ * where j or l is heavy are still summed one by one, which is
+ * O(size) since there are few heavy items. For the other pairs
+ * q2(l) / (1 - q2(j)) <= 1/4 and w(j, l) is expanded as
+ *
+ *   a(j) * b(l) * sum_n q2(l)^n / (1 - q2(j))^(n + 1)
+ *
+ * with a(j) = P(first = j) / (1 - q1(j)) and b(l) = q1(l): the sums
+ * over j and l factor out of each term, which is O(size) for the few
+ * terms needed to reach a relative precision of 1e-12.
+ */
+static void choose_third(int size, const double *rho0, const double *q1,
+			 const double *q2, double *involved, double *total)
+{
+	double S[THIRD_TERMS_MAX], T[THIRD_TERMS_MAX];
+	double qmax = 0, ratio;
+	int i, j, l, n, terms;
+
+	*total = 0;
+	if (size <= THIRD_PAIRS_MAX) {
+		for (j = 0; j < size; j++)
+			for (l = 0; l < size; l++) {
+				double w = third_weight(rho0, q1, q2, j, l);
+				*total += w;
+				involved[j] += w;
+				involved[l] += w;
+			}
+		return;
+	}
+
+	/* the pairs involving a heavy item */
+	for (j = 0; j < size; j++) {
+		if (q2[j] <= THIRD_HEAVY)
+			continue;
+		for (l = 0; l < size; l++) {
+			double w = third_weight(rho0, q1, q2, j, l);
+			/* (l, j) is counted here if l is light */
+			double v = q2[l] <= THIRD_HEAVY ?
+				third_weight(rho0, q1, q2, l, j) : 0;
+			*total += w + v;
+			involved[j] += w + v;
+			involved[l] += w + v;
+		}
+	}
+
+	/* the pairs of light items */
+	for (i = 0; i < size; i++)
+		if (q2[i] <= THIRD_HEAVY && q2[i] > qmax)
+			qmax = q2[i];
+	ratio = qmax / (1 - qmax);
+	terms = ratio > 0 ? (int)ceil(log(1e-12) / log(ratio)) : 1;
+	if (terms < 1)
+		terms = 1;
+	if (terms > THIRD_TERMS_MAX)
+		terms = THIRD_TERMS_MAX;
+	for (n = 0; n < terms; n++)
+		S[n] = T[n] = 0;
+	for (i = 0; i < size; i++) {
+		double a, c, qp = 1, cp = 1;
+		if (q2[i] > THIRD_HEAVY)
+			continue;
+		a = (rho0[i] == 0 || q1[i] >= 1) ? 0 : rho0[i] / (1 - q1[i]);
+		c = 1 - q2[i];
+		for (n = 0; n < terms; n++) {
+			cp *= c;
+			S[n] += q1[i] * qp;
+			T[n] += a / cp;
+			qp *= q2[i];
+		}
+	}
+	for (n = 0; n < terms; n++)
+		*total += S[n] * T[n];
+	for (i = 0; i < size; i++) {
+		double a, c, qp = 1, cp = 1, as_j = 0, as_l = 0, diag;
+		if (q2[i] > THIRD_HEAVY)
+			continue;
+		a = (rho0[i] == 0 || q1[i] >= 1) ? 0 : rho0[i] / (1 - q1[i]);
+		c = 1 - q2[i];
+		for (n = 0; n < terms; n++) {
+			cp *= c;
+			as_j += S[n] / cp;
+			as_l += qp * T[n];
+			qp *= q2[i];
+		}
+		/* the expansion includes the pair (i, i) */
+		diag = a * q1[i] / (1 - 2 * q2[i]);
+		*total -= diag;
+		involved[i] += a * as_j + q1[i] * as_l - 2 * diag;
+	}
+}
+
+/*
+ * The distribution of the @k-th item chosen from the candidates,
+ * conditional on being placed, is written in @rho[k]. The
+ * distributions of the previous items are in @rho[0..k-1], their sum
+ * (the probability that each candidate was already chosen) is in
+ * @incl and the normalized probabilities to draw each candidate for
+ * the previous positions are in @qn[0..k-1]. The first three
+ * distributions are exact, the following are approximated with
+ * choose_ratio(). The error of the approximation observed on the
+ * third distribution is kept in @ratio_err and scaled to estimate the
+ * error of the following distributions. Each distribution is O(size).
+ */
+static void choose_nth(const struct candidates *c, int k, int pos,
+		       int accept_pos, double **qn, double **rho,
+		       const double *incl, double *err,
+		       double *ratio_err, double *place,
+		       unsigned int tries)
+{
+	const double *q = c->q[pos];
+	const double *accept = c->accept[accept_pos];
+	double *cur = rho[k];
+	double s = 0, norm = 0, sum = 0;
+	int i, j;
+
+	for (i = 0; i < c->size; i++) {
+		double pi = incl[i] < 1 ? incl[i] : 1;
+		/* a try succeeds if accepted and not colliding */
+		s += q[i] * accept[i] * (1 - pi);
+		qn[k][i] = q[i] * accept[i];
+		norm += qn[k][i];
+		err[i] = 0;
+	}
+	*place = place_probability(s, c->lost[pos], tries);
+	if (norm <= 0 || s <= 0) {
+		for (i = 0; i < c->size; i++)
+			cur[i] = 0;
+		return;
+	}
+	for (i = 0; i < c->size; i++)
+		qn[k][i] /= norm;
+
+	if (k == 0) {
+		for (i = 0; i < c->size; i++)
+			cur[i] = qn[0][i];
+		return;
+	}
+
+	if (k == 1) {
+		/*
+		 * P(second = i) = sum_{j != i} P(first = j) *
+		 *                 q1(i) / (1 - q1(j))
+		 */
+		double total = 0;
+		for (j = 0; j < c->size; j++)
+			if (qn[1][j] < 1)
+				total += rho[0][j] / (1 - qn[1][j]);
+		for (i = 0; i < c->size; i++) {
+			double others = total;
+			if (qn[1][i] < 1)
+				others -= rho[0][i] / (1 - qn[1][i]);
+			cur[i] = qn[1][i] * others;
+		}
+	} else if (k == 2) {
+		/*
+		 * P(third = i) = sum_{j, l != i} P(first = j) *
+		 *                q1(l) / (1 - q1(j)) *
+		 *                q2(i) / (1 - q2(j) - q2(l))
+		 * is sum(w) minus the w(j, l) involving i.
+		 */
+		double *involved = err;
+		double total;
+		choose_third(c->size, rho[0], qn[1], qn[2], involved, &total);
+		for (i = 0; i < c->size; i++) {
+			cur[i] = qn[2][i] * (total - involved[i]);
+			if (cur[i] < 0)
+				cur[i] = 0;
+		}
+	} else {
+		choose_ratio(qn[k], c->size, k, incl, cur);
+		/* the error grows with the number of items already chosen */
+		for (i = 0; i < c->size; i++)
+			err[i] = ratio_err[i] * k;
+		return;
+	}
+
+	for (i = 0; i < c->size; i++)
+		sum += cur[i];
+	for (i = 0; i < c->size; i++) {
+		cur[i] = sum > 0 ? cur[i] / sum : 0;
+		err[i] = 0;
+	}
+	if (k == 2) {
+		choose_ratio(qn[2], c->size, 2, incl, ratio_err);
+		for (i = 0; i < c->size; i++)
+			ratio_err[i] = fabs(ratio_err[i] - cur[i]);
+	}
+}
+
+/*
+ * The output of choosing @numrep items from the source bucket @b,
+ * one distribution per item chosen.
+ */
+struct picks {
+	int size;
+	struct crush_dist *r;
+};
+
+static void picks_destroy(struct picks *p)
+{
+	int k;
+	for (k = 0; k < p->size; k++)
+		dist_destroy(&p->r[k]);
+	free(p->r);
+	free(p);
+}
+
+static struct picks *picks_build(struct estimator *e,
+				 const struct crush_bucket *b,
+				 int numrep, int type, int firstn,
+				 int recurse_to_leaf,
+				 unsigned int tries, unsigned int recurse_tries)
+{
+	struct candidates c;
+	struct picks *picks;
+	double **rho = NULL, **qn = NULL;
+	double *ratio_err = NULL, *err = NULL, *incl = NULL;
+	int npos = (e->choose_args && firstn) ? numrep : 1;
+	int leaf_npos = (e->choose_args && recurse_to_leaf) ? numrep : 1;
+	int k, i, l;
+
+	picks = calloc(1, sizeof(*picks));
+	if (!picks)
+		return NULL;
+	picks->r = calloc(numrep, sizeof(struct crush_dist));
+	if (!picks->r) {
+		free(picks);
+		return NULL;
+	}
+	picks->size = numrep;
+	if (candidates_build(e, &c, b, type, npos, leaf_npos,
+			     recurse_to_leaf, recurse_tries) < 0) {
+		picks_destroy(picks);
+		return NULL;
+	}
+
+	rho = calloc(numrep, sizeof(double *));
+	qn = calloc(numrep, sizeof(double *));
+	ratio_err = calloc(c.size + 1, sizeof(double));
+	err = malloc(sizeof(double) * (c.size + 1));
+	incl = calloc(c.size + 1, sizeof(double));
+	if (!rho || !qn || !ratio_err || !err || !incl)
+		goto nomem;
+	for (k = 0; k < numrep; k++) {
+		int pos = k < npos ? k : npos - 1;
+		int accept_pos = k < leaf_npos ? k : leaf_npos - 1;
+		double place;
+
+		rho[k] = malloc(sizeof(double) * (c.size + 1));
+		qn[k] = malloc(sizeof(double) * (c.size + 1));
+		if (!rho[k] || !qn[k])
+			goto nomem;
+		choose_nth(&c, k, pos, accept_pos, qn, rho, incl, err,
+			   ratio_err, &place, tries);
+		for (i = 0; i < c.size; i++)
+			incl[i] += rho[k][i];
+		dprintk("bucket %d pick %d place %f\n", b->id, k, place);
+		for (i = 0; i < c.size; i++) {
+			double p = rho[k][i] * place;
+			double perr = err[i] * place;
+			if (p == 0 && perr == 0)
+				continue;
+			if (recurse_to_leaf && c.items[i] < 0) {
+				struct crush_dist *leaves =
+					&c.leaves[accept_pos][i];
+				for (l = 0; l < leaves->size; l++)
+					accumulate(e, leaves->items[l],
+						   p * leaves->p[l],
+						   perr * leaves->p[l] +
+						   p * leaves->err[l]);
+			} else {
+				if (c.items[i] >= 0)
+					perr += out_error(p, c.accept[accept_pos][i]);
+				accumulate(e, c.items[i], p, perr);
+			}
+		}
+		if (gather(e, &picks->r[k]) < 0)
+			goto nomem;
+	}
+
+	for (k = 0; k < numrep; k++) {
+		free(rho[k]);
+		free(qn[k]);
+	}
+	free(rho);
+	free(qn);
+	free(incl);
+	free(ratio_err);
+	free(err);
+	candidates_destroy(&c);
+	return picks;
+nomem:
+	for (k = 0; k < numrep; k++) {
+		if (rho)
+			free(rho[k]);
+		if (qn)
+			free(qn[k]);
+	}
+	free(rho);
+	free(qn);
+	free(incl);
+	free(ratio_err);
+	free(err);
+	candidates_destroy(&c);
+	picks_destroy(picks);
+	return NULL;
+}
+
+static void positions_destroy(struct crush_dist *w, int size)
+{
+	int i;
+	for (i = 0; i < size; i++)
+		dist_destroy(&w[i]);
+}
+
+int crush_estimate_placement(const struct crush_map *map,
+			     int ruleno, int result_max,
+			     const __u32 *weights, int weight_max,
+			     const struct crush_choose_arg *choose_args,
+			     double threshold,
+			     double *shares, double *errors)
+{
+	struct estimator e;
+	const struct crush_rule *rule;
+	struct crush_dist *w = NULL, *o = NULL, *tmp;
+	struct picks **cache = NULL;
+	double *own_errors = NULL;
+	int wsize = 0;
+	int result_len = 0;
+	int flagged = 0;
+	int ret = -ENOMEM;
+	int n = map->max_buckets + map->max_devices;
+	__u32 step;
+	int i, d;
+	int choose_tries = map->choose_total_tries + 1;
+	int choose_leaf_tries = 0;
+
+	if ((__u32)ruleno >= map->max_rules || map->rules[ruleno] == NULL ||
+	    result_max <= 0)
+		return -EINVAL;
+	rule = map->rules[ruleno];
+
+	memset(&e, 0, sizeof(e));
+	e.map = map;
+	e.weights = weights;
+	e.weight_max = weight_max;
+	e.choose_args = choose_args;
+	e.acc = calloc(n + 1, sizeof(double));
+	e.acc_err = calloc(n + 1, sizeof(double));
+	e.touched = malloc(sizeof(int) * (n + 1));
+	w = calloc(result_max + 1, sizeof(struct crush_dist));
+	o = calloc(result_max + 1, sizeof(struct crush_dist));
+	cache = calloc(map->max_buckets + 1, sizeof(struct picks *));
+	if (errors == NULL)
+		errors = own_errors = malloc(sizeof(double) *
+					     (map->max_devices + 1));
+	if (!e.acc || !e.acc_err || !e.touched || !w || !o || !cache ||
+	    !errors)
+		goto out;
+	for (d = 0; d < map->max_devices; d++)
+		shares[d] = errors[d] = 0;
+
+	for (step = 0; step < rule->len; step++) {
+		const struct crush_rule_step *curstep = &rule->steps[step];
+		int firstn = 0;
+		int recurse_to_leaf;
+		int osize;
+
+		switch (curstep->op) {
+		case CRUSH_RULE_TAKE:
+			if ((curstep->arg1 >= 0 &&
+			     curstep->arg1 < map->max_devices) ||
+			    (-1-curstep->arg1 >= 0 &&
+			     -1-curstep->arg1 < map->max_buckets &&
+			     map->buckets[-1-curstep->arg1])) {
+				positions_destroy(w, wsize);
+				accumulate(&e, curstep->arg1, 1, 0);
+				if (gather(&e, &w[0]) < 0)
+					goto out;
+				wsize = 1;
+			}
+			break;
+
+		case CRUSH_RULE_SET_CHOOSE_TRIES:
+			if (curstep->arg1 > 0)
+				choose_tries = curstep->arg1;
+			break;
+
+		case CRUSH_RULE_SET_CHOOSELEAF_TRIES:
+			if (curstep->arg1 > 0)
+				choose_leaf_tries = curstep->arg1;
+			break;
+
+		case CRUSH_RULE_CHOOSELEAF_FIRSTN:
+		case CRUSH_RULE_CHOOSE_FIRSTN:
+			firstn = 1;
+			/* fall through */
+		case CRUSH_RULE_CHOOSELEAF_INDEP:
+		case CRUSH_RULE_CHOOSE_INDEP:
+			if (wsize == 0)
+				break;
+			recurse_to_leaf =
+				curstep->op == CRUSH_RULE_CHOOSELEAF_FIRSTN ||
+				curstep->op == CRUSH_RULE_CHOOSELEAF_INDEP;
+			osize = 0;
+			for (i = 0; i < wsize; i++) {
+				int numrep = curstep->arg1;
+				int out_size, k, s;
+				unsigned int recurse_tries;
+
+				if (numrep <= 0) {
+					numrep += result_max;
+					if (numrep <= 0)
+						continue;
+				}
+				out_size = numrep < result_max - osize ?
+					numrep : result_max - osize;
+				if (out_size <= 0)
+					continue;
+				if (numrep > result_max)
+					numrep = result_max;
+				if (firstn)
+					recurse_tries = choose_leaf_tries ?
+						choose_leaf_tries :
+						map->chooseleaf_descend_once ?
+						1 : choose_tries;
+				else
+					recurse_tries = choose_leaf_tries ?
+						choose_leaf_tries : 1;
+				for (s = 0; s < w[i].size; s++) {
+					int bno = -1 - w[i].items[s];
+					struct picks *picks;
+
+					if (bno < 0 || bno >= map->max_buckets)
+						continue;
+					picks = cache[bno];
+					if (picks == NULL ||
+					    picks->size < out_size) {
+						if (picks)
+							picks_destroy(picks);
+						picks = picks_build(
+							&e, map->buckets[bno],
+							numrep,
+							curstep->arg2, firstn,
+							recurse_to_leaf,
+							choose_tries,
+							recurse_tries);
+						cache[bno] = picks;
+						if (!picks)
+							goto out;
+					}
+					for (k = 0; k < out_size; k++) {
+						struct crush_dist *r =
+							&picks->r[k];
+						int t;
+						if (o[osize + k].size)
+							for (t = 0; t < o[osize + k].size; t++)
+								accumulate(&e, o[osize + k].items[t],
+									   o[osize + k].p[t],
+									   o[osize + k].err[t]);
+						for (t = 0; t < r->size; t++)
+							accumulate(&e, r->items[t],
+								   w[i].p[s] * r->p[t],
+								   w[i].p[s] * r->err[t] +
+								   w[i].err[s] * r->p[t]);
+						dist_destroy(&o[osize + k]);
+						if (gather(&e, &o[osize + k]) < 0)
+							goto out;
+					}
+				}
+				osize += out_size;
+			}
+			for (i = 0; i < map->max_buckets; i++) {
+				if (cache[i])
+					picks_destroy(cache[i]);
+				cache[i] = NULL;
+			}
+			positions_destroy(w, wsize);
+			tmp = o;
+			o = w;
+			w = tmp;
+			wsize = osize;
+			break;
+
+		case CRUSH_RULE_EMIT:
+			for (i = 0; i < wsize && result_len < result_max; i++) {
+				int t;
+				for (t = 0; t < w[i].size; t++) {
+					if (w[i].items[t] < 0)
+						continue;
+					shares[w[i].items[t]] += w[i].p[t];
+					errors[w[i].items[t]] += w[i].err[t];
+				}
+				result_len++;
+			}
+			positions_destroy(w, wsize);
+			wsize = 0;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	for (d = 0; d < map->max_devices; d++)
+		if (errors[d] > 0 && errors[d] > threshold * shares[d])
+			flagged++;
+	ret = flagged;
+out:
+	if (cache) {
+		for (i = 0; i < map->max_buckets; i++)
+			if (cache[i])
+				picks_destroy(cache[i]);
+		free(cache);
+	}
+	if (w)
+		positions_destroy(w, result_max);
+	if (o)
+		positions_destroy(o, result_max);
+	free(w);
+	free(o);
+	free(e.acc);
+	free(e.acc_err);
+	free(e.touched);
+	free(own_errors);
+	return ret;
+}
+
+/* cost model */
+
+/*
+ * A vector of doubles indexed with item + map->max_buckets, with the
+ * list of its non zero entries: it is scanned and cleared in the
+ * time of these entries rather than of the size of the map.
+ */
+struct sparse {
+	double *v;
+	int *index;
+	int size;
+};
+
+static int sparse_init(struct sparse *s, int n)
+{
+	s->v = calloc(n + 1, sizeof(double));
+	s->index = malloc(sizeof(int) * (n + 1));
+	s->size = 0;
+	return s->v && s->index ? 0 : -ENOMEM;
+}
+
+static void sparse_destroy(struct sparse *s)
+{
+	free(s->v);
+	free(s->index);
+}
+
+static void sparse_add(struct sparse *s, int i, double p)
+{
+	if (p <= 0)
+		return;
+	if (s->v[i] == 0)
+		s->index[s->size++] = i;
+	s->v[i] += p;
+}
+
+static void sparse_clear(struct sparse *s)
+{
+	int k;
+
+	for (k = 0; k < s->size; k++)
+		s->v[s->index[k]] = 0;
+	s->size = 0;
+}
+
+/* the devices first, then the buckets in the order of map->buckets */
+static int sparse_index_compare(const void *a, const void *b)
+{
+	return *(const int *)b - *(const int *)a;
+}
+
+struct visit_cost {
+	double hashes;
+	double visits;
+	double bytes;
+};
+
+static void visit_cost_add(struct visit_cost *to, const struct visit_cost *c,
+			   double mass)
+{
+	to->hashes += mass * c->hashes;
+	to->visits += mass * c->visits;
+	to->bytes += mass * c->bytes;
+}
+
+/* the work done by one call to crush_bucket_choose() on @b */
+static void bucket_cost(const struct estimator *e, const struct crush_bucket *b,
+			int position, struct visit_cost *c)
+{
+	__u32 i;
+
+	c->visits = 1;
+	switch (b->alg) {
+	case CRUSH_BUCKET_UNIFORM:
+		/* the permutation is built one hash at a time */
+		c->hashes = 1;
+		c->bytes = sizeof(struct crush_bucket_uniform) +
+			sizeof(struct crush_work_bucket) + 2 * sizeof(__u32);
+		break;
+	case CRUSH_BUCKET_LIST: {
+		const struct crush_bucket_list *l =
+			(const struct crush_bucket_list *)b;
+		double reach = 1;
+
+		/* items are hashed from the last until one is accepted */
+		c->hashes = 0;
+		for (i = b->size; i > 0; i--) {
+			c->hashes += reach;
+			if (l->sum_weights[i - 1] > 0)
+				reach *= 1 - (double)l->item_weights[i - 1] /
+					l->sum_weights[i - 1];
+		}
+		c->bytes = sizeof(*l) + c->hashes * 3 * sizeof(__u32);
+		break;
+	}
+	case CRUSH_BUCKET_TREE: {
+		const struct crush_bucket_tree *t =
+			(const struct crush_bucket_tree *)b;
+		int n = t->num_nodes >> 1;
+		int depth = 0;
+
+		/* one hash per level, see bucket_tree_choose() */
+		while (n > 0 && (n & 1) == 0) {
+			depth++;
+			n >>= 1;
+		}
+		c->hashes = depth;
+		c->bytes = sizeof(*t) + depth * 2 * sizeof(__u32) +
+			sizeof(__s32);
+		break;
+	}
+	case CRUSH_BUCKET_STRAW:
+		c->hashes = b->size;
+		c->bytes = sizeof(struct crush_bucket_straw) +
+			b->size * 2 * sizeof(__u32);
+		break;
+	case CRUSH_BUCKET_STRAW2:
+		/* items with a zero weight are not hashed */
+		c->hashes = 0;
+		for (i = 0; i < b->size; i++)
+			if (item_weight(e, b, position, i) > 0)
+				c->hashes++;
+		c->bytes = sizeof(struct crush_bucket_straw2) +
+			b->size * 2 * sizeof(__u32);
+		if (e->choose_args && (e->choose_args[-1-b->id].weight_set ||
+				       e->choose_args[-1-b->id].ids))
+			c->bytes += b->size * 2 * sizeof(__u32);
+		break;
+	default:
+		c->hashes = 0;
+		c->bytes = sizeof(struct crush_bucket);
+		break;
+	}
+}
+
+/*
+ * Accumulate in @c the work of a descent from @b to an item of type
+ * @type, in @arrive the probability to end on each item and in @fail
+ * the probability that the descent is rejected because of an empty
+ * bucket or a bad item.
+ */
+static void descent_cost(const struct estimator *e, const struct crush_bucket *b,
+			 int type, int position, double mass, int depth,
+			 struct visit_cost *c, struct sparse *arrive, double *fail)
+{
+	const struct crush_map *map = e->map;
+	struct visit_cost one;
+	double sum = 0;
+	__u32 i;
+
+	if (b->size == 0 || depth > map->max_buckets) {
+		*fail += mass;
+		return;
+	}
+	bucket_cost(e, b, position, &one);
+	visit_cost_add(c, &one, mass);
+	for (i = 0; i < b->size; i++)
+		sum += item_weight(e, b, position, i);
+	for (i = 0; i < b->size; i++) {
+		int item = b->items[i];
+		double p;
+
+		if (sum > 0)
+			p = item_weight(e, b, position, i) / sum;
+		else
+			p = i == 0 ? 1 : 0;
+		if (p == 0)
+			continue;
+		p *= mass;
+		if (item >= map->max_devices ||
+		    (item < 0 && (-1-item >= map->max_buckets ||
+				  map->buckets[-1-item] == NULL))) {
+			*fail += p;
+			continue;
+		}
+		if ((item < 0 ? map->buckets[-1-item]->type : 0) == type)
+			sparse_add(arrive, item + map->max_buckets, p);
+		else if (item >= 0)
+			*fail += p;
+		else
+			descent_cost(e, map->buckets[-1-item], type, position,
+				     p, depth + 1, c, arrive, fail);
+	}
+}
+
+/* expected number of tries and probability of success of a replica */
+static void replica_tries(double fail, unsigned int tries,
+			  double *attempts, double *success)
+{
+	double all_fail = pow(fail, tries);
+
+	*success = 1 - all_fail;
+	*attempts = fail < 1 ? (1 - all_fail) / (1 - fail) : tries;
+}
+
+int crush_estimate_cost(const struct crush_map *map,
+			int ruleno, int result_max,
+			const __u32 *weights, int weight_max,
+			const struct crush_choose_arg *choose_args,
+			const struct crush_cost_model *model,
+			struct crush_rule_cost *cost)
+{
+	static const struct crush_cost_model default_model = CRUSH_COST_MODEL_DEFAULT;
+	struct estimator e;
+	const struct crush_rule *rule;
+	struct visit_cost total = { 0, 0, 0 };
+	int n = map->max_buckets + map->max_devices;
+	struct sparse w, o, q, leaf, leaf_arrive;
+	/* indexed like q.index */
+	double *good, *chosen;
+	double no_retry = 1;
+	unsigned int choose_tries = map->choose_total_tries + 1;
+	unsigned int choose_leaf_tries = 0;
+	int ret = -ENOMEM;
+	__u32 step;
+	int i, j, k, d;
+
+	if ((__u32)ruleno >= map->max_rules || map->rules[ruleno] == NULL ||
+	    result_max <= 0)
+		return -EINVAL;
+	rule = map->rules[ruleno];
+	if (model == NULL)
+		model = &default_model;
+
+	memset(&e, 0, sizeof(e));
+	e.map = map;
+	e.weights = weights;
+	e.weight_max = weight_max;
+	e.choose_args = choose_args;
+	good = malloc(sizeof(double) * (n + 1));
+	chosen = malloc(sizeof(double) * (n + 1));
+	/* all the vectors are allocated, even if one fails, to be destroyed */
+	if (sparse_init(&w, n) | sparse_init(&o, n) | sparse_init(&q, n) |
+	    sparse_init(&leaf, n) | sparse_init(&leaf_arrive, n) ||
+	    !good || !chosen)
+		goto out;
+
+	for (step = 0; step < rule->len; step++) {
+		const struct crush_rule_step *curstep = &rule->steps[step];
+		int firstn = 0;
+		int recurse_to_leaf;
+		/* expected number of positions of the result filled */
+		double osize = 0;
+
+		switch (curstep->op) {
+		case CRUSH_RULE_TAKE:
+			if ((curstep->arg1 >= 0 &&
+			     curstep->arg1 < map->max_devices) ||
+			    (-1-curstep->arg1 >= 0 &&
+			     -1-curstep->arg1 < map->max_buckets &&
+			     map->buckets[-1-curstep->arg1])) {
+				sparse_clear(&w);
+				sparse_add(&w, curstep->arg1 + map->max_buckets, 1);
+			}
+			break;
+
+		case CRUSH_RULE_SET_CHOOSE_TRIES:
+			if (curstep->arg1 > 0)
+				choose_tries = curstep->arg1;
+			break;
+
+		case CRUSH_RULE_SET_CHOOSELEAF_TRIES:
+			if (curstep->arg1 > 0)
+				choose_leaf_tries = curstep->arg1;
+			break;
+
+		case CRUSH_RULE_CHOOSELEAF_FIRSTN:
+		case CRUSH_RULE_CHOOSE_FIRSTN:
+			firstn = 1;
+			/* fall through */
+		case CRUSH_RULE_CHOOSELEAF_INDEP:
+		case CRUSH_RULE_CHOOSE_INDEP:
+			recurse_to_leaf =
+				curstep->op == CRUSH_RULE_CHOOSELEAF_FIRSTN ||
+				curstep->op == CRUSH_RULE_CHOOSELEAF_INDEP;
+			sparse_clear(&o);
+			/* @osize caps the mass in the order of map->buckets */
+			qsort(w.index, w.size, sizeof(int), sparse_index_compare);
+			for (i = 0; i < w.size; i++) {
+				const struct crush_bucket *b;
+				int numrep = curstep->arg1;
+				unsigned int recurse_tries;
+				double fail = 0, placed = 0, sum;
+				struct visit_cost one = { 0, 0, 0 };
+				struct visit_cost leaves = { 0, 0, 0 };
+				/* expected number of times the bucket is in the working vector */
+				double mass = w.v[w.index[i]];
+
+				if (w.index[i] >= map->max_buckets)
+					continue;
+				b = map->buckets[map->max_buckets - 1 - w.index[i]];
+				if (mass <= 0 || b == NULL)
+					continue;
+				if (numrep <= 0) {
+					numrep += result_max;
+					if (numrep <= 0)
+						continue;
+				}
+				if (numrep > result_max)
+					numrep = result_max;
+				/*
+				 * each of the @mass positions of the bucket fills
+				 * up to @numrep positions of the result: the
+				 * positions beyond @result_max are not chosen
+				 */
+				if (osize + mass * numrep > result_max)
+					mass = (result_max - osize) / numrep;
+				if (mass <= 0)
+					continue;
+				if (firstn)
+					recurse_tries = choose_leaf_tries ?
+						choose_leaf_tries :
+						map->chooseleaf_descend_once ?
+						1 : choose_tries;
+				else
+					recurse_tries = choose_leaf_tries ?
+						choose_leaf_tries : 1;
+
+				sparse_clear(&q);
+				descent_cost(&e, b, curstep->arg2, 0, 1, 0, &one, &q, &fail);
+				sparse_clear(&leaf);
+				for (k = 0; k < q.size; k++) {
+					int item = q.index[k] - map->max_buckets;
+					double qk = q.v[q.index[k]];
+					double leaf_fail = 0, reject, attempts, success;
+					double accept;
+					struct visit_cost leaf_cost = { 0, 0, 0 };
+
+					if (item >= 0) {
+						accept = device_accept(&e, item);
+						sparse_add(&leaf, q.index[k], qk * accept);
+					} else if (!recurse_to_leaf) {
+						accept = 1;
+						sparse_add(&leaf, q.index[k], qk);
+					} else {
+						/* the leaf is chosen with recurse_tries */
+						sparse_clear(&leaf_arrive);
+						descent_cost(&e, map->buckets[-1-item], 0, 0, 1, 0,
+							     &leaf_cost, &leaf_arrive, &leaf_fail);
+						reject = leaf_fail;
+						for (j = 0; j < leaf_arrive.size; j++) {
+							d = leaf_arrive.index[j];
+							reject += leaf_arrive.v[d] *
+								(1 - device_accept(&e, d - map->max_buckets));
+						}
+						replica_tries(reject, recurse_tries, &attempts, &success);
+						accept = success;
+						visit_cost_add(&leaves, &leaf_cost, qk * attempts);
+						/* the leaves given that one was accepted */
+						for (j = 0; j < leaf_arrive.size && reject < 1; j++) {
+							d = leaf_arrive.index[j];
+							sparse_add(&leaf, d, qk * success * leaf_arrive.v[d] *
+								   device_accept(&e, d - map->max_buckets) /
+								   (1 - reject));
+						}
+					}
+					good[k] = qk * accept;
+					chosen[k] = 0;
+				}
+				/*
+				 * @chosen[k] is the probability that the item
+				 * q.index[k] was chosen by a previous replica:
+				 * drawing it again is a collision.
+				 */
+				for (j = 0; j < numrep; j++) {
+					double c = 0, f = 1;
+					double attempts, success;
+
+					sum = 0;
+					for (k = 0; k < q.size; k++) {
+						c += q.v[q.index[k]] * chosen[k];
+						sum += good[k] * (1 - chosen[k]);
+					}
+					f = 1 - sum;
+					replica_tries(f, choose_tries, &attempts, &success);
+					visit_cost_add(&total, &one, mass * attempts);
+					/* the leaf is searched if there is no collision */
+					visit_cost_add(&total, &leaves, mass * attempts * (1 - c));
+					no_retry *= pow(1 - f, mass);
+					placed += success;
+					if (sum > 0)
+						for (k = 0; k < q.size; k++)
+							chosen[k] += success * good[k] *
+								(1 - chosen[k]) / sum;
+				}
+				/* the distribution of the items placed */
+				sum = 0;
+				for (k = 0; k < leaf.size; k++)
+					sum += leaf.v[leaf.index[k]];
+				if (sum > 0)
+					for (k = 0; k < leaf.size; k++)
+						sparse_add(&o, leaf.index[k],
+							   mass * placed * leaf.v[leaf.index[k]] / sum);
+				osize += mass * numrep;
+			}
+			{
+				struct sparse swap = w;
+
+				w = o;
+				o = swap;
+			}
+			break;
+
+		case CRUSH_RULE_EMIT:
+			sparse_clear(&w);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	cost->hashes = total.hashes;
+	cost->visits = total.visits;
+	/* the rule and the workspace pointers */
+	cost->bytes = total.bytes + sizeof(struct crush_rule) +
+		rule->len * sizeof(struct crush_rule_step) + sizeof(struct crush_work);
+	cost->retry_probability = 1 - no_retry;
+	cost->ns = model->base + model->hash * cost->hashes +
+		model->visit * cost->visits + model->byte * cost->bytes;
+	ret = 0;
+out:
+	sparse_destroy(&w);
+	sparse_destroy(&o);
+	sparse_destroy(&q);
+	sparse_destroy(&leaf);
+	sparse_destroy(&leaf_arrive);
+	free(good);
+	free(chosen);
+	return ret;
+}
+
+int crush_measure_cost(const struct crush_map *map,
+		       int ruleno, int result_max,
+		       const __u32 *weights, int weight_max,
+		       const struct crush_choose_arg *choose_args,
+		       int values, double *ns)
+{
+	void *cwin;
+	int *result;
+	__u64 start;
+	int x;
+
+	if ((__u32)ruleno >= map->max_rules || map->rules[ruleno] == NULL ||
+	    result_max <= 0 || values <= 0)
+		return -EINVAL;
+	cwin = malloc(crush_work_size(map, result_max));
+	result = malloc(sizeof(int) * result_max);
+	if (!cwin || !result) {
+		free(cwin);
+		free(result);
+		return -ENOMEM;
+	}
+	crush_init_workspace(map, cwin);
+	start = crush_latency_now();
+	for (x = 0; x < values; x++)
+		crush_do_rule(map, ruleno, x, result, result_max,
+			      weights, weight_max, cwin, choose_args);
+	*ns = (double)(crush_latency_now() - start) / values;
+	free(cwin);
+	free(result);
+	return 0;
+}
+
+#define COST_FEATURES 4
+
+static void cost_features(const struct crush_rule_cost *cost, double *f)
+{
+	f[0] = 1;
+	f[1] = cost->hashes;
+	f[2] = cost->visits;
+	f[3] = cost->bytes;
+}
+
+/*
+ * Solve the normal equations restricted to the features in @active
+ * with Gaussian elimination. Features are scaled so that the
+ * diagonal is 1, which keeps the pivots comparable.
+ */
+static int least_squares(const struct crush_rule_cost *costs, const double *ns,
+			 int count, const int *active, double *x)
+{
+	double a[COST_FEATURES][COST_FEATURES + 1];
+	double scale[COST_FEATURES];
+	int idx[COST_FEATURES];
+	int m = 0, i, j, k, s;
+
+	for (i = 0; i < COST_FEATURES; i++)
+		if (active[i])
+			idx[m++] = i;
+	memset(a, 0, sizeof(a));
+	for (s = 0; s < count; s++) {
+		double f[COST_FEATURES];
+
+		cost_features(&costs[s], f);
+		for (i = 0; i < m; i++) {
+			for (j = 0; j < m; j++)
+				a[i][j] += f[idx[i]] * f[idx[j]];
+			a[i][m] += f[idx[i]] * ns[s];
+		}
+	}
+	for (i = 0; i < m; i++) {
+		if (a[i][i] <= 0)
+			return -EINVAL;
+		scale[i] = 1 / sqrt(a[i][i]);
+	}
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < m; j++)
+			a[i][j] *= scale[i] * scale[j];
+		a[i][m] *= scale[i];
+	}
+	for (k = 0; k < m; k++) {
+		int pivot = k;
+
+		for (i = k + 1; i < m; i++)
+			if (fabs(a[i][k]) > fabs(a[pivot][k]))
+				pivot = i;
+		if (fabs(a[pivot][k]) < 1e-9)
+			return -EINVAL;
+		if (pivot != k)
+			for (j = 0; j <= m; j++) {
+				double t = a[k][j];
+				a[k][j] = a[pivot][j];
+				a[pivot][j] = t;
+			}
+		for (i = 0; i < m; i++) {
+			double factor;
+
+			if (i == k)
+				continue;
+			factor = a[i][k] / a[k][k];
+			for (j = k; j <= m; j++)
+				a[i][j] -= factor * a[k][j];
+		}
+	}
+	for (i = 0; i < COST_FEATURES; i++)
+		x[i] = 0;
+	for (i = 0; i < m; i++)
+		x[idx[i]] = a[i][m] / a[i][i] * scale[i];
+	return 0;
+}
+
+int crush_calibrate_cost(const struct crush_rule_cost *costs,
+			 const double *ns, int count,
+			 struct crush_cost_model *model)
+{
+	int active[COST_FEATURES] = { 1, 1, 1, 1 };
+	double x[COST_FEATURES];
+	int i, r;
+
+	if (count < COST_FEATURES)
+		return -EINVAL;
+	for (i = 0; i < count; i++) {
+		double f[COST_FEATURES];
+		int j;
+
+		cost_features(&costs[i], f);
+		for (j = 0; j < COST_FEATURES; j++)
+			if (!(f[j] >= 0 && f[j] < HUGE_VAL))
+				return -EINVAL;
+		if (!(ns[i] >= 0 && ns[i] < HUGE_VAL))
+			return -EINVAL;
+	}
+	for (;;) {
+		int worst = -1;
+
+		r = least_squares(costs, ns, count, active, x);
+		if (r < 0) {
+			/*
+			 * the features are not independent, for instance
+			 * the bytes of straw2 buckets are proportional to
+			 * the hashes: drop the last one. The system with
+			 * no feature always has a solution.
+			 */
+			for (i = COST_FEATURES - 1; !active[i]; i--)
+				;
+			active[i] = 0;
+			continue;
+		}
+		for (i = 0; i < COST_FEATURES; i++)
+			if (active[i] && x[i] < 0 && (worst < 0 || x[i] < x[worst]))
+				worst = i;
+		if (worst < 0)
+			break;
+		active[worst] = 0;
+	}
+	model->base = x[0];
+	model->hash = x[1];
+	model->visit = x[2];
+	model->byte = x[3];
+	return 0;
+}
@@ -0,0 +1,194 @@
+#ifndef CEPH_CRUSH_ANALYZE_H
+#define CEPH_CRUSH_ANALYZE_H
+
+/*
+ * Functions that predict the behavior of crush_do_rule() by
+ * looking at the crush_map instead of mapping values.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * Estimate, without calling crush_do_rule(), how many times each
+ * device is expected to show up in the result of
+ * crush_do_rule(__map__, __ruleno__, x, result, __result_max__,
+ * __weights__, __weight_max__, cwin, __choose_args__) for a value
+ * __x__ drawn at random. The __shares__ of all devices add up to the
+ * expected size of the result: multiplying __shares[d]__ by the
+ * number of values to be mapped gives the expected number of values
+ * mapped to device __d__.
+ *
+ * The hierarchy is walked once per rule step. The probability that
+ * an item is drawn from a bucket is derived from the item weights
+ * (or the __choose_args__ weights, depending on the position), the
+ * is_out probabilities are derived from __weights__ and the items
+ * rejected because they collide with an item previously chosen are
+ * accounted for. The distribution of the first three items chosen
+ * from a bucket is exact, ignoring the rounding of the hash values.
+ * The distribution of the following items is approximated and
+ * __errors[d]__ is set to an estimate of the absolute error of
+ * __shares[d]__. The work for each item chosen from a bucket is
+ * linear in the size of the bucket.
+ *
+ * Uniform buckets are treated as if the items were drawn with
+ * replacement (the permutation they use actually avoids
+ * collisions) and legacy straw buckets are assumed to draw items
+ * in proportion to their weight.
+ *
+ * - return -EINVAL if __ruleno__ does not designate a rule or
+ *   __result_max__ <= 0
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param map the crush_map
+ * @param ruleno a positive integer < __CRUSH_MAX_RULES__
+ * @param result_max the size of the result, as given to crush_do_rule()
+ * @param weights an array of weights of size __weight_max__, as given to crush_do_rule()
+ * @param weight_max the size of the __weights__ array
+ * @param choose_args weights and ids for each known bucket or NULL
+ * @param threshold the relative error above which a device is reported
+ * @param[out] shares an array of __map->max_devices__ expected shares
+ * @param[out] errors an array of __map->max_devices__ estimated errors or NULL
+ *
+ * @returns the number of devices for which __errors[d]__ is greater than
+ *          __threshold__ * __shares[d]__, < 0 on error
+ */
+extern int crush_estimate_placement(const struct crush_map *map,
+				    int ruleno, int result_max,
+				    const __u32 *weights, int weight_max,
+				    const struct crush_choose_arg *choose_args,
+				    double threshold,
+				    double *shares, double *errors);
+
+/** @ingroup API
+ * The time crush_do_rule() takes, in nanoseconds, as a linear
+ * function of the work it does.
+ */
+struct crush_cost_model {
+	double base;  /*!< per call */
+	double hash;  /*!< per hash evaluation */
+	double visit; /*!< per bucket choose */
+	double byte;  /*!< per byte of the crush_map read */
+};
+
+/** @ingroup API
+ * The constants of ::crush_cost_model measured on a x86_64 host,
+ * to be replaced with the result of crush_calibrate_cost().
+ */
+#define CRUSH_COST_MODEL_DEFAULT { 40.0, 12.0, 10.0, 0.05 }
+
+/** @ingroup API
+ * The expected work done by crush_do_rule() to map a value.
+ */
+struct crush_rule_cost {
+	double hashes;    /*!< number of hash evaluations */
+	double visits;    /*!< number of items drawn from a bucket */
+	double bytes;     /*!< bytes of buckets and workspace read */
+	/*! probability that at least one item is rejected or collides */
+	double retry_probability;
+	/*! time in nanoseconds predicted by the ::crush_cost_model */
+	double ns;
+};
+
+/** @ingroup API
+ *
+ * Estimate, without calling crush_do_rule(), the work done by
+ * crush_do_rule(__map__, __ruleno__, x, result, __result_max__,
+ * __weights__, __weight_max__, cwin, __choose_args__) for a value
+ * __x__ drawn at random and predict how long it takes with
+ * __model__.
+ *
+ * Each step of the rule is walked once. The items are drawn from
+ * the buckets in proportion to their weights and the number of
+ * tries of each replica is derived from the probability that the
+ * item drawn is out (according to __weights__) or collides with
+ * an item previously chosen. The retries of a replica use the same
+ * values of r as the first tries of the next replicas, which makes
+ * collisions more likely than the estimate assumes: when retries
+ * are frequent the estimated visits and hashes are a few percent
+ * too low. The number of hashes and the bytes
+ * read depend on the bucket algorithm: all the items of a straw2
+ * bucket are hashed, a tree bucket hashes one node per level, etc.
+ *
+ * - return -EINVAL if __ruleno__ does not designate a rule or
+ *   __result_max__ <= 0
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param map the crush_map
+ * @param ruleno a positive integer < __CRUSH_MAX_RULES__
+ * @param result_max the size of the result, as given to crush_do_rule()
+ * @param weights an array of weights of size __weight_max__, as given to crush_do_rule()
+ * @param weight_max the size of the __weights__ array
+ * @param choose_args weights and ids for each known bucket or NULL
+ * @param model the constants used to compute __cost->ns__ or NULL for ::CRUSH_COST_MODEL_DEFAULT
+ * @param[out] cost the expected work
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_estimate_cost(const struct crush_map *map,
+			       int ruleno, int result_max,
+			       const __u32 *weights, int weight_max,
+			       const struct crush_choose_arg *choose_args,
+			       const struct crush_cost_model *model,
+			       struct crush_rule_cost *cost);
+
+/** @ingroup API
+ *
+ * Measure the average time, in nanoseconds, crush_do_rule() takes to
+ * map the values in [0,__values__[ with __ruleno__ on the current
+ * host. Together with crush_estimate_cost(), it provides the
+ * samples crush_calibrate_cost() needs.
+ *
+ * - return -EINVAL if __ruleno__ does not designate a rule,
+ *   __result_max__ <= 0 or __values__ <= 0
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param map the crush_map
+ * @param ruleno a positive integer < __CRUSH_MAX_RULES__
+ * @param result_max as given to crush_do_rule()
+ * @param weights as given to crush_do_rule()
+ * @param weight_max the size of the __weights__ array
+ * @param choose_args weights and ids for each known bucket or NULL
+ * @param values the number of values to map
+ * @param[out] ns the average time of a call to crush_do_rule()
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_measure_cost(const struct crush_map *map,
+			      int ruleno, int result_max,
+			      const __u32 *weights, int weight_max,
+			      const struct crush_choose_arg *choose_args,
+			      int values, double *ns);
+
+/** @ingroup API
+ *
+ * Fit the constants of __model__ to the __count__ times __ns[i]__
+ * measured for rules of which the expected work is __costs[i]__,
+ * for instance with crush_measure_cost() and
+ * crush_estimate_cost() on maps of various shapes. The constants
+ * minimize the sum of the squared differences between __ns[i]__
+ * and the prediction and are never negative: if the least squares
+ * solution has a negative constant, it is set to zero and the
+ * others are fitted again. If the samples do not determine all the
+ * constants, for instance because the bytes read are proportional
+ * to the hashes, the constant of the bytes is set to zero, then the
+ * constant of the visits, etc. until the remaining constants are
+ * determined: the constants set to zero are not fitted again.
+ *
+ * - return -EINVAL if __count__ < 4 or a time or a cost is negative,
+ *   infinite or not a number
+ *
+ * @param costs an array of __count__ expected costs
+ * @param ns an array of __count__ measured times in nanoseconds
+ * @param count the size of the __costs__ and __ns__ arrays
+ * @param[out] model the fitted constants
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_calibrate_cost(const struct crush_rule_cost *costs,
+				const double *ns, int count,
+				struct crush_cost_model *model);
+
+#endif
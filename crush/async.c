@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "mapper.h"
+#include "async.h"
+
+struct worker {
+	struct crush_async *async;
+	pthread_t id;
+	void *cwin;
+	size_t cwin_size;
+	__u64 seq;           /* the request cwin was initialized for */
+};
+
+struct crush_async {
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	/* FIFO of the requests of each priority, protected by lock */
+	struct crush_async_request *head[CRUSH_ASYNC_PRIORITIES];
+	struct crush_async_request *tail[CRUSH_ASYNC_PRIORITIES];
+	int stopping;
+	__u64 seq;
+	/* stack of completed requests, pushed by the workers without lock */
+	struct crush_async_request *completed;
+	/* completed requests taken from the stack but not reaped yet */
+	struct crush_async_request *reaped;
+	int fd;
+	int threads;
+	struct worker workers[];
+};
+
+static void complete(struct crush_async *async, struct crush_async_request *r)
+{
+	struct crush_async_request *head;
+	__u64 one = 1;
+
+	if (r->done != NULL) {
+		r->done(r);
+		return;
+	}
+	head = __atomic_load_n(&async->completed, __ATOMIC_RELAXED);
+	do {
+		r->next = head;
+	} while (!__atomic_compare_exchange_n(&async->completed, &head, r, 1,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	if (write(async->fd, &one, sizeof(one)) < 0) {
+		/* the fd is readable already */
+	}
+}
+
+/* __count__ values of __r__ are mapped or cancelled */
+static void done_values(struct crush_async *async, struct crush_async_request *r,
+			int count)
+{
+	if (__atomic_sub_fetch(&r->pending, count, __ATOMIC_ACQ_REL) == 0)
+		complete(async, r);
+}
+
+/* map the values [first, first + count[ of __r__ */
+static void map_chunk(struct worker *w, struct crush_async_request *r, int first,
+		      int count)
+{
+	size_t size = crush_work_size(r->map, r->result_max);
+	int i, j;
+
+	/* the map does not change while the request is pending */
+	if (w->seq != r->seq || w->cwin == NULL) {
+		if (size > w->cwin_size) {
+			free(w->cwin);
+			w->cwin = malloc(size);
+			w->cwin_size = w->cwin != NULL ? size : 0;
+		}
+		if (w->cwin == NULL) {
+			__atomic_store_n(&r->err, -ENOMEM, __ATOMIC_RELAXED);
+			return;
+		}
+		crush_init_workspace(r->map, w->cwin);
+		w->seq = r->seq;
+	}
+	for (i = first; i < first + count; i++) {
+		int *result = r->results + (size_t)i * r->result_max;
+		__u32 x = r->x != NULL ? r->x[i] : r->first_x + i;
+		int n = crush_do_rule(r->map, r->ruleno, x, result, r->result_max,
+				      r->weights, r->weight_max, w->cwin, r->choose_args);
+
+		for (j = n; j < r->result_max; j++)
+			result[j] = CRUSH_ITEM_NONE;
+		if (r->sizes != NULL)
+			r->sizes[i] = n;
+	}
+}
+
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	struct crush_async *async = w->async;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		struct crush_async_request *r = NULL;
+		int p, first, count;
+
+		for (p = 0; p < CRUSH_ASYNC_PRIORITIES && r == NULL; p++)
+			r = async->head[p];
+		if (r == NULL) {
+			if (async->stopping)
+				break;
+			pthread_cond_wait(&async->wakeup, &async->lock);
+			continue;
+		}
+		/* take a chunk, and the request with the last one */
+		first = r->next_value;
+		count = r->count - first;
+		if (count > CRUSH_ASYNC_CHUNK)
+			count = CRUSH_ASYNC_CHUNK;
+		r->next_value += count;
+		if (r->next_value == r->count) {
+			p = r->priority;
+			async->head[p] = r->next;
+			if (async->head[p] == NULL)
+				async->tail[p] = NULL;
+		}
+		pthread_mutex_unlock(&async->lock);
+		map_chunk(w, r, first, count);
+		done_values(async, r, count);
+		pthread_mutex_lock(&async->lock);
+	}
+	pthread_mutex_unlock(&async->lock);
+	return NULL;
+}
+
+struct crush_async *crush_async_create(int threads)
+{
+	struct crush_async *async;
+	int t;
+
+	if (threads < 1)
+		return NULL;
+	async = calloc(1, sizeof(*async) + sizeof(struct worker) * threads);
+	if (async == NULL)
+		return NULL;
+	async->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (async->fd < 0) {
+		free(async);
+		return NULL;
+	}
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->wakeup, NULL);
+	for (t = 0; t < threads; t++) {
+		async->workers[t].async = async;
+		if (pthread_create(&async->workers[t].id, NULL, work, &async->workers[t]) != 0)
+			break;
+		async->threads++;
+	}
+	if (async->threads < threads) {
+		crush_async_destroy(async);
+		return NULL;
+	}
+	return async;
+}
+
+void crush_async_destroy(struct crush_async *async)
+{
+	struct crush_async_request *cancelled = NULL, *r;
+	int p, t;
+
+	pthread_mutex_lock(&async->lock);
+	async->stopping = 1;
+	for (p = 0; p < CRUSH_ASYNC_PRIORITIES; p++) {
+		while ((r = async->head[p]) != NULL) {
+			async->head[p] = r->next;
+			r->next = cancelled;
+			cancelled = r;
+		}
+		async->tail[p] = NULL;
+	}
+	pthread_cond_broadcast(&async->wakeup);
+	pthread_mutex_unlock(&async->lock);
+
+	while ((r = cancelled) != NULL) {
+		int count = r->count - r->next_value;
+
+		cancelled = r->next;
+		r->next_value = r->count;
+		__atomic_store_n(&r->err, -ECANCELED, __ATOMIC_RELAXED);
+		/* the completion stack cannot be reaped anymore: a request
+		   without a callback is released here instead */
+		if (__atomic_sub_fetch(&r->pending, count, __ATOMIC_ACQ_REL) == 0 &&
+		    r->done != NULL)
+			r->done(r);
+	}
+	for (t = 0; t < async->threads; t++) {
+		pthread_join(async->workers[t].id, NULL);
+		free(async->workers[t].cwin);
+	}
+	async->completed = NULL;
+	async->reaped = NULL;
+	close(async->fd);
+	pthread_cond_destroy(&async->wakeup);
+	pthread_mutex_destroy(&async->lock);
+	free(async);
+}
+
+int crush_async_submit(struct crush_async *async, struct crush_async_request *r)
+{
+	const struct crush_map *map = r->map;
+	int p = r->priority;
+
+	if (r->ruleno < 0 || (__u32)r->ruleno >= map->max_rules ||
+	    map->rules[r->ruleno] == NULL || r->count < 0 || r->result_max < 0 ||
+	    p < 0 || p >= CRUSH_ASYNC_PRIORITIES)
+		return -EINVAL;
+	r->err = 0;
+	r->next = NULL;
+	r->next_value = 0;
+	r->pending = r->count;
+	if (r->count == 0 || r->result_max == 0) {
+		/* crush_do_rule() would not return any item */
+		if (r->sizes != NULL)
+			memset(r->sizes, 0, sizeof(int) * r->count);
+		complete(async, r);
+		return 0;
+	}
+	pthread_mutex_lock(&async->lock);
+	r->seq = ++async->seq;
+	if (async->tail[p] != NULL)
+		async->tail[p]->next = r;
+	else
+		async->head[p] = r;
+	async->tail[p] = r;
+	pthread_cond_signal(&async->wakeup);
+	pthread_mutex_unlock(&async->lock);
+	return 0;
+}
+
+int crush_async_fd(const struct crush_async *async)
+{
+	return async->fd;
+}
+
+int crush_async_reap(struct crush_async *async,
+		     struct crush_async_request **requests, int max)
+{
+	struct crush_async_request *r, *taken, **last;
+	__u64 counter;
+	int n = 0;
+
+	/*
+	 * Reset the counter before taking the stack: a request pushed
+	 * afterwards signals the fd again.
+	 */
+	if (read(async->fd, &counter, sizeof(counter)) < 0) {
+		/* EAGAIN: nothing was signalled since the last read */
+	}
+	taken = __atomic_exchange_n(&async->completed, NULL, __ATOMIC_ACQUIRE);
+	if (taken != NULL) {
+		/* the stack is in reverse order of completion */
+		struct crush_async_request *ordered = NULL;
+
+		while ((r = taken) != NULL) {
+			taken = r->next;
+			r->next = ordered;
+			ordered = r;
+		}
+		for (last = &async->reaped; *last != NULL; last = &(*last)->next)
+			;
+		*last = ordered;
+	}
+	while (n < max && (r = async->reaped) != NULL) {
+		async->reaped = r->next;
+		requests[n++] = r;
+	}
+	/* keep the fd readable while requests are left to reap */
+	if (async->reaped != NULL) {
+		counter = 1;
+		if (write(async->fd, &counter, sizeof(counter)) < 0) {
+			/* the fd is readable already */
+		}
+	}
+	return n;
+}
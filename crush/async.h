@@ -0,0 +1,151 @@
+#ifndef CEPH_CRUSH_ASYNC_H
+#define CEPH_CRUSH_ASYNC_H
+
+/*
+ * Map batches of values on a pool of worker threads owned by the
+ * library: requests are submitted without waiting and their
+ * completion is either signalled on a file descriptor, for an event
+ * loop, or reported to a callback.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ * Number of priorities of the requests, 0 is the highest.
+ */
+#define CRUSH_ASYNC_PRIORITIES 4
+
+/** @ingroup API
+ * The values of a request are mapped in chunks of this size: a
+ * request of a higher priority waits for at most one chunk per
+ * worker before it starts.
+ */
+#define CRUSH_ASYNC_CHUNK 256
+
+struct crush_async;
+
+/** @ingroup API
+ *
+ * A batch of values to map, submitted with crush_async_submit(). The
+ * fields up to __choose_args__ are the arguments of
+ * crush_do_rule_batch(). The request and the arrays it points to
+ * must not be modified or deallocated until it completes, nor the
+ * map modified.
+ */
+struct crush_async_request {
+	const struct crush_map *map;  /*!< the crush_map */
+	int ruleno;                   /*!< the rule */
+	const __u32 *x;               /*!< __count__ values or NULL */
+	__u32 first_x;                /*!< the first value if __x__ is NULL */
+	int count;                    /*!< the number of values to map */
+	int *results;                 /*!< __count__ rows of __result_max__ items */
+	int result_max;               /*!< the number of items in a row */
+	int *sizes;                   /*!< __count__ sizes or NULL */
+	const __u32 *weights;         /*!< as given to crush_do_rule() */
+	int weight_max;               /*!< as given to crush_do_rule() */
+	const struct crush_choose_arg *choose_args; /*!< as given to crush_do_rule() */
+	int priority;                 /*!< in [0, ::CRUSH_ASYNC_PRIORITIES[, 0 is the highest */
+	/*! called when the request completes, or NULL to queue the
+	    request for crush_async_reap(). It runs on the thread that
+	    completes the request: usually a worker thread, but also the
+	    thread calling crush_async_submit() for a request with no
+	    values, or the thread calling crush_async_destroy() for a
+	    cancelled request. It must not take a lock held by these
+	    callers, and must not call crush_async_destroy() itself. */
+	void (*done)(struct crush_async_request *request);
+	void *arg;                    /*!< for the caller */
+	int err;                      /*!< on completion, 0, -ENOMEM or -ECANCELED */
+
+	/* private */
+	struct crush_async_request *next;
+	int next_value;               /* the first value not given to a worker */
+	int pending;                  /* the values not mapped yet */
+	__u64 seq;                    /* unique for each submission */
+};
+
+/** @ingroup API
+ *
+ * Start a pool of __threads__ worker threads to map the requests
+ * submitted with crush_async_submit(). The pool must be deallocated
+ * with crush_async_destroy().
+ *
+ * - return NULL if __threads__ < 1
+ * - return NULL if __malloc(3)__, __eventfd(2)__ or
+ *   __pthread_create(3)__ fails
+ *
+ * @param threads the number of worker threads
+ *
+ * @returns a pool on success, NULL on error
+ */
+extern struct crush_async *crush_async_create(int threads);
+
+/** @ingroup API
+ *
+ * Stop the worker threads and deallocate __async__. The requests
+ * that did not complete are cancelled: the values not yet given to a
+ * worker are not mapped, the requests complete with -ECANCELED and
+ * the __done__ callbacks of those which have one are called, on the
+ * calling thread unless a worker was still mapping values of the
+ * request. The requests without a callback are not queued for
+ * crush_async_reap(): when the function returns, the pool no longer
+ * refers to any request, including the completed requests that were
+ * not reaped, and they can all be deallocated.
+ *
+ * @param async the pool
+ */
+extern void crush_async_destroy(struct crush_async *async);
+
+/** @ingroup API
+ *
+ * Queue __request__ to be mapped by the workers of __async__, after
+ * the requests of a higher priority and the requests of the same
+ * priority submitted before it. The function does not wait for
+ * the workers: it can be called from an event loop. A request with
+ * no values completes immediately, on the calling thread.
+ *
+ * - return -EINVAL if the rule does not exist, __count__ or
+ *   __result_max__ is negative or the priority is not in
+ *   [0, ::CRUSH_ASYNC_PRIORITIES[
+ *
+ * @param async the pool
+ * @param request the request, owned by the pool until it completes
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_async_submit(struct crush_async *async,
+			      struct crush_async_request *request);
+
+/** @ingroup API
+ *
+ * The __eventfd(2)__ of __async__, readable when requests without a
+ * __done__ callback completed and can be reaped with
+ * crush_async_reap(). It is non blocking and must not be read or
+ * closed by the caller.
+ *
+ * @param async the pool
+ *
+ * @returns a file descriptor
+ */
+extern int crush_async_fd(const struct crush_async *async);
+
+/** @ingroup API
+ *
+ * Store in __requests__ up to __max__ of the requests without a
+ * __done__ callback that completed, in the order they completed,
+ * and reset the file descriptor of crush_async_fd(). A single thread
+ * must reap the requests of a pool, typically when the file
+ * descriptor is readable. The function does not block and a wakeup
+ * may find no request.
+ *
+ * @param async the pool
+ * @param[out] requests an array of __max__ requests
+ * @param max the size of __requests__
+ *
+ * @returns the number of requests stored in __requests__
+ */
+extern int crush_async_reap(struct crush_async *async,
+			    struct crush_async_request **requests, int max);
+
+#endif
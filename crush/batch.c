@@ -0,0 +1,121 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapper.h"
+#include "executor.h"
+#include "batch.h"
+
+#define CRUSH_BATCH_GRAIN 256
+
+struct batch {
+	const struct crush_map *map;
+	int ruleno;
+	const __u32 *x;
+	__u32 first_x;
+	int *results;
+	int result_max;
+	int *sizes;
+	const __u32 *weights;
+	int weight_max;
+	const struct crush_choose_arg *choose_args;
+	void **cwins;           /* [workers] */
+};
+
+/* map the values [begin, end[ */
+static void map_values(void *arg, int worker, __s64 begin, __s64 end)
+{
+	struct batch *b = arg;
+	void *cwin = b->cwins[worker];
+	__s64 i;
+	int j;
+
+	for (i = begin; i < end; i++) {
+		int *result = b->results + (size_t)i * b->result_max;
+		__u32 x = b->x != NULL ? b->x[i] : b->first_x + i;
+		int size = crush_do_rule(b->map, b->ruleno, x, result, b->result_max,
+					 b->weights, b->weight_max, cwin, b->choose_args);
+
+		for (j = size; j < b->result_max; j++)
+			result[j] = CRUSH_ITEM_NONE;
+		if (b->sizes != NULL)
+			b->sizes[i] = size;
+	}
+}
+
+int crush_do_rule_parallel(const struct crush_map *map, int ruleno,
+			   const __u32 *x, __u32 first_x, int count,
+			   int *results, int result_max, int *sizes,
+			   const __u32 *weights, int weight_max,
+			   const struct crush_choose_arg *choose_args,
+			   struct crush_executor *executor)
+{
+	const int workers = crush_executor_workers(executor);
+	struct batch b;
+	int err = 0, w;
+
+	if (ruleno < 0 || (__u32)ruleno >= map->max_rules || map->rules[ruleno] == NULL ||
+	    count < 0 || result_max < 0)
+		return -EINVAL;
+	if (count == 0)
+		return 0;
+	if (result_max == 0) {
+		/* crush_do_rule() would not return any item */
+		if (sizes != NULL)
+			memset(sizes, 0, sizeof(int) * count);
+		return 0;
+	}
+	b.map = map;
+	b.ruleno = ruleno;
+	b.x = x;
+	b.first_x = first_x;
+	b.results = results;
+	b.result_max = result_max;
+	b.sizes = sizes;
+	b.weights = weights;
+	b.weight_max = weight_max;
+	b.choose_args = choose_args;
+	b.cwins = calloc(workers, sizeof(void *));
+	if (b.cwins == NULL)
+		return -ENOMEM;
+	for (w = 0; w < workers; w++) {
+		b.cwins[w] = malloc(crush_work_size(map, result_max));
+		if (b.cwins[w] == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+		crush_init_workspace(map, b.cwins[w]);
+	}
+	err = crush_parallel_for(executor, count, CRUSH_BATCH_GRAIN, map_values, &b);
+out:
+	for (w = 0; w < workers; w++)
+		free(b.cwins[w]);
+	free(b.cwins);
+	return err;
+}
+
+int crush_do_rule_batch(const struct crush_map *map, int ruleno,
+			const __u32 *x, __u32 first_x, int count,
+			int *results, int result_max, int *sizes,
+			const __u32 *weights, int weight_max,
+			const struct crush_choose_arg *choose_args,
+			int threads)
+{
+	struct crush_executor *executor = NULL;
+	int err;
+
+	if (threads < 0)
+		return -EINVAL;
+	if (threads > count)
+		threads = count;
+	if (threads > 1) {
+		err = crush_executor_create(threads, &executor);
+		if (err < 0)
+			return err;
+	}
+	err = crush_do_rule_parallel(map, ruleno, x, first_x, count, results, result_max,
+				     sizes, weights, weight_max, choose_args, executor);
+	if (executor != NULL)
+		crush_executor_destroy(executor);
+	return err;
+}
@@ -0,0 +1,89 @@
+#ifndef CEPH_CRUSH_BATCH_H
+#define CEPH_CRUSH_BATCH_H
+
+/*
+ * Map many values with crush_do_rule() in a single call, on several
+ * threads.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+#include "executor.h"
+
+/** @ingroup API
+ *
+ * Map __count__ values with rule __ruleno__ of __map__ and store
+ * the results in the __count__ rows of __result_max__ items of
+ * __results__, padded with ::CRUSH_ITEM_NONE. The values are
+ * __x[i]__ or, if __x__ is NULL, __first_x__ + i. If __sizes__ is
+ * not NULL, __sizes[i]__ is set to the number of items that
+ * crush_do_rule() returned for the i-th value.
+ *
+ * The values are divided between __threads__ threads, each with its
+ * own workspace, with the default executor of
+ * crush_executor_create(). The results do not depend on the number
+ * of threads. __map->choose_tries__ must be NULL when more than one
+ * thread is used.
+ *
+ * - return -EINVAL if the rule does not exist or __count__,
+ *   __result_max__ or __threads__ is negative
+ * - return -ENOMEM if __malloc(3)__ fails
+ * - return -EAGAIN if a thread cannot be created
+ *
+ * @param map the crush_map
+ * @param ruleno the rule, as given to crush_do_rule()
+ * @param x an array of __count__ values or NULL
+ * @param first_x the first value if __x__ is NULL
+ * @param count the number of values to map
+ * @param[out] results an array of __count__ * __result_max__ items
+ * @param result_max the number of items in a row of __results__
+ * @param[out] sizes an array of __count__ sizes or NULL
+ * @param weights as given to crush_do_rule()
+ * @param weight_max as given to crush_do_rule()
+ * @param choose_args as given to crush_do_rule()
+ * @param threads number of threads, 0 or 1 to not create any thread
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_do_rule_batch(const struct crush_map *map, int ruleno,
+			       const __u32 *x, __u32 first_x, int count,
+			       int *results, int result_max, int *sizes,
+			       const __u32 *weights, int weight_max,
+			       const struct crush_choose_arg *choose_args,
+			       int threads);
+
+/** @ingroup API
+ *
+ * Same as crush_do_rule_batch() with the values divided between the
+ * workers of __executor__, each with its own workspace, or mapped on
+ * the calling thread if __executor__ is NULL.
+ *
+ * - return -EINVAL if the rule does not exist or __count__ or
+ *   __result_max__ is negative
+ * - return -ENOMEM if __malloc(3)__ fails
+ * - return the error of __executor->parallel_for__
+ *
+ * @param map the crush_map
+ * @param ruleno the rule, as given to crush_do_rule()
+ * @param x an array of __count__ values or NULL
+ * @param first_x the first value if __x__ is NULL
+ * @param count the number of values to map
+ * @param[out] results an array of __count__ * __result_max__ items
+ * @param result_max the number of items in a row of __results__
+ * @param[out] sizes an array of __count__ sizes or NULL
+ * @param weights as given to crush_do_rule()
+ * @param weight_max as given to crush_do_rule()
+ * @param choose_args as given to crush_do_rule()
+ * @param executor the executor or NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_do_rule_parallel(const struct crush_map *map, int ruleno,
+				  const __u32 *x, __u32 first_x, int count,
+				  int *results, int result_max, int *sizes,
+				  const __u32 *weights, int weight_max,
+				  const struct crush_choose_arg *choose_args,
+				  struct crush_executor *executor);
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "builder.h"
 #include "hash.h"
+#include "probes.h"
 
 #define dprintk(args...) /* printf(args) */
 
@@ -61,6 +62,120 @@ void crush_finalize(struct crush_map *map)
 		/* Every bucket has a permutation array. */
 		map->working_size += map->buckets[b]->size * sizeof(__u32);
 	}
+
+	map->fingerprint = crush_map_fingerprint(map);
+	CRUSH_PROBE3(finalize, map->max_buckets, map->max_devices,
+		     map->working_size);
+}
+
+/* fingerprints */
+
+static __u64 fingerprint_mix(__u64 h, __u64 v)
+{
+	h ^= v;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+static __u64 fingerprint_array(__u64 h, const __u32 *a, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		h = fingerprint_mix(h, a[i]);
+	return h;
+}
+
+__u64 crush_bucket_fingerprint(const struct crush_bucket *b)
+{
+	__u64 h = 0;
+
+	if (b == NULL)
+		return 0;
+	h = fingerprint_mix(h, (__u32)b->id);
+	h = fingerprint_mix(h, b->type);
+	h = fingerprint_mix(h, b->alg);
+	h = fingerprint_mix(h, b->hash);
+	h = fingerprint_mix(h, b->weight);
+	h = fingerprint_mix(h, b->size);
+	h = fingerprint_array(h, (const __u32 *)b->items, b->size);
+	switch (b->alg) {
+	case CRUSH_BUCKET_UNIFORM:
+		h = fingerprint_mix(h, ((struct crush_bucket_uniform *)b)->item_weight);
+		break;
+	case CRUSH_BUCKET_LIST: {
+		struct crush_bucket_list *l = (struct crush_bucket_list *)b;
+		h = fingerprint_array(h, l->item_weights, b->size);
+		h = fingerprint_array(h, l->sum_weights, b->size);
+		break;
+	}
+	case CRUSH_BUCKET_TREE: {
+		struct crush_bucket_tree *t = (struct crush_bucket_tree *)b;
+		h = fingerprint_mix(h, t->num_nodes);
+		h = fingerprint_array(h, t->node_weights, t->num_nodes);
+		break;
+	}
+	case CRUSH_BUCKET_STRAW: {
+		struct crush_bucket_straw *s = (struct crush_bucket_straw *)b;
+		h = fingerprint_array(h, s->item_weights, b->size);
+		h = fingerprint_array(h, s->straws, b->size);
+		break;
+	}
+	case CRUSH_BUCKET_STRAW2:
+		h = fingerprint_array(h, ((struct crush_bucket_straw2 *)b)->item_weights,
+				      b->size);
+		break;
+	}
+	return h;
+}
+
+__u64 crush_rule_fingerprint(int ruleno, const struct crush_rule *r)
+{
+	__u64 h = 0;
+	__u32 i;
+
+	if (r == NULL)
+		return 0;
+	h = fingerprint_mix(h, ruleno);
+	h = fingerprint_mix(h, r->len);
+	h = fingerprint_mix(h, r->mask.ruleset);
+	h = fingerprint_mix(h, r->mask.type);
+	h = fingerprint_mix(h, r->mask.min_size);
+	h = fingerprint_mix(h, r->mask.max_size);
+	for (i = 0; i < r->len; i++) {
+		h = fingerprint_mix(h, r->steps[i].op);
+		h = fingerprint_mix(h, (__u32)r->steps[i].arg1);
+		h = fingerprint_mix(h, (__u32)r->steps[i].arg2);
+	}
+	return h;
+}
+
+__u64 crush_tunables_fingerprint(const struct crush_map *map)
+{
+	__u64 h = 0;
+
+	h = fingerprint_mix(h, map->choose_local_tries);
+	h = fingerprint_mix(h, map->choose_local_fallback_tries);
+	h = fingerprint_mix(h, map->choose_total_tries);
+	h = fingerprint_mix(h, map->chooseleaf_descend_once);
+	h = fingerprint_mix(h, map->chooseleaf_vary_r);
+	h = fingerprint_mix(h, map->chooseleaf_stable);
+	h = fingerprint_mix(h, map->straw_calc_version);
+	h = fingerprint_mix(h, map->allowed_bucket_algs);
+	return h;
+}
+
+__u64 crush_map_fingerprint(const struct crush_map *map)
+{
+	__u64 h = crush_tunables_fingerprint(map);
+	__u32 r;
+	int b;
+
+	for (b = 0; b < map->max_buckets; b++)
+		h ^= crush_bucket_fingerprint(map->buckets[b]);
+	for (r = 0; r < map->max_rules; r++)
+		h ^= crush_rule_fingerprint(r, map->rules[r]);
+	return h;
 }
 
 
@@ -87,11 +202,12 @@ int crush_add_rule(struct crush_map *map, struct crush_rule *rule, int ruleno)
 		if (map->max_rules +1 > CRUSH_MAX_RULES)
 			return -ENOSPC;
 		oldsize = map->max_rules;
-		map->max_rules = r+1;
-		if ((_realloc = realloc(map->rules, map->max_rules * sizeof(map->rules[0]))) == NULL) {
+		/* the map is unchanged if realloc fails */
+		if ((_realloc = realloc(map->rules, (r+1) * sizeof(map->rules[0]))) == NULL) {
 			return -ENOMEM; 
 		} else {
 			map->rules = _realloc;
+			map->max_rules = r+1;
 		} 
 		memset(map->rules + oldsize, 0, (map->max_rules-oldsize) * sizeof(map->rules[0]));
 	}
@@ -153,15 +269,14 @@ int crush_add_bucket(struct crush_map *map,
 	while (pos >= map->max_buckets) {
 		/* expand array */
 		int oldsize = map->max_buckets;
-		if (map->max_buckets)
-			map->max_buckets *= 2;
-		else
-			map->max_buckets = 8;
+		int newsize = oldsize ? oldsize * 2 : 8;
 		void *_realloc = NULL;
-		if ((_realloc = realloc(map->buckets, map->max_buckets * sizeof(map->buckets[0]))) == NULL) {
+		/* the map is unchanged if realloc fails */
+		if ((_realloc = realloc(map->buckets, newsize * sizeof(map->buckets[0]))) == NULL) {
 			return -ENOMEM; 
 		} else {
 			map->buckets = _realloc;
+			map->max_buckets = newsize;
 		}
 		memset(map->buckets + oldsize, 0, (map->max_buckets-oldsize) * sizeof(map->buckets[0]));
 	}
@@ -896,7 +1011,7 @@ int crush_remove_uniform_bucket_item(struct crush_bucket_uniform *bucket, int it
 	if (i == bucket->h.size)
 		return -ENOENT;
 
-	for (j = i; j < bucket->h.size; j++)
+	for (j = i; j + 1 < bucket->h.size; j++)
 		bucket->h.items[j] = bucket->h.items[j+1];
 	newsize = --bucket->h.size;
 	if (bucket->item_weight < bucket->h.weight)
@@ -925,7 +1040,7 @@ int crush_remove_list_bucket_item(struct crush_bucket_list *bucket, int item)
 		return -ENOENT;
 
 	weight = bucket->item_weights[i];
-	for (j = i; j < bucket->h.size; j++) {
+	for (j = i; j + 1 < bucket->h.size; j++) {
 		bucket->h.items[j] = bucket->h.items[j+1];
 		bucket->item_weights[j] = bucket->item_weights[j+1];
 		bucket->sum_weights[j] = bucket->sum_weights[j+1] - weight;
@@ -1045,7 +1160,8 @@ int crush_remove_straw_bucket_item(struct crush_map *map,
 			break;
 		}
 	}
-	if (i == bucket->h.size)
+	/* the size was decremented if the item was found */
+	if (bucket->h.size != (__u32)newsize)
 		return -ENOENT;
 	
 	void *_realloc = NULL;
@@ -1089,7 +1205,8 @@ int crush_remove_straw2_bucket_item(struct crush_map *map,
 			break;
 		}
 	}
-	if (i == bucket->h.size)
+	/* the size was decremented if the item was found */
+	if (bucket->h.size != (__u32)newsize)
 		return -ENOENT;
 
 	void *_realloc = NULL;
@@ -1461,6 +1578,60 @@ void crush_destroy_choose_args(struct crush_choose_arg *args)
   free(args);
 }
 
+struct crush_choose_arg *crush_pack_choose_args(const struct crush_choose_arg *const *args,
+                                                int max_buckets)
+{
+  int b;
+  __u32 position;
+  int set_count = 0;
+  int weight_count = 0;
+  int id_count = 0;
+  for (b = 0; b < max_buckets; b++) {
+    if (args[b] == NULL)
+      continue;
+    set_count += args[b]->weight_set_size;
+    for (position = 0; position < args[b]->weight_set_size; position++)
+      weight_count += args[b]->weight_set[position].size;
+    id_count += args[b]->ids_size;
+  }
+  int size = (sizeof(struct crush_choose_arg) * max_buckets +
+              sizeof(struct crush_weight_set) * set_count +
+              sizeof(__u32) * weight_count +
+              sizeof(int) * id_count);
+  char *space = malloc(size + 1);
+  if (space == NULL)
+    return NULL;
+  struct crush_choose_arg *arg = (struct crush_choose_arg *)space;
+  struct crush_weight_set *weight_set = (struct crush_weight_set *)(arg + max_buckets);
+  __u32 *weights = (__u32 *)(weight_set + set_count);
+  int *ids = (int *)(weights + weight_count);
+  for (b = 0; b < max_buckets; b++) {
+    memset(&arg[b], '\0', sizeof(struct crush_choose_arg));
+    if (args[b] == NULL)
+      continue;
+    if (args[b]->weight_set_size > 0) {
+      for (position = 0; position < args[b]->weight_set_size; position++) {
+        __u32 weight_size = args[b]->weight_set[position].size;
+        memcpy(weights, args[b]->weight_set[position].weights, sizeof(__u32) * weight_size);
+        weight_set[position].weights = weights;
+        weight_set[position].size = weight_size;
+        weights += weight_size;
+      }
+      arg[b].weight_set = weight_set;
+      arg[b].weight_set_size = args[b]->weight_set_size;
+      weight_set += args[b]->weight_set_size;
+    }
+    if (args[b]->ids_size > 0) {
+      memcpy(ids, args[b]->ids, sizeof(int) * args[b]->ids_size);
+      arg[b].ids = ids;
+      arg[b].ids_size = args[b]->ids_size;
+      ids += args[b]->ids_size;
+    }
+  }
+  BUG_ON((char *)ids != space + size);
+  return arg;
+}
+
 /***************************/
 
 /* methods to check for safe arithmetic operations */
@@ -27,6 +27,27 @@ extern struct crush_map *crush_create();
  * @param map the crush_map
  */
 extern void crush_finalize(struct crush_map *map);
+/** @ingroup API
+ *
+ * Return a hash of the buckets, the rules and the tunables of
+ * __map__, i.e. the value crush_finalize() stores in
+ * __map->fingerprint__. It is the exclusive or of the
+ * crush_tunables_fingerprint() of the map, the
+ * crush_bucket_fingerprint() of each bucket and the
+ * crush_rule_fingerprint() of each rule, so that it can be
+ * updated when a single bucket or rule is replaced.
+ *
+ * @param map the crush_map
+ *
+ * @returns the fingerprint of __map__
+ */
+extern __u64 crush_map_fingerprint(const struct crush_map *map);
+/* the contribution of a bucket, 0 if __b__ is NULL */
+extern __u64 crush_bucket_fingerprint(const struct crush_bucket *b);
+/* the contribution of a rule, 0 if __r__ is NULL */
+extern __u64 crush_rule_fingerprint(int ruleno, const struct crush_rule *r);
+/* the contribution of the tunables */
+extern __u64 crush_tunables_fingerprint(const struct crush_map *map);
 
 /* rules */
 /** @ingroup API
@@ -198,6 +219,23 @@ extern int crush_add_bucket(struct crush_map *map,
 struct crush_bucket *crush_make_bucket(struct crush_map *map, int alg, int hash, int type, int size, int *items, int *weights);
 extern struct crush_choose_arg *crush_make_choose_args(struct crush_map *map, int num_positions);
 extern void crush_destroy_choose_args(struct crush_choose_arg *args);
+/** @ingroup API
+ *
+ * Allocate an array of __max_buckets__ choose_args in a single
+ * __malloc(3)__ block, laid out as crush_make_choose_args() does, and
+ * copy __args[i]__ at index __i__. If __args[i]__ is NULL, the
+ * choose_arg at index __i__ is empty.
+ *
+ * The caller is responsible for deallocating the returned array
+ * with crush_destroy_choose_args().
+ *
+ * @param args an array of __max_buckets__ pointers to choose_args or NULL
+ * @param max_buckets the size of the __args__ array
+ *
+ * @returns a pointer to the newly created array or NULL
+ */
+extern struct crush_choose_arg *crush_pack_choose_args(const struct crush_choose_arg *const *args,
+                                                       int max_buckets);
 /** @ingroup API
  *
  * Add __item__ to __bucket__ with __weight__. The weight of the new
@@ -291,6 +329,8 @@ crush_make_straw_bucket(struct crush_map *map,
 			int hash, int type, int size,
 			int *items,
 			int *weights);
+/* compute the straws of a straw bucket from its item weights */
+extern int crush_calc_straw(struct crush_map *map, struct crush_bucket_straw *bucket);
 
 extern int crush_addition_is_unsafe(__u32 a, __u32 b);
 extern int crush_multiplication_is_unsafe(__u32  a, __u32 b);
@@ -57,6 +57,15 @@
 /* Define to 1 if you have the <linux/types.h> header file. */
 #cmakedefine HAVE_LINUX_TYPES_H 1
 
+/* Define to 1 if you have the <sys/sdt.h> header file. */
+#cmakedefine HAVE_SYS_SDT_H 1
+
+/* Define to 1 to compile the USDT probes, see probes.h */
+#cmakedefine CRUSH_USDT 1
+
+/* Define to 1 to count the work done by crush_do_rule(), see stats.h */
+#cmakedefine CRUSH_STATS 1
+
 /* Version number of package */
 #cmakedefine VERSION "@VERSION@"
 
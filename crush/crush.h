@@ -456,6 +456,16 @@ struct crush_map {
 	__u32 allowed_bucket_algs;
 
 	__u32 *choose_tries;
+	/*! @endcond */
+
+	/*! A hash of the buckets, the rules and the tunables set by
+	 *  crush_finalize() and kept up to date by
+	 *  crush_map_delta_apply(). Two maps with the same content have
+	 *  the same fingerprint.
+	 */
+	__u64 fingerprint;
+
+        /*! @cond INTERNAL */
 #endif
 	/*! @endcond */
 };
@@ -524,8 +534,24 @@ struct crush_work_bucket {
 	__u32 *perm;  /* Permutation of the bucket's items */
 };
 
+struct crush_stats;
+struct crush_trace_ops;
+struct crush_recorder;
+
 struct crush_work {
 	struct crush_work_bucket **work; /* Per-bucket working store */
+#ifndef __KERNEL__
+	const struct crush_trace_ops *trace; /* see crush_trace_attach() */
+	void *trace_arg;
+	struct crush_recorder *recorder; /* see crush_recorder_attach() */
+	__u32 *choose_tries; /* see crush_choose_tries_attach() */
+	int choose_tries_max;
+	const __u8 *pruned; /* see crush_prune_attach() */
+#endif
+#if !defined(__KERNEL__) && defined(CRUSH_STATS)
+	struct crush_stats *stats; /* see crush_stats_attach() */
+	int stats_max;
+#endif
 };
 
 #endif
@@ -0,0 +1,480 @@
+#ifndef CEPH_CRUSH_HPP
+#define CEPH_CRUSH_HPP
+
+/*
+ * C++17 interface: move-only owners of a crush_map, its choose_args
+ * and the workspaces of crush_do_rule(), and mapping functions
+ * taking spans. Everything is inline and calls the C functions
+ * directly: Map::do_rule() and Mappings do not allocate and do not
+ * throw. The constructors, the builder functions and the batch
+ * mapping functions, which allocate a workspace per thread with
+ * crush_do_rule_batch(), throw std::system_error (with the errno of
+ * the C function) or std::bad_alloc.
+ *
+ * LGPL2
+ */
+
+#if __cplusplus < 201703L
+#error "crush.hpp requires C++17"
+#endif
+
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+
+extern "C" {
+#include "crush.h"
+#include "hash.h"
+#include "builder.h"
+#include "mapper.h"
+#include "batch.h"
+#include "load.h"
+}
+
+namespace crush {
+
+#ifdef __cpp_lib_span
+using std::span;
+#else
+/*
+ * The subset of C++20 std::span used here, with a dynamic extent.
+ */
+template <class T>
+class span {
+public:
+  typedef T element_type;
+  typedef std::remove_cv_t<T> value_type;
+  typedef std::size_t size_type;
+  typedef T *pointer;
+  typedef T &reference;
+  typedef T *iterator;
+
+  constexpr span() noexcept : data_(nullptr), size_(0) {}
+  constexpr span(T *data, size_type size) noexcept : data_(data), size_(size) {}
+  template <std::size_t N>
+  constexpr span(T (&a)[N]) noexcept : data_(a), size_(N) {}
+  template <class C, class = std::enable_if_t<
+                       std::is_convertible<decltype(std::data(std::declval<C &>())), T *>::value>>
+  constexpr span(C &c) noexcept : data_(std::data(c)), size_(std::size(c)) {}
+  template <class U, class = std::enable_if_t<std::is_convertible<U (*)[], T (*)[]>::value>>
+  constexpr span(const span<U> &s) noexcept : data_(s.data()), size_(s.size()) {}
+
+  constexpr T *data() const noexcept { return data_; }
+  constexpr size_type size() const noexcept { return size_; }
+  constexpr bool empty() const noexcept { return size_ == 0; }
+  constexpr T &operator[](size_type i) const noexcept { return data_[i]; }
+  constexpr T *begin() const noexcept { return data_; }
+  constexpr T *end() const noexcept { return data_ + size_; }
+  constexpr span subspan(size_type offset, size_type count) const noexcept {
+    return span(data_ + offset, count);
+  }
+
+private:
+  T *data_;
+  size_type size_;
+};
+
+template <class T, std::size_t N>
+span(T (&)[N]) -> span<T>;
+template <class C>
+span(C &) -> span<std::remove_pointer_t<decltype(std::data(std::declval<C &>()))>>;
+#endif
+
+/* throw std::system_error if __err__ < 0 */
+inline void check(int err, const char *what) {
+  if (err < 0)
+    throw std::system_error(-err, std::generic_category(), what);
+}
+
+/** @ingroup API
+ *
+ * A step of a rule, as given to crush_rule_set_step().
+ */
+struct step {
+  int op;
+  int arg1;
+  int arg2;
+};
+
+class Workspace;
+class ChooseArgs;
+
+/** @ingroup API
+ *
+ * The owner of a crush_map, deallocated with crush_destroy(). It can
+ * be moved but not copied.
+ */
+class Map {
+public:
+  /* an empty map, as returned by crush_create() */
+  Map() : map_(crush_create()) {
+    if (map_ == nullptr)
+      throw std::bad_alloc();
+  }
+  /* take the ownership of __map__ */
+  explicit Map(crush_map *map) noexcept : map_(map) {}
+  Map(Map &&other) noexcept : map_(std::exchange(other.map_, nullptr)) {}
+  Map &operator=(Map &&other) noexcept {
+    if (this != &other) {
+      reset();
+      map_ = std::exchange(other.map_, nullptr);
+    }
+    return *this;
+  }
+  Map(const Map &) = delete;
+  Map &operator=(const Map &) = delete;
+  ~Map() { reset(); }
+
+  /* load a map with crush_load_file() */
+  static Map load(const char *path) {
+    crush_map *map = nullptr;
+    int line = 0;
+    int err = crush_load_file(path, &map, &line);
+    if (err == -EINVAL && line > 0)
+      check(err, (std::string(path) + ":" + std::to_string(line)).c_str());
+    check(err, path);
+    return Map(map);
+  }
+  /* load a map with crush_load() */
+  static Map load(const void *buffer, std::size_t length) {
+    crush_map *map = nullptr;
+    int line = 0;
+    int err = crush_load(buffer, length, &map, &line);
+    if (err == -EINVAL && line > 0)
+      check(err, ("line " + std::to_string(line)).c_str());
+    check(err, "crush_load");
+    return Map(map);
+  }
+
+  crush_map *get() const noexcept { return map_; }
+  crush_map *operator->() const noexcept { return map_; }
+  explicit operator bool() const noexcept { return map_ != nullptr; }
+  /* give up the ownership of the map */
+  crush_map *release() noexcept { return std::exchange(map_, nullptr); }
+  void reset(crush_map *map = nullptr) noexcept {
+    if (map_ != nullptr)
+      crush_destroy(map_);
+    map_ = map;
+  }
+
+  /*
+   * Make a bucket with crush_make_bucket() and add it with
+   * crush_add_bucket(). The bucket is deallocated if it cannot be
+   * added. Return the id of the bucket.
+   */
+  int add_bucket(int alg, int type, span<const int> items, span<const int> weights,
+                 int id = 0) {
+    assert(items.size() == weights.size() || alg == CRUSH_BUCKET_UNIFORM);
+    crush_bucket *b = crush_make_bucket(map_, alg, CRUSH_HASH_DEFAULT, type, items.size(),
+                                        const_cast<int *>(items.data()),
+                                        const_cast<int *>(weights.data()));
+    if (b == nullptr)
+      throw std::bad_alloc();
+    int err = crush_add_bucket(map_, id, b, &id);
+    if (err < 0) {
+      crush_destroy_bucket(b);
+      check(err, "crush_add_bucket");
+    }
+    return id;
+  }
+
+  /*
+   * Make a rule of __steps__ and add it with crush_add_rule(). The
+   * rule is deallocated if it cannot be added. Return the rule
+   * number. Throw std::invalid_argument if rule __ruleno__ exists and
+   * std::length_error if __ruleno__ is >= CRUSH_MAX_RULES or, if it
+   * is -1, all the rules are used.
+   */
+  int add_rule(span<const step> steps, int ruleno = -1, int type = 1, int min_size = 1,
+               int max_size = 10) {
+    if (ruleno >= CRUSH_MAX_RULES)
+      throw std::length_error("crush_add_rule: rule " + std::to_string(ruleno) +
+                              " >= CRUSH_MAX_RULES");
+    if (ruleno < 0) {
+      // crush_add_rule() asserts there is a free rule
+      __u32 r = 0;
+      while (r < map_->max_rules && map_->rules[r] != nullptr)
+        r++;
+      if (r >= CRUSH_MAX_RULES)
+        throw std::length_error("crush_add_rule: no free rule");
+    } else if (static_cast<__u32>(ruleno) < map_->max_rules && map_->rules[ruleno] != nullptr) {
+      // crush_add_rule() would replace it
+      throw std::invalid_argument("crush_add_rule: rule " + std::to_string(ruleno) +
+                                  " exists");
+    }
+    crush_rule *rule = crush_make_rule(steps.size(), ruleno, type, min_size, max_size);
+    if (rule == nullptr)
+      throw std::bad_alloc();
+    for (std::size_t i = 0; i < steps.size(); i++)
+      crush_rule_set_step(rule, i, steps[i].op, steps[i].arg1, steps[i].arg2);
+    int r = crush_add_rule(map_, rule, ruleno);
+    if (r < 0) {
+      crush_destroy_rule(rule);
+      check(r, "crush_add_rule");
+    }
+    rule->mask.ruleset = r;
+    return r;
+  }
+  int add_rule(std::initializer_list<step> steps, int ruleno = -1, int type = 1,
+               int min_size = 1, int max_size = 10) {
+    return add_rule(span<const step>(steps.begin(), steps.size()), ruleno, type, min_size,
+                    max_size);
+  }
+
+  /* crush_finalize(), after adding buckets and before mapping */
+  void finalize() noexcept { crush_finalize(map_); }
+  __u64 fingerprint() const noexcept { return crush_map_fingerprint(map_); }
+
+  /*
+   * crush_do_rule() for __x__ in __result__ with __work__, which
+   * must have been made for this map and at least
+   * __result.size()__ items. Return the number of items.
+   */
+  inline int do_rule(Workspace &work, int ruleno, int x, span<int> result,
+                     span<const __u32> weights,
+                     const crush_choose_arg *choose_args = nullptr) const noexcept;
+  /* the same with a result size known at compile time */
+  template <std::size_t N>
+  int do_rule(Workspace &work, int ruleno, int x, std::array<int, N> &result,
+              span<const __u32> weights,
+              const crush_choose_arg *choose_args = nullptr) const noexcept {
+    return do_rule(work, ruleno, x, span<int>(result.data(), N), weights, choose_args);
+  }
+
+  /*
+   * crush_do_rule_batch() for the values of __x__: __results__ has
+   * __x.size()__ rows of __result_max__ items and __sizes__ is
+   * empty or has __x.size()__ sizes. The workspaces, and the threads
+   * if __threads__ > 1, are allocated for each call: throw
+   * std::system_error if it fails.
+   */
+  void map_batch(int ruleno, span<const __u32> x, span<int> results, int result_max,
+                 span<const __u32> weights, span<int> sizes = {},
+                 const crush_choose_arg *choose_args = nullptr, int threads = 1) const {
+    assert(results.size() == x.size() * result_max);
+    batch(ruleno, x.data(), 0, x.size(), results.data(), result_max, sizes, weights,
+          choose_args, threads);
+  }
+  /* the same with rows of a size known at compile time */
+  template <std::size_t N>
+  void map_batch(int ruleno, span<const __u32> x, span<std::array<int, N>> results,
+                 span<const __u32> weights, span<int> sizes = {},
+                 const crush_choose_arg *choose_args = nullptr, int threads = 1) const {
+    assert(results.size() == x.size());
+    batch(ruleno, x.data(), 0, x.size(), results.data()->data(), N, sizes, weights,
+          choose_args, threads);
+  }
+  /* crush_do_rule_batch() for the values __first_x__ + i */
+  void map_range(int ruleno, __u32 first_x, span<int> results, int result_max,
+                 span<const __u32> weights, span<int> sizes = {},
+                 const crush_choose_arg *choose_args = nullptr, int threads = 1) const {
+    assert(result_max > 0 && results.size() % result_max == 0);
+    batch(ruleno, nullptr, first_x, results.size() / result_max, results.data(), result_max,
+          sizes, weights, choose_args, threads);
+  }
+  template <std::size_t N>
+  void map_range(int ruleno, __u32 first_x, span<std::array<int, N>> results,
+                 span<const __u32> weights, span<int> sizes = {},
+                 const crush_choose_arg *choose_args = nullptr, int threads = 1) const {
+    batch(ruleno, nullptr, first_x, results.size(), results.data()->data(), N, sizes,
+          weights, choose_args, threads);
+  }
+
+private:
+  void batch(int ruleno, const __u32 *x, __u32 first_x, std::size_t count, int *results,
+             int result_max, span<int> sizes, span<const __u32> weights,
+             const crush_choose_arg *choose_args, int threads) const {
+    assert(sizes.empty() || sizes.size() == count);
+    check(crush_do_rule_batch(map_, ruleno, x, first_x, count, results, result_max,
+                              sizes.empty() ? nullptr : sizes.data(), weights.data(),
+                              weights.size(), choose_args, threads),
+          "crush_do_rule_batch");
+  }
+
+  crush_map *map_;
+};
+
+/** @ingroup API
+ *
+ * The owner of a workspace of crush_do_rule() for a map and results
+ * of up to __result_max__ items, allocated once and initialized with
+ * crush_init_workspace(). A workspace must not be used by two
+ * threads at the same time and must be made again when buckets are
+ * added to the map.
+ */
+class Workspace {
+public:
+  Workspace(const Map &map, int result_max)
+    : map_(map.get()), result_max_(result_max),
+      work_(::operator new(crush_work_size(map.get(), result_max))) {
+    crush_init_workspace(map_, work_);
+  }
+  Workspace(Workspace &&other) noexcept
+    : map_(other.map_), result_max_(other.result_max_),
+      work_(std::exchange(other.work_, nullptr)) {}
+  Workspace &operator=(Workspace &&other) noexcept {
+    if (this != &other) {
+      ::operator delete(work_);
+      map_ = other.map_;
+      result_max_ = other.result_max_;
+      work_ = std::exchange(other.work_, nullptr);
+    }
+    return *this;
+  }
+  Workspace(const Workspace &) = delete;
+  Workspace &operator=(const Workspace &) = delete;
+  ~Workspace() { ::operator delete(work_); }
+
+  /* the cwin argument of crush_do_rule() */
+  void *get() const noexcept { return work_; }
+  const crush_map *map() const noexcept { return map_; }
+  int result_max() const noexcept { return result_max_; }
+
+private:
+  const crush_map *map_;
+  int result_max_;
+  void *work_;
+};
+
+inline int Map::do_rule(Workspace &work, int ruleno, int x, span<int> result,
+                        span<const __u32> weights,
+                        const crush_choose_arg *choose_args) const noexcept {
+  assert(work.map() == map_ && result.size() <= (std::size_t)work.result_max());
+  return crush_do_rule(map_, ruleno, x, result.data(), result.size(), weights.data(),
+                       weights.size(), work.get(), choose_args);
+}
+
+/** @ingroup API
+ *
+ * The owner of the choose_args of a map, as returned by
+ * crush_make_choose_args() and deallocated with
+ * crush_destroy_choose_args(). It converts to the __choose_args__
+ * argument of the mapping functions.
+ */
+class ChooseArgs {
+public:
+  ChooseArgs() noexcept : args_(nullptr) {}
+  /* crush_make_choose_args() */
+  ChooseArgs(const Map &map, int num_positions)
+    : args_(crush_make_choose_args(map.get(), num_positions)) {
+    if (args_ == nullptr)
+      throw std::bad_alloc();
+  }
+  /* take the ownership of __args__ */
+  explicit ChooseArgs(crush_choose_arg *args) noexcept : args_(args) {}
+  ChooseArgs(ChooseArgs &&other) noexcept : args_(std::exchange(other.args_, nullptr)) {}
+  ChooseArgs &operator=(ChooseArgs &&other) noexcept {
+    if (this != &other) {
+      reset();
+      args_ = std::exchange(other.args_, nullptr);
+    }
+    return *this;
+  }
+  ChooseArgs(const ChooseArgs &) = delete;
+  ChooseArgs &operator=(const ChooseArgs &) = delete;
+  ~ChooseArgs() { reset(); }
+
+  crush_choose_arg *get() const noexcept { return args_; }
+  operator const crush_choose_arg *() const noexcept { return args_; }
+  /* the choose_args of the bucket at position __pos__ of map->buckets */
+  crush_choose_arg &operator[](std::size_t pos) const noexcept { return args_[pos]; }
+  crush_choose_arg *release() noexcept { return std::exchange(args_, nullptr); }
+  void reset(crush_choose_arg *args = nullptr) noexcept {
+    if (args_ != nullptr)
+      crush_destroy_choose_args(args_);
+    args_ = args;
+  }
+
+private:
+  crush_choose_arg *args_;
+};
+
+/** @ingroup API
+ *
+ * The mappings of the values [__first__, __last__[ with a rule, as
+ * a range to iterate over. Each value is mapped with
+ * crush_do_rule() when the iterator reaches it, in the __buffer__
+ * given by the caller, which the item of the iterator refers to:
+ *
+ *     std::array<int, 3> buffer;
+ *     for (auto m : crush::Mappings(map, work, 0, 0, 1024, buffer, weights))
+ *       use(m.x, m.result);
+ */
+class Mappings {
+public:
+  struct value_type {
+    __u32 x;
+    span<const int> result;
+  };
+
+  class iterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef Mappings::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type *pointer;
+    typedef const value_type &reference;
+
+    iterator(const Mappings *mappings, __u32 x) noexcept : mappings_(mappings) {
+      value_.x = x;
+      map();
+    }
+    const value_type &operator*() const noexcept { return value_; }
+    const value_type *operator->() const noexcept { return &value_; }
+    iterator &operator++() noexcept {
+      value_.x++;
+      map();
+      return *this;
+    }
+    bool operator==(const iterator &other) const noexcept { return value_.x == other.value_.x; }
+    bool operator!=(const iterator &other) const noexcept { return value_.x != other.value_.x; }
+
+  private:
+    void map() noexcept {
+      const Mappings &m = *mappings_;
+      if (value_.x == m.last_)
+        return;
+      int size = m.map_.do_rule(m.work_, m.ruleno_, value_.x, m.buffer_, m.weights_,
+                                m.choose_args_);
+      value_.result = span<const int>(m.buffer_.data(), size);
+    }
+
+    const Mappings *mappings_;
+    value_type value_;
+  };
+
+  Mappings(const Map &map, Workspace &work, int ruleno, __u32 first, __u32 last,
+           span<int> buffer, span<const __u32> weights,
+           const crush_choose_arg *choose_args = nullptr) noexcept
+    : map_(map), work_(work), ruleno_(ruleno), first_(first), last_(last), buffer_(buffer),
+      weights_(weights), choose_args_(choose_args) {}
+
+  iterator begin() const noexcept { return iterator(this, first_); }
+  iterator end() const noexcept { return iterator(this, last_); }
+
+private:
+  const Map &map_;
+  Workspace &work_;
+  int ruleno_;
+  __u32 first_;
+  __u32 last_;
+  span<int> buffer_;
+  span<const __u32> weights_;
+  const crush_choose_arg *choose_args_;
+};
+
+}
+
+#endif
@@ -0,0 +1,870 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "delta.h"
+#include "validate.h"
+#include "varint.h"
+
+/*
+ * Layout of a delta, the integers of the header are little endian
+ * and the others are varints, zigzag encoded if they are signed:
+ *
+ *   header     magic u32, version u32, base fingerprint u64,
+ *              target fingerprint u64
+ *   tunables   the eight tunables of the target
+ *   sizes      max_buckets, max_rules, max_devices of the target
+ *   buckets    count, { position, present, bucket if present }
+ *   rules      count, { rule number, present, rule if present }
+ *   args       mode, if CHOOSE_ARGS_PATCH: count, { position, arg }
+ *
+ * The positions and rule numbers are in increasing order.
+ */
+#define CRUSH_DELTA_MAGIC 0x444d5243 /* CRMD */
+#define CRUSH_DELTA_VERSION 1
+#define HEADER_SIZE (4 + 4 + 8 + 8)
+
+enum {
+	CHOOSE_ARGS_KEEP = 0,
+	CHOOSE_ARGS_PATCH = 1,
+	CHOOSE_ARGS_REMOVE = 2,
+};
+
+struct cursor {
+	const unsigned char *p;
+	const unsigned char *end;
+	int err;
+};
+
+static __u64 get(struct cursor *c)
+{
+	__u64 v;
+
+	if (c->err)
+		return 0;
+	if (crush_get_varint(&c->p, c->end, &v) < 0) {
+		c->err = -EINVAL;
+		return 0;
+	}
+	return v;
+}
+
+static __s64 get_signed(struct cursor *c)
+{
+	return crush_unzigzag(get(c));
+}
+
+/* a value in [0, max] */
+static __u64 get_max(struct cursor *c, __u64 max)
+{
+	__u64 v = get(c);
+
+	if (v > max) {
+		c->err = -EINVAL;
+		return 0;
+	}
+	return v;
+}
+
+/* a number of elements, each of them encoded in at least one byte */
+static int get_count(struct cursor *c)
+{
+	return get_max(c, c->end - c->p);
+}
+
+static void get_array(struct cursor *c, __u32 *a, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		a[i] = get_max(c, UINT_MAX);
+}
+
+static void *alloc_array(int n, size_t size)
+{
+	return malloc(size * (n ? n : 1));
+}
+
+static int put_array(struct crush_buffer *b, const __u32 *a, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (crush_put_varint(b, a[i]) < 0)
+			return -ENOMEM;
+	return 0;
+}
+
+static int encode_bucket(struct crush_buffer *b, const struct crush_bucket *bucket)
+{
+	__u32 i;
+
+	if (bucket == NULL)
+		return crush_put_varint(b, 0);
+	if (crush_put_varint(b, 1) < 0 ||
+	    crush_put_varint(b, bucket->type) < 0 ||
+	    crush_put_varint(b, bucket->alg) < 0 ||
+	    crush_put_varint(b, bucket->hash) < 0 ||
+	    crush_put_varint(b, bucket->weight) < 0 ||
+	    crush_put_varint(b, bucket->size) < 0)
+		return -ENOMEM;
+	for (i = 0; i < bucket->size; i++)
+		if (crush_put_varint(b, crush_zigzag(bucket->items[i])) < 0)
+			return -ENOMEM;
+	switch (bucket->alg) {
+	case CRUSH_BUCKET_UNIFORM:
+		return crush_put_varint(b, ((struct crush_bucket_uniform *)bucket)->item_weight);
+	case CRUSH_BUCKET_LIST: {
+		struct crush_bucket_list *l = (struct crush_bucket_list *)bucket;
+		if (put_array(b, l->item_weights, bucket->size) < 0)
+			return -ENOMEM;
+		return put_array(b, l->sum_weights, bucket->size);
+	}
+	case CRUSH_BUCKET_TREE: {
+		struct crush_bucket_tree *t = (struct crush_bucket_tree *)bucket;
+		if (crush_put_varint(b, t->num_nodes) < 0)
+			return -ENOMEM;
+		return put_array(b, t->node_weights, t->num_nodes);
+	}
+	case CRUSH_BUCKET_STRAW: {
+		struct crush_bucket_straw *s = (struct crush_bucket_straw *)bucket;
+		if (put_array(b, s->item_weights, bucket->size) < 0)
+			return -ENOMEM;
+		return put_array(b, s->straws, bucket->size);
+	}
+	case CRUSH_BUCKET_STRAW2:
+		return put_array(b, ((struct crush_bucket_straw2 *)bucket)->item_weights,
+				 bucket->size);
+	}
+	return 0;
+}
+
+static struct crush_bucket *decode_bucket(struct cursor *c, int id)
+{
+	struct crush_bucket h, *bucket = NULL;
+	__u32 i;
+
+	memset(&h, '\0', sizeof(h));
+	h.id = id;
+	h.type = get_max(c, 0xffff);
+	h.alg = get_max(c, CRUSH_BUCKET_STRAW2);
+	h.hash = get_max(c, 0xff);
+	h.weight = get_max(c, UINT_MAX);
+	h.size = get_count(c);
+	if (c->err)
+		return NULL;
+	h.items = alloc_array(h.size, sizeof(__s32));
+	if (!h.items)
+		goto nomem;
+	for (i = 0; i < h.size; i++)
+		h.items[i] = get_signed(c);
+
+	switch (h.alg) {
+	case CRUSH_BUCKET_UNIFORM: {
+		struct crush_bucket_uniform *u = calloc(1, sizeof(*u));
+		if (!u)
+			goto nomem;
+		u->h = h;
+		u->item_weight = get_max(c, UINT_MAX);
+		bucket = &u->h;
+		break;
+	}
+	case CRUSH_BUCKET_LIST: {
+		struct crush_bucket_list *l = calloc(1, sizeof(*l));
+		if (!l)
+			goto nomem;
+		l->h = h;
+		bucket = &l->h;
+		l->item_weights = alloc_array(h.size, sizeof(__u32));
+		l->sum_weights = alloc_array(h.size, sizeof(__u32));
+		if (!l->item_weights || !l->sum_weights)
+			goto nomem;
+		get_array(c, l->item_weights, h.size);
+		get_array(c, l->sum_weights, h.size);
+		break;
+	}
+	case CRUSH_BUCKET_TREE: {
+		struct crush_bucket_tree *t = calloc(1, sizeof(*t));
+		if (!t)
+			goto nomem;
+		t->h = h;
+		bucket = &t->h;
+		t->num_nodes = get_max(c, 0xff);
+		t->node_weights = alloc_array(t->num_nodes, sizeof(__u32));
+		if (!t->node_weights)
+			goto nomem;
+		get_array(c, t->node_weights, t->num_nodes);
+		break;
+	}
+	case CRUSH_BUCKET_STRAW: {
+		struct crush_bucket_straw *s = calloc(1, sizeof(*s));
+		if (!s)
+			goto nomem;
+		s->h = h;
+		bucket = &s->h;
+		s->item_weights = alloc_array(h.size, sizeof(__u32));
+		s->straws = alloc_array(h.size, sizeof(__u32));
+		if (!s->item_weights || !s->straws)
+			goto nomem;
+		get_array(c, s->item_weights, h.size);
+		get_array(c, s->straws, h.size);
+		break;
+	}
+	case CRUSH_BUCKET_STRAW2: {
+		struct crush_bucket_straw2 *s = calloc(1, sizeof(*s));
+		if (!s)
+			goto nomem;
+		s->h = h;
+		bucket = &s->h;
+		s->item_weights = alloc_array(h.size, sizeof(__u32));
+		if (!s->item_weights)
+			goto nomem;
+		get_array(c, s->item_weights, h.size);
+		break;
+	}
+	default:
+		c->err = -EINVAL;
+		free(h.items);
+		return NULL;
+	}
+	if (c->err) {
+		crush_destroy_bucket(bucket);
+		return NULL;
+	}
+	return bucket;
+nomem:
+	if (bucket)
+		crush_destroy_bucket(bucket);
+	else
+		free(h.items);
+	c->err = -ENOMEM;
+	return NULL;
+}
+
+static int encode_rule(struct crush_buffer *b, const struct crush_rule *rule)
+{
+	__u32 i;
+
+	if (rule == NULL)
+		return crush_put_varint(b, 0);
+	if (crush_put_varint(b, 1) < 0 ||
+	    crush_put_varint(b, rule->len) < 0 ||
+	    crush_put_varint(b, rule->mask.ruleset) < 0 ||
+	    crush_put_varint(b, rule->mask.type) < 0 ||
+	    crush_put_varint(b, rule->mask.min_size) < 0 ||
+	    crush_put_varint(b, rule->mask.max_size) < 0)
+		return -ENOMEM;
+	for (i = 0; i < rule->len; i++)
+		if (crush_put_varint(b, rule->steps[i].op) < 0 ||
+		    crush_put_varint(b, crush_zigzag(rule->steps[i].arg1)) < 0 ||
+		    crush_put_varint(b, crush_zigzag(rule->steps[i].arg2)) < 0)
+			return -ENOMEM;
+	return 0;
+}
+
+static struct crush_rule *decode_rule(struct cursor *c)
+{
+	struct crush_rule *rule;
+	int len = get_count(c);
+	__u32 i;
+
+	if (c->err)
+		return NULL;
+	rule = malloc(crush_rule_size(len));
+	if (!rule) {
+		c->err = -ENOMEM;
+		return NULL;
+	}
+	rule->len = len;
+	rule->mask.ruleset = get_max(c, 0xff);
+	rule->mask.type = get_max(c, 0xff);
+	rule->mask.min_size = get_max(c, 0xff);
+	rule->mask.max_size = get_max(c, 0xff);
+	for (i = 0; i < rule->len; i++) {
+		rule->steps[i].op = get_max(c, UINT_MAX);
+		rule->steps[i].arg1 = get_signed(c);
+		rule->steps[i].arg2 = get_signed(c);
+	}
+	if (c->err) {
+		crush_destroy_rule(rule);
+		return NULL;
+	}
+	return rule;
+}
+
+static int encode_choose_arg(struct crush_buffer *b,
+			     const struct crush_choose_arg *arg)
+{
+	__u32 i, j;
+
+	if (crush_put_varint(b, arg ? arg->ids_size : 0) < 0)
+		return -ENOMEM;
+	for (i = 0; arg && i < arg->ids_size; i++)
+		if (crush_put_varint(b, crush_zigzag(arg->ids[i])) < 0)
+			return -ENOMEM;
+	if (crush_put_varint(b, arg ? arg->weight_set_size : 0) < 0)
+		return -ENOMEM;
+	for (i = 0; arg && i < arg->weight_set_size; i++) {
+		const struct crush_weight_set *weight_set = &arg->weight_set[i];
+		if (crush_put_varint(b, weight_set->size) < 0)
+			return -ENOMEM;
+		for (j = 0; j < weight_set->size; j++)
+			if (crush_put_varint(b, weight_set->weights[j]) < 0)
+				return -ENOMEM;
+	}
+	return 0;
+}
+
+static void choose_arg_clear(struct crush_choose_arg *arg)
+{
+	__u32 i;
+
+	for (i = 0; arg->weight_set && i < arg->weight_set_size; i++)
+		free(arg->weight_set[i].weights);
+	free(arg->weight_set);
+	free(arg->ids);
+	memset(arg, '\0', sizeof(*arg));
+}
+
+static void decode_choose_arg(struct cursor *c, struct crush_choose_arg *arg)
+{
+	__u32 i, j;
+
+	memset(arg, '\0', sizeof(*arg));
+	arg->ids_size = get_count(c);
+	if (c->err)
+		return;
+	arg->ids = alloc_array(arg->ids_size, sizeof(int));
+	if (!arg->ids)
+		goto nomem;
+	for (i = 0; i < arg->ids_size; i++)
+		arg->ids[i] = get_signed(c);
+	arg->weight_set_size = get_count(c);
+	if (c->err)
+		return;
+	arg->weight_set = calloc(arg->weight_set_size + 1,
+				 sizeof(struct crush_weight_set));
+	if (!arg->weight_set)
+		goto nomem;
+	for (i = 0; i < arg->weight_set_size; i++) {
+		struct crush_weight_set *weight_set = &arg->weight_set[i];
+		weight_set->size = get_count(c);
+		if (c->err)
+			return;
+		weight_set->weights = alloc_array(weight_set->size, sizeof(__u32));
+		if (!weight_set->weights)
+			goto nomem;
+		for (j = 0; j < weight_set->size; j++)
+			weight_set->weights[j] = get_max(c, UINT_MAX);
+	}
+	return;
+nomem:
+	c->err = -ENOMEM;
+}
+
+/* compare the encodings of two elements, return 1 if they differ */
+static int differ(struct crush_buffer *a, struct crush_buffer *b)
+{
+	int different = a->size != b->size ||
+		memcmp(a->data, b->data, a->size);
+
+	a->size = 0;
+	b->size = 0;
+	return different;
+}
+
+int crush_map_delta_encode(const struct crush_map *old_map,
+			   const struct crush_choose_arg *old_args,
+			   const struct crush_map *new_map,
+			   const struct crush_choose_arg *new_args,
+			   void **delta, size_t *length)
+{
+	struct crush_buffer out, changes, a, b;
+	int max_buckets = old_map->max_buckets > new_map->max_buckets ?
+		old_map->max_buckets : new_map->max_buckets;
+	__u32 max_rules = old_map->max_rules > new_map->max_rules ?
+		old_map->max_rules : new_map->max_rules;
+	int count, pos, mode;
+	__u32 r;
+
+	memset(&out, '\0', sizeof(out));
+	memset(&changes, '\0', sizeof(changes));
+	memset(&a, '\0', sizeof(a));
+	memset(&b, '\0', sizeof(b));
+
+	if (crush_put_u32(&out, CRUSH_DELTA_MAGIC) < 0 ||
+	    crush_put_u32(&out, CRUSH_DELTA_VERSION) < 0 ||
+	    crush_put_u64(&out, old_map->fingerprint) < 0 ||
+	    crush_put_u64(&out, new_map->fingerprint) < 0 ||
+	    crush_put_varint(&out, new_map->choose_local_tries) < 0 ||
+	    crush_put_varint(&out, new_map->choose_local_fallback_tries) < 0 ||
+	    crush_put_varint(&out, new_map->choose_total_tries) < 0 ||
+	    crush_put_varint(&out, new_map->chooseleaf_descend_once) < 0 ||
+	    crush_put_varint(&out, new_map->chooseleaf_vary_r) < 0 ||
+	    crush_put_varint(&out, new_map->chooseleaf_stable) < 0 ||
+	    crush_put_varint(&out, new_map->straw_calc_version) < 0 ||
+	    crush_put_varint(&out, new_map->allowed_bucket_algs) < 0 ||
+	    crush_put_varint(&out, new_map->max_buckets) < 0 ||
+	    crush_put_varint(&out, new_map->max_rules) < 0 ||
+	    crush_put_varint(&out, new_map->max_devices) < 0)
+		goto nomem;
+
+	count = 0;
+	for (pos = 0; pos < max_buckets; pos++) {
+		const struct crush_bucket *ob = pos < old_map->max_buckets ?
+			old_map->buckets[pos] : NULL;
+		const struct crush_bucket *nb = pos < new_map->max_buckets ?
+			new_map->buckets[pos] : NULL;
+		if (encode_bucket(&a, ob) < 0 || encode_bucket(&b, nb) < 0)
+			goto nomem;
+		if (!differ(&a, &b))
+			continue;
+		if (crush_put_varint(&changes, pos) < 0 ||
+		    encode_bucket(&changes, nb) < 0)
+			goto nomem;
+		count++;
+	}
+	if (crush_put_varint(&out, count) < 0 ||
+	    crush_put_bytes(&out, changes.data, changes.size) < 0)
+		goto nomem;
+	changes.size = 0;
+
+	count = 0;
+	for (r = 0; r < max_rules; r++) {
+		const struct crush_rule *or = r < old_map->max_rules ? old_map->rules[r] : NULL;
+		const struct crush_rule *nr = r < new_map->max_rules ? new_map->rules[r] : NULL;
+		if (encode_rule(&a, or) < 0 || encode_rule(&b, nr) < 0)
+			goto nomem;
+		if (!differ(&a, &b))
+			continue;
+		if (crush_put_varint(&changes, r) < 0 ||
+		    encode_rule(&changes, nr) < 0)
+			goto nomem;
+		count++;
+	}
+	if (crush_put_varint(&out, count) < 0 ||
+	    crush_put_bytes(&out, changes.data, changes.size) < 0)
+		goto nomem;
+	changes.size = 0;
+
+	if (new_args)
+		mode = CHOOSE_ARGS_PATCH;
+	else if (old_args)
+		mode = CHOOSE_ARGS_REMOVE;
+	else
+		mode = CHOOSE_ARGS_KEEP;
+	if (crush_put_varint(&out, mode) < 0)
+		goto nomem;
+	if (mode == CHOOSE_ARGS_PATCH) {
+		count = 0;
+		for (pos = 0; pos < new_map->max_buckets; pos++) {
+			const struct crush_choose_arg *oa =
+				old_args && pos < old_map->max_buckets ?
+				&old_args[pos] : NULL;
+			if (encode_choose_arg(&a, oa) < 0 ||
+			    encode_choose_arg(&b, &new_args[pos]) < 0)
+				goto nomem;
+			if (!differ(&a, &b))
+				continue;
+			if (crush_put_varint(&changes, pos) < 0 ||
+			    encode_choose_arg(&changes, &new_args[pos]) < 0)
+				goto nomem;
+			count++;
+		}
+		if (crush_put_varint(&out, count) < 0 ||
+		    crush_put_bytes(&out, changes.data, changes.size) < 0)
+			goto nomem;
+	}
+
+	free(changes.data);
+	free(a.data);
+	free(b.data);
+	*delta = out.data;
+	*length = out.size;
+	return 0;
+nomem:
+	free(out.data);
+	free(changes.data);
+	free(a.data);
+	free(b.data);
+	return -ENOMEM;
+}
+
+/* the part of map->working_size that depends on @b, see crush_finalize() */
+static size_t bucket_working_size(const struct crush_bucket *b)
+{
+	if (b == NULL)
+		return 0;
+	return sizeof(struct crush_work_bucket) + b->size * sizeof(__u32);
+}
+
+/*
+ * Allocate choose_args for @max_buckets buckets. The argument at a
+ * position is found in @patches if it is listed in @positions, in
+ * @old otherwise.
+ */
+static struct crush_choose_arg *
+choose_args_rebuild(int max_buckets,
+		    const struct crush_choose_arg *old, int old_size,
+		    const int *positions, const struct crush_choose_arg *patches,
+		    int count)
+{
+	const struct crush_choose_arg **args;
+	struct crush_choose_arg *packed;
+	int pos, patch;
+
+	args = calloc(max_buckets + 1, sizeof(struct crush_choose_arg *));
+	if (!args)
+		return NULL;
+	for (pos = 0, patch = 0; pos < max_buckets; pos++) {
+		if (patch < count && positions[patch] == pos)
+			args[pos] = &patches[patch++];
+		else if (old && pos < old_size)
+			args[pos] = &old[pos];
+	}
+	packed = crush_pack_choose_args(args, max_buckets);
+	free(args);
+	return packed;
+}
+
+/* return the index of @pos in the sorted array @positions or -1 */
+static int lookup(const int *positions, int count, int pos)
+{
+	int low = 0, high = count;
+
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (positions[middle] == pos)
+			return middle;
+		if (positions[middle] < pos)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return -1;
+}
+
+/* return 1 if @pos is in the sorted array @positions */
+static int listed(const int *positions, int count, int pos)
+{
+	return lookup(positions, count, pos) >= 0;
+}
+
+/*
+ * Return 1 if @arg can be given to crush_do_rule() for @b: its ids
+ * and weights have one entry per item. An empty @arg fits any
+ * bucket, including a missing one.
+ */
+static int choose_arg_fits(const struct crush_choose_arg *arg,
+			   const struct crush_bucket *b)
+{
+	__u32 i;
+
+	if (arg->ids_size == 0 && arg->weight_set_size == 0)
+		return 1;
+	if (b == NULL || (arg->ids_size != 0 && arg->ids_size != b->size))
+		return 0;
+	for (i = 0; i < arg->weight_set_size; i++)
+		if (arg->weight_set[i].size != b->size)
+			return 0;
+	return 1;
+}
+
+/*
+ * Check with crush_map_validate() the map @map becomes with the
+ * sizes and tunables of @target and the decoded @buckets and @rules
+ * at @bucket_positions and @rule_positions. The target fingerprint is
+ * part of the delta: it detects a delta applied to the wrong map, not
+ * a delta crafted or corrupted with a matching fingerprint.
+ */
+static int validate_patched(const struct crush_map *map, const struct crush_map *target,
+			    const int *bucket_positions, struct crush_bucket **buckets,
+			    int bucket_count, const int *rule_positions,
+			    struct crush_rule **rules, int rule_count)
+{
+	struct crush_map patched = *target;
+	int max_buckets, max_rules, i, err;
+
+	patched.buckets = calloc(target->max_buckets + 1, sizeof(struct crush_bucket *));
+	patched.rules = calloc(target->max_rules + 1, sizeof(struct crush_rule *));
+	if (!patched.buckets || !patched.rules) {
+		err = -ENOMEM;
+		goto out;
+	}
+	max_buckets = map->max_buckets < target->max_buckets ?
+		map->max_buckets : target->max_buckets;
+	max_rules = map->max_rules < target->max_rules ?
+		map->max_rules : target->max_rules;
+	for (i = 0; i < max_buckets; i++)
+		patched.buckets[i] = map->buckets[i];
+	for (i = 0; i < max_rules; i++)
+		patched.rules[i] = map->rules[i];
+	/* the buckets and rules past the end of @target are NULL */
+	for (i = 0; i < bucket_count; i++)
+		if (bucket_positions[i] < target->max_buckets)
+			patched.buckets[bucket_positions[i]] = buckets[i];
+	for (i = 0; i < rule_count; i++)
+		if (rule_positions[i] < (int)target->max_rules)
+			patched.rules[rule_positions[i]] = rules[i];
+	err = crush_map_validate(&patched, NULL, NULL);
+out:
+	free(patched.buckets);
+	free(patched.rules);
+	return err;
+}
+
+int crush_map_delta_apply(struct crush_map *map,
+			  struct crush_choose_arg **choose_args,
+			  const void *delta, size_t length)
+{
+	const unsigned char *data = delta;
+	struct cursor c;
+	struct crush_map target;
+	__u64 fingerprint, base;
+	int bucket_count = 0, rule_count = 0, arg_count = 0;
+	int *bucket_positions = NULL, *rule_positions = NULL;
+	int *arg_positions = NULL;
+	struct crush_bucket **buckets = NULL;
+	struct crush_rule **rules = NULL;
+	struct crush_choose_arg *args = NULL, *new_args = NULL;
+	int max_buckets, max_rules, mode, i, pos;
+	size_t working_size;
+	int err;
+
+	if (length < HEADER_SIZE ||
+	    crush_get_u32(data) != CRUSH_DELTA_MAGIC ||
+	    crush_get_u32(data + 4) != CRUSH_DELTA_VERSION)
+		return -EINVAL;
+	base = crush_get_u64(data + 8);
+	if (base != map->fingerprint)
+		return -ESTALE;
+	c.p = data + HEADER_SIZE;
+	c.end = data + length;
+	c.err = 0;
+
+	target = *map;
+	target.choose_local_tries = get_max(&c, UINT_MAX);
+	target.choose_local_fallback_tries = get_max(&c, UINT_MAX);
+	target.choose_total_tries = get_max(&c, UINT_MAX);
+	target.chooseleaf_descend_once = get_max(&c, UINT_MAX);
+	target.chooseleaf_vary_r = get_max(&c, 0xff);
+	target.chooseleaf_stable = get_max(&c, 0xff);
+	target.straw_calc_version = get_max(&c, 0xff);
+	target.allowed_bucket_algs = get_max(&c, UINT_MAX);
+	target.max_buckets = get_max(&c, INT_MAX / sizeof(void *));
+	target.max_rules = get_max(&c, CRUSH_MAX_RULES);
+	target.max_devices = get_max(&c, INT_MAX);
+	max_buckets = map->max_buckets > target.max_buckets ?
+		map->max_buckets : target.max_buckets;
+	max_rules = map->max_rules > target.max_rules ?
+		map->max_rules : target.max_rules;
+
+	bucket_count = get_count(&c);
+	if (c.err)
+		return c.err;
+	bucket_positions = alloc_array(bucket_count, sizeof(int));
+	buckets = calloc(bucket_count + 1, sizeof(struct crush_bucket *));
+	if (!bucket_positions || !buckets) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < bucket_count && !c.err; i++) {
+		pos = get_max(&c, INT_MAX);
+		if (pos >= max_buckets ||
+		    (i > 0 && pos <= bucket_positions[i - 1]))
+			c.err = -EINVAL;
+		bucket_positions[i] = pos;
+		if (get_max(&c, 1))
+			buckets[i] = decode_bucket(&c, -1-pos);
+		if (pos >= target.max_buckets && buckets[i])
+			c.err = -EINVAL;
+	}
+
+	rule_count = get_count(&c);
+	if (c.err) {
+		err = c.err;
+		goto out;
+	}
+	rule_positions = alloc_array(rule_count, sizeof(int));
+	rules = calloc(rule_count + 1, sizeof(struct crush_rule *));
+	if (!rule_positions || !rules) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < rule_count && !c.err; i++) {
+		pos = get_max(&c, INT_MAX);
+		if (pos >= max_rules ||
+		    (i > 0 && pos <= rule_positions[i - 1]))
+			c.err = -EINVAL;
+		rule_positions[i] = pos;
+		if (get_max(&c, 1))
+			rules[i] = decode_rule(&c);
+		if (pos >= (int)target.max_rules && rules[i])
+			c.err = -EINVAL;
+	}
+
+	mode = get_max(&c, CHOOSE_ARGS_REMOVE);
+	if (mode == CHOOSE_ARGS_PATCH) {
+		arg_count = get_count(&c);
+		if (c.err) {
+			err = c.err;
+			goto out;
+		}
+		arg_positions = alloc_array(arg_count, sizeof(int));
+		args = calloc(arg_count + 1, sizeof(struct crush_choose_arg));
+		if (!arg_positions || !args) {
+			err = -ENOMEM;
+			goto out;
+		}
+		for (i = 0; i < arg_count && !c.err; i++) {
+			pos = get_max(&c, INT_MAX);
+			if (pos >= target.max_buckets ||
+			    (i > 0 && pos <= arg_positions[i - 1]))
+				c.err = -EINVAL;
+			arg_positions[i] = pos;
+			decode_choose_arg(&c, &args[i]);
+		}
+	}
+	if (!c.err && (c.p != c.end ||
+		       (mode != CHOOSE_ARGS_KEEP && choose_args == NULL)))
+		c.err = -EINVAL;
+	if (c.err) {
+		err = c.err;
+		goto out;
+	}
+
+	/* the buckets and rules past the end of the arrays are removed */
+	err = -EINVAL;
+	for (pos = target.max_buckets; pos < map->max_buckets; pos++)
+		if (map->buckets[pos] &&
+		    !listed(bucket_positions, bucket_count, pos))
+			goto out;
+	for (pos = target.max_rules; pos < (int)map->max_rules; pos++)
+		if (map->rules[pos] &&
+		    !listed(rule_positions, rule_count, pos))
+			goto out;
+
+	fingerprint = map->fingerprint ^ crush_tunables_fingerprint(map) ^
+		crush_tunables_fingerprint(&target);
+	for (i = 0; i < bucket_count; i++) {
+		pos = bucket_positions[i];
+		if (pos < map->max_buckets)
+			fingerprint ^= crush_bucket_fingerprint(map->buckets[pos]);
+		fingerprint ^= crush_bucket_fingerprint(buckets[i]);
+	}
+	for (i = 0; i < rule_count; i++) {
+		pos = rule_positions[i];
+		if (pos < (int)map->max_rules)
+			fingerprint ^= crush_rule_fingerprint(pos, map->rules[pos]);
+		fingerprint ^= crush_rule_fingerprint(pos, rules[i]);
+	}
+	if (fingerprint != crush_get_u64(data + 16))
+		goto out;
+	/* the choose_args match the buckets once the delta is applied */
+	for (i = 0; i < arg_count; i++) {
+		const struct crush_bucket *b = NULL;
+		int j;
+
+		pos = arg_positions[i];
+		j = lookup(bucket_positions, bucket_count, pos);
+		if (j >= 0)
+			b = buckets[j];
+		else if (pos < map->max_buckets)
+			b = map->buckets[pos];
+		if (!choose_arg_fits(&args[i], b))
+			goto out;
+	}
+	err = validate_patched(map, &target, bucket_positions, buckets, bucket_count,
+			       rule_positions, rules, rule_count);
+	if (err < 0)
+		goto out;
+
+	/* allocate everything before modifying the map */
+	err = -ENOMEM;
+	if (mode == CHOOSE_ARGS_PATCH) {
+		new_args = choose_args_rebuild(target.max_buckets,
+					       *choose_args, map->max_buckets,
+					       arg_positions, args, arg_count);
+		if (!new_args)
+			goto out;
+	}
+	if (target.max_buckets > map->max_buckets) {
+		struct crush_bucket **grown = realloc(map->buckets,
+			sizeof(struct crush_bucket *) * target.max_buckets);
+		if (!grown)
+			goto out;
+		memset(grown + map->max_buckets, '\0',
+		       sizeof(struct crush_bucket *) *
+		       (target.max_buckets - map->max_buckets));
+		map->buckets = grown;
+	}
+	if (target.max_rules > map->max_rules) {
+		struct crush_rule **grown = realloc(map->rules,
+			sizeof(struct crush_rule *) * target.max_rules);
+		if (!grown)
+			goto out;
+		memset(grown + map->max_rules, '\0',
+		       sizeof(struct crush_rule *) *
+		       (target.max_rules - map->max_rules));
+		map->rules = grown;
+	}
+
+	working_size = map->working_size + sizeof(struct crush_work_bucket *) *
+		(target.max_buckets - map->max_buckets);
+	for (i = 0; i < bucket_count; i++) {
+		pos = bucket_positions[i];
+		if (pos < map->max_buckets && map->buckets[pos]) {
+			working_size -= bucket_working_size(map->buckets[pos]);
+			crush_destroy_bucket(map->buckets[pos]);
+		}
+		working_size += bucket_working_size(buckets[i]);
+		map->buckets[pos] = buckets[i];
+		buckets[i] = NULL;
+	}
+	for (i = 0; i < rule_count; i++) {
+		pos = rule_positions[i];
+		if (pos < (int)map->max_rules)
+			crush_destroy_rule(map->rules[pos]);
+		map->rules[pos] = rules[i];
+		rules[i] = NULL;
+	}
+	if (target.max_buckets < map->max_buckets) {
+		/* shrinking may fail and keep the larger array */
+		struct crush_bucket **shrunk = realloc(map->buckets,
+			sizeof(struct crush_bucket *) * (target.max_buckets + 1));
+		if (shrunk)
+			map->buckets = shrunk;
+	}
+
+	target.buckets = map->buckets;
+	target.rules = map->rules;
+	target.working_size = working_size;
+	target.fingerprint = fingerprint;
+	*map = target;
+
+	if (mode != CHOOSE_ARGS_KEEP) {
+		if (*choose_args)
+			crush_destroy_choose_args(*choose_args);
+		*choose_args = new_args;
+		new_args = NULL;
+	}
+	err = 0;
+out:
+	for (i = 0; buckets && i < bucket_count; i++)
+		if (buckets[i])
+			crush_destroy_bucket(buckets[i]);
+	for (i = 0; rules && i < rule_count; i++)
+		crush_destroy_rule(rules[i]);
+	for (i = 0; args && i < arg_count; i++)
+		choose_arg_clear(&args[i]);
+	free(buckets);
+	free(rules);
+	free(args);
+	free(bucket_positions);
+	free(rule_positions);
+	free(arg_positions);
+	free(new_args);
+	return err;
+}
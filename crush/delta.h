@@ -0,0 +1,87 @@
+#ifndef CEPH_CRUSH_DELTA_H
+#define CEPH_CRUSH_DELTA_H
+
+/*
+ * Functions to encode the differences between two crush_map and
+ * apply them to a crush_map.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * Encode in __delta__ what must be changed in __old_map__ and
+ * __old_args__ to get __new_map__ and __new_args__: the buckets and the
+ * rules that were added, removed or modified, the tunables and the
+ * choose_args of the buckets that changed. Both maps must have been
+ * finalized with crush_finalize(). The __delta__ is allocated with
+ * __malloc(3)__ and must be freed by the caller. Its content does
+ * not depend on the endianness of the host.
+ *
+ * The __old_args__ and __new_args__ arrays have respectively
+ * __old_map->max_buckets__ and __new_map->max_buckets__ elements, as
+ * returned by crush_make_choose_args(). If both are NULL the delta
+ * does not change the choose_args. If __new_args__ is NULL and
+ * __old_args__ is not, the delta removes them.
+ *
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param old_map the crush_map the delta will be applied to
+ * @param old_args the choose_args of __old_map__ or NULL
+ * @param new_map the crush_map obtained after applying the delta
+ * @param new_args the choose_args of __new_map__ or NULL
+ * @param[out] delta the encoded differences
+ * @param[out] length the size of __delta__ in bytes
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_map_delta_encode(const struct crush_map *old_map,
+				  const struct crush_choose_arg *old_args,
+				  const struct crush_map *new_map,
+				  const struct crush_choose_arg *new_args,
+				  void **delta, size_t *length);
+
+/** @ingroup API
+ *
+ * Apply the __delta__ returned by crush_map_delta_encode() to
+ * __map__. Only the buckets and rules that changed are replaced:
+ * the __map->working_size__, __map->max_devices__ and
+ * __map->fingerprint__ are updated incrementally and
+ * crush_finalize() does not need to be called. The __delta__ is
+ * decoded and checked before __map__ is modified: if an error is
+ * returned, __map__ is left untouched.
+ *
+ * If the delta changes the choose_args, __choose_args__ must not be
+ * NULL. The array it points to, which may be NULL, is replaced by a
+ * new array allocated as crush_make_choose_args() does and the
+ * previous one is deallocated with crush_destroy_choose_args().
+ *
+ * The workspaces initialized with crush_init_workspace() for the
+ * previous version of the __map__ must not be used after the delta
+ * is applied.
+ *
+ * - return -ESTALE if __map__ is not the crush_map the delta was encoded from
+ * - return -EINVAL if __delta__ is not valid, including if a
+ *   choose_arg it contains does not have one id or weight per item
+ *   of its bucket or if its bucket does not exist
+ * - return -EINVAL if the map the delta gives is rejected by
+ *   crush_map_validate(), for instance because a bucket contains an
+ *   item that does not exist, is in a cycle or is a tree without the
+ *   shape of crush_make_tree_bucket(). The fingerprints of a delta
+ *   do not guard against a delta crafted to give such a map.
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param map the crush_map to modify
+ * @param choose_args a pointer to the choose_args of __map__ or NULL
+ * @param delta the encoded differences
+ * @param length the size of __delta__ in bytes
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_map_delta_apply(struct crush_map *map,
+				 struct crush_choose_arg **choose_args,
+				 const void *delta, size_t length);
+
+#endif
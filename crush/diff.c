@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapper.h"
+#include "executor.h"
+#include "pg.h"
+#include "diff.h"
+
+/* the quantile of the standard normal distribution for 95% */
+#define CRUSH_DIFF_Z 1.959963984540054
+
+#define CRUSH_DIFF_GRAIN 256
+
+/* the counts of a worker */
+struct differ {
+	void *old_cwin;
+	void *new_cwin;
+	int moved;
+	__u64 replicas_moved;
+	__u64 *device_in;   /* [max_devices] or NULL */
+	__u64 *device_out;  /* [max_devices] or NULL */
+};
+
+struct comparison {
+	const struct crush_map *old_map;
+	const struct crush_map *new_map;
+	const struct crush_diff_params *params;
+	int positional;     /* the shards of an indep rule */
+	int max_devices;
+	struct differ *differs; /* [workers] */
+};
+
+static int contains(const int *result, int size, int item)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		if (result[i] == item)
+			return 1;
+	return 0;
+}
+
+static void count(const struct comparison *c, __u64 *devices, int device)
+{
+	if (devices != NULL && device >= 0 && device < c->max_devices)
+		devices[device]++;
+}
+
+/* compare the mappings of the PGs, or the samples, [begin, end[ */
+static void diff(void *arg, int worker, __s64 begin, __s64 end)
+{
+	const struct comparison *c = arg;
+	const struct crush_diff_params *params = c->params;
+	struct differ *d = &c->differs[worker];
+	const int result_max = params->result_max;
+	int old_result[result_max], new_result[result_max];
+	int i, j;
+
+	for (i = begin; i < end; i++) {
+		int pg = i;
+		int x, old_size, new_size, moved = 0;
+
+		if (params->samples > 0)
+			/* each sample has its own draw, whatever the worker */
+			pg = crush_splitmix64_mix(params->seed + (i + 1) * 0x9e3779b97f4a7c15ULL) %
+				params->pg_num;
+		x = crush_pg_seed(params->pool, pg);
+		old_size = crush_do_rule(c->old_map, params->ruleno, x, old_result, result_max,
+					 params->old_weights, params->old_weight_max,
+					 d->old_cwin, NULL);
+		new_size = crush_do_rule(c->new_map, params->ruleno, x, new_result, result_max,
+					 params->new_weights, params->new_weight_max,
+					 d->new_cwin, NULL);
+		for (j = 0; j < new_size; j++) {
+			int item = new_result[j];
+
+			if (item == CRUSH_ITEM_NONE)
+				continue;
+			if (c->positional ? j < old_size && old_result[j] == item :
+			    contains(old_result, old_size, item))
+				continue;
+			moved = 1;
+			d->replicas_moved++;
+			count(c, d->device_in, item);
+		}
+		for (j = 0; j < old_size; j++) {
+			int item = old_result[j];
+
+			if (item == CRUSH_ITEM_NONE)
+				continue;
+			if (c->positional ? j < new_size && new_result[j] == item :
+			    contains(new_result, new_size, item))
+				continue;
+			/* a replica lost without a replacement moved too */
+			moved = 1;
+			count(c, d->device_out, item);
+		}
+		d->moved += moved;
+	}
+}
+
+static int check_params(const struct crush_map *old_map,
+			const struct crush_map *new_map,
+			const struct crush_diff_params *params)
+{
+	int ruleno = params->ruleno;
+
+	if (ruleno < 0 ||
+	    (__u32)ruleno >= old_map->max_rules || old_map->rules[ruleno] == NULL ||
+	    (__u32)ruleno >= new_map->max_rules || new_map->rules[ruleno] == NULL)
+		return -EINVAL;
+	if (params->result_max <= 0 || params->pg_num <= 0 || params->samples < 0 ||
+	    params->threads < 0)
+		return -EINVAL;
+	return 0;
+}
+
+static int has_indep_step(const struct crush_rule *rule)
+{
+	__u32 i;
+
+	for (i = 0; i < rule->len; i++)
+		if (rule->steps[i].op == CRUSH_RULE_CHOOSE_INDEP ||
+		    rule->steps[i].op == CRUSH_RULE_CHOOSELEAF_INDEP)
+			return 1;
+	return 0;
+}
+
+/* the Wilson score interval of __moved__ successes out of __n__ */
+static void wilson(int moved, int n, double *low, double *high)
+{
+	double p = (double)moved / n;
+	double z2 = CRUSH_DIFF_Z * CRUSH_DIFF_Z;
+	double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+	double half = CRUSH_DIFF_Z * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n)) / (1 + z2 / n);
+
+	*low = center - half > 0 ? center - half : 0;
+	*high = center + half < 1 ? center + half : 1;
+}
+
+int crush_diff(const struct crush_map *old_map,
+	       const struct crush_map *new_map,
+	       const struct crush_diff_params *params,
+	       struct crush_diff_result *result,
+	       __u64 *device_in, __u64 *device_out)
+{
+	const int max_devices = old_map->max_devices > new_map->max_devices ?
+		old_map->max_devices : new_map->max_devices;
+	const int total = params->samples > 0 ? params->samples : params->pg_num;
+	struct crush_executor *executor = params->executor;
+	struct comparison c;
+	int n = 0, err, t, i;
+
+	err = check_params(old_map, new_map, params);
+	if (err < 0)
+		return err;
+	if (executor == NULL && params->threads > 1) {
+		err = crush_executor_create(params->threads < total ? params->threads : total,
+					    &executor);
+		if (err < 0)
+			return err;
+	}
+	n = crush_executor_workers(executor);
+	c.old_map = old_map;
+	c.new_map = new_map;
+	c.params = params;
+	c.positional = has_indep_step(new_map->rules[params->ruleno]);
+	c.max_devices = max_devices;
+	c.differs = calloc(n, sizeof(*c.differs));
+	if (c.differs == NULL) {
+		err = -ENOMEM;
+		n = 0;
+		goto out;
+	}
+	for (t = 0; t < n; t++) {
+		struct differ *d = &c.differs[t];
+
+		d->old_cwin = malloc(crush_work_size(old_map, params->result_max));
+		d->new_cwin = malloc(crush_work_size(new_map, params->result_max));
+		if (device_in != NULL)
+			d->device_in = calloc(max_devices + 1, sizeof(__u64));
+		if (device_out != NULL)
+			d->device_out = calloc(max_devices + 1, sizeof(__u64));
+		if (d->old_cwin == NULL || d->new_cwin == NULL ||
+		    (device_in != NULL && d->device_in == NULL) ||
+		    (device_out != NULL && d->device_out == NULL)) {
+			err = -ENOMEM;
+			goto out;
+		}
+		crush_init_workspace(old_map, d->old_cwin);
+		crush_init_workspace(new_map, d->new_cwin);
+	}
+	err = crush_parallel_for(executor, total, CRUSH_DIFF_GRAIN, diff, &c);
+	if (err < 0)
+		goto out;
+
+	memset(result, '\0', sizeof(*result));
+	if (device_in != NULL)
+		memset(device_in, '\0', sizeof(__u64) * max_devices);
+	if (device_out != NULL)
+		memset(device_out, '\0', sizeof(__u64) * max_devices);
+	for (t = 0; t < n; t++) {
+		const struct differ *d = &c.differs[t];
+
+		result->moved += d->moved;
+		result->replicas_moved += d->replicas_moved;
+		for (i = 0; i < max_devices; i++) {
+			if (device_in != NULL)
+				device_in[i] += d->device_in[i];
+			if (device_out != NULL)
+				device_out[i] += d->device_out[i];
+		}
+	}
+	result->pgs = total;
+	result->moved_ratio = (double)result->moved / total;
+	if (params->samples > 0) {
+		wilson(result->moved, total, &result->moved_low, &result->moved_high);
+	} else {
+		result->moved_low = result->moved_ratio;
+		result->moved_high = result->moved_ratio;
+	}
+out:
+	for (t = 0; t < n; t++) {
+		free(c.differs[t].old_cwin);
+		free(c.differs[t].new_cwin);
+		free(c.differs[t].device_in);
+		free(c.differs[t].device_out);
+	}
+	free(c.differs);
+	if (executor != params->executor)
+		crush_executor_destroy(executor);
+	return err;
+}
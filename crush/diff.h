@@ -0,0 +1,105 @@
+#ifndef CEPH_CRUSH_DIFF_H
+#define CEPH_CRUSH_DIFF_H
+
+/*
+ * Compare the mappings of the PGs of a pool with two crush_maps, or
+ * two weight vectors, to tell how much data a change moves.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+#include "executor.h"
+
+/** @ingroup API
+ * The parameters of crush_diff().
+ */
+struct crush_diff_params {
+	int ruleno;              /*!< the rule, as given to crush_do_rule(), in both maps */
+	int result_max;          /*!< the number of replicas of each PG */
+	const __u32 *old_weights; /*!< as given to crush_do_rule() with the old map */
+	int old_weight_max;      /*!< as given to crush_do_rule() with the old map */
+	const __u32 *new_weights; /*!< as given to crush_do_rule() with the new map */
+	int new_weight_max;      /*!< as given to crush_do_rule() with the new map */
+	int pool;                /*!< the pool the PGs belong to */
+	int pg_num;              /*!< the number of PGs in the pool */
+	/*! 0 to compare all PGs, otherwise the number of PGs drawn at random */
+	int samples;
+	__u64 seed;              /*!< the seed of the PGs drawn */
+	/*! number of threads mapping the PGs, 0 or 1 for the calling thread only */
+	int threads;
+	/*! the executor that maps the PGs with both maps, instead of __threads__, or NULL */
+	struct crush_executor *executor;
+};
+
+/** @ingroup API
+ * The outcome of crush_diff().
+ */
+struct crush_diff_result {
+	int pgs;                 /*!< the number of PGs compared */
+	int moved;               /*!< the PGs compared with at least one replica moved */
+	__u64 replicas_moved;    /*!< the replicas of the PGs compared that moved */
+	/*! the fraction of the PGs of the pool that moved, estimated if sampled */
+	double moved_ratio;
+	/*! the lower bound of the 95% confidence interval of __moved_ratio__ */
+	double moved_low;
+	/*! the upper bound of the 95% confidence interval of __moved_ratio__ */
+	double moved_high;
+};
+
+/** @ingroup API
+ *
+ * Map the PGs of __params->pool__ with __old_map__ and
+ * __params->old_weights__, then with __new_map__ and
+ * __params->new_weights__, and count the replicas that moved. The
+ * seed of each PG is computed as Ceph does, like
+ * crush_simulate_fill().
+ *
+ * If the rule of __new_map__ has an indep step, the replicas are
+ * erasure coded shards and a shard moves when the device at its
+ * position changes. Otherwise a replica moves when its device is
+ * not in the old mapping of the PG, wherever it is.
+ *
+ * When __params->samples__ is zero all PGs are compared, the result
+ * is exact and __moved_low__ and __moved_high__ are equal to
+ * __moved_ratio__. Otherwise
+ * __params->samples__ PGs are drawn with replacement, according to
+ * __params->seed__, and __moved_low__ and __moved_high__ are the
+ * Wilson score interval of the fraction of PGs moved.
+ *
+ * Each PG, or sample, is mapped with both maps by one of the workers
+ * of __params->executor__ (or of an executor of at most
+ * __params->threads__ threads created for the call when it is NULL),
+ * in two workspaces of its own, and the counts of the workers are
+ * added at the end. Sample __i__ is drawn from __params->seed__ and
+ * __i__ alone, so the result does not depend on the number of
+ * workers.
+ *
+ * If __device_in__ is not NULL, it is set to the number of replicas
+ * each device receives. If __device_out__ is not NULL, it is set to
+ * the number of replicas each device loses. Both have room for the
+ * largest __max_devices__ of the two maps and count the PGs
+ * compared, not the PGs of the pool when sampled.
+ *
+ * - return -EINVAL if the parameters are not valid or the rule is
+ *   not in both maps
+ * - return -ENOMEM if __malloc(3)__ fails
+ * - return -EAGAIN if a thread cannot be created
+ * - return the error of __params->executor->parallel_for__
+ *
+ * @param old_map the crush_map before the change
+ * @param new_map the crush_map after the change, may be __old_map__
+ * @param params the parameters of the comparison
+ * @param[out] result the outcome of the comparison
+ * @param[out] device_in an array of replicas received per device or NULL
+ * @param[out] device_out an array of replicas lost per device or NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_diff(const struct crush_map *old_map,
+		      const struct crush_map *new_map,
+		      const struct crush_diff_params *params,
+		      struct crush_diff_result *result,
+		      __u64 *device_in, __u64 *device_out);
+
+#endif
@@ -0,0 +1,242 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "executor.h"
+
+/* the indices a worker has left, stolen from the end by the others */
+struct range {
+	pthread_mutex_t lock;
+	__s64 begin;
+	__s64 end;
+};
+
+struct pool {
+	struct crush_executor executor;
+	pthread_mutex_t loop;        /* held while a loop runs */
+	pthread_mutex_t lock;        /* protects the fields below */
+	pthread_cond_t start;
+	pthread_cond_t finished;
+	__u64 generation;            /* incremented when a loop starts */
+	int stopping;
+	int running;                 /* the threads that did not finish the loop */
+	__s64 grain;
+	crush_parallel_body body;
+	void *arg;
+	int threads;                 /* the threads started */
+	pthread_t *ids;
+	struct range *ranges;        /* [workers] */
+};
+
+struct thread {
+	struct pool *pool;
+	int worker;
+};
+
+/* take a chunk of __grain__ indices at the beginning of __r__ */
+static int take(struct range *r, __s64 grain, __s64 *begin, __s64 *end)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->begin < r->end) {
+		*begin = r->begin;
+		*end = r->end - r->begin > grain ? r->begin + grain : r->end;
+		r->begin = *end;
+		found = 1;
+	}
+	pthread_mutex_unlock(&r->lock);
+	return found;
+}
+
+/*
+ * Take the second half of the indices of the first worker that has
+ * some left, starting after __worker__, and run them as if they were
+ * those of __worker__.
+ */
+static int steal(struct pool *pool, int worker, __s64 *begin, __s64 *end)
+{
+	const int workers = pool->executor.workers;
+	int i;
+
+	for (i = 1; i < workers; i++) {
+		struct range *victim = &pool->ranges[(worker + i) % workers];
+		__s64 left, stolen;
+
+		pthread_mutex_lock(&victim->lock);
+		left = victim->end - victim->begin;
+		if (left <= 0) {
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		stolen = left > pool->grain ? left / 2 : left;
+		*begin = victim->end - stolen;
+		*end = victim->end;
+		victim->end = *begin;
+		pthread_mutex_unlock(&victim->lock);
+		if (stolen > pool->grain) {
+			/* keep what exceeds a chunk for the others to steal */
+			struct range *own = &pool->ranges[worker];
+
+			pthread_mutex_lock(&own->lock);
+			own->begin = *begin + pool->grain;
+			own->end = *end;
+			pthread_mutex_unlock(&own->lock);
+			*end = *begin + pool->grain;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static void run(struct pool *pool, int worker)
+{
+	__s64 begin, end;
+
+	while (take(&pool->ranges[worker], pool->grain, &begin, &end) ||
+	       steal(pool, worker, &begin, &end))
+		pool->body(pool->arg, worker, begin, end);
+}
+
+static void *work(void *arg)
+{
+	struct thread *t = arg;
+	struct pool *pool = t->pool;
+	__u64 seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->generation == seen && !pool->stopping)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->stopping)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+		run(pool, t->worker);
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->finished);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(t);
+	return NULL;
+}
+
+static int pool_parallel_for(struct crush_executor *executor, __s64 count, __s64 grain,
+			     crush_parallel_body body, void *arg)
+{
+	struct pool *pool = executor->arg;
+	const int workers = executor->workers;
+	int w;
+
+	if (count <= 0)
+		return 0;
+	if (grain <= 0) {
+		/* a few chunks per worker before stealing */
+		grain = count / (workers * 8);
+		if (grain < 1)
+			grain = 1;
+	}
+	pthread_mutex_lock(&pool->loop);
+	for (w = 0; w < workers; w++) {
+		pool->ranges[w].begin = count * w / workers;
+		pool->ranges[w].end = count * (w + 1) / workers;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->grain = grain;
+	pool->body = body;
+	pool->arg = arg;
+	pool->running = pool->threads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	run(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->finished, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->loop);
+	return 0;
+}
+
+int crush_executor_create(int threads, struct crush_executor **executor)
+{
+	struct pool *pool;
+	int w;
+
+	if (threads < 1)
+		return -EINVAL;
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return -ENOMEM;
+	pool->ids = calloc(threads, sizeof(pthread_t));
+	pool->ranges = calloc(threads, sizeof(struct range));
+	if (pool->ids == NULL || pool->ranges == NULL) {
+		free(pool->ids);
+		free(pool->ranges);
+		free(pool);
+		return -ENOMEM;
+	}
+	pool->executor.parallel_for = pool_parallel_for;
+	pool->executor.workers = threads;
+	pool->executor.arg = pool;
+	pthread_mutex_init(&pool->loop, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+	for (w = 0; w < threads; w++)
+		pthread_mutex_init(&pool->ranges[w].lock, NULL);
+	/* worker 0 is the thread that runs the loop */
+	for (w = 1; w < threads; w++) {
+		struct thread *t = malloc(sizeof(*t));
+
+		if (t == NULL) {
+			crush_executor_destroy(&pool->executor);
+			return -ENOMEM;
+		}
+		t->pool = pool;
+		t->worker = w;
+		if (pthread_create(&pool->ids[pool->threads], NULL, work, t) != 0) {
+			free(t);
+			crush_executor_destroy(&pool->executor);
+			return -EAGAIN;
+		}
+		pool->threads++;
+	}
+	*executor = &pool->executor;
+	return 0;
+}
+
+void crush_executor_destroy(struct crush_executor *executor)
+{
+	struct pool *pool = executor->arg;
+	int t;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (t = 0; t < pool->threads; t++)
+		pthread_join(pool->ids[t], NULL);
+	for (t = 0; t < executor->workers; t++)
+		pthread_mutex_destroy(&pool->ranges[t].lock);
+	pthread_cond_destroy(&pool->finished);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->loop);
+	free(pool->ranges);
+	free(pool->ids);
+	free(pool);
+}
+
+int crush_parallel_for(struct crush_executor *executor, __s64 count, __s64 grain,
+		       crush_parallel_body body, void *arg)
+{
+	if (executor != NULL)
+		return executor->parallel_for(executor, count, grain, body, arg);
+	if (count > 0)
+		body(arg, 0, 0, count);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef CEPH_CRUSH_EXECUTOR_H
+#define CEPH_CRUSH_EXECUTOR_H
+
+/*
+ * Run the parallel loops of the library on a pool of threads, the
+ * default work stealing pool or one provided by the caller.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * The body of a parallel loop, called for the indices [__begin__,
+ * __end__[ by __worker__, in [0, executor->workers[. A worker runs
+ * one chunk at a time: __worker__ can index state private to the
+ * worker, such as a crush_do_rule() workspace.
+ */
+typedef void (*crush_parallel_body)(void *arg, int worker, __s64 begin, __s64 end);
+
+/** @ingroup API
+ *
+ * An executor of parallel loops. crush_executor_create() returns the
+ * default one. To run the loops of the library on another thread
+ * pool, fill a crush_executor with a __parallel_for__ function that
+ * submits the chunks to the pool and pass it to the functions that
+ * take one.
+ */
+struct crush_executor {
+	/*! call __body__ on chunks covering [0, __count__[, of about
+	    __grain__ indices, and return once they all returned. Return
+	    0 on success or < 0 if the chunks cannot be run, in which
+	    case none of them runs */
+	int (*parallel_for)(struct crush_executor *executor, __s64 count, __s64 grain,
+			    crush_parallel_body body, void *arg);
+	/*! the number of distinct workers given to the bodies, >= 1 */
+	int workers;
+	/*! for the implementation of __parallel_for__ */
+	void *arg;
+};
+
+/** @ingroup API
+ *
+ * Create the default executor, with __threads__ workers: the thread
+ * calling crush_parallel_for() and __threads__ - 1 threads started
+ * now. Each worker starts with an equal share of the indices and
+ * takes __grain__ indices at a time from it, then steals half of
+ * what is left to another worker. An executor runs one loop at a
+ * time: concurrent calls to crush_parallel_for() wait for their
+ * turn. It must be deallocated with crush_executor_destroy().
+ *
+ * - return -EINVAL if __threads__ < 1
+ * - return -ENOMEM if __malloc(3)__ fails
+ * - return -EAGAIN if a thread cannot be created
+ *
+ * @param threads the number of workers
+ * @param[out] executor the executor
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_executor_create(int threads, struct crush_executor **executor);
+
+/** @ingroup API
+ *
+ * Stop the threads of an executor returned by
+ * crush_executor_create() and deallocate it. No loop must be
+ * running.
+ *
+ * @param executor the executor
+ */
+extern void crush_executor_destroy(struct crush_executor *executor);
+
+/** @ingroup API
+ *
+ * Run __body__ on the indices [0, __count__[ with
+ * __executor->parallel_for__, or in a single call on the calling
+ * thread if __executor__ is NULL.
+ *
+ * @param executor the executor or NULL
+ * @param count the number of indices
+ * @param grain a hint of the number of indices per chunk, 0 for a default
+ * @param body the body of the loop
+ * @param arg the first argument of __body__
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_parallel_for(struct crush_executor *executor, __s64 count, __s64 grain,
+			      crush_parallel_body body, void *arg);
+
+/** @ingroup API
+ *
+ * The number of workers of __executor__, 1 if it is NULL.
+ */
+static inline int crush_executor_workers(const struct crush_executor *executor)
+{
+	return executor != NULL ? executor->workers : 1;
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "hash.h"
+#include "generator.h"
+
+void crush_generator_init(struct crush_generator *generator)
+{
+	static const struct crush_generator_level levels[] = {
+		{ CRUSH_GENERATOR_DATACENTER, 1, CRUSH_BUCKET_STRAW2 },
+		{ CRUSH_GENERATOR_ROOM, 1, CRUSH_BUCKET_STRAW2 },
+		{ CRUSH_GENERATOR_RACK, 4, CRUSH_BUCKET_STRAW2 },
+		{ CRUSH_GENERATOR_HOST, 8, CRUSH_BUCKET_STRAW2 },
+	};
+
+	memset(generator, 0, sizeof(*generator));
+	generator->root_type = CRUSH_GENERATOR_ROOT;
+	generator->root_alg = CRUSH_BUCKET_STRAW2;
+	generator->level_count = sizeof(levels) / sizeof(levels[0]);
+	memcpy(generator->levels, levels, sizeof(levels));
+	generator->devices = 8;
+	generator->device_weight = 0x10000;
+	generator->failure_domain = CRUSH_GENERATOR_HOST;
+}
+
+/*
+ * Set __counts[l]__ to the number of buckets of level __l__, the root
+ * being level 0 and the devices level __level_count__ + 1.
+ */
+static int level_counts(const struct crush_generator *g, __s64 *counts)
+{
+	int l;
+
+	if (g->level_count < 0 || g->level_count > CRUSH_GENERATOR_MAX_LEVELS ||
+	    g->devices < 1)
+		return -EINVAL;
+	counts[0] = 1;
+	for (l = 0; l <= g->level_count; l++) {
+		int count = l < g->level_count ? g->levels[l].count : g->devices;
+
+		if (count < 1)
+			return -EINVAL;
+		counts[l + 1] = counts[l] * count;
+		if (counts[l + 1] > INT_MAX)
+			return -E2BIG;
+	}
+	return 0;
+}
+
+/* the level of the buckets of type __type__, level_count + 1 for devices */
+static int type_level(const struct crush_generator *g, int type)
+{
+	int l;
+
+	if (type == 0)
+		return g->level_count + 1;
+	if (type == g->root_type)
+		return 0;
+	for (l = 0; l < g->level_count; l++)
+		if (g->levels[l].type == type)
+			return l + 1;
+	return -EINVAL;
+}
+
+long crush_generator_count(const struct crush_generator *generator, int type)
+{
+	__s64 counts[CRUSH_GENERATOR_MAX_LEVELS + 2];
+	int level, r;
+
+	r = level_counts(generator, counts);
+	if (r < 0)
+		return r;
+	level = type_level(generator, type);
+	if (level < 0)
+		return level;
+	return counts[level];
+}
+
+static int valid_alg(int alg)
+{
+	return alg >= CRUSH_BUCKET_UNIFORM && alg <= CRUSH_BUCKET_STRAW2;
+}
+
+static int add_rules(struct crush_map *map, const struct crush_generator *g)
+{
+	struct crush_rule *rule;
+	int op = g->failure_domain == 0 ? CRUSH_RULE_CHOOSE_FIRSTN : CRUSH_RULE_CHOOSELEAF_FIRSTN;
+	int r;
+
+	rule = crush_make_rule(3, CRUSH_GENERATOR_REPLICATED_RULE, 1, 1, 10);
+	if (rule == NULL)
+		return -ENOMEM;
+	crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, -1, 0);
+	crush_rule_set_step(rule, 1, op, CRUSH_CHOOSE_N, g->failure_domain);
+	crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+	r = crush_add_rule(map, rule, CRUSH_GENERATOR_REPLICATED_RULE);
+	if (r < 0) {
+		crush_destroy_rule(rule);
+		return r;
+	}
+	if (!g->ec)
+		return 0;
+
+	op = g->failure_domain == 0 ? CRUSH_RULE_CHOOSE_INDEP : CRUSH_RULE_CHOOSELEAF_INDEP;
+	rule = crush_make_rule(5, CRUSH_GENERATOR_EC_RULE, 3, 3, 20);
+	if (rule == NULL)
+		return -ENOMEM;
+	crush_rule_set_step(rule, 0, CRUSH_RULE_SET_CHOOSELEAF_TRIES, 5, 0);
+	crush_rule_set_step(rule, 1, CRUSH_RULE_SET_CHOOSE_TRIES, 100, 0);
+	crush_rule_set_step(rule, 2, CRUSH_RULE_TAKE, -1, 0);
+	crush_rule_set_step(rule, 3, op, CRUSH_CHOOSE_N, g->failure_domain);
+	crush_rule_set_step(rule, 4, CRUSH_RULE_EMIT, 0, 0);
+	r = crush_add_rule(map, rule, CRUSH_GENERATOR_EC_RULE);
+	if (r < 0) {
+		crush_destroy_rule(rule);
+		return r;
+	}
+	return 0;
+}
+
+int crush_generate(const struct crush_generator *generator, struct crush_map **mapout)
+{
+	const struct crush_generator *g = generator;
+	__s64 counts[CRUSH_GENERATOR_MAX_LEVELS + 2];
+	__s64 offsets[CRUSH_GENERATOR_MAX_LEVELS + 2];
+	struct crush_map *map;
+	int *weights = NULL, *parent_weights = NULL, *items = NULL;
+	int devices_level = g->level_count + 1;
+	int l, r;
+	__s64 i, j;
+
+	r = level_counts(g, counts);
+	if (r < 0)
+		return r;
+	if (!valid_alg(g->root_alg) || type_level(g, g->failure_domain) < 0 ||
+	    g->device_weight < 0 || !(g->weight_spread >= 0 && g->weight_spread <= 1))
+		return -EINVAL;
+	for (l = 0; l < g->level_count; l++)
+		if (!valid_alg(g->levels[l].alg))
+			return -EINVAL;
+	/* the weight of the root must fit, as the sum of the weights of the devices */
+	if (counts[devices_level] * (g->device_weight * (1 + g->weight_spread)) > INT_MAX)
+		return -E2BIG;
+	offsets[0] = 0;
+	for (l = 1; l <= devices_level; l++) {
+		offsets[l] = offsets[l - 1] + counts[l - 1];
+		if (offsets[l] > INT_MAX)
+			return -E2BIG;
+	}
+
+	map = crush_create();
+	if (map == NULL)
+		return -ENOMEM;
+	/* all buckets at once rather than growing the array in crush_add_bucket() */
+	map->buckets = calloc(offsets[devices_level], sizeof(map->buckets[0]));
+	weights = malloc(sizeof(int) * counts[devices_level]);
+	if (map->buckets == NULL || weights == NULL) {
+		r = -ENOMEM;
+		goto out;
+	}
+	map->max_buckets = offsets[devices_level];
+
+	for (i = 0; i < counts[devices_level]; i++) {
+		double u = crush_hash32_2(CRUSH_HASH_RJENKINS1, i, g->seed) / 4294967296.0;
+
+		weights[i] = llround(g->device_weight * (1 + g->weight_spread * (2 * u - 1)));
+	}
+
+	/* from the buckets containing devices up to the root */
+	for (l = devices_level - 1; l >= 0; l--) {
+		int size = l < g->level_count ? g->levels[l].count : g->devices;
+		int alg = l == 0 ? g->root_alg : g->levels[l - 1].alg;
+		int type = l == 0 ? g->root_type : g->levels[l - 1].type;
+
+		free(items);
+		items = malloc(sizeof(int) * size);
+		parent_weights = malloc(sizeof(int) * counts[l]);
+		if (items == NULL || parent_weights == NULL) {
+			r = -ENOMEM;
+			goto out;
+		}
+		for (i = 0; i < counts[l]; i++) {
+			struct crush_bucket *bucket;
+
+			for (j = 0; j < size; j++) {
+				__s64 child = i * size + j;
+
+				items[j] = l + 1 == devices_level ? child : -1 - (offsets[l + 1] + child);
+			}
+			bucket = crush_make_bucket(map, alg, CRUSH_HASH_DEFAULT, type, size,
+						   items, weights + i * size);
+			if (bucket == NULL) {
+				r = -ENOMEM;
+				goto out;
+			}
+			r = crush_add_bucket(map, -1 - (offsets[l] + i), bucket, NULL);
+			if (r < 0) {
+				crush_destroy_bucket(bucket);
+				goto out;
+			}
+			parent_weights[i] = bucket->weight;
+		}
+		free(weights);
+		weights = parent_weights;
+		parent_weights = NULL;
+	}
+
+	r = add_rules(map, g);
+	if (r < 0)
+		goto out;
+	crush_finalize(map);
+	*mapout = map;
+	map = NULL;
+out:
+	free(items);
+	free(weights);
+	free(parent_weights);
+	if (map != NULL)
+		crush_destroy(map);
+	return r;
+}
+
+long crush_generator_out(const struct crush_generator *generator, int type,
+			 double fraction, __u32 seed, __u32 *weights, int weight_max)
+{
+	__s64 counts[CRUSH_GENERATOR_MAX_LEVELS + 2];
+	__s64 n, k, per, i, j;
+	int *order;
+	int level, r;
+
+	r = level_counts(generator, counts);
+	if (r < 0)
+		return r;
+	level = type_level(generator, type);
+	if (level < 0)
+		return level;
+	if (!(fraction >= 0 && fraction <= 1) ||
+	    weight_max < counts[generator->level_count + 1])
+		return -EINVAL;
+	n = counts[level];
+	per = counts[generator->level_count + 1] / n;
+	k = llround(fraction * n);
+	order = malloc(sizeof(int) * n);
+	if (order == NULL)
+		return -ENOMEM;
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	/* the first k of a pseudo-random permutation */
+	for (i = 0; i < k; i++) {
+		__s64 swap = i + crush_hash32_3(CRUSH_HASH_RJENKINS1, i, n, seed) % (n - i);
+		int tmp = order[i];
+
+		order[i] = order[swap];
+		order[swap] = tmp;
+	}
+	for (i = 0; i < weight_max; i++)
+		weights[i] = 0x10000;
+	for (i = 0; i < k; i++)
+		for (j = 0; j < per; j++)
+			weights[order[i] * per + j] = 0;
+	free(order);
+	return k * per;
+}
@@ -0,0 +1,148 @@
+#ifndef CEPH_CRUSH_GENERATOR_H
+#define CEPH_CRUSH_GENERATOR_H
+
+/*
+ * Build synthetic hierarchies for tests, benchmarks and simulations.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ * The maximum number of bucket levels below the root.
+ */
+#define CRUSH_GENERATOR_MAX_LEVELS 8
+
+/** @ingroup API
+ * The bucket types of crush_generator_init(), as in Ceph.
+ */
+enum crush_generator_type {
+	CRUSH_GENERATOR_OSD = 0,
+	CRUSH_GENERATOR_HOST = 1,
+	CRUSH_GENERATOR_RACK = 3,
+	CRUSH_GENERATOR_ROOM = 7,
+	CRUSH_GENERATOR_DATACENTER = 8,
+	CRUSH_GENERATOR_ROOT = 10
+};
+
+/** @ingroup API
+ * The rules created by crush_generate().
+ */
+enum crush_generator_rule {
+	CRUSH_GENERATOR_REPLICATED_RULE = 0, /*!< chooseleaf firstn */
+	CRUSH_GENERATOR_EC_RULE = 1          /*!< chooseleaf indep, if __ec__ is set */
+};
+
+/** @ingroup API
+ * A level of buckets of the hierarchy.
+ */
+struct crush_generator_level {
+	int type;  /*!< the type of the buckets */
+	int count; /*!< the number of buckets in each bucket of the level above */
+	int alg;   /*!< the algorithm of the buckets, CRUSH_BUCKET_STRAW2 etc. */
+};
+
+/** @ingroup API
+ * The description of a hierarchy, see crush_generate().
+ */
+struct crush_generator {
+	int root_type;  /*!< the type of the root bucket */
+	int root_alg;   /*!< the algorithm of the root bucket */
+	/*! the number of levels between the root and the devices */
+	int level_count;
+	/*! the levels, from the one below the root to the one containing devices */
+	struct crush_generator_level levels[CRUSH_GENERATOR_MAX_LEVELS];
+	int devices;        /*!< the number of devices in each bucket of the last level */
+	int device_weight;  /*!< the mean weight of a device, in 16.16 fixed point */
+	/*! device weights are drawn uniformly in
+	    __device_weight__ * [1 - __weight_spread__, 1 + __weight_spread__] */
+	double weight_spread;
+	__u32 seed;         /*!< the seed of the weights */
+	/*! the type of the buckets the rules separate replicas into */
+	int failure_domain;
+	int ec;             /*!< if not zero, also create CRUSH_GENERATOR_EC_RULE */
+};
+
+/** @ingroup API
+ *
+ * Set __generator__ to a hierarchy with a straw2 root containing one
+ * datacenter, containing one room, containing 4 racks, containing 8
+ * hosts each, containing 8 devices of weight 1 each, and replicas
+ * separated by host. All buckets are straw2.
+ *
+ * @param generator the description to initialize
+ */
+extern void crush_generator_init(struct crush_generator *generator);
+
+/** @ingroup API
+ *
+ * Return the number of buckets of type __type__ in the hierarchy
+ * described by __generator__, the number of devices if __type__ is
+ * zero.
+ *
+ * - return -EINVAL if no level has type __type__
+ *
+ * @param generator the description of the hierarchy
+ * @param type a bucket type or 0
+ *
+ * @returns the number of items of type __type__ on success, < 0 on error
+ */
+extern long crush_generator_count(const struct crush_generator *generator, int type);
+
+/** @ingroup API
+ *
+ * Create the crush_map described by __generator__. The root has id
+ * -1 and the buckets are numbered in breadth first order, one level
+ * after the other: the first host is immediately after the last
+ * rack, and the buckets of a level are in the order of their
+ * parents. The devices are numbered from 0 in the order of their
+ * hosts, the devices of a given bucket have consecutive ids. The
+ * map has the CRUSH_GENERATOR_REPLICATED_RULE rule and, if
+ * __generator->ec__ is set, the CRUSH_GENERATOR_EC_RULE rule with
+ * the tries of the Ceph erasure code rules. The map is finalized
+ * with crush_finalize() and must be deallocated with crush_destroy().
+ *
+ * The buckets are allocated once, in a single pass, so that maps
+ * with millions of devices are created quickly. Uniform buckets use
+ * the weight of their first item for all items.
+ *
+ * - return -EINVAL if a count or an algorithm is invalid or the
+ *   failure domain is not the type of a level or of the devices
+ * - return -E2BIG if the hierarchy has more than 2^31 items
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param generator the description of the hierarchy
+ * @param[out] map the crush_map created
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_generate(const struct crush_generator *generator, struct crush_map **map);
+
+/** @ingroup API
+ *
+ * Set __weights__, as given to crush_do_rule(), so that
+ * round(__fraction__ * N) of the N buckets of type __type__ (or
+ * devices if __type__ is zero) of the hierarchy created by
+ * crush_generate() are out. The buckets are chosen pseudo-randomly
+ * according to __seed__. All devices of a bucket out are out, all
+ * other devices are in (0x10000). For instance a __type__ of
+ * CRUSH_GENERATOR_HOST simulates failed hosts.
+ *
+ * - return -EINVAL if no level has type __type__, __fraction__ is
+ *   not in [0,1] or __weight_max__ is lower than the number of devices
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param generator the description of the hierarchy
+ * @param type the type of the buckets to mark out or 0 for devices
+ * @param fraction the fraction of buckets out
+ * @param seed the seed of the choice of buckets
+ * @param[out] weights an array of __weight_max__ weights
+ * @param weight_max the size of __weights__
+ *
+ * @returns the number of devices out on success, < 0 on error
+ */
+extern long crush_generator_out(const struct crush_generator *generator, int type,
+				double fraction, __u32 seed, __u32 *weights, int weight_max);
+
+#endif
@@ -1,5 +1,8 @@
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "builder.h"
 #include "helpers.h"
 
 int crush_find_roots(struct crush_map *map, int **buckets)
@@ -39,3 +42,326 @@ int crush_find_roots(struct crush_map *map, int **buckets)
   *buckets = roots;
   return root_count;
 }
+
+static void *duplicate(const void *data, size_t size)
+{
+  void *copy = malloc(size > 0 ? size : 1);
+  if (copy != NULL)
+    memcpy(copy, data, size);
+  return copy;
+}
+
+static struct crush_bucket *copy_bucket(const struct crush_bucket *b)
+{
+  size_t size;
+  switch (b->alg) {
+  case CRUSH_BUCKET_UNIFORM: size = sizeof(struct crush_bucket_uniform); break;
+  case CRUSH_BUCKET_LIST: size = sizeof(struct crush_bucket_list); break;
+  case CRUSH_BUCKET_TREE: size = sizeof(struct crush_bucket_tree); break;
+  case CRUSH_BUCKET_STRAW: size = sizeof(struct crush_bucket_straw); break;
+  case CRUSH_BUCKET_STRAW2: size = sizeof(struct crush_bucket_straw2); break;
+  default: return NULL;
+  }
+  struct crush_bucket *copy = (struct crush_bucket *)calloc(1, size);
+  if (copy == NULL)
+    return NULL;
+  memcpy(copy, b, sizeof(struct crush_bucket));
+  copy->items = (__s32 *)duplicate(b->items, sizeof(__s32) * b->size);
+  int failed = copy->items == NULL;
+  size_t weights_size = sizeof(__u32) * b->size;
+  switch (b->alg) {
+  case CRUSH_BUCKET_UNIFORM:
+    ((struct crush_bucket_uniform *)copy)->item_weight =
+      ((struct crush_bucket_uniform *)b)->item_weight;
+    break;
+  case CRUSH_BUCKET_LIST: {
+    struct crush_bucket_list *from = (struct crush_bucket_list *)b;
+    struct crush_bucket_list *to = (struct crush_bucket_list *)copy;
+    to->item_weights = (__u32 *)duplicate(from->item_weights, weights_size);
+    to->sum_weights = (__u32 *)duplicate(from->sum_weights, weights_size);
+    failed |= to->item_weights == NULL || to->sum_weights == NULL;
+    break;
+  }
+  case CRUSH_BUCKET_TREE: {
+    struct crush_bucket_tree *from = (struct crush_bucket_tree *)b;
+    struct crush_bucket_tree *to = (struct crush_bucket_tree *)copy;
+    to->num_nodes = from->num_nodes;
+    to->node_weights = (__u32 *)duplicate(from->node_weights, sizeof(__u32) * from->num_nodes);
+    failed |= to->node_weights == NULL;
+    break;
+  }
+  case CRUSH_BUCKET_STRAW: {
+    struct crush_bucket_straw *from = (struct crush_bucket_straw *)b;
+    struct crush_bucket_straw *to = (struct crush_bucket_straw *)copy;
+    to->item_weights = (__u32 *)duplicate(from->item_weights, weights_size);
+    to->straws = (__u32 *)duplicate(from->straws, weights_size);
+    failed |= to->item_weights == NULL || to->straws == NULL;
+    break;
+  }
+  case CRUSH_BUCKET_STRAW2: {
+    struct crush_bucket_straw2 *from = (struct crush_bucket_straw2 *)b;
+    struct crush_bucket_straw2 *to = (struct crush_bucket_straw2 *)copy;
+    to->item_weights = (__u32 *)duplicate(from->item_weights, weights_size);
+    failed |= to->item_weights == NULL;
+    break;
+  }
+  }
+  if (failed) {
+    crush_destroy_bucket(copy);
+    return NULL;
+  }
+  return copy;
+}
+
+/*
+ * Return a calloc'ed array of map->max_buckets flags set for the
+ * buckets reachable from the TAKE steps of the @rules, walking the
+ * hierarchy depth first, or NULL if malloc fails. @take_device is
+ * set to the largest device a TAKE step designates.
+ */
+static char *reachable_buckets(const struct crush_map *map,
+                               const int *rules, int rule_count,
+                               int *take_device)
+{
+  char *reachable = (char *)calloc(map->max_buckets + 1, sizeof(char));
+  int *stack = (int *)malloc(sizeof(int) * (map->max_buckets + 1));
+  if (reachable == NULL || stack == NULL) {
+    free(reachable);
+    free(stack);
+    return NULL;
+  }
+  int stack_size = 0;
+  int i, pos;
+  __u32 step;
+  for (i = 0; i < rule_count; i++) {
+    const struct crush_rule *rule = map->rules[rules[i]];
+    for (step = 0; step < rule->len; step++) {
+      if (rule->steps[step].op != CRUSH_RULE_TAKE)
+        continue;
+      int item = rule->steps[step].arg1;
+      if (item >= 0) {
+        if (item > *take_device)
+          *take_device = item;
+        continue;
+      }
+      pos = -1-item;
+      if (pos >= map->max_buckets || map->buckets[pos] == NULL || reachable[pos])
+        continue;
+      reachable[pos] = 1;
+      stack[stack_size++] = pos;
+    }
+  }
+  while (stack_size > 0) {
+    const struct crush_bucket *b = map->buckets[stack[--stack_size]];
+    __u32 j;
+    for (j = 0; j < b->size; j++) {
+      if (b->items[j] >= 0)
+        continue;
+      pos = -1-b->items[j];
+      if (pos >= map->max_buckets || map->buckets[pos] == NULL || reachable[pos])
+        continue;
+      reachable[pos] = 1;
+      stack[stack_size++] = pos;
+    }
+  }
+  free(stack);
+  return reachable;
+}
+
+int crush_map_extract(const struct crush_map *map,
+                      const struct crush_choose_arg *choose_args,
+                      const int *rules, int rule_count,
+                      struct crush_map **extracted,
+                      struct crush_choose_arg **extracted_args)
+{
+  int i, pos;
+  int max_rules = 0;
+  for (i = 0; i < rule_count; i++) {
+    if (rules[i] < 0 || (__u32)rules[i] >= map->max_rules || map->rules[rules[i]] == NULL)
+      return -EINVAL;
+    if (rules[i] + 1 > max_rules)
+      max_rules = rules[i] + 1;
+  }
+
+  int take_device = -1;
+  char *reachable = reachable_buckets(map, rules, rule_count, &take_device);
+  if (reachable == NULL)
+    return -ENOMEM;
+  int max_buckets = 0;
+  for (pos = 0; pos < map->max_buckets; pos++)
+    if (reachable[pos])
+      max_buckets = pos + 1;
+
+  struct crush_map *m = crush_create();
+  if (m == NULL) {
+    free(reachable);
+    return -ENOMEM;
+  }
+  *m = *map;
+  m->buckets = (struct crush_bucket **)calloc(max_buckets + 1, sizeof(struct crush_bucket *));
+  m->max_buckets = max_buckets;
+  m->rules = (struct crush_rule **)calloc(max_rules + 1, sizeof(struct crush_rule *));
+  m->max_rules = max_rules;
+  m->choose_tries = NULL;
+  if (m->buckets == NULL || m->rules == NULL)
+    goto nomem;
+  for (pos = 0; pos < max_buckets; pos++) {
+    if (!reachable[pos])
+      continue;
+    m->buckets[pos] = copy_bucket(map->buckets[pos]);
+    if (m->buckets[pos] == NULL)
+      goto nomem;
+  }
+  for (i = 0; i < rule_count; i++) {
+    const struct crush_rule *rule = map->rules[rules[i]];
+    if (m->rules[rules[i]] != NULL)
+      continue;
+    m->rules[rules[i]] = (struct crush_rule *)duplicate(rule, crush_rule_size(rule->len));
+    if (m->rules[rules[i]] == NULL)
+      goto nomem;
+  }
+  crush_finalize(m);
+  /* a TAKE step may designate a device that is in no bucket */
+  if (take_device >= m->max_devices)
+    m->max_devices = take_device + 1;
+
+  if (choose_args != NULL && extracted_args != NULL) {
+    const struct crush_choose_arg **args =
+      (const struct crush_choose_arg **)calloc(max_buckets + 1, sizeof(struct crush_choose_arg *));
+    if (args == NULL)
+      goto nomem;
+    for (pos = 0; pos < max_buckets; pos++)
+      if (reachable[pos])
+        args[pos] = &choose_args[pos];
+    *extracted_args = crush_pack_choose_args(args, max_buckets);
+    free(args);
+    if (*extracted_args == NULL)
+      goto nomem;
+  }
+  free(reachable);
+  *extracted = m;
+  return 0;
+
+nomem:
+  free(reachable);
+  crush_destroy(m);
+  return -ENOMEM;
+}
+
+/* the bytes of the bucket structure, without the arrays it points to */
+static size_t bucket_header_size(const struct crush_bucket *b)
+{
+  switch (b->alg) {
+  case CRUSH_BUCKET_UNIFORM: return sizeof(struct crush_bucket_uniform);
+  case CRUSH_BUCKET_LIST: return sizeof(struct crush_bucket_list);
+  case CRUSH_BUCKET_TREE: return sizeof(struct crush_bucket_tree);
+  case CRUSH_BUCKET_STRAW: return sizeof(struct crush_bucket_straw);
+  case CRUSH_BUCKET_STRAW2: return sizeof(struct crush_bucket_straw2);
+  default: return sizeof(struct crush_bucket);
+  }
+}
+
+/* the bytes of the arrays other than items and item_weights */
+static size_t bucket_auxiliary_size(const struct crush_bucket *b)
+{
+  switch (b->alg) {
+  case CRUSH_BUCKET_LIST: return sizeof(__u32) * b->size; /* sum_weights */
+  case CRUSH_BUCKET_TREE: return sizeof(__u32) * ((struct crush_bucket_tree *)b)->num_nodes;
+  case CRUSH_BUCKET_STRAW: return sizeof(__u32) * b->size; /* straws */
+  default: return 0;
+  }
+}
+
+/* the bytes of the item_weights array */
+static size_t bucket_weights_size(const struct crush_bucket *b)
+{
+  switch (b->alg) {
+  case CRUSH_BUCKET_LIST:
+  case CRUSH_BUCKET_STRAW:
+  case CRUSH_BUCKET_STRAW2:
+    return sizeof(__u32) * b->size;
+  default:
+    return 0;
+  }
+}
+
+int crush_map_memory_report(const struct crush_map *map,
+                            const struct crush_choose_arg *choose_args,
+                            struct crush_memory_report *report)
+{
+  int pos;
+  __u32 i, p;
+  memset(report, '\0', sizeof(*report));
+
+  int *rules = (int *)malloc(sizeof(int) * (map->max_rules + 1));
+  if (rules == NULL)
+    return -ENOMEM;
+  int rule_count = 0;
+  for (i = 0; i < map->max_rules; i++) {
+    if (map->rules[i] == NULL)
+      continue;
+    rules[rule_count++] = i;
+    report->rules += crush_rule_size(map->rules[i]->len);
+  }
+  int take_device = -1;
+  char *reachable = reachable_buckets(map, rules, rule_count, &take_device);
+  free(rules);
+  if (reachable == NULL)
+    return -ENOMEM;
+
+  report->map = sizeof(struct crush_map) +
+    sizeof(struct crush_bucket *) * map->max_buckets +
+    sizeof(struct crush_rule *) * map->max_rules;
+  for (pos = 0; pos < map->max_buckets; pos++) {
+    const struct crush_bucket *b = map->buckets[pos];
+    if (b == NULL)
+      continue;
+    size_t header = bucket_header_size(b);
+    size_t items = sizeof(__s32) * b->size;
+    size_t weights = bucket_weights_size(b);
+    size_t auxiliary = bucket_auxiliary_size(b);
+    report->bucket_headers += header;
+    report->items += items;
+    report->weights += weights;
+    if (b->alg <= CRUSH_BUCKET_STRAW2)
+      report->auxiliary[b->alg] += auxiliary;
+
+    if (!reachable[pos])
+      report->unreachable_savings += header + items + weights + auxiliary +
+        sizeof(struct crush_work_bucket) + sizeof(__u32) * b->size;
+
+    /* a straw2 bucket has no auxiliary array and needs item_weights */
+    if (b->alg == CRUSH_BUCKET_LIST || b->alg == CRUSH_BUCKET_TREE ||
+        b->alg == CRUSH_BUCKET_STRAW)
+      report->straw2_savings += header + weights + auxiliary -
+        sizeof(struct crush_bucket_straw2) - sizeof(__u32) * b->size;
+  }
+  free(reachable);
+
+  if (choose_args != NULL) {
+    report->choose_args = sizeof(struct crush_choose_arg) * map->max_buckets;
+    for (pos = 0; pos < map->max_buckets; pos++) {
+      const struct crush_choose_arg *arg = &choose_args[pos];
+      const struct crush_bucket *b = map->buckets[pos];
+      report->choose_args += sizeof(__s32) * arg->ids_size;
+      if (arg->ids != NULL && b != NULL && arg->ids_size == b->size &&
+          memcmp(arg->ids, b->items, sizeof(__s32) * b->size) == 0)
+        report->choose_args_savings += sizeof(__s32) * arg->ids_size;
+      for (p = 0; p < arg->weight_set_size; p++) {
+        const struct crush_weight_set *ws = &arg->weight_set[p];
+        size_t size = sizeof(struct crush_weight_set) + sizeof(__u32) * ws->size;
+        report->choose_args += size;
+        if (p > 0 && ws->size == arg->weight_set[p - 1].size &&
+            memcmp(ws->weights, arg->weight_set[p - 1].weights, sizeof(__u32) * ws->size) == 0)
+          report->choose_args_savings += size;
+      }
+    }
+  }
+
+  report->working_size = map->working_size;
+  report->total = report->map + report->bucket_headers + report->items + report->weights +
+    report->rules + report->choose_args;
+  for (i = 0; i <= CRUSH_BUCKET_STRAW2; i++)
+    report->total += report->auxiliary[i];
+  return 0;
+}
@@ -24,4 +24,98 @@
  */
 extern int crush_find_roots(struct crush_map *map, int **buckets);
 
+/** @ingroup API
+ *
+ * Allocate a new crush_map that only contains the __rule_count__
+ * rules listed in __rules__ and the buckets reachable from their
+ * __CRUSH_RULE_TAKE__ steps. The rules and the buckets keep their
+ * identifiers and the tunables are copied: crush_do_rule() returns
+ * the same result with __extracted__ as with __map__ for all the
+ * rules listed. The __max_buckets__ of __extracted__ is one more
+ * than the position of the last bucket reachable, the other
+ * buckets are NULL. The __extracted__ map is finalized with
+ * crush_finalize() and its __working_size__ only accounts for the
+ * buckets it contains.
+ *
+ * If __choose_args__ and __extracted_args__ are not NULL, the
+ * choose_args of the buckets reachable are copied in a new array
+ * allocated as crush_pack_choose_args() does, to be used with
+ * __extracted__. The caller is responsible for deallocating it with
+ * crush_destroy_choose_args().
+ *
+ * The caller is responsible for deallocating __extracted__ with
+ * crush_destroy().
+ *
+ * - return -EINVAL if an element of __rules__ does not designate a rule
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param[in] map the crush_map
+ * @param[in] choose_args the choose_args of __map__ or NULL
+ * @param[in] rules an array of rule numbers
+ * @param[in] rule_count the size of the __rules__ array
+ * @param[out] extracted the new crush_map
+ * @param[out] extracted_args the new choose_args or NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_map_extract(const struct crush_map *map,
+                             const struct crush_choose_arg *choose_args,
+                             const int *rules, int rule_count,
+                             struct crush_map **extracted,
+                             struct crush_choose_arg **extracted_args);
+
+/** @ingroup API
+ * The bytes allocated for a crush_map and its choose_args, as
+ * returned by crush_map_memory_report(). The overhead of
+ * __malloc(3)__ is not included.
+ */
+struct crush_memory_report {
+  /*! the crush_map structure and its arrays of bucket and rule pointers */
+  size_t map;
+  /*! the crush_bucket_* structures */
+  size_t bucket_headers;
+  /*! the __items__ arrays of the buckets */
+  size_t items;
+  /*! the __item_weights__ arrays of the list, straw and straw2 buckets */
+  size_t weights;
+  /*! the __sum_weights__, __node_weights__ and __straws__ arrays,
+      indexed by ::crush_algorithm */
+  size_t auxiliary[CRUSH_BUCKET_STRAW2 + 1];
+  /*! the rules and their steps */
+  size_t rules;
+  /*! the choose_args array, its weight sets and ids */
+  size_t choose_args;
+  /*! __map->working_size__, for each workspace (see crush_work_size()) */
+  size_t working_size;
+  /*! all of the above except __working_size__ */
+  size_t total;
+  /*! saved by converting the list, tree and straw buckets to straw2 */
+  size_t straw2_savings;
+  /*! saved by not storing the choose_args ids that are the same as
+      the bucket items and the weight sets that are the same as the
+      previous position */
+  size_t choose_args_savings;
+  /*! saved by removing the buckets that no rule can reach, as
+      crush_map_extract() does, workspace included */
+  size_t unreachable_savings;
+};
+
+/** @ingroup API
+ *
+ * Fill __report__ with the number of bytes used by each part of
+ * __map__ and __choose_args__, the size of a workspace and how many
+ * bytes could be saved by compacting them.
+ *
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param[in] map the crush_map
+ * @param[in] choose_args the choose_args of __map__ or NULL
+ * @param[out] report the bytes used
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_map_memory_report(const struct crush_map *map,
+                                   const struct crush_choose_arg *choose_args,
+                                   struct crush_memory_report *report);
+
 #endif
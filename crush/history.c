@@ -0,0 +1,572 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "varint.h"
+
+/*
+ * Layout of a serialized history, all integers little endian:
+ *
+ *   header     magic, version, size, width, epoch count   5 x u32
+ *   directory  epoch count x { epoch u32, rows u32, offset u64, length u64 }
+ *   sections   one per epoch, the first one has all the rows
+ *
+ * A section is:
+ *
+ *   rows u32, blocks u32
+ *   index      blocks x { first x u32, width + 1 stream offsets u32 }
+ *   streams    the x of the rows, then each column of items
+ *
+ * The streams of a section are limited to 4GiB since their offsets
+ * are u32.
+ *
+ * The x stream contains the difference between each x and the
+ * previous one (the first x of the block for the first row of a
+ * block) and the column streams contain the items. They are all
+ * varint encoded and the index gives the offset, relative to the
+ * first stream, of each block in each stream.
+ */
+#define CRUSH_HISTORY_MAGIC 0x53484352 /* CRHS */
+#define CRUSH_HISTORY_VERSION 1
+#define CRUSH_HISTORY_BLOCK 64
+/*
+ * Every CRUSH_HISTORY_SNAPSHOT-th section has all the rows, for a
+ * lookup to read at most that many sections.
+ */
+#define CRUSH_HISTORY_SNAPSHOT 64
+#define HEADER_SIZE (5 * 4)
+#define DIRECTORY_ENTRY_SIZE (4 + 4 + 8 + 8)
+
+struct section {
+	__u32 epoch;
+	__u32 rows;
+	struct crush_buffer data;
+};
+
+struct crush_history_writer {
+	int size;
+	int width;
+	int *table;
+	int *changed;
+	int count;
+	int capacity;
+	struct section *sections;
+};
+
+struct crush_history {
+	const unsigned char *data;
+	size_t length;
+	size_t mapped; /* length to munmap() or 0 */
+	int size;
+	int width;
+	int count;
+	const unsigned char *directory;
+};
+
+/* CRUSH_ITEM_NONE is 0, devices and buckets are zigzag encoded + 1 */
+static __u64 encode_item(int item)
+{
+	if (item == CRUSH_ITEM_NONE)
+		return 0;
+	return crush_zigzag(item) + 1;
+}
+
+static int decode_item(__u64 v)
+{
+	if (v == 0)
+		return CRUSH_ITEM_NONE;
+	return (int)crush_unzigzag(v - 1);
+}
+
+int crush_table_diff(int size, int width,
+		     const int *before, const int *after,
+		     int *changed)
+{
+	int x, count = 0;
+
+	for (x = 0; x < size; x++)
+		if (memcmp(before + x * width, after + x * width,
+			   sizeof(int) * width))
+			changed[count++] = x;
+	return count;
+}
+
+/* encode the @rows rows of @table listed in @xs */
+static int section_encode(struct crush_buffer *out, int width,
+			  const int *table, const int *xs, int rows)
+{
+	int blocks = (rows + CRUSH_HISTORY_BLOCK - 1) / CRUSH_HISTORY_BLOCK;
+	struct crush_buffer *streams;
+	size_t *offsets; /* [blocks][width + 1] */
+	size_t base;
+	int block, i, c, err = -ENOMEM;
+
+	streams = calloc(width + 1, sizeof(struct crush_buffer));
+	offsets = malloc(sizeof(size_t) * (blocks * (width + 1) + 1));
+	if (!streams || !offsets)
+		goto out;
+	for (block = 0; block < blocks; block++) {
+		int first = block * CRUSH_HISTORY_BLOCK;
+		int last = first + CRUSH_HISTORY_BLOCK;
+		if (last > rows)
+			last = rows;
+		for (c = 0; c <= width; c++)
+			offsets[block * (width + 1) + c] = streams[c].size;
+		for (i = first; i < last; i++) {
+			int previous = i > first ? xs[i - 1] : xs[first];
+			if (crush_put_varint(&streams[0], xs[i] - previous) < 0)
+				goto out;
+			for (c = 0; c < width; c++)
+				if (crush_put_varint(&streams[c + 1],
+						     encode_item(table[xs[i] * width + c])) < 0)
+					goto out;
+		}
+	}
+
+	base = 0;
+	for (c = 0; c <= width; c++)
+		base += streams[c].size;
+	if (base > 0xffffffff) {
+		err = -E2BIG;
+		goto out;
+	}
+	if (crush_put_u32(out, rows) < 0 || crush_put_u32(out, blocks) < 0)
+		goto out;
+	for (block = 0; block < blocks; block++) {
+		if (crush_put_u32(out, xs[block * CRUSH_HISTORY_BLOCK]) < 0)
+			goto out;
+		base = 0;
+		for (c = 0; c <= width; c++) {
+			if (crush_put_u32(out, base + offsets[block * (width + 1) + c]) < 0)
+				goto out;
+			base += streams[c].size;
+		}
+	}
+	for (c = 0; c <= width; c++)
+		if (crush_put_bytes(out, streams[c].data, streams[c].size) < 0)
+			goto out;
+	err = 0;
+out:
+	if (streams)
+		for (c = 0; c <= width; c++)
+			free(streams[c].data);
+	free(streams);
+	free(offsets);
+	return err;
+}
+
+static int writer_add(struct crush_history_writer *w, __u32 epoch,
+		      const int *xs, int rows, const int *table)
+{
+	struct section *s;
+	int err;
+
+	if (w->count == w->capacity) {
+		int capacity = w->capacity ? w->capacity * 2 : 16;
+		struct section *sections = realloc(w->sections,
+						   sizeof(struct section) * capacity);
+		if (!sections)
+			return -ENOMEM;
+		w->sections = sections;
+		w->capacity = capacity;
+	}
+	s = &w->sections[w->count];
+	memset(s, '\0', sizeof(*s));
+	s->epoch = epoch;
+	s->rows = rows;
+	err = section_encode(&s->data, w->width, table, xs, rows);
+	if (err < 0) {
+		free(s->data.data);
+		return err;
+	}
+	w->count++;
+	return 0;
+}
+
+struct crush_history_writer *crush_history_create(int size, int width,
+						  __u32 epoch,
+						  const int *table)
+{
+	struct crush_history_writer *w;
+	int x;
+
+	if (size < 0 || width <= 0)
+		return NULL;
+	w = calloc(1, sizeof(struct crush_history_writer));
+	if (!w)
+		return NULL;
+	w->size = size;
+	w->width = width;
+	w->table = malloc(sizeof(int) * size * width + 1);
+	w->changed = malloc(sizeof(int) * size + 1);
+	if (!w->table || !w->changed)
+		goto fail;
+	memcpy(w->table, table, sizeof(int) * size * width);
+	for (x = 0; x < size; x++)
+		w->changed[x] = x;
+	if (writer_add(w, epoch, w->changed, size, table) < 0)
+		goto fail;
+	return w;
+fail:
+	crush_history_writer_destroy(w);
+	return NULL;
+}
+
+int crush_history_add(struct crush_history_writer *w, __u32 epoch,
+		      const int *table)
+{
+	int rows, x, err;
+
+	if (epoch <= w->sections[w->count - 1].epoch)
+		return -EINVAL;
+	if (w->count % CRUSH_HISTORY_SNAPSHOT == 0) {
+		for (x = 0; x < w->size; x++)
+			w->changed[x] = x;
+		rows = w->size;
+	} else {
+		rows = crush_table_diff(w->size, w->width, w->table, table,
+					w->changed);
+	}
+	err = writer_add(w, epoch, w->changed, rows, table);
+	if (err < 0)
+		return err;
+	memcpy(w->table, table, sizeof(int) * w->size * w->width);
+	return 0;
+}
+
+int crush_history_serialize(const struct crush_history_writer *w,
+			    void **buffer, size_t *length)
+{
+	struct crush_buffer out;
+	__u64 offset;
+	int i;
+
+	memset(&out, '\0', sizeof(out));
+	if (crush_put_u32(&out, CRUSH_HISTORY_MAGIC) < 0 ||
+	    crush_put_u32(&out, CRUSH_HISTORY_VERSION) < 0 ||
+	    crush_put_u32(&out, w->size) < 0 ||
+	    crush_put_u32(&out, w->width) < 0 ||
+	    crush_put_u32(&out, w->count) < 0)
+		goto nomem;
+	offset = HEADER_SIZE + DIRECTORY_ENTRY_SIZE * w->count;
+	for (i = 0; i < w->count; i++) {
+		const struct section *s = &w->sections[i];
+		if (crush_put_u32(&out, s->epoch) < 0 ||
+		    crush_put_u32(&out, s->rows) < 0 ||
+		    crush_put_u64(&out, offset) < 0 ||
+		    crush_put_u64(&out, s->data.size) < 0)
+			goto nomem;
+		offset += s->data.size;
+	}
+	for (i = 0; i < w->count; i++)
+		if (crush_put_bytes(&out, w->sections[i].data.data,
+				    w->sections[i].data.size) < 0)
+			goto nomem;
+	*buffer = out.data;
+	*length = out.size;
+	return 0;
+nomem:
+	free(out.data);
+	return -ENOMEM;
+}
+
+void crush_history_writer_destroy(struct crush_history_writer *w)
+{
+	int i;
+
+	for (i = 0; i < w->count; i++)
+		free(w->sections[i].data.data);
+	free(w->sections);
+	free(w->table);
+	free(w->changed);
+	free(w);
+}
+
+int crush_history_open(const void *buffer, size_t length,
+		       struct crush_history **history)
+{
+	const unsigned char *data = buffer;
+	struct crush_history *h;
+	__u32 size, width, count, previous = 0;
+	__u32 i;
+
+	if (length < HEADER_SIZE ||
+	    crush_get_u32(data) != CRUSH_HISTORY_MAGIC ||
+	    crush_get_u32(data + 4) != CRUSH_HISTORY_VERSION)
+		return -EINVAL;
+	size = crush_get_u32(data + 8);
+	width = crush_get_u32(data + 12);
+	count = crush_get_u32(data + 16);
+	if (size > 0x7fffffff || width == 0 || width > 0xffff || count == 0 ||
+	    (length - HEADER_SIZE) / DIRECTORY_ENTRY_SIZE < count)
+		return -EINVAL;
+	for (i = 0; i < count; i++) {
+		const unsigned char *entry = data + HEADER_SIZE +
+			DIRECTORY_ENTRY_SIZE * i;
+		__u32 epoch = crush_get_u32(entry);
+		__u32 rows = crush_get_u32(entry + 4);
+		__u64 offset = crush_get_u64(entry + 8);
+		__u64 section_length = crush_get_u64(entry + 16);
+		if ((i > 0 && epoch <= previous) || rows > size ||
+		    (i == 0 && rows != size) ||
+		    offset > length || section_length > length - offset ||
+		    section_length < 8 ||
+		    crush_get_u32(data + offset) != rows ||
+		    crush_get_u32(data + offset + 4) !=
+		    (rows + CRUSH_HISTORY_BLOCK - 1) / CRUSH_HISTORY_BLOCK ||
+		    (section_length - 8) / (4 * (width + 2)) <
+		    crush_get_u32(data + offset + 4))
+			return -EINVAL;
+		previous = epoch;
+	}
+	h = calloc(1, sizeof(struct crush_history));
+	if (!h)
+		return -ENOMEM;
+	h->data = data;
+	h->length = length;
+	h->size = size;
+	h->width = width;
+	h->count = count;
+	h->directory = data + HEADER_SIZE;
+	*history = h;
+	return 0;
+}
+
+int crush_history_map(const char *path, struct crush_history **history)
+{
+	struct stat st;
+	void *data;
+	int fd, err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return -EINVAL;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	err = -errno;
+	close(fd);
+	if (data == MAP_FAILED)
+		return err;
+	err = crush_history_open(data, st.st_size, history);
+	if (err < 0) {
+		munmap(data, st.st_size);
+		return err;
+	}
+	(*history)->mapped = st.st_size;
+	return 0;
+}
+
+void crush_history_close(struct crush_history *h)
+{
+	if (h->mapped)
+		munmap((void *)h->data, h->mapped);
+	free(h);
+}
+
+void crush_history_info(const struct crush_history *h,
+			int *size, int *width, int *epochs)
+{
+	*size = h->size;
+	*width = h->width;
+	*epochs = h->count;
+}
+
+static __u32 section_epoch(const struct crush_history *h, int i)
+{
+	return crush_get_u32(h->directory + DIRECTORY_ENTRY_SIZE * i);
+}
+
+/* the index of the last section with an epoch lower or equal to @epoch */
+static int section_find(const struct crush_history *h, __u32 epoch)
+{
+	int low = 0, high = h->count;
+
+	if (epoch < section_epoch(h, 0))
+		return -ENOENT;
+	while (high - low > 1) {
+		int middle = (low + high) / 2;
+		if (section_epoch(h, middle) <= epoch)
+			low = middle;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*
+ * Decode the row of @x from section @i into @result. Return 1 if
+ * the section has a row for @x, 0 if it does not.
+ */
+static int section_lookup(const struct crush_history *h, int i, int x,
+			  int *result)
+{
+	const unsigned char *entry = h->directory + DIRECTORY_ENTRY_SIZE * i;
+	const unsigned char *section = h->data + crush_get_u64(entry + 8);
+	const unsigned char *end = section + crush_get_u64(entry + 16);
+	const int index_size = 4 * (h->width + 2);
+	const unsigned char *index = section + 8;
+	const unsigned char *streams;
+	const unsigned char *p;
+	__u32 rows = crush_get_u32(section);
+	int blocks = crush_get_u32(section + 4);
+	int low = 0, high = blocks;
+	int row, count, c;
+	__u64 v;
+	int current;
+
+	if (blocks == 0 || (int)crush_get_u32(index) > x)
+		return 0;
+	while (high - low > 1) {
+		int middle = (low + high) / 2;
+		if ((int)crush_get_u32(index + index_size * middle) <= x)
+			low = middle;
+		else
+			high = middle;
+	}
+	index += index_size * low;
+	streams = section + 8 + index_size * blocks;
+	count = rows - low * CRUSH_HISTORY_BLOCK;
+	if (count > CRUSH_HISTORY_BLOCK)
+		count = CRUSH_HISTORY_BLOCK;
+
+	current = crush_get_u32(index);
+	if (crush_get_u32(index + 4) > end - streams)
+		return -EINVAL;
+	p = streams + crush_get_u32(index + 4);
+	for (row = 0; row < count; row++) {
+		if (crush_get_varint(&p, end, &v) < 0)
+			return -EINVAL;
+		current += v;
+		if (current >= x)
+			break;
+	}
+	if (row == count || current != x)
+		return 0;
+
+	for (c = 0; c < h->width; c++) {
+		int k;
+		if (crush_get_u32(index + 8 + 4 * c) > end - streams)
+			return -EINVAL;
+		p = streams + crush_get_u32(index + 8 + 4 * c);
+		for (k = 0; k <= row; k++)
+			if (crush_get_varint(&p, end, &v) < 0)
+				return -EINVAL;
+		result[c] = decode_item(v);
+	}
+	return 1;
+}
+
+int crush_history_lookup(const struct crush_history *h,
+			 __u32 epoch, int x, int *result)
+{
+	int i, found;
+
+	if (x < 0 || x >= h->size)
+		return -EINVAL;
+	i = section_find(h, epoch);
+	if (i < 0)
+		return i;
+	for (; i >= 0; i--) {
+		found = section_lookup(h, i, x, result);
+		if (found < 0)
+			return found;
+		if (found)
+			return h->width;
+	}
+	/* the first section has all the rows */
+	return -EINVAL;
+}
+
+int crush_history_changed(const struct crush_history *h,
+			  __u32 from, __u32 to, int *changed)
+{
+	unsigned char *touched;
+	int *before, *after;
+	int first, last, i, x, count = 0, err = 0;
+
+	first = section_find(h, from);
+	last = section_find(h, to);
+	if (first < 0)
+		return first;
+	if (last < 0)
+		return last;
+	if (first > last) {
+		i = first;
+		first = last;
+		last = i;
+	}
+	touched = calloc(h->size + 1, 1);
+	before = malloc(sizeof(int) * h->width);
+	after = malloc(sizeof(int) * h->width);
+	if (!touched || !before || !after) {
+		err = -ENOMEM;
+		goto out;
+	}
+	/* every x with a row in the sections ]first, last] */
+	for (i = first + 1; i <= last; i++) {
+		const unsigned char *entry = h->directory +
+			DIRECTORY_ENTRY_SIZE * i;
+		const unsigned char *section = h->data + crush_get_u64(entry + 8);
+		const unsigned char *end = section + crush_get_u64(entry + 16);
+		const int index_size = 4 * (h->width + 2);
+		int rows = crush_get_u32(section);
+		int blocks = crush_get_u32(section + 4);
+		const unsigned char *streams = section + 8 + index_size * blocks;
+		int block, row;
+
+		for (block = 0; block < blocks; block++) {
+			const unsigned char *index = section + 8 +
+				index_size * block;
+			const unsigned char *p;
+			__u64 v;
+			x = crush_get_u32(index);
+			if (crush_get_u32(index + 4) > end - streams) {
+				err = -EINVAL;
+				goto out;
+			}
+			p = streams + crush_get_u32(index + 4);
+			for (row = block * CRUSH_HISTORY_BLOCK;
+			     row < rows && row < (block + 1) * CRUSH_HISTORY_BLOCK;
+			     row++) {
+				if (crush_get_varint(&p, end, &v) < 0 ||
+				    x + v >= (__u64)h->size) {
+					err = -EINVAL;
+					goto out;
+				}
+				x += v;
+				touched[x] = 1;
+			}
+		}
+	}
+	for (x = 0; x < h->size; x++) {
+		if (!touched[x])
+			continue;
+		err = crush_history_lookup(h, section_epoch(h, first), x, before);
+		if (err < 0)
+			goto out;
+		err = crush_history_lookup(h, section_epoch(h, last), x, after);
+		if (err < 0)
+			goto out;
+		if (memcmp(before, after, sizeof(int) * h->width))
+			changed[count++] = x;
+	}
+	err = count;
+out:
+	free(touched);
+	free(before);
+	free(after);
+	return err;
+}
@@ -0,0 +1,211 @@
+#ifndef CEPH_CRUSH_HISTORY_H
+#define CEPH_CRUSH_HISTORY_H
+
+/*
+ * Store the mappings of a range of values over many epochs of a
+ * crush_map, as one full table followed by the differences
+ * introduced by each epoch, with a full table every 64 epochs.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * Compare two mapping tables of __size__ rows of __width__ items,
+ * i.e. the result of crush_do_rule() for x in [0, __size__[ padded
+ * with ::CRUSH_ITEM_NONE to __width__ items. The values x for which
+ * the row of __before__ differs from the row of __after__ are stored
+ * in increasing order in __changed__, which must have room for
+ * __size__ values.
+ *
+ * @param size the number of rows
+ * @param width the number of items in a row
+ * @param before an array of __size__ * __width__ items
+ * @param after an array of __size__ * __width__ items
+ * @param[out] changed an array of __size__ values
+ *
+ * @returns the number of values stored in __changed__
+ */
+extern int crush_table_diff(int size, int width,
+			    const int *before, const int *after,
+			    int *changed);
+
+/** @ingroup API
+ * A mapping history being built, see crush_history_create().
+ */
+struct crush_history_writer;
+
+/** @ingroup API
+ * A mapping history opened with crush_history_open() or
+ * crush_history_map().
+ */
+struct crush_history;
+
+/** @ingroup API
+ *
+ * Start a mapping history with the __table__ of __size__ rows of
+ * __width__ items computed at __epoch__. The layout of __table__ is
+ * described in crush_table_diff(). It is copied and can be
+ * modified or freed when the function returns.
+ *
+ * The returned writer must be deallocated with
+ * crush_history_writer_destroy().
+ *
+ * @param size the number of rows
+ * @param width the number of items in a row
+ * @param epoch the epoch of the crush_map the table was computed with
+ * @param table an array of __size__ * __width__ items
+ *
+ * @returns a writer on success, NULL on error
+ */
+extern struct crush_history_writer *crush_history_create(int size, int width,
+							 __u32 epoch,
+							 const int *table);
+
+/** @ingroup API
+ *
+ * Record the __table__ computed at __epoch__. Only the rows that
+ * differ from the table of the previous epoch are stored, in
+ * columns of varint encoded items, with an index of the first value
+ * of every block of 64 rows. Every 64th epoch, the first one
+ * included, stores all the rows instead.
+ *
+ * - return -EINVAL if __epoch__ is not greater than the previous epoch
+ * - return -E2BIG if the encoded rows exceed 4GiB
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param writer the history returned by crush_history_create()
+ * @param epoch the epoch of the crush_map the table was computed with
+ * @param table an array of __size__ * __width__ items
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_history_add(struct crush_history_writer *writer,
+			     __u32 epoch, const int *table);
+
+/** @ingroup API
+ *
+ * Store the history in a buffer allocated with __malloc(3)__ that
+ * the caller must free. The content of the buffer does not depend on
+ * the endianness of the host and can be written to a file to be
+ * mapped in memory with crush_history_map().
+ *
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param writer the history returned by crush_history_create()
+ * @param[out] buffer the serialized history
+ * @param[out] length the size of __buffer__ in bytes
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_history_serialize(const struct crush_history_writer *writer,
+				   void **buffer, size_t *length);
+
+/** @ingroup API
+ *
+ * Deallocate a writer returned by crush_history_create().
+ *
+ * @param writer the history to deallocate
+ */
+extern void crush_history_writer_destroy(struct crush_history_writer *writer);
+
+/** @ingroup API
+ *
+ * Read the history serialized in __buffer__ by
+ * crush_history_serialize(). The __buffer__ is not copied and must
+ * not be freed before crush_history_close() is called.
+ *
+ * - return -EINVAL if __buffer__ does not contain a valid history
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param buffer the serialized history
+ * @param length the size of __buffer__ in bytes
+ * @param[out] history the history
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_history_open(const void *buffer, size_t length,
+			      struct crush_history **history);
+
+/** @ingroup API
+ *
+ * Map the file at __path__, containing a history serialized by
+ * crush_history_serialize(), in memory and read it as
+ * crush_history_open() does. The file is unmapped by
+ * crush_history_close().
+ *
+ * - return -errno if the file cannot be opened or mapped
+ * - return -EINVAL if the file does not contain a valid history
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param path the file containing the history
+ * @param[out] history the history
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_history_map(const char *path, struct crush_history **history);
+
+/** @ingroup API
+ *
+ * Release the __history__ returned by crush_history_open() or
+ * crush_history_map().
+ *
+ * @param history the history to release
+ */
+extern void crush_history_close(struct crush_history *history);
+
+/** @ingroup API
+ *
+ * Store in __result__ the __width__ items __x__ was mapped to at
+ * __epoch__, i.e. in the table recorded for the greatest epoch lower
+ * or equal to __epoch__. The tables of the epochs are searched from
+ * __epoch__ backwards, with a binary search on the block index of
+ * each of them, and at most 64 tables are searched since every 64th
+ * epoch has all the rows.
+ *
+ * - return -ENOENT if __epoch__ is before the first epoch
+ * - return -EINVAL if __x__ is not in [0, size[ or the history is corrupted
+ *
+ * @param history the history
+ * @param epoch the epoch
+ * @param x the row of the table
+ * @param[out] result an array of __width__ items
+ *
+ * @returns __width__ on success, < 0 on error
+ */
+extern int crush_history_lookup(const struct crush_history *history,
+				__u32 epoch, int x, int *result);
+
+/** @ingroup API
+ *
+ * Store in __changed__, in increasing order, the values x which are
+ * not mapped to the same items at __from__ and at __to__. Only the
+ * rows modified by the epochs in ]__from__, __to__] are compared.
+ *
+ * - return -ENOENT if __from__ or __to__ is before the first epoch
+ * - return -EINVAL if the history is corrupted
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param history the history
+ * @param from the first epoch
+ * @param to the second epoch
+ * @param[out] changed an array of __size__ values
+ *
+ * @returns the number of values stored in __changed__, < 0 on error
+ */
+extern int crush_history_changed(const struct crush_history *history,
+				 __u32 from, __u32 to, int *changed);
+
+/** @ingroup API
+ *
+ * @param history the history
+ * @param[out] size the number of rows of a table
+ * @param[out] width the number of items in a row
+ * @param[out] epochs the number of epochs recorded
+ */
+extern void crush_history_info(const struct crush_history *history,
+			       int *size, int *width, int *epochs);
+
+#endif
@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "latency.h"
+#include "mapper.h"
+
+struct crush_latency {
+	int max_rules;
+	__u64 sample_mask;
+	__u64 calls;
+	/* [max_rules][CRUSH_LATENCY_BUCKETS] only modified by the owner thread */
+	__u64 *counts;
+};
+
+/*
+ * Values below 8 have a bucket of their own. Above, each power of
+ * two is divided in CRUSH_LATENCY_SUB_BUCKETS buckets of equal width.
+ */
+static int bucket_index(__u64 ns)
+{
+	int e;
+
+	if (ns < CRUSH_LATENCY_SUB_BUCKETS)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	return (e - 2) * CRUSH_LATENCY_SUB_BUCKETS +
+		((ns >> (e - 3)) & (CRUSH_LATENCY_SUB_BUCKETS - 1));
+}
+
+static __u64 bucket_upper_bound(int i)
+{
+	int e, sub;
+
+	if (i < CRUSH_LATENCY_SUB_BUCKETS)
+		return i;
+	e = i / CRUSH_LATENCY_SUB_BUCKETS + 2;
+	sub = i % CRUSH_LATENCY_SUB_BUCKETS;
+	return ((__u64)(CRUSH_LATENCY_SUB_BUCKETS + sub) << (e - 3)) +
+		((__u64)1 << (e - 3)) - 1;
+}
+
+__u64 crush_latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct crush_latency *crush_latency_create(int max_rules, int sample_shift)
+{
+	struct crush_latency *latency;
+
+	if (max_rules < 0 || sample_shift < 0 || sample_shift > 63)
+		return NULL;
+	latency = malloc(sizeof(*latency));
+	if (latency == NULL)
+		return NULL;
+	latency->max_rules = max_rules;
+	latency->sample_mask = ((__u64)1 << sample_shift) - 1;
+	latency->calls = 0;
+	latency->counts = calloc((size_t)max_rules * CRUSH_LATENCY_BUCKETS + 1,
+				 sizeof(__u64));
+	if (latency->counts == NULL) {
+		free(latency);
+		return NULL;
+	}
+	return latency;
+}
+
+void crush_latency_destroy(struct crush_latency *latency)
+{
+	if (latency == NULL)
+		return;
+	free(latency->counts);
+	free(latency);
+}
+
+int crush_latency_do_rule(struct crush_latency *latency,
+			  const struct crush_map *map,
+			  int ruleno, int x, int *result, int result_max,
+			  const __u32 *weights, int weight_max,
+			  void *cwin, const struct crush_choose_arg *choose_args)
+{
+	__u64 start;
+	int len;
+
+	if ((latency->calls++ & latency->sample_mask) != 0)
+		return crush_do_rule(map, ruleno, x, result, result_max,
+				     weights, weight_max, cwin, choose_args);
+	start = crush_latency_now();
+	len = crush_do_rule(map, ruleno, x, result, result_max,
+			    weights, weight_max, cwin, choose_args);
+	crush_latency_record(latency, ruleno, crush_latency_now() - start);
+	return len;
+}
+
+void crush_latency_record(struct crush_latency *latency, int ruleno, __u64 ns)
+{
+	__u64 *count;
+
+	if (ruleno < 0 || ruleno >= latency->max_rules)
+		return;
+	count = &latency->counts[ruleno * CRUSH_LATENCY_BUCKETS + bucket_index(ns)];
+	/* the owner is the only writer, other threads may be merging */
+	__atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+int crush_latency_merge(struct crush_latency *to, const struct crush_latency *from)
+{
+	size_t i;
+
+	if (to->max_rules != from->max_rules)
+		return -EINVAL;
+	for (i = 0; i < (size_t)to->max_rules * CRUSH_LATENCY_BUCKETS; i++) {
+		__u64 count = __atomic_load_n(&from->counts[i], __ATOMIC_RELAXED);
+
+		if (count > 0)
+			__atomic_store_n(&to->counts[i], to->counts[i] + count,
+					 __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+__u64 crush_latency_count(const struct crush_latency *latency, int ruleno)
+{
+	const __u64 *counts;
+	__u64 total = 0;
+	int i;
+
+	if (ruleno < 0 || ruleno >= latency->max_rules)
+		return 0;
+	counts = &latency->counts[ruleno * CRUSH_LATENCY_BUCKETS];
+	for (i = 0; i < CRUSH_LATENCY_BUCKETS; i++)
+		total += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+	return total;
+}
+
+double crush_latency_quantile(const struct crush_latency *latency, int ruleno,
+			      double quantile)
+{
+	const __u64 *counts;
+	__u64 total, rank, seen = 0;
+	int i;
+
+	if (!(quantile >= 0 && quantile <= 1) ||
+	    ruleno < 0 || ruleno >= latency->max_rules)
+		return -EINVAL;
+	total = crush_latency_count(latency, ruleno);
+	if (total == 0)
+		return -ENOENT;
+	/* the smallest latency such that quantile * total are lower or equal */
+	rank = (__u64)(quantile * total);
+	if (rank < quantile * total || rank == 0)
+		rank++;
+	counts = &latency->counts[ruleno * CRUSH_LATENCY_BUCKETS];
+	for (i = 0; i < CRUSH_LATENCY_BUCKETS; i++) {
+		seen += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+		if (seen >= rank)
+			return bucket_upper_bound(i);
+	}
+	/* the owner recorded latencies while counting */
+	return bucket_upper_bound(CRUSH_LATENCY_BUCKETS - 1);
+}
+
+void crush_latency_reset(struct crush_latency *latency)
+{
+	size_t i;
+
+	for (i = 0; i < (size_t)latency->max_rules * CRUSH_LATENCY_BUCKETS; i++)
+		__atomic_store_n(&latency->counts[i], 0, __ATOMIC_RELAXED);
+	latency->calls = 0;
+}
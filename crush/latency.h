@@ -0,0 +1,150 @@
+#ifndef CEPH_CRUSH_LATENCY_H
+#define CEPH_CRUSH_LATENCY_H
+
+/*
+ * Per-rule histograms of the time spent in crush_do_rule(), sampled
+ * to keep the overhead low.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ * The default __sample_shift__ of crush_latency_create(): one call
+ * out of 64 is timed.
+ */
+#define CRUSH_LATENCY_SAMPLE_SHIFT 6
+
+/** @ingroup API
+ * Number of buckets per power of two of the histograms: the
+ * quantiles are known within 1/8 of their value.
+ */
+#define CRUSH_LATENCY_SUB_BUCKETS 8
+
+/** @ingroup API
+ * Number of buckets of the histogram of a rule.
+ */
+#define CRUSH_LATENCY_BUCKETS ((64 - 2) * CRUSH_LATENCY_SUB_BUCKETS)
+
+struct crush_latency;
+
+/** @ingroup API
+ *
+ * Allocate a recorder with one histogram of latencies, in
+ * nanoseconds, for each rule < __max_rules__. A recorder is meant to
+ * be used by a single thread: each thread records in its own
+ * recorder without locking and the histograms are combined with
+ * crush_latency_merge(). The recorder must be deallocated with
+ * crush_latency_destroy().
+ *
+ * - return NULL if __max_rules__ < 0 or __sample_shift__ is not in [0,63]
+ * - return NULL if __malloc(3)__ fails
+ *
+ * @param max_rules the number of histograms
+ * @param sample_shift one call to crush_latency_do_rule() out of 2^__sample_shift__ is timed
+ *
+ * @returns a recorder on success, NULL on error
+ */
+extern struct crush_latency *crush_latency_create(int max_rules, int sample_shift);
+
+/** @ingroup API
+ *
+ * Deallocate a recorder returned by crush_latency_create().
+ *
+ * @param latency the recorder
+ */
+extern void crush_latency_destroy(struct crush_latency *latency);
+
+/** @ingroup API
+ *
+ * Call crush_do_rule() with the same arguments and, for one call
+ * out of 2^__sample_shift__, record how long it took with
+ * __clock_gettime(2)__ in the histogram of __ruleno__.
+ *
+ * @param latency the recorder of the calling thread
+ *
+ * @returns the return value of crush_do_rule()
+ */
+extern int crush_latency_do_rule(struct crush_latency *latency,
+				 const struct crush_map *map,
+				 int ruleno, int x, int *result, int result_max,
+				 const __u32 *weights, int weight_max,
+				 void *cwin, const struct crush_choose_arg *choose_args);
+
+/** @ingroup API
+ *
+ * The time of the monotonic clock crush_latency_do_rule() reads with
+ * __clock_gettime(2)__, for the callers of crush_latency_record().
+ *
+ * @returns the time in nanoseconds
+ */
+extern __u64 crush_latency_now(void);
+
+/** @ingroup API
+ *
+ * Add a latency of __ns__ nanoseconds to the histogram of
+ * __ruleno__, for a latency measured by the caller. It is ignored if
+ * __ruleno__ is not < __max_rules__.
+ *
+ * @param latency the recorder of the calling thread
+ * @param ruleno the rule
+ * @param ns the latency in nanoseconds
+ */
+extern void crush_latency_record(struct crush_latency *latency, int ruleno, __u64 ns);
+
+/** @ingroup API
+ *
+ * Add the histograms of __from__ to the histograms of __to__. The
+ * thread owning __from__ may record latencies while they are
+ * merged: they will be merged later.
+ *
+ * - return -EINVAL if the recorders do not have the same number of rules
+ *
+ * @param to the recorder receiving the histograms
+ * @param from the recorder to merge
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_latency_merge(struct crush_latency *to, const struct crush_latency *from);
+
+/** @ingroup API
+ *
+ * Return the number of latencies in the histogram of __ruleno__,
+ * or 0 if __ruleno__ is not < __max_rules__.
+ *
+ * @param latency the recorder
+ * @param ruleno the rule
+ *
+ * @returns the number of latencies recorded
+ */
+extern __u64 crush_latency_count(const struct crush_latency *latency, int ruleno);
+
+/** @ingroup API
+ *
+ * Return the __quantile__ of the latencies of __ruleno__, for
+ * instance 0.5 for the median or 0.999 for p99.9. The value is the
+ * upper bound of the histogram bucket containing the quantile and
+ * is at most 1/8 above the actual quantile.
+ *
+ * - return -EINVAL if __quantile__ is not in [0,1] or __ruleno__ is not < __max_rules__
+ * - return -ENOENT if no latency was recorded for __ruleno__
+ *
+ * @param latency the recorder
+ * @param ruleno the rule
+ * @param quantile a number in [0,1]
+ *
+ * @returns the latency in nanoseconds, < 0 on error
+ */
+extern double crush_latency_quantile(const struct crush_latency *latency, int ruleno,
+				     double quantile);
+
+/** @ingroup API
+ *
+ * Discard all the latencies recorded.
+ *
+ * @param latency the recorder
+ */
+extern void crush_latency_reset(struct crush_latency *latency);
+
+#endif
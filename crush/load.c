@@ -0,0 +1,939 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "hash.h"
+#include "load.h"
+#include "validate.h"
+#include "varint.h"
+
+/* binary */
+
+struct cursor {
+	const unsigned char *p;
+	const unsigned char *end;
+};
+
+static int get_u8(struct cursor *c, __u8 *v)
+{
+	if (c->end - c->p < 1)
+		return -EINVAL;
+	*v = *c->p++;
+	return 0;
+}
+
+static int get_u16(struct cursor *c, __u16 *v)
+{
+	if (c->end - c->p < 2)
+		return -EINVAL;
+	*v = (__u16)c->p[0] | ((__u16)c->p[1] << 8);
+	c->p += 2;
+	return 0;
+}
+
+static int get_u32(struct cursor *c, __u32 *v)
+{
+	if (c->end - c->p < 4)
+		return -EINVAL;
+	*v = crush_get_u32(c->p);
+	c->p += 4;
+	return 0;
+}
+
+/* an array of __count__ values of __size__ bytes must fit in what is left */
+static int check_count(const struct cursor *c, __u32 count, size_t size)
+{
+	return count > (size_t)(c->end - c->p) / size ? -EINVAL : 0;
+}
+
+/* a map<int32_t,string> of Ceph */
+static int skip_names(struct cursor *c)
+{
+	__u32 count, key, length, i;
+
+	if (get_u32(c, &count) < 0)
+		return -EINVAL;
+	for (i = 0; i < count; i++) {
+		if (get_u32(c, &key) < 0 || get_u32(c, &length) < 0 ||
+		    check_count(c, length, 1) < 0)
+			return -EINVAL;
+		c->p += length;
+	}
+	return 0;
+}
+
+static int decode_bucket(struct cursor *c, struct crush_bucket **bucket)
+{
+	static const size_t sizes[] = {
+		[CRUSH_BUCKET_UNIFORM] = sizeof(struct crush_bucket_uniform),
+		[CRUSH_BUCKET_LIST] = sizeof(struct crush_bucket_list),
+		[CRUSH_BUCKET_TREE] = sizeof(struct crush_bucket_tree),
+		[CRUSH_BUCKET_STRAW] = sizeof(struct crush_bucket_straw),
+		[CRUSH_BUCKET_STRAW2] = sizeof(struct crush_bucket_straw2),
+	};
+	struct crush_bucket *b;
+	__u32 alg, value, j;
+	__u32 *first = NULL, *second = NULL;
+
+	*bucket = NULL;
+	if (get_u32(c, &alg) < 0)
+		return -EINVAL;
+	if (alg == 0)
+		return 0;
+	if (alg > CRUSH_BUCKET_STRAW2)
+		return -EINVAL;
+	b = calloc(1, sizes[alg]);
+	if (b == NULL)
+		return -ENOMEM;
+	/* the bucket is destroyed with the map, even when incomplete */
+	b->alg = alg;
+	*bucket = b;
+	if (get_u32(c, &value) < 0 || get_u16(c, &b->type) < 0 ||
+	    get_u8(c, &b->alg) < 0 || get_u8(c, &b->hash) < 0 ||
+	    get_u32(c, &b->weight) < 0 || get_u32(c, &b->size) < 0)
+		return -EINVAL;
+	b->id = (__s32)value;
+	if (b->alg != alg || check_count(c, b->size, 4) < 0)
+		return -EINVAL;
+	b->items = malloc(sizeof(__s32) * (b->size ? b->size : 1));
+	if (b->items == NULL)
+		return -ENOMEM;
+	for (j = 0; j < b->size; j++) {
+		if (get_u32(c, &value) < 0)
+			return -EINVAL;
+		b->items[j] = (__s32)value;
+	}
+	switch (alg) {
+	case CRUSH_BUCKET_UNIFORM:
+		return get_u32(c, &((struct crush_bucket_uniform *)b)->item_weight);
+	case CRUSH_BUCKET_TREE: {
+		struct crush_bucket_tree *tree = (struct crush_bucket_tree *)b;
+
+		if (get_u8(c, &tree->num_nodes) < 0 ||
+		    check_count(c, tree->num_nodes, 4) < 0)
+			return -EINVAL;
+		tree->node_weights = malloc(sizeof(__u32) * (tree->num_nodes + 1));
+		if (tree->node_weights == NULL)
+			return -ENOMEM;
+		for (j = 0; j < tree->num_nodes; j++)
+			if (get_u32(c, &tree->node_weights[j]) < 0)
+				return -EINVAL;
+		return crush_tree_bucket_valid(tree) ? 0 : -EINVAL;
+	}
+	case CRUSH_BUCKET_LIST:
+	case CRUSH_BUCKET_STRAW:
+	case CRUSH_BUCKET_STRAW2:
+		first = malloc(sizeof(__u32) * (b->size ? b->size : 1));
+		if (alg == CRUSH_BUCKET_LIST) {
+			((struct crush_bucket_list *)b)->item_weights = first;
+			second = ((struct crush_bucket_list *)b)->sum_weights =
+				malloc(sizeof(__u32) * (b->size ? b->size : 1));
+		} else if (alg == CRUSH_BUCKET_STRAW) {
+			((struct crush_bucket_straw *)b)->item_weights = first;
+			second = ((struct crush_bucket_straw *)b)->straws =
+				malloc(sizeof(__u32) * (b->size ? b->size : 1));
+		} else {
+			((struct crush_bucket_straw2 *)b)->item_weights = first;
+		}
+		if (first == NULL || (alg != CRUSH_BUCKET_STRAW2 && second == NULL))
+			return -ENOMEM;
+		for (j = 0; j < b->size; j++)
+			if (get_u32(c, &first[j]) < 0 ||
+			    (second != NULL && get_u32(c, &second[j]) < 0))
+				return -EINVAL;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static int decode_rule(struct cursor *c, struct crush_rule **rule)
+{
+	struct crush_rule *r;
+	__u32 yes, len, j;
+
+	*rule = NULL;
+	if (get_u32(c, &yes) < 0)
+		return -EINVAL;
+	if (!yes)
+		return 0;
+	if (get_u32(c, &len) < 0 || check_count(c, len, 12) < 0)
+		return -EINVAL;
+	r = malloc(crush_rule_size(len));
+	if (r == NULL)
+		return -ENOMEM;
+	*rule = r;
+	r->len = len;
+	if (get_u8(c, &r->mask.ruleset) < 0 || get_u8(c, &r->mask.type) < 0 ||
+	    get_u8(c, &r->mask.min_size) < 0 || get_u8(c, &r->mask.max_size) < 0)
+		return -EINVAL;
+	for (j = 0; j < len; j++)
+		if (get_u32(c, &r->steps[j].op) < 0 ||
+		    get_u32(c, (__u32 *)&r->steps[j].arg1) < 0 ||
+		    get_u32(c, (__u32 *)&r->steps[j].arg2) < 0)
+			return -EINVAL;
+	return 0;
+}
+
+/* the tunables, each optional, in the order they were added to Ceph */
+static int decode_tunables(struct cursor *c, struct crush_map *map)
+{
+	__u32 value;
+
+	if (c->p == c->end)
+		return 0;
+	if (get_u32(c, &map->choose_local_tries) < 0 ||
+	    get_u32(c, &map->choose_local_fallback_tries) < 0 ||
+	    get_u32(c, &map->choose_total_tries) < 0)
+		return -EINVAL;
+	if (c->p == c->end)
+		return 0;
+	if (get_u32(c, &map->chooseleaf_descend_once) < 0)
+		return -EINVAL;
+	if (c->p == c->end)
+		return 0;
+	if (get_u8(c, &map->chooseleaf_vary_r) < 0)
+		return -EINVAL;
+	if (c->p == c->end)
+		return 0;
+	if (get_u8(c, &map->straw_calc_version) < 0)
+		return -EINVAL;
+	if (c->p == c->end)
+		return 0;
+	if (get_u32(c, &value) < 0)
+		return -EINVAL;
+	map->allowed_bucket_algs = value;
+	if (c->p == c->end)
+		return 0;
+	return get_u8(c, &map->chooseleaf_stable);
+}
+
+int crush_load_binary(const void *buffer, size_t length, struct crush_map **mapp)
+{
+	struct cursor c = { buffer, (const unsigned char *)buffer + length };
+	struct crush_map *map;
+	__u32 magic, max_buckets, max_rules, max_devices, i;
+	int err = -EINVAL;
+
+	if (get_u32(&c, &magic) < 0 || magic != CRUSH_MAGIC ||
+	    get_u32(&c, &max_buckets) < 0 || get_u32(&c, &max_rules) < 0 ||
+	    get_u32(&c, &max_devices) < 0 ||
+	    max_buckets > 0x7fffffff || max_devices > 0x7fffffff ||
+	    max_rules > CRUSH_MAX_RULES ||
+	    check_count(&c, max_buckets, 4) < 0)
+		return -EINVAL;
+	map = crush_create();
+	if (map == NULL)
+		return -ENOMEM;
+	/* the tunables of the maps encoded before they existed */
+	set_legacy_crush_map(map);
+	map->buckets = calloc(max_buckets ? max_buckets : 1, sizeof(*map->buckets));
+	map->rules = calloc(max_rules ? max_rules : 1, sizeof(*map->rules));
+	if (map->buckets == NULL || map->rules == NULL) {
+		err = -ENOMEM;
+		goto fail;
+	}
+	map->max_buckets = max_buckets;
+	map->max_rules = max_rules;
+	for (i = 0; i < max_buckets; i++) {
+		err = decode_bucket(&c, &map->buckets[i]);
+		if (err < 0)
+			goto fail;
+		if (map->buckets[i] != NULL && map->buckets[i]->id != -1 - (int)i) {
+			err = -EINVAL;
+			goto fail;
+		}
+	}
+	for (i = 0; i < max_rules; i++) {
+		err = decode_rule(&c, &map->rules[i]);
+		if (err < 0)
+			goto fail;
+	}
+	err = -EINVAL;
+	/* types, items and rules names */
+	if (skip_names(&c) < 0 || skip_names(&c) < 0 || skip_names(&c) < 0)
+		goto fail;
+	if (decode_tunables(&c, map) < 0)
+		goto fail;
+	crush_finalize(map);
+	if ((int)max_devices > map->max_devices)
+		map->max_devices = max_devices;
+	/* dangling items, cycles, overflowing weights, invalid rules */
+	err = crush_map_validate(map, NULL, NULL);
+	if (err < 0)
+		goto fail;
+	*mapp = map;
+	return 0;
+fail:
+	crush_destroy(map);
+	return err;
+}
+
+/* text */
+
+struct name {
+	char *key;
+	int value;
+};
+
+/* an open addressing hash table of names */
+struct names {
+	struct name *slots;
+	size_t capacity;   /* a power of two */
+	size_t count;
+};
+
+static size_t name_hash(const char *key)
+{
+	size_t h = 2166136261u;
+
+	for (; *key; key++)
+		h = (h ^ (unsigned char)*key) * 16777619u;
+	return h;
+}
+
+static struct name *names_slot(const struct names *names, const char *key)
+{
+	size_t i = name_hash(key) & (names->capacity - 1);
+
+	while (names->slots[i].key != NULL && strcmp(names->slots[i].key, key) != 0)
+		i = (i + 1) & (names->capacity - 1);
+	return &names->slots[i];
+}
+
+static int names_get(const struct names *names, const char *key, int *value)
+{
+	const struct name *slot;
+
+	if (names->count == 0)
+		return -ENOENT;
+	slot = names_slot(names, key);
+	if (slot->key == NULL)
+		return -ENOENT;
+	*value = slot->value;
+	return 0;
+}
+
+static int names_put(struct names *names, const char *key, int value)
+{
+	struct name *slot;
+
+	if (2 * (names->count + 1) > names->capacity) {
+		struct names grown = { NULL, names->capacity ? names->capacity * 2 : 64, 0 };
+		size_t i;
+
+		grown.slots = calloc(grown.capacity, sizeof(*grown.slots));
+		if (grown.slots == NULL)
+			return -ENOMEM;
+		for (i = 0; i < names->capacity; i++)
+			if (names->slots[i].key != NULL)
+				*names_slot(&grown, names->slots[i].key) = names->slots[i];
+		grown.count = names->count;
+		free(names->slots);
+		*names = grown;
+	}
+	slot = names_slot(names, key);
+	if (slot->key != NULL)
+		return -EEXIST;
+	slot->key = strdup(key);
+	if (slot->key == NULL)
+		return -ENOMEM;
+	slot->value = value;
+	names->count++;
+	return 0;
+}
+
+static void names_free(struct names *names)
+{
+	size_t i;
+
+	for (i = 0; i < names->capacity; i++)
+		free(names->slots[i].key);
+	free(names->slots);
+}
+
+#define TOKEN_MAX 256
+
+struct parser {
+	const char *p;
+	const char *end;
+	int line;
+	char token[TOKEN_MAX];
+	int token_line;     /* the line of __token__ */
+	struct crush_map *map;
+	struct names devices;
+	struct names buckets;
+	struct names types;
+	int max_device;
+};
+
+/*
+ * Read the next token, a word, { or }, in __ps->token__. Return 1, 0
+ * at the end of the text, -EINVAL if a word is too long.
+ */
+static int next(struct parser *ps)
+{
+	size_t size = 0;
+
+	for (;;) {
+		if (ps->p == ps->end)
+			return 0;
+		if (*ps->p == '\n')
+			ps->line++;
+		if (*ps->p == '#') {
+			while (ps->p < ps->end && *ps->p != '\n')
+				ps->p++;
+			continue;
+		}
+		if (*ps->p != ' ' && *ps->p != '\t' && *ps->p != '\n' && *ps->p != '\r')
+			break;
+		ps->p++;
+	}
+	ps->token_line = ps->line;
+	if (*ps->p == '{' || *ps->p == '}') {
+		ps->token[size++] = *ps->p++;
+	} else {
+		while (ps->p < ps->end && strchr(" \t\r\n#{}", *ps->p) == NULL) {
+			if (size == TOKEN_MAX - 1)
+				return -EINVAL;
+			ps->token[size++] = *ps->p++;
+		}
+	}
+	ps->token[size] = '\0';
+	return 1;
+}
+
+/* true if the next token is on the same line as the current one */
+static int same_line(const struct parser *ps)
+{
+	const char *p = ps->p;
+
+	while (p < ps->end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p < ps->end && *p != '\n' && *p != '#';
+}
+
+/* true if the next token is __word__, which is then consumed */
+static int accept(struct parser *ps, const char *word)
+{
+	struct parser saved = *ps;
+
+	if (next(ps) == 1 && strcmp(ps->token, word) == 0)
+		return 1;
+	ps->p = saved.p;
+	ps->line = saved.line;
+	memcpy(ps->token, saved.token, TOKEN_MAX);
+	ps->token_line = saved.token_line;
+	return 0;
+}
+
+static int expect(struct parser *ps, const char *word)
+{
+	return next(ps) == 1 && strcmp(ps->token, word) == 0 ? 0 : -EINVAL;
+}
+
+static int next_int(struct parser *ps, int *value)
+{
+	char *end;
+	long v;
+
+	if (next(ps) != 1)
+		return -EINVAL;
+	v = strtol(ps->token, &end, 10);
+	if (*end != '\0' || end == ps->token || v < -0x7fffffffL - 1 || v > 0x7fffffffL)
+		return -EINVAL;
+	*value = (int)v;
+	return 0;
+}
+
+/* a weight in 16.16 fixed point, rounded like crushtool does */
+static int next_weight(struct parser *ps, int *weight)
+{
+	char *end;
+	float w;
+
+	if (next(ps) != 1)
+		return -EINVAL;
+	w = strtof(ps->token, &end);
+	if (*end != '\0' || end == ps->token || w < 0 || w >= 32768)
+		return -EINVAL;
+	*weight = (int)(w * (float)0x10000);
+	return 0;
+}
+
+/* a device or a bucket */
+static int item_id(const struct parser *ps, const char *name, int *id)
+{
+	if (names_get(&ps->devices, name, id) == 0)
+		return 0;
+	return names_get(&ps->buckets, name, id) == 0 ? 0 : -EINVAL;
+}
+
+static int parse_device(struct parser *ps)
+{
+	int id, err;
+
+	if (next_int(ps, &id) < 0 || id < 0 || next(ps) != 1)
+		return -EINVAL;
+	err = names_put(&ps->devices, ps->token, id);
+	if (err < 0)
+		return err == -EEXIST ? -EINVAL : err;
+	if (id > ps->max_device)
+		ps->max_device = id;
+	/* the class */
+	while (same_line(ps))
+		if (next(ps) != 1)
+			return -EINVAL;
+	return 0;
+}
+
+static int parse_type(struct parser *ps)
+{
+	int id, err;
+
+	if (next_int(ps, &id) < 0 || id < 0 || id > 0xffff || next(ps) != 1)
+		return -EINVAL;
+	err = names_put(&ps->types, ps->token, id);
+	return err == -EEXIST ? -EINVAL : err;
+}
+
+static int parse_tunable(struct parser *ps)
+{
+	struct crush_map *map = ps->map;
+	char name[TOKEN_MAX];
+	int value;
+
+	if (next(ps) != 1)
+		return -EINVAL;
+	strcpy(name, ps->token);
+	if (next_int(ps, &value) < 0 || value < 0)
+		return -EINVAL;
+	if (strcmp(name, "choose_local_tries") == 0)
+		map->choose_local_tries = value;
+	else if (strcmp(name, "choose_local_fallback_tries") == 0)
+		map->choose_local_fallback_tries = value;
+	else if (strcmp(name, "choose_total_tries") == 0)
+		map->choose_total_tries = value;
+	else if (strcmp(name, "chooseleaf_descend_once") == 0)
+		map->chooseleaf_descend_once = value;
+	else if (strcmp(name, "chooseleaf_vary_r") == 0)
+		map->chooseleaf_vary_r = value;
+	else if (strcmp(name, "chooseleaf_stable") == 0)
+		map->chooseleaf_stable = value;
+	else if (strcmp(name, "straw_calc_version") == 0)
+		map->straw_calc_version = value;
+	else if (strcmp(name, "allowed_bucket_algs") == 0)
+		map->allowed_bucket_algs = value;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+static int parse_alg(const char *name)
+{
+	int alg;
+
+	for (alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++)
+		if (strcmp(name, crush_bucket_alg_name(alg)) == 0)
+			return alg;
+	return -EINVAL;
+}
+
+struct bucket_item {
+	int id;
+	int weight;
+	int pos;     /* -1 if not given */
+};
+
+static int compare_pos(const void *a, const void *b)
+{
+	const struct bucket_item *x = a, *y = b;
+
+	return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+static int add_bucket(struct parser *ps, const char *name, int id, int type, int alg,
+		      int hash, struct bucket_item *items, int size)
+{
+	struct crush_bucket *bucket;
+	int *ids, *weights;
+	int i, positioned = 0, err;
+
+	/* the number of nodes of a tree is 8 bits wide */
+	if (alg == CRUSH_BUCKET_TREE && size > 64)
+		return -EINVAL;
+
+	for (i = 0; i < size; i++)
+		if (items[i].pos >= 0)
+			positioned = 1;
+	if (positioned) {
+		/* the items without a position keep their place */
+		for (i = 0; i < size; i++)
+			if (items[i].pos < 0)
+				items[i].pos = i;
+		qsort(items, size, sizeof(*items), compare_pos);
+	}
+	ids = malloc(sizeof(int) * (size ? size : 1));
+	weights = malloc(sizeof(int) * (size ? size : 1));
+	if (ids == NULL || weights == NULL) {
+		free(ids);
+		free(weights);
+		return -ENOMEM;
+	}
+	for (i = 0; i < size; i++) {
+		ids[i] = items[i].id;
+		weights[i] = items[i].weight;
+	}
+	if (alg == CRUSH_BUCKET_UNIFORM)
+		bucket = (struct crush_bucket *)crush_make_uniform_bucket(
+			hash, type, size, ids, size ? weights[0] : 0);
+	else
+		bucket = crush_make_bucket(ps->map, alg, hash, type, size, ids, weights);
+	free(ids);
+	free(weights);
+	if (bucket == NULL)
+		return -ENOMEM;
+	err = crush_add_bucket(ps->map, id, bucket, &id);
+	if (err < 0) {
+		crush_destroy_bucket(bucket);
+		return err == -EEXIST ? -EINVAL : err;
+	}
+	err = names_put(&ps->buckets, name, id);
+	return err == -EEXIST ? -EINVAL : err;
+}
+
+#define BUCKET_ITEMS_MAX (1 << 20)
+
+static int parse_bucket(struct parser *ps, int type)
+{
+	char name[TOKEN_MAX];
+	struct bucket_item *items = NULL, *grown;
+	int size = 0, capacity = 0;
+	int id = 0, alg = CRUSH_BUCKET_STRAW2, hash = CRUSH_HASH_RJENKINS1;
+	int err = -EINVAL;
+
+	if (next(ps) != 1)
+		return -EINVAL;
+	strcpy(name, ps->token);
+	if (item_id(ps, name, &id) == 0 || expect(ps, "{") < 0)
+		return -EINVAL;
+	id = 0;
+	for (;;) {
+		if (next(ps) != 1)
+			goto out;
+		if (strcmp(ps->token, "}") == 0)
+			break;
+		if (strcmp(ps->token, "id") == 0) {
+			int value;
+
+			if (next_int(ps, &value) < 0 || value >= 0)
+				goto out;
+			if (accept(ps, "class")) {
+				/* the id of a shadow bucket */
+				if (next(ps) != 1)
+					goto out;
+				continue;
+			}
+			id = value;
+		} else if (strcmp(ps->token, "alg") == 0) {
+			if (next(ps) != 1 || (alg = parse_alg(ps->token)) < 0)
+				goto out;
+		} else if (strcmp(ps->token, "hash") == 0) {
+			if (next(ps) != 1)
+				goto out;
+			if (strcmp(ps->token, "0") == 0 ||
+			    strcmp(ps->token, crush_hash_name(CRUSH_HASH_RJENKINS1)) == 0)
+				hash = CRUSH_HASH_RJENKINS1;
+			else
+				goto out;
+		} else if (strcmp(ps->token, "item") == 0) {
+			struct bucket_item *item;
+
+			if (size == BUCKET_ITEMS_MAX)
+				goto out;
+			if (size == capacity) {
+				capacity = capacity ? capacity * 2 : 16;
+				grown = realloc(items, sizeof(*items) * capacity);
+				if (grown == NULL) {
+					err = -ENOMEM;
+					goto out;
+				}
+				items = grown;
+			}
+			item = &items[size++];
+			item->pos = -1;
+			if (next(ps) != 1 || item_id(ps, ps->token, &item->id) < 0)
+				goto out;
+			if (item->id < 0)
+				item->weight = ps->map->buckets[-1 - item->id]->weight;
+			else
+				item->weight = 0x10000;
+			for (;;) {
+				if (accept(ps, "weight")) {
+					if (next_weight(ps, &item->weight) < 0)
+						goto out;
+				} else if (accept(ps, "pos")) {
+					if (next_int(ps, &item->pos) < 0 || item->pos < 0)
+						goto out;
+				} else {
+					break;
+				}
+			}
+		} else {
+			goto out;
+		}
+	}
+	err = add_bucket(ps, name, id, type, alg, hash, items, size);
+out:
+	free(items);
+	return err;
+}
+
+#define STEPS_MAX 64
+
+static const struct {
+	const char *name;
+	int op;
+} set_steps[] = {
+	{ "set_choose_tries", CRUSH_RULE_SET_CHOOSE_TRIES },
+	{ "set_chooseleaf_tries", CRUSH_RULE_SET_CHOOSELEAF_TRIES },
+	{ "set_choose_local_tries", CRUSH_RULE_SET_CHOOSE_LOCAL_TRIES },
+	{ "set_choose_local_fallback_tries", CRUSH_RULE_SET_CHOOSE_LOCAL_FALLBACK_TRIES },
+	{ "set_chooseleaf_vary_r", CRUSH_RULE_SET_CHOOSELEAF_VARY_R },
+	{ "set_chooseleaf_stable", CRUSH_RULE_SET_CHOOSELEAF_STABLE },
+};
+
+static int parse_step(struct parser *ps, struct crush_rule_step *step)
+{
+	size_t i;
+
+	if (next(ps) != 1)
+		return -EINVAL;
+	step->arg1 = step->arg2 = 0;
+	if (strcmp(ps->token, "take") == 0) {
+		step->op = CRUSH_RULE_TAKE;
+		if (next(ps) != 1 || item_id(ps, ps->token, &step->arg1) < 0)
+			return -EINVAL;
+		/* the class of a take is not supported */
+		return same_line(ps) ? -EINVAL : 0;
+	}
+	if (strcmp(ps->token, "emit") == 0) {
+		step->op = CRUSH_RULE_EMIT;
+		return 0;
+	}
+	if (strcmp(ps->token, "choose") == 0 || strcmp(ps->token, "chooseleaf") == 0) {
+		int leaf = strcmp(ps->token, "chooseleaf") == 0;
+
+		if (next(ps) != 1)
+			return -EINVAL;
+		if (strcmp(ps->token, "firstn") == 0)
+			step->op = leaf ? CRUSH_RULE_CHOOSELEAF_FIRSTN : CRUSH_RULE_CHOOSE_FIRSTN;
+		else if (strcmp(ps->token, "indep") == 0)
+			step->op = leaf ? CRUSH_RULE_CHOOSELEAF_INDEP : CRUSH_RULE_CHOOSE_INDEP;
+		else
+			return -EINVAL;
+		if (next_int(ps, &step->arg1) < 0 || expect(ps, "type") < 0 || next(ps) != 1 ||
+		    names_get(&ps->types, ps->token, &step->arg2) < 0)
+			return -EINVAL;
+		return 0;
+	}
+	for (i = 0; i < sizeof(set_steps) / sizeof(set_steps[0]); i++)
+		if (strcmp(ps->token, set_steps[i].name) == 0) {
+			step->op = set_steps[i].op;
+			return next_int(ps, &step->arg1);
+		}
+	return -EINVAL;
+}
+
+static int parse_rule(struct parser *ps)
+{
+	struct crush_rule_step steps[STEPS_MAX];
+	struct crush_rule *rule;
+	int ruleno = -1, ruleset = -1, type = 1, min_size = 1, max_size = 10;
+	int len = 0, i, err;
+
+	/* the name */
+	if (next(ps) != 1 || expect(ps, "{") < 0)
+		return -EINVAL;
+	for (;;) {
+		if (next(ps) != 1)
+			return -EINVAL;
+		if (strcmp(ps->token, "}") == 0)
+			break;
+		if (strcmp(ps->token, "id") == 0) {
+			if (next_int(ps, &ruleno) < 0 || ruleno < 0 || ruleno >= CRUSH_MAX_RULES)
+				return -EINVAL;
+		} else if (strcmp(ps->token, "ruleset") == 0) {
+			if (next_int(ps, &ruleset) < 0 || ruleset < 0 || ruleset >= CRUSH_MAX_RULESET)
+				return -EINVAL;
+		} else if (strcmp(ps->token, "type") == 0) {
+			if (next(ps) != 1)
+				return -EINVAL;
+			/* the pool types of Ceph */
+			if (strcmp(ps->token, "replicated") == 0)
+				type = 1;
+			else if (strcmp(ps->token, "erasure") == 0)
+				type = 3;
+			else {
+				char *end;
+
+				type = strtol(ps->token, &end, 10);
+				if (*end != '\0' || type < 0 || type > 0xff)
+					return -EINVAL;
+			}
+		} else if (strcmp(ps->token, "min_size") == 0) {
+			if (next_int(ps, &min_size) < 0 || min_size < 0 || min_size > 0xff)
+				return -EINVAL;
+		} else if (strcmp(ps->token, "max_size") == 0) {
+			if (next_int(ps, &max_size) < 0 || max_size < 0 || max_size > 0xff)
+				return -EINVAL;
+		} else if (strcmp(ps->token, "step") == 0) {
+			if (len == STEPS_MAX)
+				return -EINVAL;
+			err = parse_step(ps, &steps[len++]);
+			if (err < 0)
+				return err;
+		} else {
+			return -EINVAL;
+		}
+	}
+	if (ruleno < 0) {
+		/* the first free rule */
+		for (ruleno = 0; ruleno < (int)ps->map->max_rules; ruleno++)
+			if (ps->map->rules[ruleno] == NULL)
+				break;
+		if (ruleno >= CRUSH_MAX_RULES)
+			return -EINVAL;
+	}
+	if (ruleno < (int)ps->map->max_rules && ps->map->rules[ruleno] != NULL)
+		return -EINVAL;
+	rule = crush_make_rule(len, ruleset < 0 ? ruleno : ruleset, type, min_size, max_size);
+	if (rule == NULL)
+		return -ENOMEM;
+	for (i = 0; i < len; i++)
+		crush_rule_set_step(rule, i, steps[i].op, steps[i].arg1, steps[i].arg2);
+	err = crush_add_rule(ps->map, rule, ruleno);
+	if (err < 0) {
+		crush_destroy_rule(rule);
+		return err;
+	}
+	return 0;
+}
+
+/* a section that is ignored, up to its closing brace */
+static int skip_section(struct parser *ps)
+{
+	int depth = 0;
+
+	for (;;) {
+		if (next(ps) != 1)
+			return -EINVAL;
+		if (strcmp(ps->token, "{") == 0)
+			depth++;
+		else if (strcmp(ps->token, "}") == 0 && --depth <= 0)
+			return depth == 0 ? 0 : -EINVAL;
+	}
+}
+
+static int parse(struct parser *ps)
+{
+	int type, err;
+
+	for (;;) {
+		err = next(ps);
+		if (err <= 0)
+			return err;
+		if (strcmp(ps->token, "device") == 0)
+			err = parse_device(ps);
+		else if (strcmp(ps->token, "type") == 0)
+			err = parse_type(ps);
+		else if (strcmp(ps->token, "tunable") == 0)
+			err = parse_tunable(ps);
+		else if (strcmp(ps->token, "rule") == 0)
+			err = parse_rule(ps);
+		else if (strcmp(ps->token, "choose_args") == 0)
+			err = skip_section(ps);
+		else if (names_get(&ps->types, ps->token, &type) == 0)
+			err = parse_bucket(ps, type);
+		else
+			err = -EINVAL;
+		if (err < 0)
+			return err;
+	}
+}
+
+int crush_load_text(const char *text, size_t length, struct crush_map **mapp, int *line)
+{
+	struct parser ps;
+	int err;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = text;
+	ps.end = text + length;
+	ps.line = 1;
+	ps.max_device = -1;
+	ps.map = crush_create();
+	if (ps.map == NULL)
+		return -ENOMEM;
+	err = parse(&ps);
+	names_free(&ps.devices);
+	names_free(&ps.buckets);
+	names_free(&ps.types);
+	if (err < 0) {
+		if (line != NULL)
+			*line = ps.token_line ? ps.token_line : ps.line;
+		crush_destroy(ps.map);
+		return err;
+	}
+	crush_finalize(ps.map);
+	if (ps.max_device >= ps.map->max_devices)
+		ps.map->max_devices = ps.max_device + 1;
+	err = crush_map_validate(ps.map, NULL, NULL);
+	if (err < 0) {
+		if (line != NULL)
+			*line = 0;
+		crush_destroy(ps.map);
+		return err;
+	}
+	*mapp = ps.map;
+	return 0;
+}
+
+int crush_load(const void *buffer, size_t length, struct crush_map **map, int *line)
+{
+	if (length >= 4 && crush_get_u32(buffer) == CRUSH_MAGIC)
+		return crush_load_binary(buffer, length, map);
+	return crush_load_text(buffer, length, map, line);
+}
+
+int crush_load_file(const char *path, struct crush_map **map, int *line)
+{
+	FILE *f = fopen(path, "rb");
+	char *buffer = NULL, *grown;
+	size_t length = 0, capacity = 0, n;
+	int err;
+
+	if (f == NULL)
+		return -errno;
+	do {
+		if (length == capacity) {
+			capacity = capacity ? capacity * 2 : 1 << 16;
+			grown = realloc(buffer, capacity);
+			if (grown == NULL) {
+				free(buffer);
+				fclose(f);
+				return -ENOMEM;
+			}
+			buffer = grown;
+		}
+		n = fread(buffer + length, 1, capacity - length, f);
+		length += n;
+	} while (n > 0);
+	err = ferror(f) ? -EIO : 0;
+	fclose(f);
+	if (err == 0)
+		err = crush_load(buffer, length, map, line);
+	free(buffer);
+	return err;
+}
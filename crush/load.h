@@ -0,0 +1,118 @@
+#ifndef CEPH_CRUSH_LOAD_H
+#define CEPH_CRUSH_LOAD_H
+
+/*
+ * Load a crush_map from the binary encoding of Ceph (crushtool -o)
+ * or from its text format (crushtool -d).
+ *
+ * LGPL2
+ */
+
+#include <stddef.h>
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * Decode the binary encoding of a crush map, as written by
+ * __crushtool -o__ or __ceph osd getcrushmap__. The buckets,
+ * including the straws of straw buckets, the rules and the
+ * tunables are decoded as they are; the names, device classes and
+ * choose_args that follow are ignored. The tunables missing from
+ * old encodings get their legacy values, as in Ceph. The map is
+ * finalized with crush_finalize() and must be deallocated with
+ * crush_destroy().
+ *
+ * - return -EINVAL if __buffer__ is not a valid encoding or the map
+ *   decoded is not valid according to crush_map_validate()
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param buffer the encoded map
+ * @param length the size of __buffer__ in bytes
+ * @param[out] map the crush_map decoded
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_load_binary(const void *buffer, size_t length, struct crush_map **map);
+
+/** @ingroup API
+ *
+ * Compile a crush map in the text format of __crushtool -d__:
+ *
+ *     tunable choose_total_tries 50
+ *     device 0 osd.0
+ *     device 1 osd.1 class ssd
+ *     type 0 osd
+ *     type 1 host
+ *     host host0 {
+ *             id -2
+ *             alg straw2
+ *             hash 0
+ *             item osd.0 weight 1.000
+ *             item osd.1 weight 1.000
+ *     }
+ *     rule replicated_rule {
+ *             id 0
+ *             type replicated
+ *             min_size 1
+ *             max_size 10
+ *             step take host0
+ *             step choose firstn 0 type osd
+ *             step emit
+ *     }
+ *
+ * Buckets must be defined before they are used as items. The
+ * tunables that are not set keep the values of crush_create(). The
+ * device classes of devices are ignored, as are the shadow ids of
+ * buckets (id -3 class ssd) and the choose_args sections. Rules
+ * taking a device class are not supported. A bucket has at most
+ * 2^20 items. Comments start with #.
+ * The map is finalized with crush_finalize() and must be
+ * deallocated with crush_destroy().
+ *
+ * - return -EINVAL if __text__ is not a valid map, __line__ is set
+ *   to the line of the error
+ * - return -EINVAL if the map compiled is not valid according to
+ *   crush_map_validate(), __line__ is set to 0
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param text the map, not necessarily NUL terminated
+ * @param length the size of __text__ in bytes
+ * @param[out] map the crush_map compiled
+ * @param[out] line the line of the error, if not NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_load_text(const char *text, size_t length, struct crush_map **map,
+			   int *line);
+
+/** @ingroup API
+ *
+ * Load the crush map in __buffer__ with crush_load_binary() if it
+ * starts like a binary encoding, with crush_load_text() otherwise.
+ *
+ * @param buffer the map
+ * @param length the size of __buffer__ in bytes
+ * @param[out] map the crush_map loaded
+ * @param[out] line the line of the error of a text map, if not NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_load(const void *buffer, size_t length, struct crush_map **map,
+		      int *line);
+
+/** @ingroup API
+ *
+ * Load the crush map in the file __path__ with crush_load().
+ *
+ * - return -errno if the file cannot be read
+ *
+ * @param path the file
+ * @param[out] map the crush_map loaded
+ * @param[out] line the line of the error of a text map, if not NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_load_file(const char *path, struct crush_map **map, int *line);
+
+#endif
@@ -27,6 +27,39 @@
 
 #define dprintk(args...) /* printf(args) */
 
+#if !defined(__KERNEL__) && defined(CRUSH_STATS)
+# include "stats.h"
+/*
+ * The counters of the rule being mapped by crush_do_rule() in this
+ * thread, or NULL if they are not collected. The bucket choose
+ * functions do not have access to the workspace.
+ */
+static __thread struct crush_stats *stats;
+# define stat_inc(counter) do { if (stats) stats->counter++; } while (0)
+#else
+# define stat_inc(counter) do { } while (0)
+#endif
+
+#ifndef __KERNEL__
+# include "probes.h"
+# include "replay.h"
+# include "trace.h"
+# define trace_event(work, event, ...)					\
+	do {								\
+		if ((work)->trace && (work)->trace->event)		\
+			(work)->trace->event((work)->trace_arg, __VA_ARGS__); \
+	} while (0)
+/* true if every device under the bucket __item__ is out */
+# define pruned(work, item)						\
+	((work)->pruned && (work)->pruned[-1-(item)])
+#else
+# define CRUSH_PROBE3(name, a, b, c) do { } while (0)
+# define CRUSH_PROBE4(name, a, b, c, d) do { } while (0)
+# define CRUSH_PROBE5(name, a, b, c, d, e) do { } while (0)
+# define trace_event(work, event, ...) do { } while (0)
+# define pruned(work, item) 0
+#endif
+
 /*
  * Implement the core CRUSH mapping algorithm.
  */
@@ -84,6 +117,7 @@ static int bucket_perm_choose(const struct crush_bucket *bucket,
 
 		/* optimize common r=0 case */
 		if (pr == 0) {
+			stat_inc(hashes);
 			s = crush_hash32_3(bucket->hash, x, bucket->id, 0) %
 				bucket->size;
 			work->perm[0] = s;
@@ -109,6 +143,7 @@ static int bucket_perm_choose(const struct crush_bucket *bucket,
 		unsigned int p = work->perm_n;
 		/* no point in swapping the final entry */
 		if (p < bucket->size - 1) {
+			stat_inc(hashes);
 			i = crush_hash32_3(bucket->hash, x, bucket->id, p) %
 				(bucket->size - p);
 			if (i) {
@@ -144,7 +179,10 @@ static int bucket_list_choose(const struct crush_bucket_list *bucket,
 	int i;
 
 	for (i = bucket->h.size-1; i >= 0; i--) {
-		__u64 w = crush_hash32_4(bucket->h.hash, x, bucket->h.items[i],
+		__u64 w;
+
+		stat_inc(hashes);
+		w = crush_hash32_4(bucket->h.hash, x, bucket->h.items[i],
 					 r, bucket->h.id);
 		w &= 0xffff;
 		dprintk("list_choose i=%d x=%d r=%d item %d weight %x "
@@ -206,6 +244,7 @@ static int bucket_tree_choose(const struct crush_bucket_tree *bucket,
 		int l;
 		/* pick point in [0, w) */
 		w = bucket->node_weights[n];
+		stat_inc(hashes);
 		t = (__u64)crush_hash32_4(bucket->h.hash, x, n, r,
 					  bucket->h.id) * (__u64)w;
 		t = t >> 32;
@@ -233,6 +272,7 @@ static int bucket_straw_choose(const struct crush_bucket_straw *bucket,
 	__u64 draw;
 
 	for (i = 0; i < bucket->h.size; i++) {
+		stat_inc(hashes);
 		draw = crush_hash32_3(bucket->h.hash, x, bucket->h.items[i], r);
 		draw &= 0xffff;
 		draw *= bucket->straws[i];
@@ -332,6 +372,7 @@ static int bucket_straw2_choose(const struct crush_bucket_straw2 *bucket,
 	for (i = 0; i < bucket->h.size; i++) {
                 dprintk("weight 0x%x item %d\n", weights[i], ids[i]);
 		if (weights[i]) {
+			stat_inc(hashes);
 			u = crush_hash32_3(bucket->h.hash, x, ids[i], r);
 			u &= 0xffff;
 
@@ -376,6 +417,11 @@ static int crush_bucket_choose(const struct crush_bucket *in,
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
 	BUG_ON(in->size == 0);
+	CRUSH_PROBE4(bucket_choose, in->id, x, r, in->alg);
+#if !defined(__KERNEL__) && defined(CRUSH_STATS)
+	if (stats && in->alg <= CRUSH_BUCKET_STRAW2)
+		stats->bucket_choose[in->alg]++;
+#endif
 	switch (in->alg) {
 	case CRUSH_BUCKET_UNIFORM:
 		return bucket_uniform_choose(
@@ -415,12 +461,28 @@ static int is_out(const struct crush_map *map,
 		return 0;
 	if (weight[item] == 0)
 		return 1;
+	stat_inc(hashes);
 	if ((crush_hash32_2(CRUSH_HASH_RJENKINS1, x, item) & 0xffff)
 	    < weight[item])
 		return 0;
 	return 1;
 }
 
+/*
+ * count an item placed, or not, after ftotal failed attempts in the
+ * choose_tries histograms
+ */
+static void count_tries(const struct crush_map *map, struct crush_work *work,
+			unsigned int ftotal)
+{
+#ifndef __KERNEL__
+	if (map->choose_tries && ftotal <= map->choose_total_tries)
+		map->choose_tries[ftotal]++;
+	if (work->choose_tries && ftotal < work->choose_tries_max)
+		work->choose_tries[ftotal]++;
+#endif
+}
+
 /**
  * crush_choose_firstn - choose numrep distinct items of given type
  * @map: the crush_map
@@ -497,21 +559,25 @@ parent_r %d stable %d\n",
 
 				/* bucket choose */
 				if (in->size == 0) {
+					trace_event(work, reject, in->id, in->id, r,
+						    ftotal, CRUSH_TRACE_EMPTY);
 					reject = 1;
 					goto reject;
 				}
 				if (local_fallback_retries > 0 &&
 				    flocal >= (in->size>>1) &&
-				    flocal > local_fallback_retries)
+				    flocal > local_fallback_retries) {
+					stat_inc(perm_choose);
 					item = bucket_perm_choose(
 						in, work->work[-1-in->id],
 						x, r);
-				else
+				} else
 					item = crush_bucket_choose(
 						in, work->work[-1-in->id],
 						x, r,
                                                 (choose_args ? &choose_args[-1-in->id] : 0),
                                                 outpos);
+				trace_event(work, choose, in->id, x, r, item);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					skip_rep = 1;
@@ -533,6 +599,19 @@ parent_r %d stable %d\n",
 						skip_rep = 1;
 						break;
 					}
+					if (type == 0 && local_retries == 0 &&
+					    local_fallback_retries == 0 &&
+					    pruned(work, item)) {
+						/*
+						 * the descent would end with a
+						 * single reject, skip it
+						 */
+						trace_event(work, reject, in->id, item, r,
+							    ftotal, CRUSH_TRACE_PRUNED);
+						reject = 1;
+						goto reject;
+					}
+					stat_inc(descents);
 					in = map->buckets[-1-item];
 					retry_bucket = 1;
 					continue;
@@ -541,6 +620,8 @@ parent_r %d stable %d\n",
 				/* collision? */
 				for (i = 0; i < outpos; i++) {
 					if (out[i] == item) {
+						trace_event(work, collide, in->id,
+							    item, r, ftotal);
 						collide = 1;
 						break;
 					}
@@ -554,7 +635,12 @@ parent_r %d stable %d\n",
 							sub_r = r >> (vary_r-1);
 						else
 							sub_r = 0;
-						if (crush_choose_firstn(
+						if (pruned(work, item)) {
+							/* as if no leaf was found */
+							trace_event(work, reject, in->id, item, r,
+								    ftotal, CRUSH_TRACE_PRUNED);
+							reject = 1;
+						} else if (crush_choose_firstn(
 							    map,
 							    work,
 							    map->buckets[-1-item],
@@ -569,9 +655,13 @@ parent_r %d stable %d\n",
 							    stable,
 							    NULL,
 							    sub_r,
-                                                            choose_args) <= outpos)
+                                                            choose_args) <= outpos) {
 							/* didn't get leaf */
+							trace_event(work, reject, in->id, item, r,
+								    ftotal, CRUSH_TRACE_NO_LEAF);
+							stat_inc(rejects_leaf);
 							reject = 1;
+						}
 					} else {
 						/* we already have a leaf! */
 						out2[outpos] = item;
@@ -580,34 +670,57 @@ parent_r %d stable %d\n",
 
 				if (!reject && !collide) {
 					/* out? */
-					if (itemtype == 0)
+					if (itemtype == 0) {
 						reject = is_out(map, weight,
 								weight_max,
 								item, x);
+						CRUSH_PROBE3(is_out, item, x, reject);
+						if (reject) {
+							trace_event(work, reject, in->id, item, r,
+								    ftotal, CRUSH_TRACE_OUT);
+							stat_inc(rejects_out);
+						}
+					}
 				}
 
 reject:
 				if (reject || collide) {
 					ftotal++;
 					flocal++;
+					if (collide) {
+						CRUSH_PROBE5(choose_collide, in->id, item,
+							     x, r, ftotal);
+						stat_inc(collisions);
+					} else {
+						CRUSH_PROBE5(choose_reject, in->id, item,
+							     x, r, ftotal);
+					}
 
-					if (collide && flocal <= local_retries)
+					if (collide && flocal <= local_retries) {
 						/* retry locally a few times */
+						stat_inc(retries_local);
 						retry_bucket = 1;
-					else if (local_fallback_retries > 0 &&
-						 flocal <= in->size + local_fallback_retries)
+					} else if (local_fallback_retries > 0 &&
+						 flocal <= in->size + local_fallback_retries) {
 						/* exhaustive bucket search */
+						stat_inc(retries_local);
 						retry_bucket = 1;
-					else if (ftotal < tries)
+					} else if (ftotal < tries) {
 						/* then retry descent */
+						stat_inc(retries_total);
 						retry_descent = 1;
-					else
+					} else {
 						/* else give up */
+						stat_inc(skips);
 						skip_rep = 1;
+					}
 					dprintk("  reject %d  collide %d  "
 						"ftotal %u  flocal %u\n",
 						reject, collide, ftotal,
 						flocal);
+					if (retry_bucket || retry_descent)
+						CRUSH_PROBE5(choose_retry, in->id, x, r,
+							     ftotal, flocal);
 				}
 			} while (retry_bucket);
 		} while (retry_descent);
@@ -621,10 +734,7 @@ reject:
 		out[outpos] = item;
 		outpos++;
 		count--;
-#ifndef __KERNEL__
-		if (map->choose_tries && ftotal <= map->choose_total_tries)
-			map->choose_tries[ftotal]++;
-#endif
+		count_tries(map, work, ftotal);
 	}
 
 	dprintk("CHOOSE returns %d\n", outpos);
@@ -687,6 +797,11 @@ static void crush_choose_indep(const struct crush_map *map,
 		for (rep = outpos; rep < endpos; rep++) {
 			if (out[rep] != CRUSH_ITEM_UNDEF)
 				continue;
+			if (ftotal > 0) {
+				CRUSH_PROBE5(choose_retry, bucket->id, x, rep,
+					     ftotal, 0);
+				stat_inc(retries_total);
+			}
 
 			in = bucket;  /* initial bucket */
 
@@ -714,6 +829,8 @@ static void crush_choose_indep(const struct crush_map *map,
 				/* bucket choose */
 				if (in->size == 0) {
 					dprintk("   empty bucket\n");
+					trace_event(work, reject, in->id, in->id, r,
+						    ftotal, CRUSH_TRACE_EMPTY);
 					break;
 				}
 
@@ -722,6 +839,7 @@ static void crush_choose_indep(const struct crush_map *map,
 					x, r,
                                         (choose_args ? &choose_args[-1-in->id] : 0),
                                         outpos);
+				trace_event(work, choose, in->id, x, r, item);
 				if (item >= map->max_devices) {
 					dprintk("   bad item %d\n", item);
 					out[rep] = CRUSH_ITEM_NONE;
@@ -750,6 +868,12 @@ static void crush_choose_indep(const struct crush_map *map,
 						left--;
 						break;
 					}
+					if (type == 0 && pruned(work, item)) {
+						trace_event(work, reject, in->id, item, r,
+							    ftotal, CRUSH_TRACE_PRUNED);
+						break;
+					}
+					stat_inc(descents);
 					in = map->buckets[-1-item];
 					continue;
 				}
@@ -762,22 +886,48 @@ static void crush_choose_indep(const struct crush_map *map,
 						break;
 					}
 				}
-				if (collide)
+				if (collide) {
+					CRUSH_PROBE5(choose_collide, in->id, item,
+						     x, r, ftotal);
+					trace_event(work, collide, in->id, item, r,
+						    ftotal);
+					stat_inc(collisions);
 					break;
+				}
 
 				if (recurse_to_leaf) {
 					if (item < 0) {
-						crush_choose_indep(
-							map,
-							work,
-							map->buckets[-1-item],
-							weight, weight_max,
-							x, 1, numrep, 0,
-							out2, rep,
-							recurse_tries, 0,
-							0, NULL, r, choose_args);
+						if (pruned(work, item)) {
+							/* as if all the tries failed */
+							CRUSH_PROBE5(choose_reject,
+								     in->id, item,
+								     x, r, ftotal);
+							trace_event(work, reject, in->id,
+								    item, r, ftotal,
+								    CRUSH_TRACE_PRUNED);
+							out2[rep] = CRUSH_ITEM_NONE;
+							count_tries(map, work,
+								    recurse_tries);
+							break;
+						} else
+							crush_choose_indep(
+								map,
+								work,
+								map->buckets[-1-item],
+								weight, weight_max,
+								x, 1, numrep, 0,
+								out2, rep,
+								recurse_tries, 0,
+								0, NULL, r, choose_args);
 						if (out2[rep] == CRUSH_ITEM_NONE) {
 							/* placed nothing; no leaf */
+							CRUSH_PROBE5(choose_reject,
+								     in->id, item,
+								     x, r, ftotal);
+							trace_event(work, reject, in->id,
+								    item, r, ftotal,
+								    CRUSH_TRACE_NO_LEAF);
+							stat_inc(rejects_leaf);
 							break;
 						}
 					} else {
@@ -787,9 +937,22 @@ static void crush_choose_indep(const struct crush_map *map,
 				}
 
 				/* out? */
-				if (itemtype == 0 &&
-				    is_out(map, weight, weight_max, item, x))
-					break;
+				if (itemtype == 0) {
+					int is_out_dev = is_out(map, weight,
+								weight_max,
+								item, x);
+
+					CRUSH_PROBE3(is_out, item, x, is_out_dev);
+					if (is_out_dev) {
+						CRUSH_PROBE5(choose_reject, in->id,
+							     item, x, r, ftotal);
+						trace_event(work, reject, in->id,
+							    item, r, ftotal,
+							    CRUSH_TRACE_OUT);
+						stat_inc(rejects_out);
+						break;
+					}
+				}
 
 				/* yay! */
 				out[rep] = item;
@@ -800,16 +963,14 @@ static void crush_choose_indep(const struct crush_map *map,
 	}
 	for (rep = outpos; rep < endpos; rep++) {
 		if (out[rep] == CRUSH_ITEM_UNDEF) {
+			stat_inc(skips);
 			out[rep] = CRUSH_ITEM_NONE;
 		}
 		if (out2 && out2[rep] == CRUSH_ITEM_UNDEF) {
 			out2[rep] = CRUSH_ITEM_NONE;
 		}
 	}
-#ifndef __KERNEL__
-	if (map->choose_tries && ftotal <= map->choose_total_tries)
-		map->choose_tries[ftotal]++;
-#endif
+	count_tries(map, work, ftotal);
 #ifdef DEBUG_INDEP
 	if (out2) {
 		dprintk("%u %d a: ", ftotal, left);
@@ -851,6 +1012,14 @@ void crush_init_workspace(const struct crush_map *m, void *v) {
 	__s32 b;
 	point += sizeof(struct crush_work);
 	w->work = (struct crush_work_bucket **)point;
+#ifndef __KERNEL__
+	w->trace = NULL;
+	w->trace_arg = NULL;
+	w->recorder = NULL;
+	w->choose_tries = NULL;
+	w->choose_tries_max = 0;
+	w->pruned = NULL;
+#endif
 	point += m->max_buckets * sizeof(struct crush_work_bucket *);
 	for (b = 0; b < m->max_buckets; ++b) {
 		if (m->buckets[b] == 0)
@@ -867,9 +1036,24 @@ void crush_init_workspace(const struct crush_map *m, void *v) {
 		w->work[b]->perm = (__u32 *)point;
 		point += m->buckets[b]->size * sizeof(__u32);
 	}
+#if !defined(__KERNEL__) && defined(CRUSH_STATS)
+	w->stats = NULL;
+	w->stats_max = 0;
+#endif
 	BUG_ON((char *)point - (char *)w != m->working_size);
 }
 
+#ifndef __KERNEL__
+void crush_choose_tries_attach(void *cwin, __u32 *choose_tries,
+			       int choose_tries_max)
+{
+	struct crush_work *cw = (struct crush_work *)cwin;
+
+	cw->choose_tries = choose_tries;
+	cw->choose_tries_max = choose_tries ? choose_tries_max : 0;
+}
+#endif
+
 /**
  * crush_do_rule - calculate a mapping with the given input and rule
  * @map: the crush_map
@@ -918,6 +1102,11 @@ int crush_do_rule(const struct crush_map *map,
 	int vary_r = map->chooseleaf_vary_r;
 	int stable = map->chooseleaf_stable;
 
+#ifndef __KERNEL__
+	if (cw->recorder)
+		crush_recorder_add(cw->recorder, ruleno, x, result_max,
+				   weight, weight_max);
+#endif
 	if ((__u32)ruleno >= map->max_rules) {
 		dprintk(" bad ruleno %d\n", ruleno);
 		return 0;
@@ -925,11 +1114,19 @@ int crush_do_rule(const struct crush_map *map,
 
 	rule = map->rules[ruleno];
 	result_len = 0;
+#if !defined(__KERNEL__) && defined(CRUSH_STATS)
+	stats = ruleno < cw->stats_max ? &cw->stats[ruleno] : NULL;
+	stat_inc(mappings);
+#endif
+	CRUSH_PROBE3(do_rule_entry, ruleno, x, result_max);
 
 	for (step = 0; step < rule->len; step++) {
 		int firstn = 0;
 		const struct crush_rule_step *curstep = &rule->steps[step];
 
+		trace_event(cw, step, ruleno, step, curstep->op,
+			    curstep->arg1, curstep->arg2);
+
 		switch (curstep->op) {
 		case CRUSH_RULE_TAKE:
 			if ((curstep->arg1 >= 0 &&
@@ -1077,6 +1274,7 @@ int crush_do_rule(const struct crush_map *map,
 
 		case CRUSH_RULE_EMIT:
 			for (i = 0; i < wsize && result_len < result_max; i++) {
+				trace_event(cw, emit, w[i]);
 				result[result_len] = w[i];
 				result_len++;
 			}
@@ -1090,5 +1288,6 @@ int crush_do_rule(const struct crush_map *map,
 		}
 	}
 
+	CRUSH_PROBE3(do_rule_return, ruleno, x, result_len);
 	return result_len;
 }
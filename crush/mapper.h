@@ -90,4 +90,24 @@ static inline size_t crush_work_size(const struct crush_map *map,
 
 extern void crush_init_workspace(const struct crush_map *m, void *v);
 
+#ifndef __KERNEL__
+/** @ingroup API
+ *
+ * Make crush_do_rule() called with __cwin__ count, in
+ * __choose_tries[n]__, the items that were placed after __n__
+ * failed attempts, for all __n__ < __choose_tries_max__. Unlike
+ * __map->choose_tries__, which is shared by all threads, each thread
+ * can count in its own histogram and they can be added afterwards.
+ * The histogram is not reset. Calling crush_init_workspace()
+ * detaches the histogram. If __choose_tries__ is NULL the histogram
+ * is detached.
+ *
+ * @param cwin a workspace initialized with crush_init_workspace()
+ * @param choose_tries an array of __choose_tries_max__ counters or NULL
+ * @param choose_tries_max the size of the __choose_tries__ array
+ */
+extern void crush_choose_tries_attach(void *cwin, __u32 *choose_tries,
+				      int choose_tries_max);
+#endif
+
 #endif
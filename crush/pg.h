@@ -0,0 +1,35 @@
+#ifndef CEPH_CRUSH_PG_H
+#define CEPH_CRUSH_PG_H
+
+/*
+ * The random draws and the seeds of the PGs shared by the functions
+ * that map the PGs of a pool.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+#include "hash.h"
+
+/* the finalizer of splitmix64: a bijection that mixes all the bits of z */
+static inline __u64 crush_splitmix64_mix(__u64 z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* the next value of the splitmix64 stream of state */
+static inline __u64 crush_splitmix64(__u64 *state)
+{
+	*state += 0x9e3779b97f4a7c15ULL;
+	return crush_splitmix64_mix(*state);
+}
+
+/* the x given to crush_do_rule() for a PG, as in pg_pool_t::raw_pg_to_pps() */
+static inline int crush_pg_seed(int pool, int pg)
+{
+	return crush_hash32_2(CRUSH_HASH_RJENKINS1, pg, pool);
+}
+
+#endif
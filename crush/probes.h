@@ -0,0 +1,41 @@
+#ifndef CEPH_CRUSH_PROBES_H
+#define CEPH_CRUSH_PROBES_H
+
+/*
+ * USDT probes of the libcrush provider, for bpftrace, perf or
+ * SystemTap. They are compiled in when <sys/sdt.h> is available and
+ * CRUSH_USDT is set (the default) and are a single nop when no
+ * tracer is attached.
+ *
+ *   do_rule_entry(ruleno, x, result_max)
+ *   do_rule_return(ruleno, x, result_len)
+ *   bucket_choose(bucket id, x, r, alg)
+ *   choose_collide(bucket id, item, x, r, ftotal)
+ *   choose_reject(bucket id, item, x, r, ftotal)
+ *   choose_retry(bucket id, x, r, ftotal, flocal)
+ *   is_out(item, x, out)
+ *   finalize(max_buckets, max_devices, working_size)
+ *
+ * For instance:
+ *
+ *   bpftrace -e 'usdt:libcrush.so:libcrush:choose_retry { @[arg0] = count(); }'
+ *
+ * LGPL2
+ */
+
+#ifndef __KERNEL__
+# include "acconfig.h"
+#endif
+
+#if !defined(__KERNEL__) && defined(CRUSH_USDT) && defined(HAVE_SYS_SDT_H)
+# include <sys/sdt.h>
+# define CRUSH_PROBE3(name, a, b, c) DTRACE_PROBE3(libcrush, name, a, b, c)
+# define CRUSH_PROBE4(name, a, b, c, d) DTRACE_PROBE4(libcrush, name, a, b, c, d)
+# define CRUSH_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(libcrush, name, a, b, c, d, e)
+#else
+# define CRUSH_PROBE3(name, a, b, c) do { } while (0)
+# define CRUSH_PROBE4(name, a, b, c, d) do { } while (0)
+# define CRUSH_PROBE5(name, a, b, c, d, e) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#include "prune.h"
+
+/* the states of a bucket in __pruned__ before it is set to 0 or 1 */
+#define PRUNE_UNKNOWN 2
+#define PRUNE_VISITING 3
+
+static int device_out(const __u32 *weights, int weight_max, int item)
+{
+	return item >= weight_max || weights[item] == 0;
+}
+
+static int prune(const struct crush_map *map, const __u32 *weights, int weight_max,
+		 __u8 *pruned, int b)
+{
+	const struct crush_bucket *bucket = map->buckets[b];
+	__u32 i;
+
+	if (pruned[b] != PRUNE_UNKNOWN)
+		/* a bucket being visited is in a cycle and not pruned */
+		return pruned[b] == 1;
+	pruned[b] = PRUNE_VISITING;
+	for (i = 0; i < bucket->size; i++) {
+		int item = bucket->items[i];
+		int child = -1 - item;
+
+		if (item >= 0) {
+			if (item >= map->max_devices ||
+			    !device_out(weights, weight_max, item))
+				break;
+		} else if (child >= map->max_buckets || map->buckets[child] == NULL ||
+			   !prune(map, weights, weight_max, pruned, child))
+			break;
+	}
+	pruned[b] = i == bucket->size;
+	return pruned[b];
+}
+
+int crush_prune_compute(const struct crush_map *map,
+			const __u32 *weights, int weight_max,
+			__u8 *pruned)
+{
+	int b, count = 0;
+
+	for (b = 0; b < map->max_buckets; b++)
+		pruned[b] = map->buckets[b] ? PRUNE_UNKNOWN : 0;
+	for (b = 0; b < map->max_buckets; b++)
+		if (map->buckets[b] != NULL)
+			count += prune(map, weights, weight_max, pruned, b);
+	return count;
+}
+
+void crush_prune_attach(void *cwin, const __u8 *pruned)
+{
+	struct crush_work *cw = (struct crush_work *)cwin;
+
+	cw->pruned = pruned;
+}
@@ -0,0 +1,67 @@
+#ifndef CEPH_CRUSH_PRUNE_H
+#define CEPH_CRUSH_PRUNE_H
+
+/*
+ * Let crush_do_rule() skip the subtrees in which every device is out,
+ * without changing the mappings.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * Set __pruned[b]__ to 1 if every device under __map->buckets[b]__
+ * is always out for the __weights__ given to crush_do_rule(), that
+ * is if it is >= __weight_max__ or its weight is 0, and to 0
+ * otherwise. An empty bucket is pruned. A bucket is not pruned if
+ * an item under it is neither a device < __map->max_devices__ nor
+ * an existing bucket, or if it is in a cycle: crush_map_validate()
+ * rejects such maps.
+ *
+ * The array must be computed again when the map or the weights
+ * change and is typically attached to the workspaces of the threads
+ * mapping with these weights, with crush_prune_attach().
+ *
+ * @param map the crush_map
+ * @param weights an array of weights of size __weight_max__
+ * @param weight_max the size of the __weights__ array
+ * @param[out] pruned an array of __map->max_buckets__ flags
+ *
+ * @returns the number of pruned buckets
+ */
+extern int crush_prune_compute(const struct crush_map *map,
+			       const __u32 *weights, int weight_max,
+			       __u8 *pruned);
+
+/** @ingroup API
+ *
+ * Make crush_do_rule() called with __cwin__ skip the buckets flagged
+ * in __pruned__, computed with crush_prune_compute() for the same
+ * map and weights. Instead of descending into a pruned bucket, where
+ * every try is bound to be rejected, the mapper rejects it at once:
+ *
+ * - when looking for a device under a pruned bucket of the type of
+ *   a chooseleaf step
+ * - when a choose step looking for devices draws a pruned bucket,
+ *   if the local retries are disabled (__choose_local_tries__ and
+ *   __choose_local_fallback_tries__ are 0, as with the optimal
+ *   tunables). Otherwise the tries made in the pruned bucket would
+ *   count and the bucket is descended into as usual.
+ *
+ * The result, as well as the histograms of
+ * crush_choose_tries_attach(), are the same as without the flags.
+ * The trace reports a descent skipped with ::CRUSH_TRACE_PRUNED, by
+ * a choose or a chooseleaf step, and the counters of
+ * crush_stats_attach() count less work: the skipped descent is not
+ * counted in __rejects_leaf__. Calling
+ * crush_init_workspace() detaches the flags. If __pruned__ is NULL
+ * the flags are detached.
+ *
+ * @param cwin a workspace initialized with crush_init_workspace()
+ * @param pruned an array of __map->max_buckets__ flags or NULL
+ */
+extern void crush_prune_attach(void *cwin, const __u8 *pruned);
+
+#endif
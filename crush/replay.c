@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapper.h"
+#include "replay.h"
+#include "varint.h"
+
+/*
+ * Layout of a serialized recording, all integers little endian:
+ *
+ *   header     magic u32, version u32
+ *   records    until the end of the buffer
+ *
+ * A record is a varint tag followed by varints:
+ *
+ *   EPOCH      epoch, weight_max + 1 (0 for NULL weights), weights
+ *   CALL       zigzag ruleno, zigzag result_max, x
+ *   SAME       x, for a call with the ruleno and result_max of the previous one
+ *
+ * A call uses the weights of the last EPOCH record, NULL if there
+ * is none.
+ */
+#define CRUSH_REPLAY_MAGIC 0x50524352 /* CRRP */
+#define CRUSH_REPLAY_VERSION 1
+#define HEADER_SIZE (2 * 4)
+
+enum {
+	TAG_EPOCH = 0,
+	TAG_CALL = 1,
+	TAG_SAME = 2
+};
+
+struct crush_recorder {
+	struct crush_buffer out;
+	int error;
+	__u64 count;
+	int has_call;      /* ruleno and result_max are those of the previous call */
+	int ruleno;
+	int result_max;
+	int has_epoch;
+	__u32 epoch;
+	const __u32 *weights;
+	int weight_max;
+};
+
+struct crush_recorder *crush_recorder_create(void)
+{
+	struct crush_recorder *recorder = calloc(1, sizeof(*recorder));
+
+	if (recorder == NULL)
+		return NULL;
+	if (crush_put_u32(&recorder->out, CRUSH_REPLAY_MAGIC) < 0 ||
+	    crush_put_u32(&recorder->out, CRUSH_REPLAY_VERSION) < 0) {
+		crush_recorder_destroy(recorder);
+		return NULL;
+	}
+	return recorder;
+}
+
+void crush_recorder_destroy(struct crush_recorder *recorder)
+{
+	if (recorder == NULL)
+		return;
+	free(recorder->out.data);
+	free(recorder);
+}
+
+void crush_recorder_attach(void *cwin, struct crush_recorder *recorder)
+{
+	struct crush_work *cw = (struct crush_work *)cwin;
+
+	cw->recorder = recorder;
+}
+
+int crush_recorder_epoch(struct crush_recorder *recorder, __u32 epoch,
+			 const __u32 *weights, int weight_max)
+{
+	struct crush_buffer *out = &recorder->out;
+	int i;
+
+	if (weights == NULL || weight_max < 0)
+		weight_max = 0;
+	if (crush_put_varint(out, TAG_EPOCH) < 0 ||
+	    crush_put_varint(out, epoch) < 0 ||
+	    crush_put_varint(out, weights ? weight_max + 1 : 0) < 0)
+		goto nomem;
+	for (i = 0; i < weight_max; i++)
+		if (crush_put_varint(out, weights[i]) < 0)
+			goto nomem;
+	recorder->has_epoch = 1;
+	recorder->epoch = epoch;
+	recorder->weights = weights;
+	recorder->weight_max = weight_max;
+	return 0;
+nomem:
+	recorder->error = -ENOMEM;
+	return -ENOMEM;
+}
+
+void crush_recorder_add(struct crush_recorder *recorder,
+			int ruleno, int x, int result_max,
+			const __u32 *weights, int weight_max)
+{
+	struct crush_buffer *out = &recorder->out;
+
+	if (recorder->error)
+		return;
+	if (weights == NULL || weight_max < 0)
+		weight_max = 0;
+	if (!recorder->has_epoch || weights != recorder->weights ||
+	    weight_max != recorder->weight_max) {
+		__u32 epoch = recorder->has_epoch ? recorder->epoch + 1 : 0;
+
+		if (crush_recorder_epoch(recorder, epoch, weights, weight_max) < 0)
+			return;
+	}
+	if (recorder->has_call && ruleno == recorder->ruleno &&
+	    result_max == recorder->result_max) {
+		if (crush_put_varint(out, TAG_SAME) < 0)
+			goto nomem;
+	} else {
+		if (crush_put_varint(out, TAG_CALL) < 0 ||
+		    crush_put_varint(out, crush_zigzag(ruleno)) < 0 ||
+		    crush_put_varint(out, crush_zigzag(result_max)) < 0)
+			goto nomem;
+		recorder->has_call = 1;
+		recorder->ruleno = ruleno;
+		recorder->result_max = result_max;
+	}
+	if (crush_put_varint(out, (__u32)x) < 0)
+		goto nomem;
+	recorder->count++;
+	return;
+nomem:
+	recorder->error = -ENOMEM;
+}
+
+__u64 crush_recorder_count(const struct crush_recorder *recorder)
+{
+	return recorder->count;
+}
+
+int crush_recorder_serialize(const struct crush_recorder *recorder,
+			     void **buffer, size_t *length)
+{
+	if (recorder->error)
+		return recorder->error;
+	*buffer = malloc(recorder->out.size);
+	if (*buffer == NULL)
+		return -ENOMEM;
+	memcpy(*buffer, recorder->out.data, recorder->out.size);
+	*length = recorder->out.size;
+	return 0;
+}
+
+/* replay */
+
+struct epoch {
+	__u32 epoch;
+	__u32 *weights;
+	int weight_max;
+};
+
+struct crush_replay {
+	const unsigned char *data;
+	const unsigned char *end;
+	const unsigned char *p;
+	int has_call;
+	int ruleno;
+	int result_max;
+	const struct epoch *current;
+	/* the epochs decoded, the next EPOCH record is epochs[next_epoch] */
+	struct epoch *epochs;
+	int epoch_count;
+	int epoch_capacity;
+	int next_epoch;
+};
+
+int crush_replay_open(const void *buffer, size_t length,
+		      struct crush_replay **replay)
+{
+	const unsigned char *data = buffer;
+	struct crush_replay *r;
+
+	if (length < HEADER_SIZE ||
+	    crush_get_u32(data) != CRUSH_REPLAY_MAGIC ||
+	    crush_get_u32(data + 4) != CRUSH_REPLAY_VERSION)
+		return -EINVAL;
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return -ENOMEM;
+	r->data = data + HEADER_SIZE;
+	r->end = data + length;
+	crush_replay_rewind(r);
+	*replay = r;
+	return 0;
+}
+
+static int read_epoch(struct crush_replay *r)
+{
+	struct epoch *e;
+	__u64 epoch, size, weight;
+	int i;
+
+	if (crush_get_varint(&r->p, r->end, &epoch) < 0 ||
+	    crush_get_varint(&r->p, r->end, &size) < 0 ||
+	    epoch > 0xffffffffu || size > (__u64)(r->end - r->p) + 1)
+		return -EINVAL;
+	if (r->next_epoch < r->epoch_count) {
+		/* decoded before crush_replay_rewind() */
+		e = &r->epochs[r->next_epoch++];
+		for (i = 0; i < e->weight_max; i++)
+			if (crush_get_varint(&r->p, r->end, &weight) < 0)
+				return -EINVAL;
+		r->current = e;
+		return 0;
+	}
+	if (r->epoch_count == r->epoch_capacity) {
+		int capacity = r->epoch_capacity ? r->epoch_capacity * 2 : 8;
+		struct epoch *epochs = realloc(r->epochs, sizeof(*epochs) * capacity);
+
+		if (epochs == NULL)
+			return -ENOMEM;
+		r->epochs = epochs;
+		r->epoch_capacity = capacity;
+	}
+	e = &r->epochs[r->epoch_count];
+	e->epoch = epoch;
+	e->weight_max = size > 0 ? size - 1 : 0;
+	e->weights = NULL;
+	if (size > 0) {
+		e->weights = malloc(sizeof(__u32) * (e->weight_max + 1));
+		if (e->weights == NULL)
+			return -ENOMEM;
+		for (i = 0; i < e->weight_max; i++) {
+			if (crush_get_varint(&r->p, r->end, &weight) < 0 ||
+			    weight > 0xffffffffu) {
+				free(e->weights);
+				return -EINVAL;
+			}
+			e->weights[i] = weight;
+		}
+	}
+	r->epoch_count++;
+	r->next_epoch++;
+	r->current = e;
+	return 0;
+}
+
+int crush_replay_next(struct crush_replay *r, struct crush_replay_record *record)
+{
+	__u64 tag, ruleno, result_max, x;
+	int err;
+
+	for (;;) {
+		if (r->p == r->end)
+			return 0;
+		if (crush_get_varint(&r->p, r->end, &tag) < 0)
+			return -EINVAL;
+		if (tag != TAG_EPOCH)
+			break;
+		err = read_epoch(r);
+		if (err < 0)
+			return err;
+	}
+	switch (tag) {
+	case TAG_CALL:
+		if (crush_get_varint(&r->p, r->end, &ruleno) < 0 ||
+		    crush_get_varint(&r->p, r->end, &result_max) < 0)
+			return -EINVAL;
+		r->has_call = 1;
+		r->ruleno = crush_unzigzag(ruleno);
+		r->result_max = crush_unzigzag(result_max);
+		break;
+	case TAG_SAME:
+		if (!r->has_call)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (crush_get_varint(&r->p, r->end, &x) < 0 || x > 0xffffffffu)
+		return -EINVAL;
+	record->ruleno = r->ruleno;
+	record->x = (__u32)x;
+	record->result_max = r->result_max;
+	record->epoch = r->current ? r->current->epoch : 0;
+	record->weights = r->current ? r->current->weights : NULL;
+	record->weight_max = r->current ? r->current->weight_max : 0;
+	return 1;
+}
+
+void crush_replay_rewind(struct crush_replay *r)
+{
+	r->p = r->data;
+	r->has_call = 0;
+	r->ruleno = 0;
+	r->result_max = 0;
+	r->current = NULL;
+	r->next_epoch = 0;
+}
+
+void crush_replay_close(struct crush_replay *r)
+{
+	int i;
+
+	if (r == NULL)
+		return;
+	for (i = 0; i < r->epoch_count; i++)
+		free(r->epochs[i].weights);
+	free(r->epochs);
+	free(r);
+}
@@ -0,0 +1,192 @@
+#ifndef CEPH_CRUSH_REPLAY_H
+#define CEPH_CRUSH_REPLAY_H
+
+/*
+ * Record the calls to crush_do_rule() of a workload and read them
+ * back to replay them.
+ *
+ * LGPL2
+ */
+
+#include <stddef.h>
+
+#include "crush.h"
+
+/** @ingroup API
+ * The calls recorded, see crush_recorder_create().
+ */
+struct crush_recorder;
+
+/** @ingroup API
+ * A recording opened with crush_replay_open().
+ */
+struct crush_replay;
+
+/** @ingroup API
+ * A call to crush_do_rule() read by crush_replay_next().
+ */
+struct crush_replay_record {
+	int ruleno;            /*!< as given to crush_do_rule() */
+	int x;                 /*!< as given to crush_do_rule() */
+	int result_max;        /*!< as given to crush_do_rule() */
+	__u32 epoch;           /*!< the epoch of the weights */
+	/*! the weights, NULL if the call had none, valid until
+	    crush_replay_close() */
+	const __u32 *weights;
+	int weight_max;        /*!< the size of __weights__ */
+};
+
+/** @ingroup API
+ *
+ * Allocate an empty recording. A recorder is meant to be used by a
+ * single thread, each thread records in its own recorder. It must be
+ * deallocated with crush_recorder_destroy().
+ *
+ * @returns a recorder on success, NULL if __malloc(3)__ fails
+ */
+extern struct crush_recorder *crush_recorder_create(void);
+
+/** @ingroup API
+ *
+ * Deallocate a recorder returned by crush_recorder_create().
+ *
+ * @param recorder the recorder
+ */
+extern void crush_recorder_destroy(struct crush_recorder *recorder);
+
+/** @ingroup API
+ *
+ * Make crush_do_rule() called with __cwin__ record its __ruleno__,
+ * __x__, __result_max__ and weights with crush_recorder_add(). When
+ * no recorder is attached, which is the case after
+ * crush_init_workspace(), the only cost is to check a pointer for
+ * each call. If __recorder__ is NULL the recorder is detached.
+ *
+ * @param cwin a workspace initialized with crush_init_workspace()
+ * @param recorder the recorder or NULL
+ */
+extern void crush_recorder_attach(void *cwin, struct crush_recorder *recorder);
+
+/** @ingroup API
+ *
+ * Record a copy of the __weights__ used by the following calls and
+ * the __epoch__ they belong to. It must be called when the content
+ * of the weights given to crush_do_rule() is modified: a change of
+ * the __weights__ pointer or __weight_max__ is detected by
+ * crush_recorder_add() but a change of the content is not.
+ *
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param recorder the recorder
+ * @param epoch the epoch of the weights, for instance of the OSDMap
+ * @param weights as given to crush_do_rule() or NULL
+ * @param weight_max the size of __weights__
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_recorder_epoch(struct crush_recorder *recorder, __u32 epoch,
+				const __u32 *weights, int weight_max);
+
+/** @ingroup API
+ *
+ * Record a call to crush_do_rule(). If __weights__ or __weight_max__
+ * differ from the ones of the previous call, crush_recorder_epoch()
+ * is called with the epoch following the current one. A call with
+ * the same __ruleno__ and __result_max__ as the previous one takes
+ * as many bytes as the varint encoding of __x__: a single byte for
+ * x < 128 and three bytes for x < 2^21.
+ *
+ * If __malloc(3)__ fails the recording is truncated and
+ * crush_recorder_serialize() fails.
+ *
+ * @param recorder the recorder
+ * @param ruleno as given to crush_do_rule()
+ * @param x as given to crush_do_rule()
+ * @param result_max as given to crush_do_rule()
+ * @param weights as given to crush_do_rule()
+ * @param weight_max as given to crush_do_rule()
+ */
+extern void crush_recorder_add(struct crush_recorder *recorder,
+			       int ruleno, int x, int result_max,
+			       const __u32 *weights, int weight_max);
+
+/** @ingroup API
+ *
+ * Return the number of calls recorded.
+ *
+ * @param recorder the recorder
+ *
+ * @returns the number of calls
+ */
+extern __u64 crush_recorder_count(const struct crush_recorder *recorder);
+
+/** @ingroup API
+ *
+ * Store the recording in a buffer allocated with __malloc(3)__ that
+ * the caller must free. The content of the buffer does not depend
+ * on the endianness of the host and can be written to a file. The
+ * recordings of several threads can be replayed one after the
+ * other.
+ *
+ * - return -ENOMEM if __malloc(3)__ fails or failed while recording
+ *
+ * @param recorder the recorder
+ * @param[out] buffer the serialized recording
+ * @param[out] length the size of __buffer__ in bytes
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_recorder_serialize(const struct crush_recorder *recorder,
+				    void **buffer, size_t *length);
+
+/** @ingroup API
+ *
+ * Read the recording serialized in __buffer__ by
+ * crush_recorder_serialize(). The __buffer__ is not copied and must
+ * not be freed before crush_replay_close() is called.
+ *
+ * - return -EINVAL if __buffer__ does not start like a recording
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param buffer the serialized recording
+ * @param length the size of __buffer__ in bytes
+ * @param[out] replay the recording
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_replay_open(const void *buffer, size_t length,
+			     struct crush_replay **replay);
+
+/** @ingroup API
+ *
+ * Read the next call of the recording in __record__.
+ *
+ * - return -EINVAL if the recording is corrupted
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param replay the recording
+ * @param[out] record the call
+ *
+ * @returns 1 if a call was read, 0 at the end of the recording, < 0 on error
+ */
+extern int crush_replay_next(struct crush_replay *replay,
+			     struct crush_replay_record *record);
+
+/** @ingroup API
+ *
+ * Go back to the first call of the recording. The weights read so
+ * far remain valid.
+ *
+ * @param replay the recording
+ */
+extern void crush_replay_rewind(struct crush_replay *replay);
+
+/** @ingroup API
+ *
+ * Release the __replay__ returned by crush_replay_open().
+ *
+ * @param replay the recording
+ */
+extern void crush_replay_close(struct crush_replay *replay);
+
+#endif
@@ -0,0 +1,345 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapper.h"
+#include "executor.h"
+#include "pg.h"
+#include "simulate.h"
+
+#define CRUSH_FILL_BATCH_SIZE (1 << 20)
+#define CRUSH_FILL_GRAIN 4096
+
+/* the PGs of the pool and the devices they are mapped to */
+struct pg_table {
+	int pg_num;
+	int pg_num_mask;
+	int result_max;
+	int *devices; /* [pg_num][result_max] */
+	int *size;    /* [pg_num] */
+};
+
+struct filler {
+	const struct crush_fill_params *params;
+	const struct pg_table *pgs;
+	const double *cumulative; /* [histogram_size] for CRUSH_SIZE_HISTOGRAM */
+	__u64 first;              /* the first object of the batch */
+	__u64 **pg_bytes;         /* [workers][pg_num] added by this batch */
+};
+
+/* uniform in [0, 1[ */
+static double uniform(__u64 *state)
+{
+	return (crush_splitmix64(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/* same as ceph_stable_mod() */
+static int stable_mod(int x, int b, int bmask)
+{
+	if ((x & bmask) < b)
+		return x & bmask;
+	else
+		return x & (bmask >> 1);
+}
+
+static double draw_size(const struct filler *f, __u64 *state)
+{
+	const struct crush_size_distribution *size = &f->params->size;
+	double u = uniform(state);
+
+	switch (size->alg) {
+	case CRUSH_SIZE_FIXED:
+		return size->a;
+	case CRUSH_SIZE_UNIFORM:
+		return size->a + u * (size->b - size->a);
+	case CRUSH_SIZE_EXPONENTIAL:
+		return -size->a * log(1 - u);
+	case CRUSH_SIZE_LOGNORMAL: {
+		/* Box-Muller */
+		double v = uniform(state);
+		return exp(size->a + size->b * sqrt(-2 * log(1 - u)) *
+			   cos(2 * M_PI * v));
+	}
+	case CRUSH_SIZE_HISTOGRAM: {
+		int low = 0, high = size->histogram_size - 1;
+		u *= f->cumulative[high];
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (f->cumulative[middle] > u)
+				high = middle;
+			else
+				low = middle + 1;
+		}
+		return size->sizes[low];
+	}
+	}
+	return 0;
+}
+
+/*
+ * Return the PG of the object __o__ and set __bytes__ to its size.
+ * Each object has its own random stream so that the outcome does
+ * not depend on how the objects are divided.
+ */
+static int draw_object(const struct filler *f, __u64 o, __u64 *bytes)
+{
+	const struct pg_table *pgs = f->pgs;
+	__u64 state = crush_splitmix64_mix(f->params->seed + o * 0x9e3779b97f4a7c15ULL);
+	int hash = (int)(crush_splitmix64(&state) >> 33);
+	int pg = stable_mod(hash, pgs->pg_num, pgs->pg_num_mask);
+	double size = draw_size(f, &state);
+
+	*bytes = size > 0 ? (__u64)(size + 0.5) : 0;
+	return pg;
+}
+
+/* add the bytes of the objects [first + begin, first + end[ to their PG */
+static void fill(void *arg, int worker, __s64 begin, __s64 end)
+{
+	const struct filler *f = arg;
+	__u64 *pg_bytes = f->pg_bytes[worker];
+	__u64 o;
+
+	for (o = f->first + begin; o < f->first + end; o++) {
+		__u64 bytes;
+		int pg = draw_object(f, o, &bytes);
+
+		pg_bytes[pg] += bytes;
+	}
+}
+
+/*
+ * Place the __count__ objects of the batch one at a time, on top of
+ * __device_bytes__, until a device is full. Return the device, or
+ * -1 if none is, and set __count__ to the number of objects placed.
+ */
+static int fill_until_full(const struct filler *f, int max_devices,
+			   double *device_bytes, double *total, __u64 *count)
+{
+	const struct crush_fill_params *params = f->params;
+	const struct pg_table *pgs = f->pgs;
+	__u64 o;
+	int i;
+
+	for (o = 0; o < *count; o++) {
+		__u64 bytes;
+		int pg = draw_object(f, f->first + o, &bytes);
+		int full = -1;
+
+		for (i = 0; i < pgs->size[pg]; i++) {
+			int d = pgs->devices[pg * pgs->result_max + i];
+
+			if (d < 0 || d >= max_devices)
+				continue;
+			device_bytes[d] += bytes;
+			*total += bytes;
+			if (full < 0 && params->capacities[d] > 0 &&
+			    device_bytes[d] >= params->capacities[d] * params->full_ratio)
+				full = d;
+		}
+		if (full >= 0) {
+			*count = o + 1;
+			return full;
+		}
+	}
+	return -1;
+}
+
+static int check_params(const struct crush_map *map,
+			const struct crush_fill_params *params)
+{
+	const struct crush_size_distribution *size = &params->size;
+	int i;
+
+	if (params->ruleno < 0 || (__u32)params->ruleno >= map->max_rules ||
+	    map->rules[params->ruleno] == NULL)
+		return -EINVAL;
+	if (params->result_max <= 0 || params->pg_num <= 0 ||
+	    params->capacities == NULL || params->full_ratio <= 0 ||
+	    params->threads < 0)
+		return -EINVAL;
+	switch (size->alg) {
+	case CRUSH_SIZE_FIXED:
+		return size->a >= 0 ? 0 : -EINVAL;
+	case CRUSH_SIZE_UNIFORM:
+		return size->a >= 0 && size->b >= size->a ? 0 : -EINVAL;
+	case CRUSH_SIZE_EXPONENTIAL:
+		return size->a > 0 ? 0 : -EINVAL;
+	case CRUSH_SIZE_LOGNORMAL:
+		return size->b >= 0 ? 0 : -EINVAL;
+	case CRUSH_SIZE_HISTOGRAM:
+		if (size->histogram_size <= 0 || !size->sizes ||
+		    !size->frequencies)
+			return -EINVAL;
+		for (i = 0; i < size->histogram_size; i++)
+			if (size->frequencies[i] < 0)
+				return -EINVAL;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static int pg_table_build(const struct crush_map *map,
+			  const struct crush_fill_params *params,
+			  struct pg_table *pgs)
+{
+	void *cwin;
+	int pg;
+
+	pgs->pg_num = params->pg_num;
+	pgs->pg_num_mask = 1;
+	while (pgs->pg_num_mask < params->pg_num)
+		pgs->pg_num_mask <<= 1;
+	pgs->pg_num_mask--;
+	pgs->result_max = params->result_max;
+	pgs->devices = malloc(sizeof(int) * params->pg_num * params->result_max);
+	pgs->size = malloc(sizeof(int) * params->pg_num);
+	cwin = malloc(crush_work_size(map, params->result_max));
+	if (!pgs->devices || !pgs->size || !cwin) {
+		free(pgs->devices);
+		free(pgs->size);
+		free(cwin);
+		return -ENOMEM;
+	}
+	crush_init_workspace(map, cwin);
+	for (pg = 0; pg < params->pg_num; pg++) {
+		pgs->size[pg] = crush_do_rule(map, params->ruleno,
+					      crush_pg_seed(params->pool, pg),
+					      pgs->devices + pg * params->result_max,
+					      params->result_max,
+					      params->weights, params->weight_max,
+					      cwin, params->choose_args);
+	}
+	free(cwin);
+	return 0;
+}
+
+int crush_simulate_fill(const struct crush_map *map,
+			const struct crush_fill_params *params,
+			struct crush_fill_result *result,
+			double *device_bytes)
+{
+	const int max_devices = map->max_devices;
+	struct crush_executor *executor = params->executor;
+	struct pg_table pgs;
+	struct filler filler;
+	__u64 **pg_bytes = NULL;
+	double *cumulative = NULL;
+	double *before = NULL, *delta = NULL;
+	double capacity = 0, total = 0;
+	__u64 batch_size = params->batch_size ? params->batch_size :
+		CRUSH_FILL_BATCH_SIZE;
+	__u64 done = 0;
+	int n, err, t, pg, i, d;
+
+	err = check_params(map, params);
+	if (err < 0)
+		return err;
+	if (executor == NULL && params->threads > 1) {
+		err = crush_executor_create(params->threads, &executor);
+		if (err < 0)
+			return err;
+	}
+	n = crush_executor_workers(executor);
+	err = pg_table_build(map, params, &pgs);
+	if (err < 0)
+		goto out_executor;
+
+	err = -ENOMEM;
+	pg_bytes = calloc(n, sizeof(__u64 *));
+	before = calloc(max_devices + 1, sizeof(double));
+	delta = calloc(max_devices + 1, sizeof(double));
+	if (!pg_bytes || !before || !delta)
+		goto out;
+	if (params->size.alg == CRUSH_SIZE_HISTOGRAM) {
+		int size = params->size.histogram_size;
+		cumulative = malloc(sizeof(double) * size);
+		if (!cumulative)
+			goto out;
+		for (i = 0; i < size; i++)
+			cumulative[i] = (i > 0 ? cumulative[i - 1] : 0) +
+				params->size.frequencies[i];
+	}
+	filler.params = params;
+	filler.pgs = &pgs;
+	filler.cumulative = cumulative;
+	filler.pg_bytes = pg_bytes;
+	for (t = 0; t < n; t++) {
+		pg_bytes[t] = malloc(sizeof(__u64) * pgs.pg_num);
+		if (!pg_bytes[t])
+			goto out;
+	}
+	for (d = 0; d < max_devices; d++)
+		if (params->capacities[d] > 0)
+			capacity += params->capacities[d];
+
+	result->device = -1;
+	while (done < params->max_objects) {
+		__u64 count = params->max_objects - done;
+		double batch_total = 0;
+		int full = -1;
+
+		if (count > batch_size)
+			count = batch_size;
+		for (t = 0; t < n; t++)
+			memset(pg_bytes[t], '\0', sizeof(__u64) * pgs.pg_num);
+		filler.first = done;
+		err = crush_parallel_for(executor, count, CRUSH_FILL_GRAIN, fill,
+					 &filler);
+		if (err < 0)
+			goto out;
+
+		memset(delta, '\0', sizeof(double) * max_devices);
+		for (pg = 0; pg < pgs.pg_num; pg++) {
+			__u64 bytes = 0;
+			for (t = 0; t < n; t++)
+				bytes += pg_bytes[t][pg];
+			if (bytes == 0)
+				continue;
+			for (i = 0; i < pgs.size[pg]; i++) {
+				d = pgs.devices[pg * pgs.result_max + i];
+				if (d < 0 || d >= max_devices)
+					continue;
+				delta[d] += bytes;
+				batch_total += bytes;
+			}
+		}
+
+		for (d = 0; d < max_devices && full < 0; d++)
+			if (params->capacities[d] > 0 &&
+			    before[d] + delta[d] >= params->capacities[d] * params->full_ratio)
+				full = d;
+		if (full >= 0) {
+			/* find the object of the batch that filled a device */
+			d = fill_until_full(&filler, max_devices, before, &total, &count);
+			done += count;
+			result->device = d >= 0 ? d : full;
+			break;
+		}
+		for (d = 0; d < max_devices; d++)
+			before[d] += delta[d];
+		total += batch_total;
+		done += count;
+	}
+
+	result->objects = done;
+	result->bytes = total;
+	result->fill = capacity > 0 ? total / capacity : 0;
+	if (device_bytes)
+		memcpy(device_bytes, before, sizeof(double) * max_devices);
+	err = 0;
+out:
+	for (t = 0; pg_bytes && t < n; t++)
+		free(pg_bytes[t]);
+	free(pg_bytes);
+	free(cumulative);
+	free(before);
+	free(delta);
+	free(pgs.devices);
+	free(pgs.size);
+out_executor:
+	if (executor != params->executor)
+		crush_executor_destroy(executor);
+	return err;
+}
@@ -0,0 +1,128 @@
+#ifndef CEPH_CRUSH_SIMULATE_H
+#define CEPH_CRUSH_SIMULATE_H
+
+/*
+ * Functions that simulate the placement of objects in a cluster
+ * with crush_do_rule().
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+#include "executor.h"
+
+/** @ingroup API
+ * The distributions from which the size of an object can be drawn.
+ */
+enum crush_size_algorithm {
+	CRUSH_SIZE_FIXED = 1,       /*!< always __a__ bytes */
+	CRUSH_SIZE_UNIFORM = 2,     /*!< uniform in [__a__, __b__] */
+	CRUSH_SIZE_EXPONENTIAL = 3, /*!< exponential of mean __a__ */
+	CRUSH_SIZE_LOGNORMAL = 4,   /*!< exp(N(__a__, __b__)) */
+	CRUSH_SIZE_HISTOGRAM = 5    /*!< __sizes[i]__ with probability
+				      __frequencies[i]__ */
+};
+
+/** @ingroup API
+ * The distribution of the object sizes, in bytes.
+ */
+struct crush_size_distribution {
+	enum crush_size_algorithm alg;
+	double a;
+	double b;
+	/*! size of the __sizes__ and __frequencies__ arrays */
+	int histogram_size;
+	const double *sizes;
+	/*! relative frequencies, they do not need to add up to 1 */
+	const double *frequencies;
+};
+
+/** @ingroup API
+ * The parameters of crush_simulate_fill().
+ */
+struct crush_fill_params {
+	int ruleno;              /*!< the rule, as given to crush_do_rule() */
+	int result_max;          /*!< the number of replicas of each object */
+	const __u32 *weights;    /*!< as given to crush_do_rule() */
+	int weight_max;          /*!< as given to crush_do_rule() */
+	const struct crush_choose_arg *choose_args; /*!< or NULL */
+	int pool;                /*!< the pool the PGs belong to */
+	int pg_num;              /*!< the number of PGs in the pool */
+	/*! array of __map->max_devices__ capacities, in bytes */
+	const double *capacities;
+	/*! fraction of the capacity at which a device is full */
+	double full_ratio;
+	/*! the simulation stops after this number of objects */
+	__u64 max_objects;
+	/*! number of objects placed between two checks, 0 for a default */
+	__u64 batch_size;
+	/*! number of threads drawing the objects of a batch, 0 or 1 for the calling thread only */
+	int threads;
+	/*! seed of the random number generator */
+	__u64 seed;
+	struct crush_size_distribution size;
+	/*! the executor that draws the objects of a batch, instead of __threads__, or NULL */
+	struct crush_executor *executor;
+};
+
+/** @ingroup API
+ * The outcome of crush_simulate_fill().
+ */
+struct crush_fill_result {
+	/*! first device to be full or -1 if none is full */
+	int device;
+	/*! number of objects placed when __device__ became full */
+	__u64 objects;
+	/*! bytes stored on all devices, replicas included */
+	double bytes;
+	/*! __bytes__ divided by the capacity of all devices */
+	double fill;
+};
+
+/** @ingroup API
+ *
+ * Place objects drawn from the __params->size__ distribution until
+ * a device is filled above __params->full_ratio__ of its capacity
+ * or __params->max_objects__ objects are placed, whichever comes
+ * first.
+ *
+ * Each object is mapped to one of the __params->pg_num__ PGs of
+ * __params->pool__ with the stable modulo of its hash, the same way
+ * Ceph does, and each PG is mapped to devices with crush_do_rule().
+ * The PGs are mapped once and the memory used does not depend on
+ * the number of objects: the bytes are accumulated per PG and per
+ * device.
+ *
+ * The PGs are mapped on the calling thread. The objects are then
+ * drawn in batches of __params->batch_size__: the workers of
+ * __params->executor__ (or of an executor of __params->threads__
+ * threads created for the call when it is NULL) add the bytes of
+ * the objects to their own per PG counters, which are summed into
+ * the devices after each batch. Object __o__ is drawn from its own
+ * stream of __params->seed__, so the result does not change with
+ * the number of workers or the size of the batches. When a device
+ * becomes full in the middle of a batch, the objects of the batch
+ * are placed again one at a time, on the calling thread, and the
+ * simulation stops with the object that filled it.
+ *
+ * If __device_bytes__ is not NULL, it is set to the number of bytes
+ * stored on each device when the simulation stops.
+ *
+ * - return -EINVAL if the parameters are not valid
+ * - return -ENOMEM if __malloc(3)__ fails
+ * - return -EAGAIN if a thread cannot be created
+ * - return the error of __params->executor->parallel_for__
+ *
+ * @param map the crush_map
+ * @param params the parameters of the simulation
+ * @param[out] result the outcome of the simulation
+ * @param[out] device_bytes an array of __map->max_devices__ bytes or NULL
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_simulate_fill(const struct crush_map *map,
+			       const struct crush_fill_params *params,
+			       struct crush_fill_result *result,
+			       double *device_bytes);
+
+#endif
@@ -0,0 +1,39 @@
+#include <errno.h>
+#include <string.h>
+
+#include "stats.h"
+
+int crush_stats_attach(void *cwin, struct crush_stats *stats, int max_rules)
+{
+#ifdef CRUSH_STATS
+	struct crush_work *cw = (struct crush_work *)cwin;
+
+	cw->stats = stats;
+	cw->stats_max = stats ? max_rules : 0;
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+void crush_stats_reset(struct crush_stats *stats, int count)
+{
+	memset(stats, '\0', sizeof(*stats) * count);
+}
+
+void crush_stats_add(struct crush_stats *to, const struct crush_stats *from,
+		     int count)
+{
+	/* struct crush_stats only contains __u64 counters */
+	const size_t counters = sizeof(struct crush_stats) / sizeof(__u64);
+	int i;
+	size_t j;
+
+	for (i = 0; i < count; i++) {
+		__u64 *t = (__u64 *)&to[i];
+		const __u64 *f = (const __u64 *)&from[i];
+
+		for (j = 0; j < counters; j++)
+			t[j] += f[j];
+	}
+}
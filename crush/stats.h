@@ -0,0 +1,76 @@
+#ifndef CEPH_CRUSH_STATS_H
+#define CEPH_CRUSH_STATS_H
+
+/*
+ * Counters of the work done by crush_do_rule(), collected when
+ * libcrush is built with -DCRUSH_STATS=ON.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ *
+ * The work done by crush_do_rule() for a given rule, accumulated
+ * over all the calls made with a workspace, once the counters are
+ * attached to it with crush_stats_attach().
+ */
+struct crush_stats {
+	__u64 mappings;    /*!< number of crush_do_rule() calls */
+	__u64 hashes;      /*!< number of crush_hash32_*() calls */
+	/*! number of items drawn from a bucket, indexed by ::crush_algorithm */
+	__u64 bucket_choose[CRUSH_BUCKET_STRAW2 + 1];
+	__u64 perm_choose; /*!< items drawn with the exhaustive permutation search */
+	__u64 descents;    /*!< number of times an item was a bucket of the wrong type */
+	__u64 retries_total; /*!< retries from the top of the hierarchy (ftotal) */
+	__u64 retries_local; /*!< retries in the same bucket (flocal) */
+	__u64 collisions;  /*!< items rejected because they were already chosen */
+	__u64 rejects_out; /*!< devices rejected because they are out */
+	__u64 rejects_leaf; /*!< items rejected because no leaf was found under them */
+	__u64 skips;       /*!< replicas for which the retries were exhausted */
+};
+
+/** @ingroup API
+ *
+ * Make crush_do_rule(__map__, ruleno, ...) called with __cwin__ add
+ * to __stats[ruleno]__ the work it does, for all __ruleno__ <
+ * __max_rules__. Rules with a greater number are not counted. The
+ * counters are not reset: a thread keeps its own workspace and
+ * counters, which can then be aggregated with crush_stats_add().
+ * Calling crush_init_workspace() detaches the counters. If __stats__
+ * is NULL, the counters are detached.
+ *
+ * - return -EOPNOTSUPP if libcrush was built without CRUSH_STATS
+ *
+ * @param cwin a workspace initialized with crush_init_workspace()
+ * @param stats an array of __max_rules__ counters or NULL
+ * @param max_rules the size of the __stats__ array
+ *
+ * @returns 0 on success, < 0 on error
+ */
+extern int crush_stats_attach(void *cwin, struct crush_stats *stats, int max_rules);
+
+/** @ingroup API
+ *
+ * Set all the counters of the __stats__ array to zero.
+ *
+ * @param stats an array of __count__ counters
+ * @param count the size of the __stats__ array
+ */
+extern void crush_stats_reset(struct crush_stats *stats, int count);
+
+/** @ingroup API
+ *
+ * Add each counter of the __from__ array to the same counter of
+ * the __to__ array, for instance to aggregate the counters of
+ * several threads.
+ *
+ * @param to an array of __count__ counters
+ * @param from an array of __count__ counters
+ * @param count the size of the __to__ and __from__ arrays
+ */
+extern void crush_stats_add(struct crush_stats *to, const struct crush_stats *from,
+			    int count);
+
+#endif
@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mapper.h"
+#include "trace.h"
+
+void crush_trace_attach(void *cwin, const struct crush_trace_ops *ops, void *arg)
+{
+	struct crush_work *cw = (struct crush_work *)cwin;
+
+	cw->trace = ops;
+	cw->trace_arg = ops ? arg : NULL;
+}
+
+/* explain */
+
+struct explain {
+	char *data;
+	size_t size;
+	size_t capacity;
+	int error;
+	int in_step;  /* the events array of a step is open */
+	int events;   /* number of events in the current step */
+};
+
+static void append(struct explain *e, const char *format, ...)
+{
+	va_list ap;
+	int length;
+
+	if (e->error)
+		return;
+	for (;;) {
+		va_start(ap, format);
+		length = vsnprintf(e->data ? e->data + e->size : NULL,
+				   e->capacity - e->size, format, ap);
+		va_end(ap);
+		if (length < 0) {
+			e->error = -EINVAL;
+			return;
+		}
+		if (e->size + length < e->capacity)
+			break;
+		size_t capacity = e->capacity ? e->capacity : 1024;
+		while (capacity <= e->size + length)
+			capacity *= 2;
+		char *data = realloc(e->data, capacity);
+		if (data == NULL) {
+			e->error = -ENOMEM;
+			return;
+		}
+		e->data = data;
+		e->capacity = capacity;
+	}
+	e->size += length;
+}
+
+static void begin_event(struct explain *e, const char *event)
+{
+	append(e, "%s{\"event\":\"%s\"", e->events++ > 0 ? "," : "", event);
+}
+
+static const char *op_name(int op)
+{
+	switch (op) {
+	case CRUSH_RULE_NOOP: return "noop";
+	case CRUSH_RULE_TAKE: return "take";
+	case CRUSH_RULE_CHOOSE_FIRSTN: return "choose_firstn";
+	case CRUSH_RULE_CHOOSE_INDEP: return "choose_indep";
+	case CRUSH_RULE_EMIT: return "emit";
+	case CRUSH_RULE_CHOOSELEAF_FIRSTN: return "chooseleaf_firstn";
+	case CRUSH_RULE_CHOOSELEAF_INDEP: return "chooseleaf_indep";
+	case CRUSH_RULE_SET_CHOOSE_TRIES: return "set_choose_tries";
+	case CRUSH_RULE_SET_CHOOSELEAF_TRIES: return "set_chooseleaf_tries";
+	case CRUSH_RULE_SET_CHOOSE_LOCAL_TRIES: return "set_choose_local_tries";
+	case CRUSH_RULE_SET_CHOOSE_LOCAL_FALLBACK_TRIES: return "set_choose_local_fallback_tries";
+	case CRUSH_RULE_SET_CHOOSELEAF_VARY_R: return "set_chooseleaf_vary_r";
+	case CRUSH_RULE_SET_CHOOSELEAF_STABLE: return "set_chooseleaf_stable";
+	default: return "unknown";
+	}
+}
+
+static const char *reason_name(enum crush_trace_reason reason)
+{
+	switch (reason) {
+	case CRUSH_TRACE_OUT: return "out";
+	case CRUSH_TRACE_NO_LEAF: return "no_leaf";
+	case CRUSH_TRACE_EMPTY: return "empty";
+	case CRUSH_TRACE_PRUNED: return "pruned";
+	default: return "unknown";
+	}
+}
+
+static void explain_step(void *arg, int ruleno, int step, int op, int arg1, int arg2)
+{
+	struct explain *e = arg;
+
+	if (e->in_step)
+		append(e, "]},");
+	append(e, "{\"step\":%d,\"op\":\"%s\",\"arg1\":%d,\"arg2\":%d,\"events\":[",
+	       step, op_name(op), arg1, arg2);
+	e->in_step = 1;
+	e->events = 0;
+}
+
+static void explain_choose(void *arg, int bucket, int x, int r, int item)
+{
+	struct explain *e = arg;
+
+	begin_event(e, "choose");
+	append(e, ",\"bucket\":%d,\"r\":%d,\"item\":%d}", bucket, r, item);
+}
+
+static void explain_collide(void *arg, int bucket, int item, int r, unsigned int ftotal)
+{
+	struct explain *e = arg;
+
+	begin_event(e, "collide");
+	append(e, ",\"bucket\":%d,\"item\":%d,\"r\":%d,\"ftotal\":%u}",
+	       bucket, item, r, ftotal);
+}
+
+static void explain_reject(void *arg, int bucket, int item, int r, unsigned int ftotal,
+			   enum crush_trace_reason reason)
+{
+	struct explain *e = arg;
+
+	begin_event(e, "reject");
+	append(e, ",\"bucket\":%d,\"item\":%d,\"r\":%d,\"ftotal\":%u,\"reason\":\"%s\"}",
+	       bucket, item, r, ftotal, reason_name(reason));
+}
+
+static void explain_emit(void *arg, int item)
+{
+	struct explain *e = arg;
+
+	begin_event(e, "emit");
+	append(e, ",\"item\":%d}", item);
+}
+
+static const struct crush_trace_ops explain_ops = {
+	.step = explain_step,
+	.choose = explain_choose,
+	.collide = explain_collide,
+	.reject = explain_reject,
+	.emit = explain_emit,
+};
+
+int crush_explain(const struct crush_map *map, int ruleno, int x, int result_max,
+		  const __u32 *weights, int weight_max,
+		  const struct crush_choose_arg *choose_args,
+		  char **json)
+{
+	struct explain e = { NULL, 0, 0, 0, 0, 0 };
+	void *cwin;
+	int *result;
+	int result_len, i;
+
+	if (ruleno < 0 || (__u32)ruleno >= map->max_rules || map->rules[ruleno] == NULL ||
+	    result_max < 0)
+		return -EINVAL;
+	cwin = malloc(crush_work_size(map, result_max));
+	/* one more so that malloc(3) does not return NULL when result_max is 0 */
+	result = malloc(sizeof(int) * (result_max + 1));
+	if (cwin == NULL || result == NULL) {
+		free(cwin);
+		free(result);
+		return -ENOMEM;
+	}
+	crush_init_workspace(map, cwin);
+	crush_trace_attach(cwin, &explain_ops, &e);
+
+	append(&e, "{\"rule\":%d,\"x\":%d,\"steps\":[", ruleno, x);
+	result_len = crush_do_rule(map, ruleno, x, result, result_max,
+				   weights, weight_max, cwin, choose_args);
+	if (e.in_step)
+		append(&e, "]}");
+	append(&e, "],\"result\":[");
+	for (i = 0; i < result_len; i++)
+		append(&e, "%s%d", i > 0 ? "," : "", result[i]);
+	append(&e, "]}");
+
+	free(cwin);
+	free(result);
+	if (e.error) {
+		free(e.data);
+		return e.error;
+	}
+	*json = e.data;
+	return result_len;
+}
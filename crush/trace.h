@@ -0,0 +1,99 @@
+#ifndef CEPH_CRUSH_TRACE_H
+#define CEPH_CRUSH_TRACE_H
+
+/*
+ * Callbacks receiving the decisions made by crush_do_rule() and a
+ * collector explaining a mapping in JSON.
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+
+/** @ingroup API
+ * Why an item chosen from a bucket was not kept.
+ */
+enum crush_trace_reason {
+	CRUSH_TRACE_OUT = 1,     /*!< the device is out, see the weights of crush_do_rule() */
+	CRUSH_TRACE_NO_LEAF = 2, /*!< no device could be found under the bucket */
+	CRUSH_TRACE_EMPTY = 3,   /*!< the bucket has no item */
+	CRUSH_TRACE_PRUNED = 4   /*!< every device under the bucket is out, see crush_prune_attach() */
+};
+
+/** @ingroup API
+ *
+ * The functions called by crush_do_rule() when a workspace has a
+ * trace attached with crush_trace_attach(). Each function is
+ * optional and receives the __arg__ given to crush_trace_attach().
+ * The __r__ argument is the value given to the bucket choose
+ * function, __ftotal__ the number of failures since the descent
+ * from the top of the hierarchy began.
+ */
+struct crush_trace_ops {
+	/*! step __step__ of rule __ruleno__ is about to run */
+	void (*step)(void *arg, int ruleno, int step, int op, int arg1, int arg2);
+	/*! __item__ was chosen from __bucket__ */
+	void (*choose)(void *arg, int bucket, int x, int r, int item);
+	/*! __item__ was chosen from __bucket__ but is already in the result */
+	void (*collide)(void *arg, int bucket, int item, int r, unsigned int ftotal);
+	/*! __item__ was chosen from __bucket__ and rejected */
+	void (*reject)(void *arg, int bucket, int item, int r, unsigned int ftotal,
+		       enum crush_trace_reason reason);
+	/*! __item__ is added to the result */
+	void (*emit)(void *arg, int item);
+};
+
+/** @ingroup API
+ *
+ * Make crush_do_rule() called with __cwin__ report what it does to
+ * __ops__. When no trace is attached, which is the case after
+ * crush_init_workspace(), the only cost is to check a pointer for
+ * each event. If __ops__ is NULL the trace is detached.
+ *
+ * @param cwin a workspace initialized with crush_init_workspace()
+ * @param ops the functions to call or NULL
+ * @param arg the first argument of the __ops__ functions
+ */
+extern void crush_trace_attach(void *cwin, const struct crush_trace_ops *ops, void *arg);
+
+/** @ingroup API
+ *
+ * Map __x__ as crush_do_rule() would and store in __json__ a
+ * description of the steps of the rule, the items that were
+ * chosen, collided or were rejected and why, and the result. For
+ * instance:
+ *
+ *     {"rule":0,"x":1,"steps":[
+ *       {"step":0,"op":"take","arg1":-1,"arg2":0,"events":[]},
+ *       {"step":1,"op":"chooseleaf_firstn","arg1":0,"arg2":1,"events":[
+ *         {"event":"choose","bucket":-1,"r":0,"item":-3},
+ *         {"event":"choose","bucket":-3,"r":0,"item":4},
+ *         {"event":"reject","bucket":-3,"item":4,"r":0,"ftotal":0,"reason":"out"},
+ *         ...]},
+ *       {"step":2,"op":"emit","arg1":0,"arg2":0,"events":[
+ *         {"event":"emit","item":5},...]}],
+ *      "result":[5,1,8]}
+ *
+ * without the line breaks. The __json__ string is allocated with
+ * __malloc(3)__ and must be freed by the caller.
+ *
+ * - return -EINVAL if __ruleno__ does not designate a rule
+ * - return -ENOMEM if __malloc(3)__ fails
+ *
+ * @param map the crush_map
+ * @param ruleno the rule, as given to crush_do_rule()
+ * @param x the value to map, as given to crush_do_rule()
+ * @param result_max as given to crush_do_rule()
+ * @param weights as given to crush_do_rule()
+ * @param weight_max the size of the __weights__ array
+ * @param choose_args weights and ids for each known bucket or NULL
+ * @param[out] json the explanation, a NUL terminated string
+ *
+ * @returns the size of the result on success, < 0 on error
+ */
+extern int crush_explain(const struct crush_map *map, int ruleno, int x, int result_max,
+			 const __u32 *weights, int weight_max,
+			 const struct crush_choose_arg *choose_args,
+			 char **json);
+
+#endif
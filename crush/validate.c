@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "hash.h"
+#include "validate.h"
+
+#define CRUSH_VALIDATE_GRAIN 1024
+
+struct validation {
+	const struct crush_map *map;
+	int *parents;                        /* [max_buckets] references to each bucket */
+	int *first;                          /* [workers] the first invalid bucket or -1 */
+	struct crush_validate_error *errors; /* [workers] the problem of __first__ */
+};
+
+static void set_error(struct crush_validate_error *error, enum crush_validate_code code,
+		      int bucket, int position, int item)
+{
+	error->code = code;
+	error->bucket = bucket;
+	error->position = position;
+	error->item = item;
+	error->rule = -1;
+	error->step = -1;
+}
+
+int crush_tree_bucket_valid(const struct crush_bucket_tree *tree)
+{
+	const __u32 size = tree->h.size;
+	__u32 depth = 1, i;
+
+	if (size == 0)
+		return 1;
+	if (tree->node_weights == NULL)
+		return 0;
+	/* the depth of crush_make_tree_bucket() */
+	for (i = size - 1; i > 0; i >>= 1)
+		depth++;
+	/* num_nodes is 8 bits wide: the tree has at most 64 items */
+	if (depth >= 8 || tree->num_nodes != 1U << depth)
+		return 0;
+	/* the leaves after the last item are never chosen */
+	for (i = 2 * size + 1; i < tree->num_nodes; i += 2)
+		if (tree->node_weights[i] != 0)
+			return 0;
+	return 1;
+}
+
+static int item_exists(const struct crush_map *map, int item)
+{
+	__s64 pos = -1 - (__s64)item;
+
+	if (item >= 0)
+		return item < map->max_devices;
+	return pos < map->max_buckets && map->buckets[pos] != NULL;
+}
+
+/* the sum of the weights of the items of __b__, 0 if an array is missing */
+static __u64 bucket_weight(const struct crush_bucket *b, int *missing)
+{
+	const __u32 *weights = NULL;
+	__u64 sum = 0;
+	__u32 i;
+
+	*missing = 0;
+	switch (b->alg) {
+	case CRUSH_BUCKET_UNIFORM:
+		return (__u64)b->size * ((const struct crush_bucket_uniform *)b)->item_weight;
+	case CRUSH_BUCKET_LIST: {
+		const struct crush_bucket_list *list = (const struct crush_bucket_list *)b;
+
+		*missing = list->sum_weights == NULL;
+		weights = list->item_weights;
+		break;
+	}
+	case CRUSH_BUCKET_TREE: {
+		const struct crush_bucket_tree *tree = (const struct crush_bucket_tree *)b;
+
+		*missing = !crush_tree_bucket_valid(tree);
+		if (*missing)
+			return 0;
+		/* the leaf of item i is node 2i+1 */
+		for (i = 0; i < b->size; i++)
+			sum += tree->node_weights[2 * i + 1];
+		return sum;
+	}
+	case CRUSH_BUCKET_STRAW: {
+		const struct crush_bucket_straw *straw = (const struct crush_bucket_straw *)b;
+
+		*missing = straw->straws == NULL;
+		weights = straw->item_weights;
+		break;
+	}
+	case CRUSH_BUCKET_STRAW2:
+		weights = ((const struct crush_bucket_straw2 *)b)->item_weights;
+		break;
+	}
+	if (weights == NULL)
+		*missing = 1;
+	if (*missing)
+		return 0;
+	for (i = 0; i < b->size; i++)
+		sum += weights[i];
+	return sum;
+}
+
+/* check __map->buckets[i]__ and count the references to its children */
+static int check_bucket(const struct validation *v, int i,
+			struct crush_validate_error *error)
+{
+	const struct crush_map *map = v->map;
+	const struct crush_bucket *b = map->buckets[i];
+	int id = -1 - i, missing;
+	__u64 weight;
+	__u32 j;
+
+	if (b == NULL)
+		return 0;
+	if (b->id != id) {
+		set_error(error, CRUSH_INVALID_BUCKET_ID, id, -1, b->id);
+		return -EINVAL;
+	}
+	if (b->alg < CRUSH_BUCKET_UNIFORM || b->alg > CRUSH_BUCKET_STRAW2 ||
+	    b->hash != CRUSH_HASH_RJENKINS1) {
+		set_error(error, CRUSH_INVALID_BUCKET_ALG, id, -1, 0);
+		return -EINVAL;
+	}
+	if (b->size > 0 && b->items == NULL) {
+		set_error(error, CRUSH_INVALID_BUCKET_SIZE, id, -1, 0);
+		return -EINVAL;
+	}
+	if (b->size > 0) {
+		weight = bucket_weight(b, &missing);
+		if (missing) {
+			set_error(error, CRUSH_INVALID_BUCKET_SIZE, id, -1, 0);
+			return -EINVAL;
+		}
+		if (weight > 0xffffffffULL) {
+			set_error(error, CRUSH_INVALID_WEIGHT, id, -1, 0);
+			return -EINVAL;
+		}
+	}
+	for (j = 0; j < b->size; j++)
+		if (!item_exists(map, b->items[j])) {
+			set_error(error, CRUSH_INVALID_ITEM, id, j, b->items[j]);
+			return -EINVAL;
+		}
+	for (j = 0; j < b->size; j++)
+		if (b->items[j] < 0)
+			__atomic_add_fetch(&v->parents[-1 - b->items[j]], 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void check_buckets(void *arg, int worker, __s64 begin, __s64 end)
+{
+	const struct validation *v = arg;
+	struct crush_validate_error error;
+	__s64 i;
+
+	for (i = begin; i < end; i++) {
+		/* only the first invalid bucket matters */
+		if (v->first[worker] >= 0 && i > v->first[worker])
+			return;
+		if (check_bucket(v, i, &error) < 0) {
+			v->first[worker] = i;
+			v->errors[worker] = error;
+		}
+	}
+}
+
+/*
+ * Kahn's topological sort: remove the buckets that are not
+ * referenced, then those only referenced by the removed buckets.
+ * Return the number of buckets left, which are in a cycle or
+ * referenced by a cycle. The references to them are left in
+ * __parents__.
+ */
+static int kahn(const struct crush_map *map, int *parents, int *queue)
+{
+	int head = 0, tail = 0, left = 0, i;
+	__u32 j;
+
+	for (i = 0; i < map->max_buckets; i++) {
+		if (map->buckets[i] == NULL)
+			continue;
+		left++;
+		if (parents[i] == 0)
+			queue[tail++] = i;
+	}
+	while (head < tail) {
+		const struct crush_bucket *b = map->buckets[queue[head++]];
+
+		left--;
+		for (j = 0; j < b->size; j++)
+			if (b->items[j] < 0 && --parents[-1 - b->items[j]] == 0)
+				queue[tail++] = -1 - b->items[j];
+	}
+	return left;
+}
+
+/*
+ * Find an item that closes a cycle among the buckets left by kahn(),
+ * with an iterative depth first search.
+ */
+static int find_cycle(const struct crush_map *map, const int *parents,
+		      struct crush_validate_error *error)
+{
+	enum { WHITE, GRAY, BLACK };
+	char *color = calloc(map->max_buckets, 1);
+	int *stack = malloc(sizeof(int) * map->max_buckets);
+	__u32 *next = malloc(sizeof(__u32) * map->max_buckets);
+	int i, depth, err = -ENOMEM;
+
+	if (color == NULL || stack == NULL || next == NULL)
+		goto out;
+	err = -EINVAL;
+	for (i = 0; i < map->max_buckets; i++) {
+		if (map->buckets[i] == NULL || parents[i] == 0 || color[i] != WHITE)
+			continue;
+		depth = 0;
+		stack[depth] = i;
+		next[depth++] = 0;
+		color[i] = GRAY;
+		while (depth > 0) {
+			const struct crush_bucket *b = map->buckets[stack[depth - 1]];
+			__u32 j = next[depth - 1]++;
+			int child;
+
+			if (j >= b->size) {
+				color[stack[--depth]] = BLACK;
+				continue;
+			}
+			if (b->items[j] >= 0)
+				continue;
+			child = -1 - b->items[j];
+			if (color[child] == GRAY) {
+				set_error(error, CRUSH_INVALID_CYCLE, b->id, j, b->items[j]);
+				goto out;
+			}
+			if (color[child] == WHITE) {
+				color[child] = GRAY;
+				stack[depth] = child;
+				next[depth++] = 0;
+			}
+		}
+	}
+	/* kahn() left buckets, one of them is in a cycle */
+	set_error(error, CRUSH_INVALID_CYCLE, 0, -1, 0);
+out:
+	free(color);
+	free(stack);
+	free(next);
+	return err;
+}
+
+static int valid_op(int op)
+{
+	switch (op) {
+	case CRUSH_RULE_NOOP:
+	case CRUSH_RULE_TAKE:
+	case CRUSH_RULE_CHOOSE_FIRSTN:
+	case CRUSH_RULE_CHOOSE_INDEP:
+	case CRUSH_RULE_EMIT:
+	case CRUSH_RULE_CHOOSELEAF_FIRSTN:
+	case CRUSH_RULE_CHOOSELEAF_INDEP:
+	case CRUSH_RULE_SET_CHOOSE_TRIES:
+	case CRUSH_RULE_SET_CHOOSELEAF_TRIES:
+	case CRUSH_RULE_SET_CHOOSE_LOCAL_TRIES:
+	case CRUSH_RULE_SET_CHOOSE_LOCAL_FALLBACK_TRIES:
+	case CRUSH_RULE_SET_CHOOSELEAF_VARY_R:
+	case CRUSH_RULE_SET_CHOOSELEAF_STABLE:
+		return 1;
+	}
+	return 0;
+}
+
+static int check_rules(const struct crush_map *map, struct crush_validate_error *error)
+{
+	__u32 r, s;
+
+	for (r = 0; r < map->max_rules; r++) {
+		const struct crush_rule *rule = map->rules[r];
+
+		if (rule == NULL)
+			continue;
+		for (s = 0; s < rule->len; s++) {
+			const struct crush_rule_step *step = &rule->steps[s];
+			enum crush_validate_code code = CRUSH_VALID;
+
+			if (!valid_op(step->op))
+				code = CRUSH_INVALID_RULE_STEP;
+			else if (step->op == CRUSH_RULE_TAKE && !item_exists(map, step->arg1))
+				code = CRUSH_INVALID_RULE_TAKE;
+			if (code != CRUSH_VALID) {
+				set_error(error, code, 0, -1,
+					  code == CRUSH_INVALID_RULE_TAKE ? step->arg1 : 0);
+				error->rule = r;
+				error->step = s;
+				return -EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+
+int crush_map_validate(const struct crush_map *map,
+		       struct crush_executor *executor,
+		       struct crush_validate_error *error)
+{
+	const int workers = crush_executor_workers(executor);
+	struct crush_validate_error ignored;
+	struct validation v;
+	int *queue = NULL;
+	int err = -ENOMEM, first = -1, w;
+
+	if (error == NULL)
+		error = &ignored;
+	set_error(error, CRUSH_VALID, 0, -1, 0);
+	v.map = map;
+	v.parents = calloc(map->max_buckets + 1, sizeof(int));
+	v.first = malloc(sizeof(int) * workers);
+	v.errors = malloc(sizeof(*v.errors) * workers);
+	if (v.parents == NULL || v.first == NULL || v.errors == NULL)
+		goto out;
+	for (w = 0; w < workers; w++)
+		v.first[w] = -1;
+	err = crush_parallel_for(executor, map->max_buckets, CRUSH_VALIDATE_GRAIN,
+				 check_buckets, &v);
+	if (err < 0)
+		goto out;
+	for (w = 0; w < workers; w++)
+		if (v.first[w] >= 0 && (first < 0 || v.first[w] < first)) {
+			first = v.first[w];
+			*error = v.errors[w];
+		}
+	if (first >= 0) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	err = -ENOMEM;
+	queue = malloc(sizeof(int) * (map->max_buckets + 1));
+	if (queue == NULL)
+		goto out;
+	if (kahn(map, v.parents, queue) > 0) {
+		err = find_cycle(map, v.parents, error);
+		goto out;
+	}
+	err = check_rules(map, error);
+out:
+	free(queue);
+	free(v.parents);
+	free(v.first);
+	free(v.errors);
+	return err;
+}
+
+const char *crush_validate_code_name(enum crush_validate_code code)
+{
+	switch (code) {
+	case CRUSH_VALID:
+		return "valid";
+	case CRUSH_INVALID_BUCKET_ID:
+		return "bucket id does not match its position";
+	case CRUSH_INVALID_BUCKET_ALG:
+		return "unknown bucket algorithm or hash";
+	case CRUSH_INVALID_BUCKET_SIZE:
+		return "bucket arrays do not match its size";
+	case CRUSH_INVALID_ITEM:
+		return "item does not exist";
+	case CRUSH_INVALID_WEIGHT:
+		return "bucket weight overflows";
+	case CRUSH_INVALID_CYCLE:
+		return "bucket in a cycle";
+	case CRUSH_INVALID_RULE_STEP:
+		return "unknown rule step";
+	case CRUSH_INVALID_RULE_TAKE:
+		return "rule takes an item that does not exist";
+	}
+	return "unknown";
+}
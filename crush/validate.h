@@ -0,0 +1,95 @@
+#ifndef CEPH_CRUSH_VALIDATE_H
+#define CEPH_CRUSH_VALIDATE_H
+
+/*
+ * Check that a crush_map from an untrusted source can be given to
+ * crush_do_rule().
+ *
+ * LGPL2
+ */
+
+#include "crush.h"
+#include "executor.h"
+
+/** @ingroup API
+ * The problems found by crush_map_validate().
+ */
+enum crush_validate_code {
+	CRUSH_VALID = 0,                 /*!< no problem */
+	CRUSH_INVALID_BUCKET_ID = 1,     /*!< buckets[i]->id is not -1-i */
+	CRUSH_INVALID_BUCKET_ALG = 2,    /*!< unknown algorithm or hash */
+	CRUSH_INVALID_BUCKET_SIZE = 3,   /*!< the arrays of the bucket do not match its size */
+	CRUSH_INVALID_ITEM = 4,          /*!< a device >= max_devices or a bucket that does not exist */
+	CRUSH_INVALID_WEIGHT = 5,        /*!< the weights of the items overflow */
+	CRUSH_INVALID_CYCLE = 6,         /*!< the bucket is in a cycle */
+	CRUSH_INVALID_RULE_STEP = 7,     /*!< unknown operation */
+	CRUSH_INVALID_RULE_TAKE = 8      /*!< take of an item that does not exist */
+};
+
+/** @ingroup API
+ * Where crush_map_validate() found a problem.
+ */
+struct crush_validate_error {
+	enum crush_validate_code code; /*!< the problem */
+	int bucket;                    /*!< the id of the bucket or 0 */
+	int position;                  /*!< the position of the item in the bucket or -1 */
+	int item;                      /*!< the item in question or 0 */
+	int rule;                      /*!< the rule or -1 */
+	int step;                      /*!< the step of the rule or -1 */
+};
+
+/** @ingroup API
+ *
+ * Check in a single pass over the buckets, divided between the
+ * workers of __executor__, then over the rules, that:
+ *
+ * - each bucket has the id of its position in __map->buckets__, a
+ *   known algorithm and hash and the arrays its algorithm needs
+ * - each item is a device < __map->max_devices__ or an existing bucket
+ * - the sum of the weights of the items of a bucket fits in 32 bits
+ * - no bucket contains itself, directly or not (with Kahn's
+ *   topological sort)
+ * - each step of a rule has a known operation and each take step an
+ *   existing item
+ *
+ * If a problem is found __error__ tells which and where: the first
+ * bucket found invalid, in the order of __map->buckets__, then the
+ * first cycle or the first invalid rule. The result does not depend
+ * on __executor__.
+ *
+ * - return -EINVAL if the map is not valid and set __error__
+ * - return -ENOMEM if __malloc(3)__ fails
+ * - return the error of __executor->parallel_for__
+ *
+ * @param map the crush_map
+ * @param executor the executor or NULL to check on the calling thread
+ * @param[out] error the problem found, or ::CRUSH_VALID, or NULL
+ *
+ * @returns 0 if the map is valid, < 0 otherwise
+ */
+extern int crush_map_validate(const struct crush_map *map,
+			      struct crush_executor *executor,
+			      struct crush_validate_error *error);
+
+/** @ingroup API
+ *
+ * Check that the nodes of __tree__ have the shape given by
+ * crush_make_tree_bucket(): __num_nodes__ is twice the smallest power
+ * of two >= the size, which limits a tree to 64 items, and the leaves
+ * after the last item have no weight. Otherwise
+ * crush_do_rule() may descend to a leaf that has no item. A tree
+ * without items is always valid.
+ *
+ * @param tree the tree bucket
+ *
+ * @returns 1 if the tree is valid, 0 otherwise
+ */
+extern int crush_tree_bucket_valid(const struct crush_bucket_tree *tree);
+
+/** @ingroup API
+ *
+ * A description of __code__, such as "bucket in a cycle".
+ */
+extern const char *crush_validate_code_name(enum crush_validate_code code);
+
+#endif
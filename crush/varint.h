@@ -0,0 +1,119 @@
+#ifndef CEPH_CRUSH_VARINT_H
+#define CEPH_CRUSH_VARINT_H
+
+/*
+ * Growable byte buffers and the little endian, varint and zigzag
+ * encodings shared by the serialization formats.
+ *
+ * LGPL2
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crush.h"
+
+struct crush_buffer {
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+};
+
+static inline int crush_buffer_reserve(struct crush_buffer *b, size_t size)
+{
+	unsigned char *data;
+	size_t capacity;
+
+	if (b->size + size <= b->capacity)
+		return 0;
+	capacity = b->capacity ? b->capacity : 64;
+	while (capacity < b->size + size)
+		capacity *= 2;
+	data = realloc(b->data, capacity);
+	if (!data)
+		return -ENOMEM;
+	b->data = data;
+	b->capacity = capacity;
+	return 0;
+}
+
+static inline int crush_put_varint(struct crush_buffer *b, __u64 v)
+{
+	if (crush_buffer_reserve(b, 10) < 0)
+		return -ENOMEM;
+	while (v >= 0x80) {
+		b->data[b->size++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	b->data[b->size++] = (unsigned char)v;
+	return 0;
+}
+
+static inline __u64 crush_zigzag(__s64 v)
+{
+	return ((__u64)v << 1) ^ (__u64)(v >> 63);
+}
+
+static inline __s64 crush_unzigzag(__u64 v)
+{
+	return (__s64)(v >> 1) ^ -(__s64)(v & 1);
+}
+
+static inline int crush_put_u32(struct crush_buffer *b, __u32 v)
+{
+	int i;
+
+	if (crush_buffer_reserve(b, 4) < 0)
+		return -ENOMEM;
+	for (i = 0; i < 4; i++)
+		b->data[b->size++] = (unsigned char)(v >> (8 * i));
+	return 0;
+}
+
+static inline int crush_put_u64(struct crush_buffer *b, __u64 v)
+{
+	if (crush_put_u32(b, (__u32)v) < 0)
+		return -ENOMEM;
+	return crush_put_u32(b, (__u32)(v >> 32));
+}
+
+static inline int crush_put_bytes(struct crush_buffer *b,
+				  const void *data, size_t size)
+{
+	if (crush_buffer_reserve(b, size) < 0)
+		return -ENOMEM;
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+	return 0;
+}
+
+static inline __u32 crush_get_u32(const unsigned char *p)
+{
+	return (__u32)p[0] | ((__u32)p[1] << 8) |
+		((__u32)p[2] << 16) | ((__u32)p[3] << 24);
+}
+
+static inline __u64 crush_get_u64(const unsigned char *p)
+{
+	return (__u64)crush_get_u32(p) | ((__u64)crush_get_u32(p + 4) << 32);
+}
+
+/* decode the varint at *@p and move *@p after it, -EINVAL past @end */
+static inline int crush_get_varint(const unsigned char **p,
+				   const unsigned char *end, __u64 *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; shift < 64; shift += 7) {
+		if (*p >= end)
+			return -EINVAL;
+		*v |= (__u64)(**p & 0x7f) << shift;
+		if ((*(*p)++ & 0x80) == 0)
+			return 0;
+	}
+	return -EINVAL;
+}
+
+#endif
@@ -0,0 +1,701 @@
+/*
+ * Python bindings of libcrush.
+ *
+ * The arrays, x values, weights and results, are passed through the
+ * buffer protocol: numpy arrays of int32 or uint32 are used in place,
+ * without copies, and the batch mappings release the GIL while they
+ * run on the threads of crush_do_rule_batch().
+ *
+ * LGPL2
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "crush.h"
+#include "builder.h"
+#include "mapper.h"
+#include "hash.h"
+#include "load.h"
+#include "batch.h"
+
+typedef struct {
+	PyObject_HEAD
+	struct crush_map *map;
+	int busy;            /* mappings running without the GIL */
+} MapObject;
+
+static PyTypeObject MapType;
+
+static PyObject *errno_error(int err)
+{
+	if (err == -ENOMEM)
+		return PyErr_NoMemory();
+	if (err == -EINVAL)
+		PyErr_SetString(PyExc_ValueError, strerror(EINVAL));
+	else
+		PyErr_SetString(PyExc_OSError, strerror(-err));
+	return NULL;
+}
+
+static PyObject *map_new(PyTypeObject *type, struct crush_map *map)
+{
+	MapObject *self = (MapObject *)type->tp_alloc(type, 0);
+
+	if (self == NULL) {
+		crush_destroy(map);
+		return NULL;
+	}
+	self->map = map;
+	return (PyObject *)self;
+}
+
+static void map_dealloc(MapObject *self)
+{
+	if (self->map != NULL)
+		crush_destroy(self->map);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*
+ * Get a C contiguous buffer of 32 bits integers with __ndim__
+ * dimensions from __obj__, writable if __writable__.
+ */
+static int get_buffer(PyObject *obj, Py_buffer *view, int ndim, int writable, const char *name)
+{
+	const char *format;
+
+	if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT |
+			       (writable ? PyBUF_WRITABLE : 0)) < 0)
+		return -1;
+	format = view->format != NULL ? view->format : "B";
+	if (*format == '@' || *format == '=' ||
+	    (*format == '<' && PY_LITTLE_ENDIAN) || (*format == '>' && PY_BIG_ENDIAN))
+		format++;
+	if (view->itemsize != 4 || *format == '\0' || strchr("iIlL", *format) == NULL ||
+	    format[1] != '\0') {
+		PyErr_Format(PyExc_TypeError, "%s must be an array of int32 or uint32", name);
+		goto fail;
+	}
+	if (view->ndim != ndim) {
+		PyErr_Format(PyExc_ValueError, "%s must have %d dimension%s", name, ndim,
+			     ndim > 1 ? "s" : "");
+		goto fail;
+	}
+	return 0;
+fail:
+	PyBuffer_Release(view);
+	return -1;
+}
+
+static void release(Py_buffer *view)
+{
+	if (view->obj != NULL)
+		PyBuffer_Release(view);
+}
+
+static PyObject *map_load(PyTypeObject *type, PyObject *args)
+{
+	struct crush_map *map;
+	PyObject *path;
+	int line = 0, err;
+
+	if (!PyArg_ParseTuple(args, "O&:load", PyUnicode_FSConverter, &path))
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	err = crush_load_file(PyBytes_AS_STRING(path), &map, &line);
+	Py_END_ALLOW_THREADS
+	if (err == -EINVAL && line > 0) {
+		PyErr_Format(PyExc_ValueError, "%s:%d: invalid crush map",
+			     PyBytes_AS_STRING(path), line);
+		Py_DECREF(path);
+		return NULL;
+	}
+	Py_DECREF(path);
+	if (err < 0)
+		return errno_error(err);
+	return map_new(type, map);
+}
+
+static PyObject *map_from_bytes(PyTypeObject *type, PyObject *args)
+{
+	struct crush_map *map;
+	Py_buffer data;
+	int line = 0, err;
+
+	if (!PyArg_ParseTuple(args, "y*:from_bytes", &data))
+		return NULL;
+	err = crush_load(data.buf, data.len, &map, &line);
+	PyBuffer_Release(&data);
+	if (err == -EINVAL && line > 0)
+		return PyErr_Format(PyExc_ValueError, "line %d: invalid crush map", line);
+	if (err < 0)
+		return errno_error(err);
+	return map_new(type, map);
+}
+
+/* the state of the buckets while from_topology() creates them */
+enum { UNVISITED, VISITING, CREATED };
+
+struct topology {
+	struct crush_map *map;
+	Py_ssize_t bucket_count;
+	const __s32 *bucket_ids;
+	const __s32 *bucket_types;
+	Py_ssize_t item_count;
+	const __s32 *item_ids;
+	const __s32 *item_parents;
+	const __u32 *item_weights;
+	int alg;
+	int *state;          /* per bucket */
+	Py_ssize_t *index;   /* the bucket of each id, -1 - id */
+	Py_ssize_t max_index;
+	/* the items of bucket b are order[first[b]] to order[first[b + 1] - 1] */
+	Py_ssize_t *first;
+	Py_ssize_t *order;
+};
+
+/* create bucket __b__ after the buckets it contains */
+static int create_bucket(struct topology *t, Py_ssize_t b)
+{
+	int id = t->bucket_ids[b];
+	int size = 0, created, err;
+	int *items, *weights;
+	struct crush_bucket *bucket;
+	Py_ssize_t i;
+
+	if (t->state[b] == CREATED)
+		return 0;
+	if (t->state[b] == VISITING) {
+		PyErr_Format(PyExc_ValueError, "bucket %d contains itself", id);
+		return -1;
+	}
+	t->state[b] = VISITING;
+	size = t->first[b + 1] - t->first[b];
+	items = PyMem_Malloc(sizeof(int) * (size + 1));
+	weights = PyMem_Malloc(sizeof(int) * (size + 1));
+	if (items == NULL || weights == NULL) {
+		PyMem_Free(items);
+		PyMem_Free(weights);
+		PyErr_NoMemory();
+		return -1;
+	}
+	size = 0;
+	for (i = t->first[b]; i < t->first[b + 1]; i++) {
+		int item = t->item_ids[t->order[i]];
+
+		if (item < 0) {
+			Py_ssize_t child = -1 - (Py_ssize_t)item < t->max_index ?
+				t->index[-1 - item] : -1;
+
+			if (child < 0) {
+				PyErr_Format(PyExc_ValueError, "item %d is not a bucket", item);
+				goto fail;
+			}
+			if (create_bucket(t, child) < 0)
+				goto fail;
+			weights[size] = t->map->buckets[-1 - item]->weight;
+		} else {
+			weights[size] = t->item_weights[t->order[i]];
+		}
+		items[size++] = item;
+	}
+	if (t->alg == CRUSH_BUCKET_UNIFORM)
+		bucket = (struct crush_bucket *)crush_make_uniform_bucket(
+			CRUSH_HASH_RJENKINS1, t->bucket_types[b], size, items,
+			size ? weights[0] : 0);
+	else
+		bucket = crush_make_bucket(t->map, t->alg, CRUSH_HASH_RJENKINS1,
+					   t->bucket_types[b], size, items, weights);
+	if (bucket == NULL) {
+		PyErr_NoMemory();
+		goto fail;
+	}
+	err = crush_add_bucket(t->map, id, bucket, &created);
+	if (err < 0) {
+		crush_destroy_bucket(bucket);
+		errno_error(err);
+		goto fail;
+	}
+	PyMem_Free(items);
+	PyMem_Free(weights);
+	t->state[b] = CREATED;
+	return 0;
+fail:
+	PyMem_Free(items);
+	PyMem_Free(weights);
+	return -1;
+}
+
+static PyObject *map_from_topology(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "bucket_ids", "bucket_types", "item_ids", "item_parents",
+				    "item_weights", "alg", NULL };
+	PyObject *objects[5];
+	Py_buffer views[5];
+	struct topology t;
+	PyObject *result = NULL;
+	Py_ssize_t i;
+	int v;
+
+	memset(&t, 0, sizeof(t));
+	memset(views, 0, sizeof(views));
+	t.alg = CRUSH_BUCKET_STRAW2;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOO|i:from_topology", keywords,
+					 &objects[0], &objects[1], &objects[2], &objects[3],
+					 &objects[4], &t.alg))
+		return NULL;
+	for (v = 0; v < 5; v++)
+		if (get_buffer(objects[v], &views[v], 1, 0, keywords[v]) < 0)
+			goto out;
+	if (views[1].shape[0] != views[0].shape[0] ||
+	    views[3].shape[0] != views[2].shape[0] ||
+	    views[4].shape[0] != views[2].shape[0]) {
+		PyErr_SetString(PyExc_ValueError, "the bucket and item arrays differ in length");
+		goto out;
+	}
+	if (t.alg < CRUSH_BUCKET_UNIFORM || t.alg > CRUSH_BUCKET_STRAW2) {
+		PyErr_Format(PyExc_ValueError, "unknown bucket algorithm %d", t.alg);
+		goto out;
+	}
+	t.bucket_count = views[0].shape[0];
+	t.bucket_ids = views[0].buf;
+	t.bucket_types = views[1].buf;
+	t.item_count = views[2].shape[0];
+	t.item_ids = views[2].buf;
+	t.item_parents = views[3].buf;
+	t.item_weights = views[4].buf;
+	for (i = 0; i < t.bucket_count; i++) {
+		if (t.bucket_ids[i] >= 0) {
+			PyErr_Format(PyExc_ValueError, "bucket id %d is not negative",
+				     t.bucket_ids[i]);
+			goto out;
+		}
+		if (-1 - (Py_ssize_t)t.bucket_ids[i] >= t.max_index)
+			t.max_index = -(Py_ssize_t)t.bucket_ids[i];
+	}
+	t.state = PyMem_Calloc(t.bucket_count + 1, sizeof(int));
+	t.index = PyMem_Malloc(sizeof(Py_ssize_t) * (t.max_index + 1));
+	t.map = crush_create();
+	if (t.state == NULL || t.index == NULL || t.map == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < t.max_index; i++)
+		t.index[i] = -1;
+	for (i = 0; i < t.bucket_count; i++) {
+		if (t.index[-1 - t.bucket_ids[i]] >= 0) {
+			PyErr_Format(PyExc_ValueError, "bucket id %d is not unique",
+				     t.bucket_ids[i]);
+			goto out;
+		}
+		t.index[-1 - t.bucket_ids[i]] = i;
+	}
+	for (i = 0; i < t.item_count; i++)
+		if (t.item_parents[i] >= 0 || -1 - (Py_ssize_t)t.item_parents[i] >= t.max_index ||
+		    t.index[-1 - t.item_parents[i]] < 0) {
+			PyErr_Format(PyExc_ValueError, "parent %d is not a bucket", t.item_parents[i]);
+			goto out;
+		}
+	/* group the items by bucket, in the order of the arrays */
+	t.first = PyMem_Calloc(t.bucket_count + 2, sizeof(Py_ssize_t));
+	t.order = PyMem_Malloc(sizeof(Py_ssize_t) * (t.item_count + 1));
+	if (t.first == NULL || t.order == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < t.item_count; i++)
+		t.first[t.index[-1 - t.item_parents[i]] + 2]++;
+	for (i = 2; i <= t.bucket_count + 1; i++)
+		t.first[i] += t.first[i - 1];
+	for (i = 0; i < t.item_count; i++)
+		t.order[t.first[t.index[-1 - t.item_parents[i]] + 1]++] = i;
+	for (i = 0; i < t.bucket_count; i++)
+		if (create_bucket(&t, i) < 0)
+			goto out;
+	crush_finalize(t.map);
+	result = map_new(type, t.map);
+	t.map = NULL;
+out:
+	if (t.map != NULL)
+		crush_destroy(t.map);
+	PyMem_Free(t.state);
+	PyMem_Free(t.index);
+	PyMem_Free(t.first);
+	PyMem_Free(t.order);
+	for (v = 0; v < 5; v++)
+		release(&views[v]);
+	return result;
+}
+
+static PyObject *map_add_rule(MapObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "steps", "ruleno", "type", "min_size", "max_size", NULL };
+	struct crush_rule *rule;
+	PyObject *steps, *sequence;
+	int ruleno = -1, rule_type = 1, min_size = 1, max_size = 10;
+	Py_ssize_t len, i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iiii:add_rule", keywords, &steps,
+					 &ruleno, &rule_type, &min_size, &max_size))
+		return NULL;
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "the map is being used by a mapping");
+		return NULL;
+	}
+	sequence = PySequence_Fast(steps, "steps must be a sequence of (op, arg1, arg2)");
+	if (sequence == NULL)
+		return NULL;
+	len = PySequence_Fast_GET_SIZE(sequence);
+	if (ruleno >= CRUSH_MAX_RULES || len > 0xffff) {
+		Py_DECREF(sequence);
+		PyErr_SetString(PyExc_ValueError, "too many rules or steps");
+		return NULL;
+	}
+	rule = crush_make_rule(len, ruleno >= 0 ? ruleno : 0, rule_type, min_size, max_size);
+	if (rule == NULL) {
+		Py_DECREF(sequence);
+		return PyErr_NoMemory();
+	}
+	for (i = 0; i < len; i++) {
+		int op, arg1 = 0, arg2 = 0;
+
+		if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(sequence, i), "i|ii", &op,
+				      &arg1, &arg2)) {
+			crush_destroy_rule(rule);
+			Py_DECREF(sequence);
+			return NULL;
+		}
+		crush_rule_set_step(rule, i, op, arg1, arg2);
+	}
+	Py_DECREF(sequence);
+	if (ruleno < 0) {
+		/* crush_add_rule() asserts there is a free rule */
+		for (i = 0; i < self->map->max_rules; i++)
+			if (self->map->rules[i] == NULL)
+				break;
+		if (i >= CRUSH_MAX_RULES) {
+			crush_destroy_rule(rule);
+			PyErr_SetString(PyExc_ValueError, "too many rules or steps");
+			return NULL;
+		}
+	} else if ((__u32)ruleno < self->map->max_rules && self->map->rules[ruleno] != NULL) {
+		crush_destroy_rule(rule);
+		return PyErr_Format(PyExc_ValueError, "rule %d exists", ruleno);
+	}
+	ruleno = crush_add_rule(self->map, rule, ruleno);
+	if (ruleno < 0) {
+		crush_destroy_rule(rule);
+		return errno_error(ruleno);
+	}
+	/* the ruleset of the rules created by Ceph */
+	rule->mask.ruleset = ruleno;
+	crush_finalize(self->map);
+	return PyLong_FromLong(ruleno);
+}
+
+static int check_rule(const MapObject *self, int ruleno)
+{
+	if (ruleno < 0 || (__u32)ruleno >= self->map->max_rules ||
+	    self->map->rules[ruleno] == NULL) {
+		PyErr_Format(PyExc_ValueError, "rule %d does not exist", ruleno);
+		return -1;
+	}
+	return 0;
+}
+
+/* the weights given, or all devices in */
+static const __u32 *get_weights(const MapObject *self, PyObject *obj, Py_buffer *view,
+				__u32 **allocated, int *weight_max)
+{
+	int d;
+
+	*allocated = NULL;
+	if (obj != NULL && obj != Py_None) {
+		if (get_buffer(obj, view, 1, 0, "weights") < 0)
+			return NULL;
+		*weight_max = view->shape[0];
+		return view->buf;
+	}
+	*weight_max = self->map->max_devices;
+	*allocated = PyMem_Malloc(sizeof(__u32) * (*weight_max + 1));
+	if (*allocated == NULL) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	for (d = 0; d < *weight_max; d++)
+		(*allocated)[d] = 0x10000;
+	return *allocated;
+}
+
+static PyObject *map_do_rule(MapObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "ruleno", "x", "result_max", "weights", NULL };
+	PyObject *weights_obj = NULL, *list = NULL;
+	Py_buffer weights_view = { 0 };
+	const __u32 *weights;
+	__u32 *allocated;
+	unsigned int x;
+	int ruleno, result_max, weight_max, size, i;
+	int *result = NULL;
+	void *cwin = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iIi|O:do_rule", keywords, &ruleno, &x,
+					 &result_max, &weights_obj))
+		return NULL;
+	if (check_rule(self, ruleno) < 0)
+		return NULL;
+	if (result_max < 0)
+		return PyErr_Format(PyExc_ValueError, "result_max must not be negative");
+	weights = get_weights(self, weights_obj, &weights_view, &allocated, &weight_max);
+	if (weights == NULL)
+		return NULL;
+	result = PyMem_Malloc(sizeof(int) * (result_max + 1));
+	cwin = PyMem_Malloc(crush_work_size(self->map, result_max));
+	if (result == NULL || cwin == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	crush_init_workspace(self->map, cwin);
+	size = crush_do_rule(self->map, ruleno, x, result, result_max, weights, weight_max,
+			     cwin, NULL);
+	list = PyList_New(size);
+	if (list == NULL)
+		goto out;
+	for (i = 0; i < size; i++) {
+		PyObject *item = PyLong_FromLong(result[i]);
+
+		if (item == NULL) {
+			Py_CLEAR(list);
+			goto out;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+out:
+	PyMem_Free(result);
+	PyMem_Free(cwin);
+	PyMem_Free(allocated);
+	release(&weights_view);
+	return list;
+}
+
+/* map_batch() and map_range() */
+static PyObject *map_many(MapObject *self, int ruleno, PyObject *x_obj, __u32 first_x,
+			  PyObject *out_obj, PyObject *weights_obj, PyObject *sizes_obj, int threads)
+{
+	Py_buffer x_view = { 0 }, out_view = { 0 }, sizes_view = { 0 }, weights_view = { 0 };
+	const __u32 *weights;
+	__u32 *allocated = NULL;
+	int count, result_max, weight_max, err;
+	PyObject *result = NULL;
+
+	if (check_rule(self, ruleno) < 0)
+		return NULL;
+	if (threads < 0)
+		return PyErr_Format(PyExc_ValueError, "threads must not be negative");
+	if (get_buffer(out_obj, &out_view, 2, 1, "out") < 0)
+		return NULL;
+	if (out_view.shape[0] > 0x7fffffff || out_view.shape[1] > 0x7fffffff) {
+		PyErr_SetString(PyExc_ValueError, "out is too large");
+		goto out;
+	}
+	count = out_view.shape[0];
+	result_max = out_view.shape[1];
+	if (x_obj != NULL) {
+		if (get_buffer(x_obj, &x_view, 1, 0, "x") < 0)
+			goto out;
+		if (x_view.shape[0] != count) {
+			PyErr_SetString(PyExc_ValueError, "x and out differ in length");
+			goto out;
+		}
+	}
+	if (sizes_obj != NULL && sizes_obj != Py_None) {
+		if (get_buffer(sizes_obj, &sizes_view, 1, 1, "sizes") < 0)
+			goto out;
+		if (sizes_view.shape[0] != count) {
+			PyErr_SetString(PyExc_ValueError, "sizes and out differ in length");
+			goto out;
+		}
+	}
+	weights = get_weights(self, weights_obj, &weights_view, &allocated, &weight_max);
+	if (weights == NULL)
+		goto out;
+	self->busy++;
+	Py_BEGIN_ALLOW_THREADS
+	err = crush_do_rule_batch(self->map, ruleno, x_view.buf, first_x, count, out_view.buf,
+				  result_max, sizes_view.buf, weights, weight_max, NULL, threads);
+	Py_END_ALLOW_THREADS
+	self->busy--;
+	if (err < 0) {
+		errno_error(err);
+		goto out;
+	}
+	Py_INCREF(out_obj);
+	result = out_obj;
+out:
+	PyMem_Free(allocated);
+	release(&x_view);
+	release(&out_view);
+	release(&sizes_view);
+	release(&weights_view);
+	return result;
+}
+
+static PyObject *map_map_batch(MapObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "ruleno", "x", "out", "weights", "sizes", "threads", NULL };
+	PyObject *x, *out, *weights = NULL, *sizes = NULL;
+	int ruleno, threads = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iOO|OOi:map_batch", keywords, &ruleno,
+					 &x, &out, &weights, &sizes, &threads))
+		return NULL;
+	return map_many(self, ruleno, x, 0, out, weights, sizes, threads);
+}
+
+static PyObject *map_map_range(MapObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "ruleno", "first_x", "out", "weights", "sizes", "threads",
+				    NULL };
+	PyObject *out, *weights = NULL, *sizes = NULL;
+	unsigned int first_x;
+	int ruleno, threads = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iIO|OOi:map_range", keywords, &ruleno,
+					 &first_x, &out, &weights, &sizes, &threads))
+		return NULL;
+	return map_many(self, ruleno, NULL, first_x, out, weights, sizes, threads);
+}
+
+static PyObject *map_get_max_devices(MapObject *self, void *closure)
+{
+	return PyLong_FromLong(self->map->max_devices);
+}
+
+static PyObject *map_get_max_buckets(MapObject *self, void *closure)
+{
+	return PyLong_FromLong(self->map->max_buckets);
+}
+
+static PyObject *map_get_max_rules(MapObject *self, void *closure)
+{
+	return PyLong_FromUnsignedLong(self->map->max_rules);
+}
+
+static PyObject *map_get_fingerprint(MapObject *self, void *closure)
+{
+	return PyLong_FromUnsignedLongLong(self->map->fingerprint);
+}
+
+static PyMethodDef map_methods[] = {
+	{ "load", (PyCFunction)map_load, METH_VARARGS | METH_CLASS,
+	  "load(path) -> Map\n\n"
+	  "Load a map in the binary or text format of crushtool." },
+	{ "from_bytes", (PyCFunction)map_from_bytes, METH_VARARGS | METH_CLASS,
+	  "from_bytes(data) -> Map\n\n"
+	  "Load a map in the binary or text format of crushtool from a bytes-like object." },
+	{ "from_topology", (PyCFunction)map_from_topology,
+	  METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+	  "from_topology(bucket_ids, bucket_types, item_ids, item_parents, item_weights,\n"
+	  "              alg=BUCKET_STRAW2) -> Map\n\n"
+	  "Build a map from int32 arrays: the negative ids of the buckets and their\n"
+	  "types, then the items, devices or buckets, with the bucket they are in and\n"
+	  "their weight in 16.16 fixed point. The weight of an item that is a bucket\n"
+	  "is the sum of the weights of its items and the value given is ignored.\n"
+	  "The items of a bucket are in the order of the arrays." },
+	{ "add_rule", (PyCFunction)map_add_rule, METH_VARARGS | METH_KEYWORDS,
+	  "add_rule(steps, ruleno=-1, type=1, min_size=1, max_size=10) -> int\n\n"
+	  "Add a rule made of (op, arg1, arg2) steps, at the first free ruleno if\n"
+	  "ruleno is negative, and return its ruleno." },
+	{ "do_rule", (PyCFunction)map_do_rule, METH_VARARGS | METH_KEYWORDS,
+	  "do_rule(ruleno, x, result_max, weights=None) -> list\n\n"
+	  "Map x with crush_do_rule(). The weights are an array of uint32 in 16.16\n"
+	  "fixed point, all devices are in if None." },
+	{ "map_batch", (PyCFunction)map_map_batch, METH_VARARGS | METH_KEYWORDS,
+	  "map_batch(ruleno, x, out, weights=None, sizes=None, threads=0) -> out\n\n"
+	  "Map each value of the array x and store the results in the rows of the\n"
+	  "int32 matrix out, padded with ITEM_NONE, without copies. If sizes is\n"
+	  "given, it is set to the number of results of each value. The GIL is\n"
+	  "released while the values are mapped on threads threads." },
+	{ "map_range", (PyCFunction)map_map_range, METH_VARARGS | METH_KEYWORDS,
+	  "map_range(ruleno, first_x, out, weights=None, sizes=None, threads=0) -> out\n\n"
+	  "Same as map_batch() for the values first_x, first_x + 1, ... and as many\n"
+	  "as out has rows." },
+	{ NULL }
+};
+
+static PyGetSetDef map_getset[] = {
+	{ "max_devices", (getter)map_get_max_devices, NULL, "the number of devices", NULL },
+	{ "max_buckets", (getter)map_get_max_buckets, NULL, "the size of the bucket array", NULL },
+	{ "max_rules", (getter)map_get_max_rules, NULL, "the size of the rule array", NULL },
+	{ "fingerprint", (getter)map_get_fingerprint, NULL,
+	  "the fingerprint of the map, see crush_map_fingerprint()", NULL },
+	{ NULL }
+};
+
+static PyTypeObject MapType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "crush.Map",
+	.tp_basicsize = sizeof(MapObject),
+	.tp_dealloc = (destructor)map_dealloc,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "A crush map, created with Map.load(), Map.from_bytes() or "
+		  "Map.from_topology().",
+	.tp_methods = map_methods,
+	.tp_getset = map_getset,
+};
+
+static struct PyModuleDef crush_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "crush",
+	.m_doc = "Python bindings of libcrush.",
+	.m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_crush(void)
+{
+	static const struct {
+		const char *name;
+		long value;
+	} constants[] = {
+		{ "ITEM_NONE", CRUSH_ITEM_NONE },
+		{ "BUCKET_UNIFORM", CRUSH_BUCKET_UNIFORM },
+		{ "BUCKET_LIST", CRUSH_BUCKET_LIST },
+		{ "BUCKET_TREE", CRUSH_BUCKET_TREE },
+		{ "BUCKET_STRAW", CRUSH_BUCKET_STRAW },
+		{ "BUCKET_STRAW2", CRUSH_BUCKET_STRAW2 },
+		{ "RULE_TAKE", CRUSH_RULE_TAKE },
+		{ "RULE_CHOOSE_FIRSTN", CRUSH_RULE_CHOOSE_FIRSTN },
+		{ "RULE_CHOOSE_INDEP", CRUSH_RULE_CHOOSE_INDEP },
+		{ "RULE_EMIT", CRUSH_RULE_EMIT },
+		{ "RULE_CHOOSELEAF_FIRSTN", CRUSH_RULE_CHOOSELEAF_FIRSTN },
+		{ "RULE_CHOOSELEAF_INDEP", CRUSH_RULE_CHOOSELEAF_INDEP },
+		{ "RULE_SET_CHOOSE_TRIES", CRUSH_RULE_SET_CHOOSE_TRIES },
+		{ "RULE_SET_CHOOSELEAF_TRIES", CRUSH_RULE_SET_CHOOSELEAF_TRIES },
+		{ "RULE_SET_CHOOSE_LOCAL_TRIES", CRUSH_RULE_SET_CHOOSE_LOCAL_TRIES },
+		{ "RULE_SET_CHOOSE_LOCAL_FALLBACK_TRIES",
+		  CRUSH_RULE_SET_CHOOSE_LOCAL_FALLBACK_TRIES },
+		{ "RULE_SET_CHOOSELEAF_VARY_R", CRUSH_RULE_SET_CHOOSELEAF_VARY_R },
+		{ "RULE_SET_CHOOSELEAF_STABLE", CRUSH_RULE_SET_CHOOSELEAF_STABLE },
+	};
+	PyObject *module;
+	size_t i;
+
+	if (PyType_Ready(&MapType) < 0)
+		return NULL;
+	module = PyModule_Create(&crush_module);
+	if (module == NULL)
+		return NULL;
+	Py_INCREF(&MapType);
+	if (PyModule_AddObject(module, "Map", (PyObject *)&MapType) < 0) {
+		Py_DECREF(&MapType);
+		Py_DECREF(module);
+		return NULL;
+	}
+	for (i = 0; i < sizeof(constants) / sizeof(constants[0]); i++)
+		if (PyModule_AddIntConstant(module, constants[i].name, constants[i].value) < 0) {
+			Py_DECREF(module);
+			return NULL;
+		}
+	return module;
+}
@@ -0,0 +1,178 @@
+import os
+import tempfile
+import threading
+import unittest
+
+import crush
+
+try:
+    import numpy
+except ImportError:
+    # CI sets CRUSH_TEST_NUMPY so that the numpy tests cannot be skipped
+    if os.environ.get("CRUSH_TEST_NUMPY"):
+        raise
+    numpy = None
+
+TEXT_MAP = b"""
+device 0 osd.0
+device 1 osd.1
+device 2 osd.2
+device 3 osd.3
+type 0 osd
+type 1 host
+type 2 root
+host host0 {
+	id -2
+	alg straw2
+	hash 0
+	item osd.0 weight 1.000
+	item osd.1 weight 1.000
+}
+host host1 {
+	id -3
+	alg straw2
+	hash 0
+	item osd.2 weight 1.000
+	item osd.3 weight 1.000
+}
+root default {
+	id -1
+	alg straw2
+	hash 0
+	item host0 weight 2.000
+	item host1 weight 2.000
+}
+rule replicated_rule {
+	id 0
+	type replicated
+	min_size 1
+	max_size 10
+	step take default
+	step chooseleaf firstn 0 type host
+	step emit
+}
+"""
+
+
+@unittest.skipIf(numpy is None, "numpy is not installed")
+class TestMap(unittest.TestCase):
+
+    def topology(self, hosts=16, devices=8):
+        # a root of hosts of devices
+        bucket_ids = [-1] + [-2 - h for h in range(hosts)]
+        bucket_types = [2] + [1] * hosts
+        item_ids = [-2 - h for h in range(hosts)] + list(range(hosts * devices))
+        item_parents = [-1] * hosts + [-2 - d // devices for d in range(hosts * devices)]
+        item_weights = [0] * hosts + [0x10000] * (hosts * devices)
+        m = crush.Map.from_topology(numpy.array(bucket_ids, dtype=numpy.int32),
+                                    numpy.array(bucket_types, dtype=numpy.int32),
+                                    numpy.array(item_ids, dtype=numpy.int32),
+                                    numpy.array(item_parents, dtype=numpy.int32),
+                                    numpy.array(item_weights, dtype=numpy.uint32))
+        ruleno = m.add_rule([(crush.RULE_TAKE, -1),
+                             (crush.RULE_CHOOSELEAF_FIRSTN, 0, 1),
+                             (crush.RULE_EMIT,)])
+        return m, ruleno
+
+    def test_load(self):
+        m = crush.Map.from_bytes(TEXT_MAP)
+        self.assertEqual(4, m.max_devices)
+        result = m.do_rule(0, 1, 2)
+        self.assertEqual(2, len(result))
+        self.assertNotEqual(result[0] // 2, result[1] // 2)
+        with tempfile.NamedTemporaryFile(suffix=".txt", delete=False) as f:
+            f.write(TEXT_MAP)
+        try:
+            self.assertEqual(m.fingerprint, crush.Map.load(f.name).fingerprint)
+        finally:
+            os.unlink(f.name)
+        with self.assertRaises(ValueError):
+            crush.Map.from_bytes(b"device 0 osd.0\nfoo\n")
+        with self.assertRaises(OSError):
+            crush.Map.load("/nonexistent")
+
+    def test_from_topology(self):
+        m, ruleno = self.topology()
+        self.assertEqual(128, m.max_devices)
+        self.assertEqual(0, ruleno)
+        for x in range(100):
+            result = m.do_rule(ruleno, x, 3)
+            self.assertEqual(3, len(result))
+            self.assertEqual(3, len(set(d // 8 for d in result)))
+        # a bucket that contains itself
+        with self.assertRaises(ValueError):
+            crush.Map.from_topology(numpy.array([-1, -2], dtype=numpy.int32),
+                                    numpy.array([2, 1], dtype=numpy.int32),
+                                    numpy.array([-2, -1], dtype=numpy.int32),
+                                    numpy.array([-1, -2], dtype=numpy.int32),
+                                    numpy.zeros(2, dtype=numpy.uint32))
+        # not 32 bits integers
+        with self.assertRaises(TypeError):
+            crush.Map.from_topology(numpy.array([-1], dtype=numpy.int64),
+                                    numpy.array([2], dtype=numpy.int32),
+                                    numpy.array([0], dtype=numpy.int32),
+                                    numpy.array([-1], dtype=numpy.int32),
+                                    numpy.zeros(1, dtype=numpy.uint32))
+
+    def test_map_batch(self):
+        m, ruleno = self.topology()
+        x = numpy.arange(1000, 3000, dtype=numpy.uint32)
+        out = numpy.empty((len(x), 4), dtype=numpy.int32)
+        sizes = numpy.empty(len(x), dtype=numpy.int32)
+        self.assertIs(out, m.map_batch(ruleno, x, out, sizes=sizes, threads=4))
+        for i in range(0, len(x), 97):
+            self.assertEqual(m.do_rule(ruleno, int(x[i]), 4), list(out[i][:sizes[i]]))
+        self.assertTrue((sizes == 4).all())
+
+        # the same from a range, in place in a slice of a larger matrix
+        larger = numpy.full((len(x) + 10, 4), 7, dtype=numpy.int32)
+        m.map_range(ruleno, 1000, larger[5:len(x) + 5])
+        self.assertTrue((larger[5:len(x) + 5] == out).all())
+        self.assertTrue((larger[:5] == 7).all())
+
+        # weights, results padded with ITEM_NONE
+        weights = numpy.full(m.max_devices, 0x10000, dtype=numpy.uint32)
+        weights[:120] = 0
+        wide = numpy.empty((len(x), 3), dtype=numpy.int32)
+        m.map_batch(ruleno, x, wide, weights=weights, sizes=sizes)
+        # one host left, at most one replica
+        self.assertTrue((sizes <= 1).all())
+        self.assertTrue((wide[sizes == 1, 0] >= 120).all())
+        self.assertTrue((wide[sizes == 0, 0] == crush.ITEM_NONE).all())
+        self.assertTrue((wide[:, 1:] == crush.ITEM_NONE).all())
+
+    def test_map_batch_errors(self):
+        m, ruleno = self.topology()
+        x = numpy.arange(10, dtype=numpy.uint32)
+        with self.assertRaises(ValueError):
+            m.map_batch(ruleno + 1, x, numpy.empty((10, 3), dtype=numpy.int32))
+        with self.assertRaises(ValueError):
+            m.map_batch(ruleno, x, numpy.empty((9, 3), dtype=numpy.int32))
+        with self.assertRaises(ValueError):
+            m.map_batch(ruleno, x, numpy.empty(10, dtype=numpy.int32))
+        with self.assertRaises(TypeError):
+            m.map_batch(ruleno, x, numpy.empty((10, 3), dtype=numpy.int64))
+        # not contiguous
+        with self.assertRaises((BufferError, ValueError)):
+            m.map_batch(ruleno, x, numpy.empty((10, 6), dtype=numpy.int32)[:, ::2])
+        readonly = numpy.empty((10, 3), dtype=numpy.int32)
+        readonly.flags.writeable = False
+        with self.assertRaises((BufferError, ValueError)):
+            m.map_batch(ruleno, x, readonly)
+
+    def test_threads(self):
+        # the GIL is released: python threads map concurrently
+        m, ruleno = self.topology()
+        outs = [numpy.empty((20000, 3), dtype=numpy.int32) for _ in range(4)]
+        threads = [threading.Thread(target=m.map_range, args=(ruleno, 0, out))
+                   for out in outs]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for out in outs[1:]:
+            self.assertTrue((out == outs[0]).all())
+
+
+if __name__ == '__main__':
+    unittest.main()
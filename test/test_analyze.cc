@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <math.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/hash.h"
+#include "crush/builder.h"
+#include "crush/mapper.h"
+#include "crush/analyze.h"
+#include "crush/trace.h"
+}
+
+#include "test_map.h"
+
+static std::vector<double> measure(crush_map *m, int result_max,
+                                   const __u32 *weights, int weight_max, int count)
+{
+  std::vector<double> shares(m->max_devices, 0);
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  int result[result_max];
+  for (int x = 0; x < count; x++) {
+    int len = crush_do_rule(m, 0, x, result, result_max, weights, weight_max, &cwin[0], NULL);
+    for (int i = 0; i < len; i++)
+      if (result[i] != CRUSH_ITEM_NONE)
+        shares[result[i]] += 1.0 / count;
+  }
+  return shares;
+}
+
+TEST(analyze, crush_estimate_placement) {
+  crush_map *m = make_test_map(6, 4, 0.5);
+  ASSERT_TRUE(m != NULL);
+  int weight_max = m->max_devices;
+  __u32 weights[weight_max];
+  for (int i = 0; i < weight_max; i++)
+    weights[i] = 0x10000;
+  weights[5] = 0;
+  weights[6] = 0x8000;
+
+  ASSERT_EQ(-EINVAL, crush_estimate_placement(m, 1, 3, weights, weight_max, NULL,
+                                              0, NULL, NULL));
+  std::vector<double> none(m->max_devices);
+  ASSERT_EQ(-EINVAL, crush_estimate_placement(m, 0, 0, weights, weight_max, NULL,
+                                              0, &none[0], NULL));
+  ASSERT_EQ(-EINVAL, crush_estimate_placement(m, 0, -1, weights, weight_max, NULL,
+                                              0, &none[0], NULL));
+
+  for (int result_max = 1; result_max <= 4; result_max++) {
+    std::vector<double> shares(m->max_devices), errors(m->max_devices);
+    ASSERT_LE(0, crush_estimate_placement(m, 0, result_max, weights, weight_max, NULL,
+                                          0.01, &shares[0], &errors[0]));
+    std::vector<double> measured = measure(m, result_max, weights, weight_max, 100000);
+    double total = 0;
+    for (int d = 0; d < m->max_devices; d++) {
+      total += shares[d];
+      EXPECT_NEAR(measured[d], shares[d], 0.01 + errors[d]) << "device " << d;
+    }
+    EXPECT_NEAR(result_max, total, 0.001);
+    EXPECT_EQ(0, shares[5]);
+    if (result_max <= 3) {
+      // only the partially out device is not exact
+      for (int d = 0; d < m->max_devices; d++) {
+        if (d != 6) {
+          EXPECT_EQ(0, errors[d]) << "device " << d;
+        }
+      }
+      EXPECT_LT(0, errors[6]);
+    }
+  }
+
+  std::vector<double> shares(m->max_devices);
+  EXPECT_LT(0, crush_estimate_placement(m, 0, 4, weights, weight_max, NULL,
+                                        0, &shares[0], NULL));
+  EXPECT_EQ(0, crush_estimate_placement(m, 0, 4, weights, weight_max, NULL,
+                                        1, &shares[0], NULL));
+  crush_destroy(m);
+}
+
+TEST(analyze, crush_estimate_placement_wide) {
+  // a root of 200 hosts and a heavy host drawn for almost half of
+  // the first positions
+  crush_map *m = make_test_map(200, 1, 0.5);
+  ASSERT_TRUE(m != NULL);
+  int items[2] = { 200, 201 };
+  int item_weights[2] = { 0x10000 * 80, 0x10000 * 80 };
+  crush_bucket *heavy = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, 1,
+                                          2, items, item_weights);
+  int heavyno;
+  ASSERT_EQ(0, crush_add_bucket(m, 0, heavy, &heavyno));
+  crush_bucket_add_item(m, m->buckets[0], heavyno, heavy->weight);
+  crush_finalize(m);
+  int weight_max = m->max_devices;
+  std::vector<__u32> weights(weight_max, 0x10000);
+
+  for (int result_max = 3; result_max <= 4; result_max++) {
+    std::vector<double> shares(m->max_devices), errors(m->max_devices);
+    ASSERT_LE(0, crush_estimate_placement(m, 0, result_max, &weights[0], weight_max, NULL,
+                                          0.01, &shares[0], &errors[0]));
+    std::vector<double> measured = measure(m, result_max, &weights[0], weight_max, 10000);
+    double total = 0, heavy_share = 0;
+    for (int d = 0; d < m->max_devices; d++) {
+      total += shares[d];
+      EXPECT_NEAR(measured[d], shares[d], 0.005 + errors[d]) << "device " << d;
+    }
+    EXPECT_NEAR(result_max, total, 0.001);
+    for (int d = 200; d < 202; d++)
+      heavy_share += shares[d];
+    EXPECT_NEAR(measured[200] + measured[201], heavy_share, 0.01);
+    if (result_max == 3) {
+      for (int d = 0; d < m->max_devices; d++)
+        EXPECT_EQ(0, errors[d]) << "device " << d;
+    }
+  }
+  crush_destroy(m);
+}
+
+TEST(analyze, crush_estimate_placement_choose_args) {
+  crush_map *m = make_test_map(4, 2, 0.5);
+  ASSERT_TRUE(m != NULL);
+  int weight_max = m->max_devices;
+  __u32 weights[weight_max];
+  for (int i = 0; i < weight_max; i++)
+    weights[i] = 0x10000;
+  struct crush_choose_arg *choose_args = crush_make_choose_args(m, 2);
+  // the first position of the first host only contains its first device
+  int host = -2;
+  choose_args[-1-host].weight_set[0].weights[1] = 0;
+
+  std::vector<double> shares(m->max_devices);
+  ASSERT_LE(0, crush_estimate_placement(m, 0, 1, weights, weight_max, choose_args,
+                                        0.01, &shares[0], NULL));
+  EXPECT_EQ(0, shares[1]);
+  EXPECT_LT(0, shares[0]);
+  ASSERT_LE(0, crush_estimate_placement(m, 0, 2, weights, weight_max, choose_args,
+                                        0.01, &shares[0], NULL));
+  EXPECT_LT(0, shares[1]);
+  crush_destroy_choose_args(choose_args);
+  crush_destroy(m);
+}
+
+struct observed {
+  crush_map *map;
+  double visits;
+  double hashes;
+  bool retried;
+};
+
+static void observe_choose(void *arg, int bucket, int x, int r, int item)
+{
+  observed *o = (observed *)arg;
+  o->visits++;
+  o->hashes += o->map->buckets[-1-bucket]->size;
+}
+
+static void observe_collide(void *arg, int bucket, int item, int r, unsigned int ftotal)
+{
+  ((observed *)arg)->retried = true;
+}
+
+static void observe_reject(void *arg, int bucket, int item, int r, unsigned int ftotal,
+                           enum crush_trace_reason reason)
+{
+  ((observed *)arg)->retried = true;
+}
+
+TEST(analyze, crush_estimate_cost) {
+  crush_map *m = make_test_map(5, 4, 0.5);
+  ASSERT_TRUE(m != NULL);
+  const int result_max = 3;
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  crush_rule_cost cost;
+  EXPECT_EQ(-EINVAL, crush_estimate_cost(m, 1, result_max, &weights[0], weights.size(), NULL,
+                                         NULL, &cost));
+  EXPECT_EQ(-EINVAL, crush_estimate_cost(m, 0, 0, &weights[0], weights.size(), NULL,
+                                         NULL, &cost));
+
+  crush_trace_ops ops = {};
+  ops.choose = observe_choose;
+  ops.collide = observe_collide;
+  ops.reject = observe_reject;
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  for (int out = 0; out < 2; out++) {
+    if (out) {
+      weights[1] = 0;
+      weights[6] = 0x8000;
+      weights[13] = 0;
+    }
+    ASSERT_EQ(0, crush_estimate_cost(m, 0, result_max, &weights[0], weights.size(), NULL,
+                                     NULL, &cost));
+    // all the items of the straw2 buckets are hashed
+    EXPECT_NEAR(cost.hashes, cost.visits * 4.5, cost.visits * 0.1);
+
+    const int values = 20000;
+    observed o = { m, 0, 0, false };
+    double retries = 0;
+    crush_trace_attach(&cwin[0], &ops, &o);
+    for (int x = 0; x < values; x++) {
+      int result[result_max];
+      o.retried = false;
+      crush_do_rule(m, 0, x, result, result_max, &weights[0], weights.size(), &cwin[0], NULL);
+      if (o.retried)
+        retries++;
+    }
+    // the estimate ignores that consecutive replicas share r values
+    EXPECT_NEAR(o.visits / values, cost.visits, cost.visits * 0.1) << out;
+    EXPECT_NEAR(o.hashes / values, cost.hashes, cost.hashes * 0.1) << out;
+    EXPECT_NEAR(retries / values, cost.retry_probability, 0.03) << out;
+    EXPECT_GT(cost.ns, 0);
+  }
+  crush_destroy(m);
+}
+
+TEST(analyze, crush_estimate_cost_steps) {
+  // choose the hosts, then a device in each of them
+  crush_map *m = make_test_map(12, 4, 0.5);
+  ASSERT_TRUE(m != NULL);
+  const int result_max = 3;
+  crush_rule *rule = crush_make_rule(4, 1, 0, 0, 0);
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, m->rules[0]->steps[0].arg1, 0);
+  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 3, CRUSH_GENERATOR_HOST);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+  crush_rule_set_step(rule, 3, CRUSH_RULE_EMIT, 0, 0);
+  ASSERT_EQ(1, crush_add_rule(m, rule, 1));
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  crush_rule_cost cost;
+  crush_trace_ops ops = {};
+  ops.choose = observe_choose;
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  for (int ruleno = 0; ruleno < 2; ruleno++) {
+    ASSERT_EQ(0, crush_estimate_cost(m, ruleno, result_max, &weights[0], weights.size(), NULL,
+                                     NULL, &cost));
+    const int values = 20000;
+    observed o = { m, 0, 0, false };
+    crush_trace_attach(&cwin[0], &ops, &o);
+    for (int x = 0; x < values; x++) {
+      int result[result_max];
+      crush_do_rule(m, ruleno, x, result, result_max, &weights[0], weights.size(), &cwin[0],
+                    NULL);
+    }
+    EXPECT_NEAR(o.visits / values, cost.visits, cost.visits * 0.1) << ruleno;
+    EXPECT_NEAR(o.hashes / values, cost.hashes, cost.hashes * 0.1) << ruleno;
+  }
+  crush_destroy(m);
+}
+
+TEST(analyze, crush_calibrate_cost) {
+  // timings that follow the model exactly
+  const crush_cost_model expected = { 30, 15, 8, 0.25 };
+  std::vector<crush_rule_cost> costs;
+  std::vector<double> ns;
+  for (int i = 0; i < 10; i++) {
+    crush_rule_cost cost = {};
+    cost.hashes = 10 + 7 * i;
+    cost.visits = 3 + (i * i) % 5;
+    cost.bytes = 200 + 100 * (i % 3);
+    costs.push_back(cost);
+    ns.push_back(expected.base + expected.hash * cost.hashes + expected.visit * cost.visits +
+                 expected.byte * cost.bytes);
+  }
+  crush_cost_model model;
+  EXPECT_EQ(-EINVAL, crush_calibrate_cost(&costs[0], &ns[0], 3, &model));
+  ASSERT_EQ(0, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+  EXPECT_NEAR(expected.base, model.base, 1e-6);
+  EXPECT_NEAR(expected.hash, model.hash, 1e-6);
+  EXPECT_NEAR(expected.visit, model.visit, 1e-6);
+  EXPECT_NEAR(expected.byte, model.byte, 1e-6);
+
+  // a negative constant is set to zero
+  for (size_t i = 0; i < ns.size(); i++)
+    ns[i] -= 2 * expected.base;
+  ASSERT_EQ(0, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+  EXPECT_EQ(0, model.base);
+  EXPECT_GE(model.hash, 0);
+  EXPECT_GE(model.visit, 0);
+  EXPECT_GE(model.byte, 0);
+
+  // the bytes proportional to the hashes cannot be told apart: the
+  // constant of the bytes is zero and the hashes account for them
+  std::vector<crush_rule_cost> proportional(costs);
+  for (size_t i = 0; i < costs.size(); i++) {
+    proportional[i].bytes = 2 * proportional[i].hashes;
+    ns[i] = expected.base + expected.hash * costs[i].hashes + expected.visit * costs[i].visits +
+      expected.byte * proportional[i].bytes;
+  }
+  ASSERT_EQ(0, crush_calibrate_cost(&proportional[0], &ns[0], costs.size(), &model));
+  EXPECT_EQ(0, model.byte);
+  EXPECT_NEAR(expected.base, model.base, 1e-6);
+  EXPECT_NEAR(expected.hash + 2 * expected.byte, model.hash, 1e-6);
+  EXPECT_NEAR(expected.visit, model.visit, 1e-6);
+
+  // times and costs must be finite and positive
+  ns[2] = NAN;
+  EXPECT_EQ(-EINVAL, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+  ns[2] = -1;
+  EXPECT_EQ(-EINVAL, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+  ns[2] = 100;
+  costs[1].visits = -1;
+  EXPECT_EQ(-EINVAL, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+  costs[1].visits = INFINITY;
+  EXPECT_EQ(-EINVAL, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+
+  // calibrate with the maps of the current host
+  costs.clear();
+  ns.clear();
+  for (int hosts = 2; hosts <= 8; hosts += 2) {
+    for (int size = 2; size <= 16; size *= 2) {
+      crush_map *m = make_test_map(hosts, size, 0.5);
+      ASSERT_TRUE(m != NULL);
+      std::vector<__u32> weights(m->max_devices, 0x10000);
+      crush_rule_cost cost;
+      double measured;
+      ASSERT_EQ(0, crush_estimate_cost(m, 0, 2, &weights[0], weights.size(), NULL, NULL, &cost));
+      ASSERT_EQ(0, crush_measure_cost(m, 0, 2, &weights[0], weights.size(), NULL, 1000,
+                                      &measured));
+      EXPECT_GT(measured, 0);
+      EXPECT_EQ(-EINVAL, crush_measure_cost(m, 0, 0, &weights[0], weights.size(), NULL, 1000,
+                                            &measured));
+      costs.push_back(cost);
+      ns.push_back(measured);
+      crush_destroy(m);
+    }
+  }
+  EXPECT_EQ(0, crush_calibrate_cost(&costs[0], &ns[0], costs.size(), &model));
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_analyze && valgrind --tool=memcheck test/unittest_analyze"
+// End:
@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <poll.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/generator.h"
+#include "crush/batch.h"
+#include "crush/async.h"
+}
+
+#include "test_map.h"
+
+class async : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_generated_map();
+    ASSERT_TRUE(m != NULL);
+    weights.assign(m->max_devices, 0x10000);
+  }
+
+  virtual void TearDown() {
+    crush_destroy(m);
+  }
+
+  void init(crush_async_request *r, int first_x, int count, std::vector<int> &results,
+            int priority) {
+    memset(r, 0, sizeof(*r));
+    r->map = m;
+    r->ruleno = CRUSH_GENERATOR_REPLICATED_RULE;
+    r->first_x = first_x;
+    r->count = count;
+    results.assign(count * 3, 42);
+    r->results = results.empty() ? NULL : &results[0];
+    r->result_max = 3;
+    r->weights = &weights[0];
+    r->weight_max = weights.size();
+    r->priority = priority;
+  }
+
+  void expect_mapped(const crush_async_request *r) {
+    std::vector<int> expected(r->count * r->result_max);
+    ASSERT_EQ(0, crush_do_rule_batch(m, r->ruleno, r->x, r->first_x, r->count, &expected[0],
+                                     r->result_max, NULL, r->weights, r->weight_max, NULL,
+                                     1));
+    EXPECT_EQ(expected, std::vector<int>(r->results, r->results + expected.size()));
+  }
+
+  // reap until __count__ requests completed
+  std::vector<crush_async_request *> reap(crush_async *a, size_t count) {
+    std::vector<crush_async_request *> reaped;
+    while (reaped.size() < count) {
+      struct pollfd pfd = { crush_async_fd(a), POLLIN, 0 };
+      EXPECT_EQ(1, poll(&pfd, 1, 10000));
+      crush_async_request *requests[2];
+      int n;
+      while ((n = crush_async_reap(a, requests, 2)) > 0)
+        reaped.insert(reaped.end(), requests, requests + n);
+    }
+    return reaped;
+  }
+
+  crush_map *m;
+  std::vector<__u32> weights;
+};
+
+TEST_F(async, reap) {
+  crush_async *a = crush_async_create(3);
+  ASSERT_TRUE(a != NULL);
+  const int n = 10;
+  crush_async_request requests[n];
+  std::vector<int> results[n];
+  std::vector<__u32> x(1000);
+  for (size_t i = 0; i < x.size(); i++)
+    x[i] = i * 31;
+  for (int i = 0; i < n; i++) {
+    init(&requests[i], i * 1000, i * 200, results[i], i % CRUSH_ASYNC_PRIORITIES);
+    if (i == 5) {
+      requests[i].x = &x[0];
+      requests[i].count = x.size();
+      results[i].resize(x.size() * 3);
+      requests[i].results = &results[i][0];
+    }
+    ASSERT_EQ(0, crush_async_submit(a, &requests[i]));
+  }
+  std::vector<crush_async_request *> reaped = reap(a, n);
+  EXPECT_EQ((size_t)n, reaped.size());
+  for (int i = 0; i < n; i++) {
+    EXPECT_EQ(1, std::count(reaped.begin(), reaped.end(), &requests[i]));
+    EXPECT_EQ(0, requests[i].err);
+    expect_mapped(&requests[i]);
+  }
+  crush_async_request *none;
+  EXPECT_EQ(0, crush_async_reap(a, &none, 1));
+  crush_async_destroy(a);
+}
+
+static std::mutex lock;
+static std::condition_variable cond;
+static std::vector<crush_async_request *> completed;
+
+static void done(crush_async_request *r) {
+  std::lock_guard<std::mutex> l(lock);
+  completed.push_back(r);
+  cond.notify_all();
+}
+
+TEST_F(async, priority) {
+  crush_async *a = crush_async_create(1);
+  ASSERT_TRUE(a != NULL);
+  completed.clear();
+  crush_async_request bulk, lookup;
+  std::vector<int> bulk_results, lookup_results;
+  init(&bulk, 0, 200 * CRUSH_ASYNC_CHUNK, bulk_results, CRUSH_ASYNC_PRIORITIES - 1);
+  bulk.done = done;
+  init(&lookup, 123456, 1, lookup_results, 0);
+  lookup.done = done;
+  ASSERT_EQ(0, crush_async_submit(a, &bulk));
+  ASSERT_EQ(0, crush_async_submit(a, &lookup));
+  {
+    std::unique_lock<std::mutex> l(lock);
+    cond.wait(l, [] { return completed.size() == 2; });
+  }
+  // the lookup overtook the bulk request
+  EXPECT_EQ(&lookup, completed[0]);
+  EXPECT_EQ(&bulk, completed[1]);
+  expect_mapped(&lookup);
+  expect_mapped(&bulk);
+  crush_async_destroy(a);
+}
+
+TEST_F(async, cancel) {
+  crush_async *a = crush_async_create(1);
+  ASSERT_TRUE(a != NULL);
+  completed.clear();
+  const int n = 5;
+  crush_async_request requests[n];
+  std::vector<int> results[n];
+  for (int i = 0; i < n; i++) {
+    init(&requests[i], 0, 100 * CRUSH_ASYNC_CHUNK, results[i], 0);
+    requests[i].done = done;
+    ASSERT_EQ(0, crush_async_submit(a, &requests[i]));
+  }
+  crush_async_destroy(a);
+  // each request completed once, the last ones were cancelled
+  ASSERT_EQ((size_t)n, completed.size());
+  for (int i = 0; i < n; i++)
+    EXPECT_EQ(1, std::count(completed.begin(), completed.end(), &requests[i]));
+  EXPECT_EQ(-ECANCELED, requests[n - 1].err);
+}
+
+TEST_F(async, cancel_without_callback) {
+  crush_async *a = crush_async_create(1);
+  ASSERT_TRUE(a != NULL);
+  const int n = 5;
+  crush_async_request requests[n];
+  std::vector<int> results[n];
+  for (int i = 0; i < n; i++) {
+    init(&requests[i], 0, 100 * CRUSH_ASYNC_CHUNK, results[i], 0);
+    ASSERT_EQ(0, crush_async_submit(a, &requests[i]));
+  }
+  // the requests are released and can go out of scope
+  crush_async_destroy(a);
+  EXPECT_EQ(-ECANCELED, requests[n - 1].err);
+  EXPECT_EQ(42, results[n - 1].back());
+}
+
+TEST_F(async, invalid) {
+  EXPECT_TRUE(crush_async_create(0) == NULL);
+  crush_async *a = crush_async_create(1);
+  ASSERT_TRUE(a != NULL);
+  crush_async_request r;
+  std::vector<int> results;
+  init(&r, 0, 1, results, CRUSH_ASYNC_PRIORITIES);
+  EXPECT_EQ(-EINVAL, crush_async_submit(a, &r));
+  init(&r, 0, 1, results, 0);
+  r.ruleno = 42;
+  EXPECT_EQ(-EINVAL, crush_async_submit(a, &r));
+  init(&r, 0, 1, results, 0);
+  r.count = -1;
+  EXPECT_EQ(-EINVAL, crush_async_submit(a, &r));
+  // nothing to map, completes immediately
+  init(&r, 0, 0, results, 0);
+  EXPECT_EQ(0, crush_async_submit(a, &r));
+  crush_async_request *reaped;
+  EXPECT_EQ(1, crush_async_reap(a, &reaped, 1));
+  EXPECT_EQ(&r, reaped);
+  // no room for an item, the sizes are still set
+  init(&r, 0, 10, results, 0);
+  r.result_max = 0;
+  std::vector<int> sizes(r.count, 42);
+  r.sizes = &sizes[0];
+  EXPECT_EQ(0, crush_async_submit(a, &r));
+  EXPECT_EQ(1, crush_async_reap(a, &reaped, 1));
+  EXPECT_EQ(std::vector<int>(10, 0), sizes);
+  crush_async_destroy(a);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_async && valgrind --tool=memcheck test/unittest_async"
+// End:
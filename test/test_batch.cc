@@ -0,0 +1,99 @@
+#include <errno.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/generator.h"
+#include "crush/batch.h"
+}
+
+#include "test_map.h"
+
+class batch : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_generated_map(1);
+    ASSERT_TRUE(m != NULL);
+    weights.assign(m->max_devices, 0x10000);
+  }
+
+  virtual void TearDown() {
+    crush_destroy(m);
+  }
+
+  crush_map *m;
+  std::vector<__u32> weights;
+};
+
+TEST_F(batch, same_as_do_rule) {
+  const int count = 5000;
+  const int result_max = 4;
+  std::vector<__u32> x(count);
+  for (int i = 0; i < count; i++)
+    x[i] = i * 7919;
+  // devices out to get results shorter than result_max
+  for (int d = 0; d < m->max_devices; d += 3)
+    weights[d] = 0;
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+
+  for (int threads = 0; threads <= 4; threads += 2) {
+    std::vector<int> results(count * result_max, 42);
+    std::vector<int> sizes(count, 42);
+    ASSERT_EQ(0, crush_do_rule_batch(m, CRUSH_GENERATOR_REPLICATED_RULE, &x[0], 0, count,
+                                     &results[0], result_max, &sizes[0],
+                                     &weights[0], weights.size(), NULL, threads));
+    for (int i = 0; i < count; i++) {
+      int result[result_max];
+      int size = crush_do_rule(m, CRUSH_GENERATOR_REPLICATED_RULE, x[i], result, result_max,
+                               &weights[0], weights.size(), &cwin[0], NULL);
+      ASSERT_EQ(size, sizes[i]);
+      for (int j = 0; j < result_max; j++)
+        ASSERT_EQ(j < size ? result[j] : CRUSH_ITEM_NONE, results[i * result_max + j]);
+    }
+  }
+}
+
+TEST_F(batch, range) {
+  const int count = 1000;
+  const int result_max = 6;
+  std::vector<__u32> x(count);
+  for (int i = 0; i < count; i++)
+    x[i] = 100 + i;
+  std::vector<int> expected(count * result_max);
+  ASSERT_EQ(0, crush_do_rule_batch(m, CRUSH_GENERATOR_EC_RULE, &x[0], 0, count,
+                                   &expected[0], result_max, NULL,
+                                   &weights[0], weights.size(), NULL, 1));
+  std::vector<int> results(count * result_max);
+  ASSERT_EQ(0, crush_do_rule_batch(m, CRUSH_GENERATOR_EC_RULE, NULL, 100, count,
+                                   &results[0], result_max, NULL,
+                                   &weights[0], weights.size(), NULL, 3));
+  EXPECT_EQ(expected, results);
+}
+
+TEST_F(batch, invalid) {
+  int result[3];
+  EXPECT_EQ(-EINVAL, crush_do_rule_batch(m, 42, NULL, 0, 1, result, 3, NULL,
+                                         &weights[0], weights.size(), NULL, 1));
+  EXPECT_EQ(-EINVAL, crush_do_rule_batch(m, CRUSH_GENERATOR_REPLICATED_RULE, NULL, 0, -1,
+                                         result, 3, NULL, &weights[0], weights.size(),
+                                         NULL, 1));
+  EXPECT_EQ(-EINVAL, crush_do_rule_batch(m, CRUSH_GENERATOR_REPLICATED_RULE, NULL, 0, 1,
+                                         result, 3, NULL, &weights[0], weights.size(),
+                                         NULL, -1));
+  // nothing to map
+  EXPECT_EQ(0, crush_do_rule_batch(m, CRUSH_GENERATOR_REPLICATED_RULE, NULL, 0, 0,
+                                   NULL, 3, NULL, &weights[0], weights.size(), NULL, 4));
+  // no room for an item, the sizes are still set
+  std::vector<int> sizes(10, 42);
+  EXPECT_EQ(0, crush_do_rule_batch(m, CRUSH_GENERATOR_REPLICATED_RULE, NULL, 0, sizes.size(),
+                                   NULL, 0, &sizes[0], &weights[0], weights.size(), NULL, 4));
+  EXPECT_EQ(std::vector<int>(10, 0), sizes);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_batch && valgrind --tool=memcheck test/unittest_batch"
+// End:
@@ -2,6 +2,7 @@
 
 extern "C" {
 #include "crush/builder.h"
+#include "crush/hash.h"
 }
 
 TEST(builder, crush_create) {
@@ -102,6 +103,31 @@ TEST(builder, crush_bucket_add_item_uniform) {
   crush_destroy(m);
 }
 
+TEST(builder, crush_bucket_remove_item) {
+  // removing the last item must not read past the arrays
+  for (int alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++) {
+    crush_map *m = crush_create();
+    int items[3] = { 0, 1, 2 };
+    int weights[3] = { 0x10000, 0x10000, 0x10000 };
+    crush_bucket *b = crush_make_bucket(m, alg, CRUSH_HASH_DEFAULT, 1, 3, items, weights);
+    int id;
+    ASSERT_EQ(0, crush_add_bucket(m, 0, b, &id));
+    ASSERT_EQ(0, crush_bucket_remove_item(m, b, 2)) << alg;
+    EXPECT_EQ(2u, b->size) << alg;
+    EXPECT_EQ(0, b->items[0]) << alg;
+    EXPECT_EQ(1, b->items[1]) << alg;
+    EXPECT_EQ(2u * 0x10000, b->weight) << alg;
+    if (alg == CRUSH_BUCKET_LIST) {
+      EXPECT_EQ(2u * 0x10000, ((crush_bucket_list *)b)->sum_weights[1]);
+    }
+    ASSERT_EQ(0, crush_bucket_remove_item(m, b, 1)) << alg;
+    EXPECT_EQ(1u, b->size) << alg;
+    EXPECT_EQ(0, b->items[0]) << alg;
+    EXPECT_EQ(-ENOENT, crush_bucket_remove_item(m, b, 1)) << alg;
+    crush_destroy(m);
+  }
+}
+
 TEST(builder, crush_make_choose_args) {
   crush_map *m = crush_create();
   const int type = 1;
@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+
+#include <type_traits>
+#include <vector>
+
+#include "crush/crush.hpp"
+
+extern "C" {
+#include "crush/generator.h"
+}
+
+#include "test_map.h"
+
+static_assert(!std::is_copy_constructible<crush::Map>::value, "");
+static_assert(std::is_nothrow_move_constructible<crush::Map>::value, "");
+static_assert(!std::is_copy_constructible<crush::Workspace>::value, "");
+static_assert(std::is_nothrow_move_constructible<crush::Workspace>::value, "");
+static_assert(!std::is_copy_constructible<crush::ChooseArgs>::value, "");
+static_assert(std::is_nothrow_move_constructible<crush::ChooseArgs>::value, "");
+
+// a root of 4 hosts of 4 devices and a rule with a replica per host
+static crush::Map make_map(int *root) {
+  crush::Map map;
+  std::vector<int> hosts, host_weights;
+  for (int h = 0; h < 4; h++) {
+    std::vector<int> devices, weights;
+    for (int d = 0; d < 4; d++) {
+      devices.push_back(h * 4 + d);
+      weights.push_back(0x10000);
+    }
+    hosts.push_back(map.add_bucket(CRUSH_BUCKET_STRAW2, 1, devices, weights));
+    host_weights.push_back(4 * 0x10000);
+  }
+  *root = map.add_bucket(CRUSH_BUCKET_STRAW2, 2, hosts, host_weights);
+  EXPECT_EQ(0, map.add_rule({{CRUSH_RULE_TAKE, *root, 0},
+                             {CRUSH_RULE_CHOOSELEAF_FIRSTN, 0, 1},
+                             {CRUSH_RULE_EMIT, 0, 0}}));
+  map.finalize();
+  return map;
+}
+
+TEST(cpp, map) {
+  int root;
+  crush::Map map = make_map(&root);
+  EXPECT_EQ(16, map->max_devices);
+  crush::Map other(std::move(map));
+  EXPECT_FALSE(map);
+  EXPECT_TRUE(other);
+  map = std::move(other);
+  EXPECT_EQ(16, map->max_devices);
+
+  // the bucket is deallocated when it cannot be added
+  int items[] = { 0 };
+  int weights[] = { 0x10000 };
+  try {
+    map.add_bucket(CRUSH_BUCKET_STRAW2, 1, items, weights, root);
+    FAIL();
+  } catch (const std::system_error &e) {
+    EXPECT_EQ(EEXIST, e.code().value());
+  }
+
+  crush_map *m = map.release();
+  EXPECT_FALSE(map);
+  map.reset(m);
+  EXPECT_EQ(m, map.get());
+}
+
+TEST(cpp, add_rule) {
+  int root;
+  crush::Map map = make_map(&root);
+  crush::step steps[] = {{CRUSH_RULE_TAKE, root, 0}, {CRUSH_RULE_EMIT, 0, 0}};
+
+  // an existing rule is not replaced
+  crush_rule *rule = map->rules[0];
+  EXPECT_THROW(map.add_rule(steps, 0), std::invalid_argument);
+  EXPECT_EQ(rule, map->rules[0]);
+  EXPECT_THROW(map.add_rule(steps, CRUSH_MAX_RULES), std::length_error);
+
+  // fill the map, then no rule is free
+  for (int r = 1; r < CRUSH_MAX_RULES; r++)
+    ASSERT_EQ(r, map.add_rule(steps));
+  EXPECT_THROW(map.add_rule(steps), std::length_error);
+  EXPECT_EQ(static_cast<__u32>(CRUSH_MAX_RULES), map->max_rules);
+}
+
+TEST(cpp, load) {
+  const char text[] =
+    "device 0 osd.0\n"
+    "type 0 osd\n"
+    "type 1 root\n"
+    "root default {\n"
+    "  id -1\n"
+    "  alg straw2\n"
+    "  hash 0\n"
+    "  item osd.0 weight 1.000\n"
+    "}\n";
+  crush::Map map = crush::Map::load(text, sizeof(text) - 1);
+  EXPECT_EQ(1, map->max_devices);
+  try {
+    crush::Map::load("device 0 osd.0\nfoo\n", 19);
+    FAIL();
+  } catch (const std::system_error &e) {
+    EXPECT_EQ(EINVAL, e.code().value());
+    EXPECT_NE(std::string::npos, std::string(e.what()).find("line 2"));
+  }
+  try {
+    crush::Map::load("/nonexistent");
+    FAIL();
+  } catch (const std::system_error &e) {
+    EXPECT_EQ(ENOENT, e.code().value());
+  }
+}
+
+TEST(cpp, do_rule) {
+  int root;
+  crush::Map map = make_map(&root);
+  std::vector<__u32> weights(map->max_devices, 0x10000);
+  crush::Workspace work(map, 3);
+  std::vector<char> cwin(crush_work_size(map.get(), 3));
+  crush_init_workspace(map.get(), &cwin[0]);
+  crush::ChooseArgs choose_args(map, 1);
+
+  for (int x = 0; x < 1000; x++) {
+    int expected[3];
+    int expected_size = crush_do_rule(map.get(), 0, x, expected, 3, &weights[0],
+                                      weights.size(), &cwin[0], NULL);
+    int result[3];
+    ASSERT_EQ(expected_size, map.do_rule(work, 0, x, result, weights));
+    ASSERT_EQ(std::vector<int>(expected, expected + 3), std::vector<int>(result, result + 3));
+    std::array<int, 3> fixed;
+    ASSERT_EQ(expected_size, map.do_rule(work, 0, x, fixed, weights, choose_args));
+    ASSERT_EQ(std::vector<int>(expected, expected + 3),
+              std::vector<int>(fixed.begin(), fixed.end()));
+  }
+
+  crush::Workspace moved(std::move(work));
+  EXPECT_EQ(nullptr, work.get());
+  EXPECT_EQ(3, moved.result_max());
+}
+
+TEST(cpp, batch) {
+  crush::Map map(make_generated_map());
+  ASSERT_TRUE(map);
+  std::vector<__u32> weights(map->max_devices, 0x10000);
+  crush::Workspace work(map, 3);
+
+  const int count = 2000;
+  std::vector<__u32> x(count);
+  for (int i = 0; i < count; i++)
+    x[i] = 1000 + i;
+  std::vector<int> results(count * 3);
+  std::vector<int> sizes(count);
+  map.map_batch(CRUSH_GENERATOR_REPLICATED_RULE, x, results, 3, weights, sizes, nullptr, 4);
+  std::vector<std::array<int, 3>> rows(count);
+  map.map_range(CRUSH_GENERATOR_REPLICATED_RULE, 1000, crush::span(rows), weights);
+  std::vector<std::array<int, 3>> batch_rows(count);
+  map.map_batch(CRUSH_GENERATOR_REPLICATED_RULE, x, crush::span(batch_rows), weights);
+
+  std::array<int, 3> buffer;
+  int i = 0;
+  for (auto mapping : crush::Mappings(map, work, CRUSH_GENERATOR_REPLICATED_RULE, 1000,
+                                      1000 + count, buffer, weights)) {
+    ASSERT_EQ(x[i], mapping.x);
+    ASSERT_EQ(sizes[i], (int)mapping.result.size());
+    for (int j = 0; j < sizes[i]; j++) {
+      ASSERT_EQ(results[i * 3 + j], mapping.result[j]);
+      ASSERT_EQ(results[i * 3 + j], rows[i][j]);
+      ASSERT_EQ(results[i * 3 + j], batch_rows[i][j]);
+    }
+    i++;
+  }
+  EXPECT_EQ(count, i);
+
+  try {
+    map.map_range(42, 0, results, 3, weights);
+    FAIL();
+  } catch (const std::system_error &e) {
+    EXPECT_EQ(EINVAL, e.code().value());
+  }
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_cpp && valgrind --tool=memcheck test/unittest_cpp"
+// End:
@@ -0,0 +1,247 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/hash.h"
+#include "crush/builder.h"
+#include "crush/mapper.h"
+#include "crush/delta.h"
+}
+
+#include "test_map.h"
+
+// variant 1 changes a weight, removes a bucket, adds another
+// bucket and a rule and modifies a tunable. Return NULL on error.
+static crush_map *make_map(int variant, const int *algs, int host_count)
+{
+  crush_map *m = crush_create();
+  crush_bucket *root = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT,
+                                         CRUSH_GENERATOR_ROOT, 0, NULL, NULL);
+  int rootno;
+  int err = crush_add_bucket(m, 0, root, &rootno);
+  for (int host = 0; host < host_count && err >= 0; host++) {
+    if (variant == 1 && host == 2)
+      continue;
+    int weight = variant == 1 && host == 0 ? 0x20000 : 0x10000;
+    err = add_test_host(m, root, algs[host], host * 4, 4, weight);
+  }
+  if (variant == 1 && err >= 0) {
+    err = add_test_host(m, root, CRUSH_BUCKET_STRAW2, host_count * 4, 4, 0x10000);
+    m->choose_total_tries = 100;
+  }
+  if (err >= 0)
+    err = add_test_rule(m, rootno, 0, CRUSH_RULE_CHOOSELEAF_FIRSTN, CRUSH_GENERATOR_HOST);
+  if (variant == 1 && err >= 0)
+    err = add_test_rule(m, rootno, 1, CRUSH_RULE_CHOOSELEAF_INDEP, CRUSH_GENERATOR_HOST);
+  if (err < 0) {
+    crush_destroy(m);
+    return NULL;
+  }
+  crush_finalize(m);
+  return m;
+}
+
+static void expect_same_mappings(crush_map *a, const crush_choose_arg *a_args,
+                                 crush_map *b, const crush_choose_arg *b_args)
+{
+  ASSERT_EQ(a->max_devices, b->max_devices);
+  ASSERT_EQ(a->working_size, b->working_size);
+  ASSERT_EQ(a->max_rules, b->max_rules);
+  std::vector<__u32> weights(a->max_devices, 0x10000);
+  std::vector<char> a_cwin(crush_work_size(a, 3)), b_cwin(crush_work_size(b, 3));
+  crush_init_workspace(a, &a_cwin[0]);
+  crush_init_workspace(b, &b_cwin[0]);
+  for (__u32 ruleno = 0; ruleno < a->max_rules; ruleno++) {
+    if (a->rules[ruleno] == NULL)
+      continue;
+    for (int x = 0; x < 1000; x++) {
+      int a_result[3], b_result[3];
+      int a_len = crush_do_rule(a, ruleno, x, a_result, 3, &weights[0], weights.size(),
+                                &a_cwin[0], a_args);
+      int b_len = crush_do_rule(b, ruleno, x, b_result, 3, &weights[0], weights.size(),
+                                &b_cwin[0], b_args);
+      ASSERT_EQ(b_len, a_len);
+      for (int i = 0; i < a_len; i++)
+        ASSERT_EQ(b_result[i], a_result[i]) << "rule " << ruleno << " x " << x;
+    }
+  }
+}
+
+TEST(delta, buckets_rules_tunables) {
+  const int algs[] = {
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_LIST,
+    CRUSH_BUCKET_UNIFORM,
+    CRUSH_BUCKET_TREE,
+    CRUSH_BUCKET_STRAW,
+  };
+  crush_map *old_map = make_map(0, algs, 5);
+  ASSERT_TRUE(old_map != NULL);
+  crush_map *new_map = make_map(1, algs, 5);
+  ASSERT_TRUE(new_map != NULL);
+  EXPECT_NE(old_map->fingerprint, new_map->fingerprint);
+
+  void *delta;
+  size_t length;
+  ASSERT_EQ(0, crush_map_delta_encode(old_map, NULL, new_map, NULL, &delta, &length));
+
+  // a truncated delta is rejected and the map is not modified
+  __u64 fingerprint = old_map->fingerprint;
+  EXPECT_EQ(-EINVAL, crush_map_delta_apply(old_map, NULL, delta, length - 1));
+  EXPECT_EQ(fingerprint, old_map->fingerprint);
+
+  ASSERT_EQ(0, crush_map_delta_apply(old_map, NULL, delta, length));
+  EXPECT_EQ(new_map->fingerprint, old_map->fingerprint);
+  EXPECT_EQ(crush_map_fingerprint(old_map), old_map->fingerprint);
+  EXPECT_EQ(100u, old_map->choose_total_tries);
+  expect_same_mappings(old_map, NULL, new_map, NULL);
+
+  // the delta cannot be applied twice
+  EXPECT_EQ(-ESTALE, crush_map_delta_apply(old_map, NULL, delta, length));
+  free(delta);
+
+  // the reverse delta restores the original map
+  crush_map *original = make_map(0, algs, 5);
+  ASSERT_TRUE(original != NULL);
+  ASSERT_EQ(0, crush_map_delta_encode(new_map, NULL, original, NULL, &delta, &length));
+  ASSERT_EQ(0, crush_map_delta_apply(old_map, NULL, delta, length));
+  EXPECT_EQ(original->fingerprint, old_map->fingerprint);
+  expect_same_mappings(old_map, NULL, original, NULL);
+  free(delta);
+
+  crush_destroy(original);
+  crush_destroy(old_map);
+  crush_destroy(new_map);
+}
+
+TEST(delta, choose_args) {
+  const int algs[] = {
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+  };
+  crush_map *old_map = make_map(0, algs, 4);
+  ASSERT_TRUE(old_map != NULL);
+  crush_map *new_map = make_map(1, algs, 4);
+  ASSERT_TRUE(new_map != NULL);
+  crush_choose_arg *old_args = crush_make_choose_args(old_map, 2);
+  crush_choose_arg *new_args = crush_make_choose_args(new_map, 2);
+  new_args[1].weight_set[0].weights[0] = 0;
+  new_args[1].weight_set[1].weights[2] = 0x30000;
+
+  void *delta;
+  size_t length;
+  ASSERT_EQ(0, crush_map_delta_encode(old_map, old_args, new_map, new_args, &delta, &length));
+  EXPECT_EQ(-EINVAL, crush_map_delta_apply(old_map, NULL, delta, length));
+  ASSERT_EQ(0, crush_map_delta_apply(old_map, &old_args, delta, length));
+  EXPECT_EQ(new_map->fingerprint, old_map->fingerprint);
+  EXPECT_EQ(0u, old_args[1].weight_set[0].weights[0]);
+  EXPECT_EQ(0x30000u, old_args[1].weight_set[1].weights[2]);
+  expect_same_mappings(old_map, old_args, new_map, new_args);
+  free(delta);
+
+  // remove the choose_args
+  crush_map *same_map = make_map(1, algs, 4);
+  ASSERT_TRUE(same_map != NULL);
+  ASSERT_EQ(0, crush_map_delta_encode(new_map, new_args, same_map, NULL, &delta, &length));
+  ASSERT_EQ(0, crush_map_delta_apply(old_map, &old_args, delta, length));
+  EXPECT_EQ(NULL, old_args);
+  free(delta);
+
+  crush_destroy_choose_args(new_args);
+  crush_destroy(same_map);
+  crush_destroy(old_map);
+  crush_destroy(new_map);
+}
+
+TEST(delta, choose_args_mismatch) {
+  const int algs[] = {
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+  };
+  crush_map *old_map = make_map(0, algs, 4);
+  ASSERT_TRUE(old_map != NULL);
+  crush_map *new_map = make_map(1, algs, 4);
+  ASSERT_TRUE(new_map != NULL);
+  crush_choose_arg *old_args = crush_make_choose_args(old_map, 2);
+  crush_choose_arg *new_args = crush_make_choose_args(new_map, 2);
+  __u64 fingerprint = old_map->fingerprint;
+  int missing = new_map->max_buckets - 1;
+  ASSERT_EQ(NULL, new_map->buckets[missing]);
+  void *delta;
+  size_t length;
+
+  // fewer weights, fewer ids than the bucket has items or a
+  // choose_arg for a bucket that does not exist
+  for (int c = 0; c < 3; c++) {
+    crush_choose_arg saved = new_args[c < 2 ? 1 : missing];
+    if (c == 0)
+      new_args[1].weight_set[1].size--;
+    else if (c == 1)
+      new_args[1].ids_size--;
+    else
+      new_args[missing] = new_args[1];
+    ASSERT_EQ(0, crush_map_delta_encode(old_map, old_args, new_map, new_args, &delta,
+                                        &length));
+    EXPECT_EQ(-EINVAL, crush_map_delta_apply(old_map, &old_args, delta, length)) << c;
+    EXPECT_EQ(fingerprint, old_map->fingerprint);
+    free(delta);
+    new_args[c < 2 ? 1 : missing] = saved;
+  }
+
+  crush_destroy_choose_args(old_args);
+  crush_destroy_choose_args(new_args);
+  crush_destroy(old_map);
+  crush_destroy(new_map);
+}
+
+TEST(delta, invalid_map) {
+  const int algs[] = {
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_TREE,
+    CRUSH_BUCKET_STRAW2,
+    CRUSH_BUCKET_STRAW2,
+  };
+  crush_map *old_map = make_map(0, algs, 4);
+  ASSERT_TRUE(old_map != NULL);
+  __u64 fingerprint = old_map->fingerprint;
+
+  // a delta giving a bucket with a device that does not exist, a
+  // bucket containing the root that contains it, or a tree with
+  // fewer nodes than its items need, with a fingerprint matching
+  // that map
+  for (int c = 0; c < 3; c++) {
+    crush_map *new_map = make_map(1, algs, 4);
+    ASSERT_TRUE(new_map != NULL);
+    crush_bucket *host = new_map->buckets[1];
+    if (c == 0) {
+      host->items[0] = new_map->max_devices;
+    } else if (c == 1) {
+      host->items[0] = new_map->buckets[0]->id;
+    } else {
+      ASSERT_EQ(CRUSH_BUCKET_TREE, new_map->buckets[2]->alg);
+      ((crush_bucket_tree *)new_map->buckets[2])->num_nodes = 2;
+    }
+    new_map->fingerprint = crush_map_fingerprint(new_map);
+    void *delta;
+    size_t length;
+    ASSERT_EQ(0, crush_map_delta_encode(old_map, NULL, new_map, NULL, &delta, &length));
+    EXPECT_EQ(-EINVAL, crush_map_delta_apply(old_map, NULL, delta, length)) << c;
+    EXPECT_EQ(fingerprint, old_map->fingerprint);
+    free(delta);
+    crush_destroy(new_map);
+  }
+
+  crush_destroy(old_map);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_delta && valgrind --tool=memcheck test/unittest_delta"
+// End:
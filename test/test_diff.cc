@@ -0,0 +1,207 @@
+#include <errno.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/hash.h"
+#include "crush/mapper.h"
+#include "crush/generator.h"
+#include "crush/diff.h"
+}
+
+#include "test_map.h"
+
+class diff : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_generated_map(1, &g);
+    ASSERT_TRUE(m != NULL);
+    weights.assign(m->max_devices, 0x10000);
+    reweighted.assign(m->max_devices, 0x10000);
+    memset(&params, 0, sizeof(params));
+    params.ruleno = CRUSH_GENERATOR_REPLICATED_RULE;
+    params.result_max = 3;
+    params.old_weights = &weights[0];
+    params.old_weight_max = weights.size();
+    params.new_weights = &reweighted[0];
+    params.new_weight_max = reweighted.size();
+    params.pool = 1;
+    params.pg_num = 2048;
+  }
+
+  virtual void TearDown() {
+    crush_destroy(m);
+  }
+
+  // the mapping of each PG of the pool
+  std::vector<std::vector<int> > pgs(int ruleno, int result_max, const std::vector<__u32> &w) {
+    std::vector<char> cwin(crush_work_size(m, result_max));
+    crush_init_workspace(m, &cwin[0]);
+    std::vector<std::vector<int> > mappings(params.pg_num);
+    for (int pg = 0; pg < params.pg_num; pg++) {
+      int x = crush_hash32_2(CRUSH_HASH_RJENKINS1, pg, params.pool);
+      mappings[pg].resize(result_max);
+      int len = crush_do_rule(m, ruleno, x, &mappings[pg][0], result_max,
+                              &w[0], w.size(), &cwin[0], NULL);
+      mappings[pg].resize(len);
+    }
+    return mappings;
+  }
+
+  crush_generator g;
+  crush_map *m;
+  std::vector<__u32> weights;
+  std::vector<__u32> reweighted;
+  crush_diff_params params;
+};
+
+TEST_F(diff, same) {
+  crush_diff_result result;
+  std::vector<__u64> in(m->max_devices, 42), out(m->max_devices, 42);
+  ASSERT_EQ(0, crush_diff(m, m, &params, &result, &in[0], &out[0]));
+  EXPECT_EQ(params.pg_num, result.pgs);
+  EXPECT_EQ(0, result.moved);
+  EXPECT_EQ(0u, result.replicas_moved);
+  EXPECT_EQ(0, result.moved_ratio);
+  for (int d = 0; d < m->max_devices; d++) {
+    EXPECT_EQ(0u, in[d]);
+    EXPECT_EQ(0u, out[d]);
+  }
+}
+
+TEST_F(diff, exact) {
+  const int out_device = 5;
+  reweighted[out_device] = 0;
+  std::vector<std::vector<int> > before = pgs(params.ruleno, 3, weights);
+  int expected_moved = 0;
+  for (int pg = 0; pg < params.pg_num; pg++)
+    for (size_t i = 0; i < before[pg].size(); i++)
+      if (before[pg][i] == out_device)
+        expected_moved++;
+
+  crush_diff_result result;
+  std::vector<__u64> in(m->max_devices), out(m->max_devices);
+  ASSERT_EQ(0, crush_diff(m, m, &params, &result, &in[0], &out[0]));
+  EXPECT_EQ(expected_moved, result.moved);
+  EXPECT_EQ((__u64)expected_moved, result.replicas_moved);
+  EXPECT_EQ((__u64)expected_moved, out[out_device]);
+  EXPECT_EQ(0u, in[out_device]);
+  EXPECT_DOUBLE_EQ((double)expected_moved / params.pg_num, result.moved_ratio);
+  EXPECT_EQ(result.moved_ratio, result.moved_low);
+  EXPECT_EQ(result.moved_ratio, result.moved_high);
+  __u64 total_in = 0, total_out = 0;
+  for (int d = 0; d < m->max_devices; d++) {
+    total_in += in[d];
+    total_out += out[d];
+  }
+  EXPECT_EQ(result.replicas_moved, total_in);
+  EXPECT_EQ(total_in, total_out);
+
+  // the same with threads
+  crush_diff_result threaded;
+  std::vector<__u64> threaded_in(m->max_devices), threaded_out(m->max_devices);
+  params.threads = 3;
+  ASSERT_EQ(0, crush_diff(m, m, &params, &threaded, &threaded_in[0], &threaded_out[0]));
+  EXPECT_EQ(result.moved, threaded.moved);
+  EXPECT_EQ(result.replicas_moved, threaded.replicas_moved);
+  EXPECT_EQ(in, threaded_in);
+  EXPECT_EQ(out, threaded_out);
+}
+
+TEST_F(diff, positional) {
+  // a host out moves the shards of an indep rule, and only them
+  const int out_device = 9;
+  reweighted[out_device] = 0;
+  params.ruleno = CRUSH_GENERATOR_EC_RULE;
+  params.result_max = 6;
+  std::vector<std::vector<int> > before = pgs(params.ruleno, 6, weights);
+  std::vector<std::vector<int> > after = pgs(params.ruleno, 6, reweighted);
+  int expected_moved = 0;
+  __u64 expected_replicas = 0;
+  for (int pg = 0; pg < params.pg_num; pg++) {
+    int changed = 0;
+    for (size_t i = 0; i < after[pg].size(); i++)
+      if (after[pg][i] != CRUSH_ITEM_NONE &&
+          (i >= before[pg].size() || before[pg][i] != after[pg][i])) {
+        expected_replicas++;
+        changed = 1;
+      }
+    expected_moved += changed;
+  }
+  ASSERT_LT(0, expected_moved);
+
+  crush_diff_result result;
+  ASSERT_EQ(0, crush_diff(m, m, &params, &result, NULL, NULL));
+  EXPECT_EQ(expected_moved, result.moved);
+  EXPECT_EQ(expected_replicas, result.replicas_moved);
+}
+
+TEST_F(diff, sampled) {
+  crush_generator_out(&g, CRUSH_GENERATOR_HOST, 0.1, 1, &reweighted[0], reweighted.size());
+  params.pg_num = 8192;
+  crush_diff_result exact;
+  ASSERT_EQ(0, crush_diff(m, m, &params, &exact, NULL, NULL));
+  ASSERT_LT(0, exact.moved);
+
+  params.samples = 1000;
+  params.seed = 7;
+  crush_diff_result sampled;
+  std::vector<__u64> in(m->max_devices), out(m->max_devices);
+  ASSERT_EQ(0, crush_diff(m, m, &params, &sampled, &in[0], &out[0]));
+  EXPECT_EQ(1000, sampled.pgs);
+  EXPECT_LT(sampled.moved_low, sampled.moved_ratio);
+  EXPECT_GT(sampled.moved_high, sampled.moved_ratio);
+  EXPECT_LE(sampled.moved_low, exact.moved_ratio);
+  EXPECT_GE(sampled.moved_high, exact.moved_ratio);
+  // about 3 / sqrt(1000) wide
+  EXPECT_GT(0.1, sampled.moved_high - sampled.moved_low);
+
+  // the samples do not depend on the threads
+  params.threads = 4;
+  crush_diff_result threaded;
+  std::vector<__u64> threaded_in(m->max_devices), threaded_out(m->max_devices);
+  ASSERT_EQ(0, crush_diff(m, m, &params, &threaded, &threaded_in[0], &threaded_out[0]));
+  EXPECT_EQ(sampled.moved, threaded.moved);
+  EXPECT_EQ(sampled.moved_low, threaded.moved_low);
+  EXPECT_EQ(in, threaded_in);
+  EXPECT_EQ(out, threaded_out);
+
+  // another seed, other samples
+  params.seed = 8;
+  ASSERT_EQ(0, crush_diff(m, m, &params, &threaded, NULL, NULL));
+  EXPECT_NE(sampled.replicas_moved, threaded.replicas_moved);
+}
+
+TEST_F(diff, invalid) {
+  crush_diff_result result;
+  params.ruleno = 42;
+  EXPECT_EQ(-EINVAL, crush_diff(m, m, &params, &result, NULL, NULL));
+  params.ruleno = CRUSH_GENERATOR_REPLICATED_RULE;
+  params.pg_num = 0;
+  EXPECT_EQ(-EINVAL, crush_diff(m, m, &params, &result, NULL, NULL));
+  params.pg_num = 1;
+  params.samples = -1;
+  EXPECT_EQ(-EINVAL, crush_diff(m, m, &params, &result, NULL, NULL));
+  params.samples = 0;
+  params.result_max = 0;
+  EXPECT_EQ(-EINVAL, crush_diff(m, m, &params, &result, NULL, NULL));
+
+  // a rule that is not in the old map
+  crush_generator other;
+  crush_generator_init(&other);
+  crush_map *old_map;
+  ASSERT_EQ(0, crush_generate(&other, &old_map));
+  params.result_max = 3;
+  params.ruleno = CRUSH_GENERATOR_EC_RULE;
+  EXPECT_EQ(-EINVAL, crush_diff(old_map, m, &params, &result, NULL, NULL));
+  params.ruleno = CRUSH_GENERATOR_REPLICATED_RULE;
+  EXPECT_EQ(0, crush_diff(old_map, m, &params, &result, NULL, NULL));
+  crush_destroy(old_map);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_diff && valgrind --tool=memcheck test/unittest_diff"
+// End:
@@ -0,0 +1,169 @@
+#include <errno.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/generator.h"
+#include "crush/executor.h"
+#include "crush/batch.h"
+#include "crush/diff.h"
+#include "crush/simulate.h"
+}
+
+#include "test_map.h"
+
+struct loop {
+  std::vector<std::atomic<int> > *seen;
+  std::atomic<int> chunks;
+  std::atomic<int> bad;
+  int workers;
+  __s64 grain;
+};
+
+static void count(void *arg, int worker, __s64 begin, __s64 end) {
+  loop *l = static_cast<loop *>(arg);
+  if (worker < 0 || worker >= l->workers || begin >= end || end - begin > l->grain)
+    l->bad++;
+  for (__s64 i = begin; i < end; i++)
+    (*l->seen)[i]++;
+  l->chunks++;
+}
+
+TEST(executor, parallel_for) {
+  crush_executor *e;
+  EXPECT_EQ(-EINVAL, crush_executor_create(0, &e));
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    ASSERT_EQ(0, crush_executor_create(threads, &e));
+    EXPECT_EQ(threads, crush_executor_workers(e));
+    for (__s64 count : { 0, 1, 7, 1000, 100003 }) {
+      std::vector<std::atomic<int> > seen(count);
+      for (auto &s : seen)
+        s = 0;
+      loop l;
+      l.seen = &seen;
+      l.chunks = 0;
+      l.bad = 0;
+      l.workers = threads;
+      l.grain = 100;
+      ASSERT_EQ(0, crush_parallel_for(e, count, l.grain, ::count, &l));
+      EXPECT_EQ(0, l.bad);
+      for (__s64 i = 0; i < count; i++)
+        ASSERT_EQ(1, seen[i]) << i;
+    }
+    crush_executor_destroy(e);
+  }
+  EXPECT_EQ(1, crush_executor_workers(NULL));
+}
+
+TEST(executor, concurrent_loops) {
+  crush_executor *e;
+  ASSERT_EQ(0, crush_executor_create(4, &e));
+  const __s64 count = 50000;
+  std::vector<std::atomic<int> > seen(count);
+  for (auto &s : seen)
+    s = 0;
+  std::vector<std::thread> callers;
+  for (int t = 0; t < 4; t++)
+    callers.push_back(std::thread([e, &seen] {
+      loop l;
+      l.seen = &seen;
+      l.chunks = 0;
+      l.bad = 0;
+      l.workers = 4;
+      l.grain = 64;
+      EXPECT_EQ(0, crush_parallel_for(e, count, l.grain, ::count, &l));
+      EXPECT_EQ(0, l.bad);
+    }));
+  for (auto &c : callers)
+    c.join();
+  for (__s64 i = 0; i < count; i++)
+    ASSERT_EQ(4, seen[i]);
+  crush_executor_destroy(e);
+}
+
+// a pool of the caller: runs the chunks in reverse order on "workers"
+// taken in turn
+static int reverse_for(crush_executor *executor, __s64 count, __s64 grain,
+                       crush_parallel_body body, void *arg) {
+  int *calls = static_cast<int *>(executor->arg);
+  if (grain <= 0)
+    grain = 1;
+  int worker = 0;
+  for (__s64 end = count; end > 0; end -= grain) {
+    body(arg, worker, end > grain ? end - grain : 0, end);
+    worker = (worker + 1) % executor->workers;
+  }
+  (*calls)++;
+  return 0;
+}
+
+TEST(executor, custom) {
+  crush_map *m = make_generated_map();
+  ASSERT_TRUE(m != NULL);
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  int calls = 0;
+  crush_executor custom = { reverse_for, 3, &calls };
+
+  const int count = 3000;
+  std::vector<int> expected(count * 3), results(count * 3);
+  ASSERT_EQ(0, crush_do_rule_parallel(m, CRUSH_GENERATOR_REPLICATED_RULE, NULL, 0, count,
+                                      &expected[0], 3, NULL, &weights[0], weights.size(),
+                                      NULL, NULL));
+  ASSERT_EQ(0, crush_do_rule_parallel(m, CRUSH_GENERATOR_REPLICATED_RULE, NULL, 0, count,
+                                      &results[0], 3, NULL, &weights[0], weights.size(),
+                                      NULL, &custom));
+  EXPECT_EQ(expected, results);
+  EXPECT_EQ(1, calls);
+
+  std::vector<__u32> reweighted(weights);
+  reweighted[3] = 0;
+  crush_diff_params params;
+  memset(&params, 0, sizeof(params));
+  params.ruleno = CRUSH_GENERATOR_REPLICATED_RULE;
+  params.result_max = 3;
+  params.old_weights = &weights[0];
+  params.old_weight_max = weights.size();
+  params.new_weights = &reweighted[0];
+  params.new_weight_max = reweighted.size();
+  params.pg_num = 1024;
+  crush_diff_result expected_diff, diff;
+  ASSERT_EQ(0, crush_diff(m, m, &params, &expected_diff, NULL, NULL));
+  params.executor = &custom;
+  ASSERT_EQ(0, crush_diff(m, m, &params, &diff, NULL, NULL));
+  EXPECT_EQ(expected_diff.moved, diff.moved);
+  EXPECT_EQ(expected_diff.replicas_moved, diff.replicas_moved);
+  EXPECT_EQ(2, calls);
+
+  std::vector<double> capacities(m->max_devices, 1e9);
+  crush_fill_params fill;
+  memset(&fill, 0, sizeof(fill));
+  fill.ruleno = CRUSH_GENERATOR_REPLICATED_RULE;
+  fill.result_max = 3;
+  fill.weights = &weights[0];
+  fill.weight_max = weights.size();
+  fill.pg_num = 256;
+  fill.capacities = &capacities[0];
+  fill.full_ratio = 0.9;
+  fill.max_objects = 100000;
+  fill.size.alg = CRUSH_SIZE_EXPONENTIAL;
+  fill.size.a = 4e6;
+  crush_fill_result expected_fill, filled;
+  ASSERT_EQ(0, crush_simulate_fill(m, &fill, &expected_fill, NULL));
+  fill.executor = &custom;
+  ASSERT_EQ(0, crush_simulate_fill(m, &fill, &filled, NULL));
+  EXPECT_EQ(expected_fill.device, filled.device);
+  EXPECT_EQ(expected_fill.objects, filled.objects);
+  EXPECT_EQ(expected_fill.bytes, filled.bytes);
+  EXPECT_LT(2, calls);
+
+  crush_destroy(m);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_executor && valgrind --tool=memcheck test/unittest_executor"
+// End:
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <vector>
+
+extern "C" {
+#include "crush/hash.h"
+#include "crush/builder.h"
+#include "crush/mapper.h"
+#include "crush/generator.h"
+}
+
+static int map(const crush_map *m, int ruleno, int x, int *result, int result_max,
+               const std::vector<__u32> &weights)
+{
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  return crush_do_rule(m, ruleno, x, result, result_max, &weights[0], weights.size(),
+                       &cwin[0], NULL);
+}
+
+TEST(generator, crush_generate) {
+  crush_generator g;
+  crush_generator_init(&g);
+  g.ec = 1;
+  EXPECT_EQ(1, crush_generator_count(&g, CRUSH_GENERATOR_ROOT));
+  EXPECT_EQ(4, crush_generator_count(&g, CRUSH_GENERATOR_RACK));
+  EXPECT_EQ(32, crush_generator_count(&g, CRUSH_GENERATOR_HOST));
+  EXPECT_EQ(256, crush_generator_count(&g, CRUSH_GENERATOR_OSD));
+  EXPECT_EQ(-EINVAL, crush_generator_count(&g, 2));
+
+  crush_map *m;
+  ASSERT_EQ(0, crush_generate(&g, &m));
+  EXPECT_EQ(256, m->max_devices);
+  EXPECT_EQ(1 + 1 + 1 + 4 + 32, m->max_buckets);
+  EXPECT_EQ(2u, m->max_rules);
+  crush_bucket *root = m->buckets[0];
+  EXPECT_EQ(-1, root->id);
+  EXPECT_EQ(CRUSH_GENERATOR_ROOT, root->type);
+  EXPECT_EQ(256u * 0x10000, root->weight);
+  // the hosts are after the racks and contain consecutive devices
+  crush_bucket *host = m->buckets[7];
+  EXPECT_EQ(CRUSH_GENERATOR_HOST, host->type);
+  EXPECT_EQ(CRUSH_BUCKET_STRAW2, host->alg);
+  for (__u32 i = 0; i < host->size; i++)
+    EXPECT_EQ((int)i, host->items[i]);
+  crush_bucket *rack = m->buckets[3];
+  EXPECT_EQ(CRUSH_GENERATOR_RACK, rack->type);
+  EXPECT_EQ(-8, rack->items[0]);
+
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  for (int x = 0; x < 100; x++) {
+    int result[3];
+    ASSERT_EQ(3, map(m, CRUSH_GENERATOR_REPLICATED_RULE, x, result, 3, weights));
+    std::set<int> hosts;
+    for (int i = 0; i < 3; i++)
+      hosts.insert(result[i] / g.devices);
+    EXPECT_EQ(3u, hosts.size());
+    int chunks[6];
+    ASSERT_EQ(6, map(m, CRUSH_GENERATOR_EC_RULE, x, chunks, 6, weights));
+    hosts.clear();
+    for (int i = 0; i < 6; i++) {
+      ASSERT_NE(CRUSH_ITEM_NONE, chunks[i]);
+      hosts.insert(chunks[i] / g.devices);
+    }
+    EXPECT_EQ(6u, hosts.size());
+  }
+  crush_destroy(m);
+}
+
+TEST(generator, levels) {
+  crush_generator g;
+  crush_generator_init(&g);
+  g.level_count = 2;
+  g.levels[0].type = CRUSH_GENERATOR_RACK;
+  g.levels[0].count = 3;
+  g.levels[0].alg = CRUSH_BUCKET_LIST;
+  g.levels[1].type = CRUSH_GENERATOR_HOST;
+  g.levels[1].count = 2;
+  g.levels[1].alg = CRUSH_BUCKET_TREE;
+  g.devices = 4;
+  g.device_weight = 0x20000;
+  g.weight_spread = 0.5;
+  g.seed = 7;
+  g.failure_domain = CRUSH_GENERATOR_RACK;
+
+  crush_map *m;
+  ASSERT_EQ(0, crush_generate(&g, &m));
+  EXPECT_EQ(24, m->max_devices);
+  EXPECT_EQ(CRUSH_BUCKET_LIST, m->buckets[1]->alg);
+  EXPECT_EQ(CRUSH_BUCKET_TREE, m->buckets[4]->alg);
+  crush_bucket_tree *host = (crush_bucket_tree *)m->buckets[4];
+  std::set<__u32> distinct;
+  for (__u32 i = 0; i < host->h.size; i++) {
+    __u32 weight = crush_get_bucket_item_weight(&host->h, i);
+    EXPECT_GE(weight, 0x10000u);
+    EXPECT_LE(weight, 0x30000u);
+    distinct.insert(weight);
+  }
+  EXPECT_LT(1u, distinct.size());
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  for (int x = 0; x < 100; x++) {
+    int result[3];
+    ASSERT_EQ(3, map(m, CRUSH_GENERATOR_REPLICATED_RULE, x, result, 3, weights));
+    std::set<int> racks;
+    for (int i = 0; i < 3; i++)
+      racks.insert(result[i] / 8);
+    EXPECT_EQ(3u, racks.size());
+  }
+  crush_destroy(m);
+
+  g.failure_domain = CRUSH_GENERATOR_DATACENTER;
+  EXPECT_EQ(-EINVAL, crush_generate(&g, &m));
+  g.failure_domain = CRUSH_GENERATOR_HOST;
+  g.levels[1].alg = 42;
+  EXPECT_EQ(-EINVAL, crush_generate(&g, &m));
+  g.levels[1].alg = CRUSH_BUCKET_STRAW2;
+  g.levels[1].count = 0;
+  EXPECT_EQ(-EINVAL, crush_generate(&g, &m));
+  g.levels[1].count = 1 << 20;
+  g.devices = 1 << 12;
+  EXPECT_EQ(-E2BIG, crush_generate(&g, &m));
+}
+
+TEST(generator, crush_generator_out) {
+  crush_generator g;
+  crush_generator_init(&g);
+  std::vector<__u32> weights(256);
+
+  EXPECT_EQ(-EINVAL, crush_generator_out(&g, CRUSH_GENERATOR_HOST, 0.1, 1, &weights[0], 255));
+  EXPECT_EQ(-EINVAL, crush_generator_out(&g, CRUSH_GENERATOR_HOST, 1.5, 1, &weights[0], 256));
+  EXPECT_EQ(-EINVAL, crush_generator_out(&g, 2, 0.1, 1, &weights[0], 256));
+
+  // 26 random devices
+  EXPECT_EQ(26, crush_generator_out(&g, CRUSH_GENERATOR_OSD, 0.1, 1, &weights[0], 256));
+  int out = 0;
+  for (__u32 weight : weights)
+    if (weight == 0)
+      out++;
+    else
+      EXPECT_EQ(0x10000u, weight);
+  EXPECT_EQ(26, out);
+
+  // 3 whole hosts out of 32
+  EXPECT_EQ(3 * 8, crush_generator_out(&g, CRUSH_GENERATOR_HOST, 0.1, 1, &weights[0], 256));
+  int hosts_out = 0;
+  for (int host = 0; host < 32; host++) {
+    int host_out = 0;
+    for (int i = 0; i < 8; i++)
+      if (weights[host * 8 + i] == 0)
+        host_out++;
+    EXPECT_TRUE(host_out == 0 || host_out == 8);
+    if (host_out)
+      hosts_out++;
+  }
+  EXPECT_EQ(3, hosts_out);
+
+  crush_map *m;
+  ASSERT_EQ(0, crush_generate(&g, &m));
+  for (int x = 0; x < 100; x++) {
+    int result[3];
+    ASSERT_EQ(3, map(m, CRUSH_GENERATOR_REPLICATED_RULE, x, result, 3, weights));
+    for (int i = 0; i < 3; i++)
+      EXPECT_NE(0u, weights[result[i]]);
+  }
+  crush_destroy(m);
+
+  // the same seed chooses the same buckets
+  std::vector<__u32> again(256);
+  EXPECT_EQ(3 * 8, crush_generator_out(&g, CRUSH_GENERATOR_HOST, 0.1, 1, &again[0], 256));
+  EXPECT_EQ(weights, again);
+  EXPECT_EQ(256, crush_generator_out(&g, CRUSH_GENERATOR_ROOT, 1, 1, &again[0], 256));
+}
+
+TEST(generator, large) {
+  crush_generator g;
+  crush_generator_init(&g);
+  // 4 rooms of 16 racks of 40 hosts of 24 devices
+  g.levels[1].count = 4;
+  g.levels[2].count = 16;
+  g.levels[3].count = 40;
+  g.devices = 24;
+  g.device_weight = 0x100;
+  crush_map *m;
+  ASSERT_EQ(0, crush_generate(&g, &m));
+  EXPECT_EQ(4 * 16 * 40 * 24, m->max_devices);
+  EXPECT_EQ((__u32)m->max_devices * 0x100, m->buckets[0]->weight);
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  int result[3];
+  EXPECT_EQ(3, map(m, CRUSH_GENERATOR_REPLICATED_RULE, 1, result, 3, weights));
+  crush_destroy(m);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_generator && valgrind --tool=memcheck test/unittest_generator"
+// End:
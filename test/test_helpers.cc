@@ -5,9 +5,12 @@
 extern "C" {
 #include "crush/hash.h"  
 #include "crush/builder.h"
+#include "crush/mapper.h"
 #include "crush/helpers.h"
 }
 
+#include <vector>
+
 TEST(helpers, crush_find_roots) {
   int *roots = NULL;
   struct crush_map *m = crush_create();
@@ -39,3 +42,166 @@ TEST(helpers, crush_find_roots) {
 
   crush_destroy(m);
 }
+
+TEST(helpers, crush_map_extract) {
+  const int host_type = 1;
+  const int root_type = 2;
+  crush_map *m = crush_create();
+  int roots[2];
+  int device = 0;
+  for (int r = 0; r < 2; r++) {
+    crush_bucket *root = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, root_type,
+                                           0, NULL, NULL);
+    ASSERT_EQ(0, crush_add_bucket(m, 0, root, &roots[r]));
+    for (int host = 0; host < 3; host++) {
+      int items[3];
+      int weights[3];
+      for (int i = 0; i < 3; i++) {
+        items[i] = device++;
+        weights[i] = 0x10000;
+      }
+      crush_bucket *b = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, host_type,
+                                          3, items, weights);
+      int id;
+      ASSERT_EQ(0, crush_add_bucket(m, 0, b, &id));
+      ASSERT_EQ(0, crush_bucket_add_item(m, root, id, b->weight));
+    }
+    crush_rule *rule = crush_make_rule(3, r, 0, 0, 0);
+    crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, roots[r], 0);
+    crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSELEAF_FIRSTN, 0, host_type);
+    crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+    ASSERT_EQ(r, crush_add_rule(m, rule, r));
+  }
+  crush_finalize(m);
+  crush_choose_arg *choose_args = crush_make_choose_args(m, 1);
+  choose_args[-1-roots[0]].weight_set[0].weights[1] = 0x20000;
+
+  crush_map *extracted = NULL;
+  crush_choose_arg *extracted_args = NULL;
+  int rules[] = { 5 };
+  ASSERT_EQ(-EINVAL, crush_map_extract(m, choose_args, rules, 1, &extracted, &extracted_args));
+  rules[0] = 0;
+  ASSERT_EQ(0, crush_map_extract(m, choose_args, rules, 1, &extracted, &extracted_args));
+
+  // the buckets of the second root are not copied and ids are preserved
+  EXPECT_EQ(1u, extracted->max_rules);
+  EXPECT_EQ(4, extracted->max_buckets);
+  for (int pos = 0; pos < extracted->max_buckets; pos++) {
+    ASSERT_TRUE(extracted->buckets[pos] != NULL);
+    EXPECT_EQ(m->buckets[pos]->id, extracted->buckets[pos]->id);
+  }
+  EXPECT_LT(extracted->working_size, m->working_size);
+  EXPECT_EQ(9, extracted->max_devices);
+  EXPECT_EQ(0x20000u, extracted_args[-1-roots[0]].weight_set[0].weights[1]);
+
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  std::vector<char> cwin(crush_work_size(m, 3)), extracted_cwin(crush_work_size(extracted, 3));
+  crush_init_workspace(m, &cwin[0]);
+  crush_init_workspace(extracted, &extracted_cwin[0]);
+  for (int x = 0; x < 1000; x++) {
+    int result[3], extracted_result[3];
+    int len = crush_do_rule(m, 0, x, result, 3, &weights[0], weights.size(),
+                            &cwin[0], choose_args);
+    int extracted_len = crush_do_rule(extracted, 0, x, extracted_result, 3, &weights[0],
+                                      extracted->max_devices, &extracted_cwin[0], extracted_args);
+    ASSERT_EQ(len, extracted_len);
+    for (int i = 0; i < len; i++)
+      ASSERT_EQ(result[i], extracted_result[i]);
+  }
+
+  crush_destroy_choose_args(extracted_args);
+  crush_destroy(extracted);
+  crush_destroy_choose_args(choose_args);
+  crush_destroy(m);
+}
+
+TEST(helpers, crush_map_memory_report) {
+  crush_map *m = crush_create();
+  const int size = 3;
+  crush_bucket *root = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, 2,
+                                         0, NULL, NULL);
+  int rootno;
+  ASSERT_EQ(0, crush_add_bucket(m, 0, root, &rootno));
+  const int algs[] = {
+    CRUSH_BUCKET_LIST,
+    CRUSH_BUCKET_TREE,
+    CRUSH_BUCKET_STRAW,
+    CRUSH_BUCKET_STRAW2,
+  };
+  int device = 0;
+  for (int alg : algs) {
+    int items[size];
+    int weights[size];
+    for (int i = 0; i < size; i++) {
+      items[i] = device++;
+      weights[i] = 0x10000;
+    }
+    crush_bucket *b = crush_make_bucket(m, alg, CRUSH_HASH_DEFAULT, 1, size, items, weights);
+    int id;
+    ASSERT_EQ(0, crush_add_bucket(m, 0, b, &id));
+    ASSERT_EQ(0, crush_bucket_add_item(m, root, id, b->weight));
+  }
+  // a bucket no rule can reach
+  int items[size];
+  int weights[size];
+  for (int i = 0; i < size; i++) {
+    items[i] = device++;
+    weights[i] = 0x10000;
+  }
+  crush_bucket *orphan = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, 1,
+                                           size, items, weights);
+  int orphanno;
+  ASSERT_EQ(0, crush_add_bucket(m, 0, orphan, &orphanno));
+  crush_rule *rule = crush_make_rule(3, 0, 0, 0, 0);
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootno, 0);
+  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSELEAF_FIRSTN, 0, 1);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+  ASSERT_EQ(0, crush_add_rule(m, rule, 0));
+  crush_finalize(m);
+
+  crush_memory_report report;
+  ASSERT_EQ(0, crush_map_memory_report(m, NULL, &report));
+  const size_t u32 = sizeof(__u32);
+  EXPECT_EQ(sizeof(crush_map) + m->max_buckets * sizeof(crush_bucket *) +
+            m->max_rules * sizeof(crush_rule *), report.map);
+  EXPECT_EQ(sizeof(crush_bucket_list) + sizeof(crush_bucket_tree) +
+            sizeof(crush_bucket_straw) + 3 * sizeof(crush_bucket_straw2), report.bucket_headers);
+  // the root, the hosts and the orphan
+  EXPECT_EQ(u32 * (4 + 4 * size + size), report.items);
+  // list, straw and straw2 buckets
+  EXPECT_EQ(u32 * (size + size + 4 + 2 * size), report.weights);
+  EXPECT_EQ(u32 * size, report.auxiliary[CRUSH_BUCKET_LIST]);
+  crush_bucket_tree *tree = (crush_bucket_tree *)m->buckets[2];
+  EXPECT_EQ(u32 * tree->num_nodes, report.auxiliary[CRUSH_BUCKET_TREE]);
+  EXPECT_EQ(u32 * size, report.auxiliary[CRUSH_BUCKET_STRAW]);
+  EXPECT_EQ(0u, report.auxiliary[CRUSH_BUCKET_STRAW2]);
+  EXPECT_EQ(crush_rule_size(3), report.rules);
+  EXPECT_EQ(0u, report.choose_args);
+  EXPECT_EQ((size_t)m->working_size, report.working_size);
+  EXPECT_EQ(sizeof(crush_bucket_straw2) + 2 * u32 * size +
+            sizeof(crush_work_bucket) + u32 * size, report.unreachable_savings);
+  EXPECT_EQ(u32 * size + u32 * tree->num_nodes + u32 * size +
+            sizeof(crush_bucket_list) + sizeof(crush_bucket_tree) + sizeof(crush_bucket_straw) -
+            3 * sizeof(crush_bucket_straw2) - u32 * size, report.straw2_savings);
+  crush_destroy(m);
+
+  // choose_args of a map with straw2 buckets only
+  m = crush_create();
+  crush_bucket *b = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, 1,
+                                      size, items, weights);
+  int id;
+  ASSERT_EQ(0, crush_add_bucket(m, 0, b, &id));
+  crush_finalize(m);
+  crush_choose_arg *choose_args = crush_make_choose_args(m, 2);
+  ASSERT_EQ(0, crush_map_memory_report(m, choose_args, &report));
+  EXPECT_EQ(m->max_buckets * sizeof(crush_choose_arg) + 2 * sizeof(crush_weight_set) + 2 * u32 * size +
+            u32 * size, report.choose_args);
+  // the ids and the second position are the same as the bucket
+  EXPECT_EQ(u32 * size + sizeof(crush_weight_set) + u32 * size, report.choose_args_savings);
+  choose_args[0].weight_set[1].weights[0] = 0;
+  choose_args[0].ids[0] = 100;
+  ASSERT_EQ(0, crush_map_memory_report(m, choose_args, &report));
+  EXPECT_EQ(0u, report.choose_args_savings);
+  crush_destroy_choose_args(choose_args);
+  crush_destroy(m);
+}
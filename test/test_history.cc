@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/history.h"
+}
+
+#include "test_map.h"
+
+static std::vector<int> make_table(crush_map *m, int size, int width,
+                                   const std::vector<__u32> &weights)
+{
+  std::vector<int> table(size * width, CRUSH_ITEM_NONE);
+  std::vector<char> cwin(crush_work_size(m, width));
+  crush_init_workspace(m, &cwin[0]);
+  for (int x = 0; x < size; x++)
+    crush_do_rule(m, 0, x, &table[x * width], width, &weights[0], weights.size(),
+                  &cwin[0], NULL);
+  return table;
+}
+
+TEST(history, crush_table_diff) {
+  int before[] = { 1, 2, 3, 4, 5, 6 };
+  int after[] = { 1, 2, 4, 3, 5, 6 };
+  int changed[3];
+  EXPECT_EQ(1, crush_table_diff(3, 2, before, after, changed));
+  EXPECT_EQ(1, changed[0]);
+  EXPECT_EQ(0, crush_table_diff(3, 2, before, before, changed));
+}
+
+TEST(history, lookup) {
+  const int devices = 20;
+  const int size = 1000;
+  const int width = 3;
+  crush_map *m = make_test_map(0, devices);
+  ASSERT_TRUE(m != NULL);
+  std::vector<__u32> weights(devices, 0x10000);
+  std::vector< std::vector<int> > tables;
+  std::vector<__u32> epochs;
+
+  // epoch 10, 12, 14... one more device out at each epoch
+  tables.push_back(make_table(m, size, width, weights));
+  epochs.push_back(10);
+  struct crush_history_writer *w = crush_history_create(size, width, epochs[0], &tables[0][0]);
+  ASSERT_TRUE(w != NULL);
+  for (int e = 1; e < 5; e++) {
+    weights[e] = 0;
+    tables.push_back(make_table(m, size, width, weights));
+    epochs.push_back(10 + 2 * e);
+    ASSERT_EQ(0, crush_history_add(w, epochs[e], &tables[e][0]));
+  }
+  EXPECT_EQ(-EINVAL, crush_history_add(w, epochs.back(), &tables.back()[0]));
+  void *buffer;
+  size_t length;
+  ASSERT_EQ(0, crush_history_serialize(w, &buffer, &length));
+  crush_history_writer_destroy(w);
+  // the deltas are much smaller than the tables
+  EXPECT_GT(sizeof(int) * size * width * 2, length);
+
+  char path[] = "/tmp/test_history.XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_LE(0, fd);
+  ASSERT_EQ((ssize_t)length, write(fd, buffer, length));
+  close(fd);
+
+  struct crush_history *h;
+  ASSERT_EQ(0, crush_history_map(path, &h));
+  unlink(path);
+  int h_size, h_width, h_epochs;
+  crush_history_info(h, &h_size, &h_width, &h_epochs);
+  EXPECT_EQ(size, h_size);
+  EXPECT_EQ(width, h_width);
+  EXPECT_EQ(5, h_epochs);
+
+  int result[width];
+  EXPECT_EQ(-ENOENT, crush_history_lookup(h, 9, 0, result));
+  EXPECT_EQ(-EINVAL, crush_history_lookup(h, 10, size, result));
+  for (int e = 0; e < 5; e++) {
+    for (__u32 epoch = epochs[e]; epoch < epochs[e] + 2; epoch++) {
+      for (int x = 0; x < size; x++) {
+        ASSERT_EQ(width, crush_history_lookup(h, epoch, x, result));
+        for (int i = 0; i < width; i++)
+          ASSERT_EQ(tables[e][x * width + i], result[i]) << "x " << x << " epoch " << epoch;
+      }
+    }
+  }
+
+  std::vector<int> changed(size), expected(size);
+  for (int from = 0; from < 5; from++) {
+    for (int to = from; to < 5; to++) {
+      int count = crush_table_diff(size, width, &tables[from][0], &tables[to][0], &expected[0]);
+      ASSERT_EQ(count, crush_history_changed(h, epochs[from], epochs[to] + 1, &changed[0]));
+      for (int i = 0; i < count; i++)
+        EXPECT_EQ(expected[i], changed[i]);
+    }
+  }
+  EXPECT_EQ(-ENOENT, crush_history_changed(h, 0, 10, &changed[0]));
+  crush_history_close(h);
+
+  // a truncated history is rejected
+  EXPECT_EQ(-EINVAL, crush_history_open(buffer, length / 2, &h));
+  ((unsigned char*)buffer)[0]++;
+  EXPECT_EQ(-EINVAL, crush_history_open(buffer, length, &h));
+  free(buffer);
+  crush_destroy(m);
+}
+
+TEST(history, snapshots) {
+  const int size = 200;
+  const int width = 2;
+  const int count = 150;
+  std::vector< std::vector<int> > tables;
+
+  // each epoch changes a single row
+  tables.push_back(std::vector<int>(size * width));
+  for (int i = 0; i < size * width; i++)
+    tables[0][i] = i;
+  struct crush_history_writer *w = crush_history_create(size, width, 0, &tables[0][0]);
+  ASSERT_TRUE(w != NULL);
+  for (int e = 1; e < count; e++) {
+    tables.push_back(tables.back());
+    tables[e][(e * 7 % size) * width] = -e;
+    ASSERT_EQ(0, crush_history_add(w, e, &tables[e][0]));
+  }
+  void *buffer;
+  size_t length;
+  ASSERT_EQ(0, crush_history_serialize(w, &buffer, &length));
+  crush_history_writer_destroy(w);
+
+  // the epochs 64 and 128 have all the rows, the others one
+  const unsigned char *directory = (const unsigned char *)buffer + 5 * 4;
+  for (int e = 0; e < count; e++) {
+    __u32 rows;
+    memcpy(&rows, directory + 24 * e + 4, sizeof(rows));
+    EXPECT_EQ(e % 64 == 0 ? (__u32)size : 1u, rows) << "epoch " << e;
+  }
+
+  struct crush_history *h;
+  ASSERT_EQ(0, crush_history_open(buffer, length, &h));
+  int result[width];
+  for (int e = 0; e < count; e++)
+    for (int x = 0; x < size; x++) {
+      ASSERT_EQ(width, crush_history_lookup(h, e, x, result));
+      for (int i = 0; i < width; i++)
+        ASSERT_EQ(tables[e][x * width + i], result[i]) << "x " << x << " epoch " << e;
+    }
+  std::vector<int> changed(size), expected(size);
+  const int ranges[][2] = { { 60, 70 }, { 0, 149 }, { 64, 65 }, { 127, 129 } };
+  for (auto &r : ranges) {
+    int n = crush_table_diff(size, width, &tables[r[0]][0], &tables[r[1]][0], &expected[0]);
+    ASSERT_EQ(n, crush_history_changed(h, r[0], r[1], &changed[0]));
+    for (int i = 0; i < n; i++)
+      EXPECT_EQ(expected[i], changed[i]);
+  }
+  crush_history_close(h);
+  free(buffer);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_history && valgrind --tool=memcheck test/unittest_history"
+// End:
@@ -0,0 +1,109 @@
+#include <errno.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/hash.h"
+#include "crush/builder.h"
+#include "crush/mapper.h"
+#include "crush/latency.h"
+}
+
+TEST(latency, quantile) {
+  crush_latency *latency = crush_latency_create(2, 0);
+  ASSERT_TRUE(latency != NULL);
+  EXPECT_EQ(-ENOENT, crush_latency_quantile(latency, 0, 0.5));
+  EXPECT_EQ(-EINVAL, crush_latency_quantile(latency, 2, 0.5));
+  EXPECT_EQ(-EINVAL, crush_latency_quantile(latency, 0, 1.5));
+
+  // small values are exact
+  for (int ns = 0; ns < 8; ns++)
+    crush_latency_record(latency, 1, ns);
+  EXPECT_EQ(0, crush_latency_quantile(latency, 1, 0));
+  EXPECT_EQ(3, crush_latency_quantile(latency, 1, 0.5));
+  EXPECT_EQ(7, crush_latency_quantile(latency, 1, 1));
+
+  for (int ns = 1; ns <= 10000; ns++)
+    crush_latency_record(latency, 0, ns * 1000);
+  crush_latency_record(latency, 2, 1000); // ignored
+  EXPECT_EQ(10000u, crush_latency_count(latency, 0));
+  const double quantiles[] = { 0.5, 0.99, 0.999 };
+  for (double q : quantiles) {
+    double expected = q * 10000 * 1000;
+    double value = crush_latency_quantile(latency, 0, q);
+    EXPECT_GE(value, expected) << q;
+    EXPECT_LE(value, expected * 1.125) << q;
+  }
+
+  crush_latency_reset(latency);
+  EXPECT_EQ(0u, crush_latency_count(latency, 0));
+  crush_latency_destroy(latency);
+}
+
+TEST(latency, merge) {
+  crush_latency *a = crush_latency_create(1, 0);
+  crush_latency *b = crush_latency_create(1, 0);
+  crush_latency *c = crush_latency_create(2, 0);
+  for (int i = 0; i < 100; i++) {
+    crush_latency_record(a, 0, 1000);
+    crush_latency_record(b, 0, 100000);
+  }
+  EXPECT_EQ(-EINVAL, crush_latency_merge(c, a));
+  ASSERT_EQ(0, crush_latency_merge(a, b));
+  EXPECT_EQ(200u, crush_latency_count(a, 0));
+  EXPECT_EQ(100u, crush_latency_count(b, 0));
+  EXPECT_LE(crush_latency_quantile(a, 0, 0.5), 1000 * 1.125);
+  EXPECT_GE(crush_latency_quantile(a, 0, 0.51), 100000);
+  crush_latency_destroy(a);
+  crush_latency_destroy(b);
+  crush_latency_destroy(c);
+}
+
+TEST(latency, do_rule) {
+  crush_map *m = crush_create();
+  const int size = 10;
+  int items[size];
+  int weights[size];
+  for (int i = 0; i < size; i++) {
+    items[i] = i;
+    weights[i] = 0x10000;
+  }
+  crush_bucket *root = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT, 1,
+                                         size, items, weights);
+  int rootno;
+  crush_add_bucket(m, 0, root, &rootno);
+  crush_rule *rule = crush_make_rule(3, 0, 0, 0, 0);
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, rootno, 0);
+  crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 0, 0);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+  crush_add_rule(m, rule, 0);
+  crush_finalize(m);
+
+  const int result_max = 3;
+  std::vector<__u32> device_weights(m->max_devices, 0x10000);
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  crush_latency *latency = crush_latency_create(m->max_rules, CRUSH_LATENCY_SAMPLE_SHIFT);
+  const int values = 64 * 10;
+  for (int x = 0; x < values; x++) {
+    int expected[result_max], result[result_max];
+    int expected_len = crush_do_rule(m, 0, x, expected, result_max, &device_weights[0],
+                                     device_weights.size(), &cwin[0], NULL);
+    int len = crush_latency_do_rule(latency, m, 0, x, result, result_max, &device_weights[0],
+                                    device_weights.size(), &cwin[0], NULL);
+    ASSERT_EQ(expected_len, len);
+    for (int i = 0; i < len; i++)
+      ASSERT_EQ(expected[i], result[i]);
+  }
+  EXPECT_EQ((__u64)(values >> CRUSH_LATENCY_SAMPLE_SHIFT), crush_latency_count(latency, 0));
+  EXPECT_GT(crush_latency_quantile(latency, 0, 0.5), 0);
+
+  crush_latency_destroy(latency);
+  crush_destroy(m);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_latency && valgrind --tool=memcheck test/unittest_latency"
+// End:
@@ -0,0 +1,523 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "crush/builder.h"
+#include "crush/hash.h"
+#include "crush/mapper.h"
+#include "crush/load.h"
+}
+
+static const char *text_map =
+  "# begin crush map\n"
+  "tunable choose_total_tries 50\n"
+  "\n"
+  "device 0 osd.0 class hdd\n"
+  "device 1 osd.1 class hdd\n"
+  "device 2 osd.2\n"
+  "device 3 osd.3\n"
+  "device 4 osd.4\n"
+  "\n"
+  "type 0 osd\n"
+  "type 1 host\n"
+  "type 11 root\n"
+  "\n"
+  "host host0 {\n"
+  "\tid -2\t\t# do not change unnecessarily\n"
+  "\tid -5 class hdd\n"
+  "\t# weight 2.000\n"
+  "\talg straw2\n"
+  "\thash 0\t# rjenkins1\n"
+  "\titem osd.0 weight 1.000\n"
+  "\titem osd.1 weight 1.000\n"
+  "}\n"
+  "host host1 {\n"
+  "\tid -3\n"
+  "\talg list\n"
+  "\thash 0\n"
+  "\titem osd.3 weight 0.500 pos 1\n"
+  "\titem osd.2 weight 2.000 pos 0\n"
+  "}\n"
+  "host host2 {\n"
+  "\tid -4\n"
+  "\talg uniform\n"
+  "\thash 0\n"
+  "\titem osd.4 weight 3.000\n"
+  "}\n"
+  "root default {\n"
+  "\tid -1\n"
+  "\talg straw2\n"
+  "\thash 0\n"
+  "\titem host0 weight 2.000\n"
+  "\titem host1\n"
+  "\titem host2 weight 3.000\n"
+  "}\n"
+  "\n"
+  "rule replicated_rule {\n"
+  "\tid 0\n"
+  "\ttype replicated\n"
+  "\tmin_size 1\n"
+  "\tmax_size 10\n"
+  "\tstep take default\n"
+  "\tstep chooseleaf firstn 0 type host\n"
+  "\tstep emit\n"
+  "}\n"
+  "rule ec {\n"
+  "\tid 1\n"
+  "\ttype erasure\n"
+  "\tmin_size 3\n"
+  "\tmax_size 3\n"
+  "\tstep set_chooseleaf_tries 5\n"
+  "\tstep take default\n"
+  "\tstep choose indep 0 type osd\n"
+  "\tstep emit\n"
+  "}\n"
+  "\n"
+  "choose_args 1 {\n"
+  "  {\n"
+  "    bucket_id -1\n"
+  "    weight_set [\n"
+  "      [ 2.000 2.500 3.000 ]\n"
+  "    ]\n"
+  "  }\n"
+  "}\n"
+  "# end crush map\n";
+
+// the map of text_map, with the builder
+static crush_map *build_map() {
+  crush_map *m = crush_create();
+  m->choose_total_tries = 50;
+
+  int id;
+  int host0_items[] = { 0, 1 };
+  int host0_weights[] = { 0x10000, 0x10000 };
+  crush_bucket *host0 = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_RJENKINS1, 1,
+                                          2, host0_items, host0_weights);
+  EXPECT_EQ(0, crush_add_bucket(m, -2, host0, &id));
+  int host1_items[] = { 2, 3 };
+  int host1_weights[] = { 0x20000, 0x8000 };
+  crush_bucket *host1 = crush_make_bucket(m, CRUSH_BUCKET_LIST, CRUSH_HASH_RJENKINS1, 1,
+                                          2, host1_items, host1_weights);
+  EXPECT_EQ(0, crush_add_bucket(m, -3, host1, &id));
+  int host2_items[] = { 4 };
+  crush_bucket *host2 = (crush_bucket *)crush_make_uniform_bucket(CRUSH_HASH_RJENKINS1, 1,
+                                                                  1, host2_items, 0x30000);
+  EXPECT_EQ(0, crush_add_bucket(m, -4, host2, &id));
+  int root_items[] = { -2, -3, -4 };
+  int root_weights[] = { 0x20000, (int)host1->weight, 0x30000 };
+  crush_bucket *root = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_RJENKINS1, 11,
+                                         3, root_items, root_weights);
+  EXPECT_EQ(0, crush_add_bucket(m, -1, root, &id));
+
+  crush_rule *replicated = crush_make_rule(3, 0, 1, 1, 10);
+  crush_rule_set_step(replicated, 0, CRUSH_RULE_TAKE, -1, 0);
+  crush_rule_set_step(replicated, 1, CRUSH_RULE_CHOOSELEAF_FIRSTN, 0, 1);
+  crush_rule_set_step(replicated, 2, CRUSH_RULE_EMIT, 0, 0);
+  EXPECT_EQ(0, crush_add_rule(m, replicated, 0));
+  crush_rule *ec = crush_make_rule(4, 1, 3, 3, 3);
+  crush_rule_set_step(ec, 0, CRUSH_RULE_SET_CHOOSELEAF_TRIES, 5, 0);
+  crush_rule_set_step(ec, 1, CRUSH_RULE_TAKE, -1, 0);
+  crush_rule_set_step(ec, 2, CRUSH_RULE_CHOOSE_INDEP, 0, 0);
+  crush_rule_set_step(ec, 3, CRUSH_RULE_EMIT, 0, 0);
+  EXPECT_EQ(1, crush_add_rule(m, ec, 1));
+  crush_finalize(m);
+  return m;
+}
+
+static void expect_same_mappings(const crush_map *a, const crush_map *b) {
+  ASSERT_EQ(a->max_devices, b->max_devices);
+  ASSERT_EQ(a->max_rules, b->max_rules);
+  std::vector<__u32> weights(a->max_devices, 0x10000);
+  std::vector<char> cwin_a(crush_work_size(a, 3));
+  std::vector<char> cwin_b(crush_work_size(b, 3));
+  crush_init_workspace(a, &cwin_a[0]);
+  crush_init_workspace(b, &cwin_b[0]);
+  for (__u32 ruleno = 0; ruleno < a->max_rules; ruleno++) {
+    for (int x = 0; x < 1000; x++) {
+      int result_a[3], result_b[3];
+      int len_a = crush_do_rule(a, ruleno, x, result_a, 3, &weights[0], weights.size(),
+                                &cwin_a[0], NULL);
+      int len_b = crush_do_rule(b, ruleno, x, result_b, 3, &weights[0], weights.size(),
+                                &cwin_b[0], NULL);
+      ASSERT_EQ(len_a, len_b);
+      for (int i = 0; i < len_a; i++)
+        ASSERT_EQ(result_a[i], result_b[i]) << "rule " << ruleno << " x " << x;
+    }
+  }
+}
+
+// the binary encoding of Ceph, to test the decoder
+class encoder {
+public:
+  void u8(__u8 v) { buffer.push_back(v); }
+  void u16(__u16 v) { u8(v & 0xff); u8(v >> 8); }
+  void u32(__u32 v) { u16(v & 0xffff); u16(v >> 16); }
+
+  void names(int count) {
+    u32(count);
+    for (int i = 0; i < count; i++) {
+      u32(i);
+      u32(4);
+      for (int j = 0; j < 4; j++)
+        u8('a' + j);
+    }
+  }
+
+  void map(const crush_map *m, bool tunables) {
+    u32(CRUSH_MAGIC);
+    u32(m->max_buckets);
+    u32(m->max_rules);
+    u32(m->max_devices);
+    for (int i = 0; i < m->max_buckets; i++)
+      bucket(m->buckets[i]);
+    for (__u32 i = 0; i < m->max_rules; i++)
+      rule(m->rules[i]);
+    names(2);
+    names(m->max_devices);
+    names(0);
+    if (tunables) {
+      u32(m->choose_local_tries);
+      u32(m->choose_local_fallback_tries);
+      u32(m->choose_total_tries);
+      u32(m->chooseleaf_descend_once);
+      u8(m->chooseleaf_vary_r);
+      u8(m->straw_calc_version);
+      u32(m->allowed_bucket_algs);
+      u8(m->chooseleaf_stable);
+    }
+  }
+
+  void bucket(const crush_bucket *b) {
+    if (b == NULL) {
+      u32(0);
+      return;
+    }
+    u32(b->alg);
+    u32(b->id);
+    u16(b->type);
+    u8(b->alg);
+    u8(b->hash);
+    u32(b->weight);
+    u32(b->size);
+    for (__u32 j = 0; j < b->size; j++)
+      u32(b->items[j]);
+    switch (b->alg) {
+    case CRUSH_BUCKET_UNIFORM:
+      u32(((const crush_bucket_uniform *)b)->item_weight);
+      break;
+    case CRUSH_BUCKET_LIST:
+      for (__u32 j = 0; j < b->size; j++) {
+        u32(((const crush_bucket_list *)b)->item_weights[j]);
+        u32(((const crush_bucket_list *)b)->sum_weights[j]);
+      }
+      break;
+    case CRUSH_BUCKET_TREE: {
+      const crush_bucket_tree *tree = (const crush_bucket_tree *)b;
+      u8(tree->num_nodes);
+      for (int j = 0; j < tree->num_nodes; j++)
+        u32(tree->node_weights[j]);
+      break;
+    }
+    case CRUSH_BUCKET_STRAW:
+      for (__u32 j = 0; j < b->size; j++) {
+        u32(((const crush_bucket_straw *)b)->item_weights[j]);
+        u32(((const crush_bucket_straw *)b)->straws[j]);
+      }
+      break;
+    case CRUSH_BUCKET_STRAW2:
+      for (__u32 j = 0; j < b->size; j++)
+        u32(((const crush_bucket_straw2 *)b)->item_weights[j]);
+      break;
+    }
+  }
+
+  void rule(const crush_rule *r) {
+    if (r == NULL) {
+      u32(0);
+      return;
+    }
+    u32(1);
+    u32(r->len);
+    u8(r->mask.ruleset);
+    u8(r->mask.type);
+    u8(r->mask.min_size);
+    u8(r->mask.max_size);
+    for (__u32 j = 0; j < r->len; j++) {
+      u32(r->steps[j].op);
+      u32(r->steps[j].arg1);
+      u32(r->steps[j].arg2);
+    }
+  }
+
+  std::vector<unsigned char> buffer;
+};
+
+// a map with a bucket of each algorithm
+static crush_map *build_all_algs() {
+  crush_map *m = crush_create();
+  std::vector<int> hosts;
+  int device = 0;
+  for (int alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++) {
+    int items[3], weights[3];
+    for (int i = 0; i < 3; i++) {
+      items[i] = device++;
+      weights[i] = alg == CRUSH_BUCKET_UNIFORM ? 0x10000 : 0x10000 * (i + 1);
+    }
+    crush_bucket *b = crush_make_bucket(m, alg, CRUSH_HASH_RJENKINS1, 1, 3, items, weights);
+    int id;
+    EXPECT_EQ(0, crush_add_bucket(m, 0, b, &id));
+    hosts.push_back(id);
+  }
+  std::vector<int> weights;
+  for (size_t i = 0; i < hosts.size(); i++)
+    weights.push_back(m->buckets[-1 - hosts[i]]->weight);
+  crush_bucket *root = crush_make_bucket(m, CRUSH_BUCKET_STRAW, CRUSH_HASH_RJENKINS1, 2,
+                                         hosts.size(), &hosts[0], &weights[0]);
+  int root_id;
+  EXPECT_EQ(0, crush_add_bucket(m, 0, root, &root_id));
+  crush_rule *r = crush_make_rule(3, 0, 1, 1, 10);
+  crush_rule_set_step(r, 0, CRUSH_RULE_TAKE, root_id, 0);
+  crush_rule_set_step(r, 1, CRUSH_RULE_CHOOSELEAF_FIRSTN, 0, 1);
+  crush_rule_set_step(r, 2, CRUSH_RULE_EMIT, 0, 0);
+  EXPECT_EQ(0, crush_add_rule(m, r, 0));
+  crush_finalize(m);
+  return m;
+}
+
+TEST(load, text) {
+  crush_map *expected = build_map();
+  crush_map *m;
+  int line = 0;
+  ASSERT_EQ(0, crush_load_text(text_map, strlen(text_map), &m, &line));
+  EXPECT_EQ(0, line);
+  EXPECT_EQ(5, m->max_devices);
+  EXPECT_TRUE(m->buckets[-1 - -4] != NULL);
+  EXPECT_EQ(50u, m->choose_total_tries);
+  // the pos of the items
+  EXPECT_EQ(2, m->buckets[-1 - -3]->items[0]);
+  EXPECT_EQ(3, m->buckets[-1 - -3]->items[1]);
+  // the weight of host1 is its own
+  EXPECT_EQ(0x28000, (int)crush_get_bucket_item_weight(m->buckets[0], 1));
+  EXPECT_EQ(3, m->rules[1]->mask.type);
+  EXPECT_EQ(crush_map_fingerprint(expected), crush_map_fingerprint(m));
+  expect_same_mappings(expected, m);
+  crush_destroy(m);
+  crush_destroy(expected);
+}
+
+TEST(load, text_errors) {
+  static const struct {
+    const char *text;
+    int line;
+  } cases[] = {
+    // an unknown item
+    { "device 0 osd.0\ntype 0 osd\ntype 1 host\nhost h {\n\titem osd.1\n}\n", 5 },
+    // an unknown type
+    { "device 0 osd.0\ntype 0 osd\nrack r {\n\titem osd.0\n}\n", 3 },
+    // a duplicate device
+    { "device 0 osd.0\ndevice 1 osd.0\n", 2 },
+    // a take with a device class
+    { "device 0 osd.0\ntype 0 osd\ntype 1 host\nhost h {\n\titem osd.0\n}\n"
+      "rule r {\n\tstep take h class hdd\n\tstep emit\n}\n", 8 },
+    // an unknown type in a step
+    { "device 0 osd.0\ntype 0 osd\ntype 1 host\nhost h {\n\titem osd.0\n}\n"
+      "rule r {\n\tstep take h\n\tstep chooseleaf firstn 0 type rack\n\tstep emit\n}\n", 9 },
+    // two rules with the same id
+    { "rule a {\n\tid 0\n}\nrule b {\n\tid 0\n}\n", 6 },
+    // an unknown tunable
+    { "\n\ntunable choose_nothing 1\n", 3 },
+    // a negative weight
+    { "device 0 osd.0\ntype 0 osd\ntype 1 host\nhost h {\n\titem osd.0 weight -1\n}\n", 5 },
+    // an unknown algorithm
+    { "type 1 host\nhost h {\n\talg straw3\n}\n", 3 },
+    // a missing }
+    { "type 1 host\nhost h {\n\talg straw2\n", 3 },
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    crush_map *m;
+    int line = 0;
+    EXPECT_EQ(-EINVAL, crush_load_text(cases[i].text, strlen(cases[i].text), &m, &line))
+      << cases[i].text;
+    EXPECT_EQ(cases[i].line, line) << cases[i].text;
+  }
+}
+
+TEST(load, text_large_bucket) {
+  std::string head = "device 0 osd.0\ntype 0 osd\ntype 1 host\nhost h {\n";
+  std::string text = head;
+  for (int i = 0; i < (1 << 20) + 1; i++)
+    text += "\titem osd.0\n";
+  text += "}\n";
+  crush_map *m;
+  int line = 0;
+  EXPECT_EQ(-EINVAL, crush_load_text(text.c_str(), text.size(), &m, &line));
+  EXPECT_EQ(5 + (1 << 20), line);
+
+  // a tree has at most 64 items
+  text = head + "\talg tree\n";
+  for (int i = 0; i < 64; i++)
+    text += "\titem osd.0\n";
+  ASSERT_EQ(0, crush_load_text((text + "}\n").c_str(), text.size() + 2, &m, &line));
+  EXPECT_EQ(64u, m->buckets[0]->size);
+  crush_destroy(m);
+  text += "\titem osd.0\n}\n";
+  EXPECT_EQ(-EINVAL, crush_load_text(text.c_str(), text.size(), &m, &line));
+}
+
+TEST(load, binary) {
+  crush_map *expected = build_all_algs();
+  encoder e;
+  e.map(expected, true);
+  crush_map *m;
+  ASSERT_EQ(0, crush_load_binary(&e.buffer[0], e.buffer.size(), &m));
+  EXPECT_EQ(crush_map_fingerprint(expected), crush_map_fingerprint(m));
+  for (int alg = CRUSH_BUCKET_UNIFORM; alg <= CRUSH_BUCKET_STRAW2; alg++)
+    EXPECT_EQ(alg, m->buckets[alg - 1]->alg);
+  expect_same_mappings(expected, m);
+  crush_destroy(m);
+
+  // crush_load() recognizes the encoding
+  ASSERT_EQ(0, crush_load(&e.buffer[0], e.buffer.size(), &m, NULL));
+  EXPECT_EQ(crush_map_fingerprint(expected), crush_map_fingerprint(m));
+  crush_destroy(m);
+  crush_destroy(expected);
+}
+
+TEST(load, binary_legacy) {
+  crush_map *expected = build_all_algs();
+  encoder e;
+  e.map(expected, false);
+  crush_map *m;
+  ASSERT_EQ(0, crush_load_binary(&e.buffer[0], e.buffer.size(), &m));
+  EXPECT_EQ(2u, m->choose_local_tries);
+  EXPECT_EQ(5u, m->choose_local_fallback_tries);
+  EXPECT_EQ(19u, m->choose_total_tries);
+  EXPECT_EQ(0u, m->chooseleaf_descend_once);
+  EXPECT_EQ(0, m->chooseleaf_vary_r);
+  EXPECT_EQ(0, m->chooseleaf_stable);
+  crush_destroy(m);
+
+  // the tunables added one after the other
+  size_t length = e.buffer.size();
+  e.u32(2);
+  e.u32(5);
+  e.u32(50);
+  e.u32(1);
+  ASSERT_EQ(0, crush_load_binary(&e.buffer[0], e.buffer.size(), &m));
+  EXPECT_EQ(50u, m->choose_total_tries);
+  EXPECT_EQ(1u, m->chooseleaf_descend_once);
+  EXPECT_EQ(0, m->chooseleaf_vary_r);
+  crush_destroy(m);
+  // not all the values of a tunable
+  ASSERT_EQ(-EINVAL, crush_load_binary(&e.buffer[0], length + 8, &m));
+  crush_destroy(expected);
+}
+
+TEST(load, binary_corrupted) {
+  crush_map *expected = build_all_algs();
+  encoder e;
+  e.map(expected, false);
+  crush_map *m;
+  // truncated anywhere before the tunables
+  for (size_t length = 0; length < e.buffer.size(); length++)
+    ASSERT_EQ(-EINVAL, crush_load_binary(&e.buffer[0], length, &m)) << length;
+  // a bucket id that does not match its position
+  std::vector<unsigned char> buffer(e.buffer);
+  buffer[16 + 4] = 0xfe;
+  EXPECT_EQ(-EINVAL, crush_load_binary(&buffer[0], buffer.size(), &m));
+  // an unknown algorithm
+  buffer = e.buffer;
+  buffer[16] = 9;
+  EXPECT_EQ(-EINVAL, crush_load_binary(&buffer[0], buffer.size(), &m));
+  // more buckets than the buffer can hold
+  buffer = e.buffer;
+  buffer[4 + 3] = 0x7f;
+  EXPECT_EQ(-EINVAL, crush_load_binary(&buffer[0], buffer.size(), &m));
+  // a root whose items are not buckets
+  encoder bad;
+  crush_bucket *root = expected->buckets[-1 - expected->rules[0]->steps[0].arg1];
+  int item = root->items[0];
+  root->items[0] = -42;
+  bad.map(expected, true);
+  EXPECT_EQ(-EINVAL, crush_load_binary(&bad.buffer[0], bad.buffer.size(), &m));
+  root->items[0] = item;
+  // a tree bucket with more nodes than its items need
+  crush_bucket_tree *tree = (crush_bucket_tree *)expected->buckets[CRUSH_BUCKET_TREE - 1];
+  ASSERT_EQ(CRUSH_BUCKET_TREE, tree->h.alg);
+  __u32 *node_weights = tree->node_weights;
+  std::vector<__u32> more(node_weights, node_weights + tree->num_nodes);
+  more.resize(tree->num_nodes * 2, 0);
+  tree->node_weights = &more[0];
+  tree->num_nodes *= 2;
+  encoder big;
+  big.map(expected, true);
+  EXPECT_EQ(-EINVAL, crush_load_binary(&big.buffer[0], big.buffer.size(), &m));
+  tree->num_nodes /= 2;
+  // a weight on a leaf without item
+  more[tree->num_nodes - 1] = 0x10000;
+  encoder leaf;
+  leaf.map(expected, true);
+  EXPECT_EQ(-EINVAL, crush_load_binary(&leaf.buffer[0], leaf.buffer.size(), &m));
+  tree->node_weights = node_weights;
+  crush_destroy(expected);
+}
+
+TEST(load, file) {
+  char path[] = "/tmp/test_load.XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_LE(0, fd);
+  ASSERT_EQ((ssize_t)strlen(text_map), write(fd, text_map, strlen(text_map)));
+  close(fd);
+  crush_map *m;
+  int line = 0;
+  ASSERT_EQ(0, crush_load_file(path, &m, &line));
+  EXPECT_EQ(5, m->max_devices);
+  crush_destroy(m);
+  unlink(path);
+  EXPECT_EQ(-ENOENT, crush_load_file(path, &m, &line));
+}
+
+TEST(load, choose_tries) {
+  crush_map *m;
+  ASSERT_EQ(0, crush_load_text(text_map, strlen(text_map), &m, NULL));
+  int max = m->choose_total_tries + 1;
+  std::vector<__u32> histogram(max);
+  m->choose_tries = (__u32 *)calloc(max, sizeof(__u32));
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  weights[0] = 0;
+  std::vector<char> cwin(crush_work_size(m, 3));
+  crush_init_workspace(m, &cwin[0]);
+  crush_choose_tries_attach(&cwin[0], &histogram[0], max);
+  for (int x = 0; x < 1000; x++) {
+    int result[3];
+    crush_do_rule(m, 0, x, result, 3, &weights[0], weights.size(), &cwin[0], NULL);
+  }
+  __u32 total = 0;
+  for (int i = 0; i < max; i++) {
+    EXPECT_EQ(m->choose_tries[i], histogram[i]) << i;
+    total += histogram[i];
+  }
+  EXPECT_LT(1000u, total);
+  // detached
+  crush_choose_tries_attach(&cwin[0], NULL, 0);
+  int result[3];
+  crush_do_rule(m, 0, 0, result, 3, &weights[0], weights.size(), &cwin[0], NULL);
+  __u32 after = 0;
+  for (int i = 0; i < max; i++)
+    after += histogram[i];
+  EXPECT_EQ(total, after);
+  // crush_destroy() frees map->choose_tries
+  crush_destroy(m);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_load && valgrind --tool=memcheck test/unittest_load"
+// End:
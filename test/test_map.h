@@ -0,0 +1,102 @@
+#ifndef CRUSH_TEST_MAP_H
+#define CRUSH_TEST_MAP_H
+
+// The hierarchies the unit tests map values with.
+
+#include <errno.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/builder.h"
+#include "crush/generator.h"
+#include "crush/hash.h"
+}
+
+// A straw2 root (-1) containing __hosts__ straw2 hosts of __devices__
+// devices each: host h is -2 - h and contains the devices h *
+// __devices__ and up. If __hosts__ is 0 the root directly contains the
+// devices. The device weights are 0x10000, spread as with
+// crush_generator::weight_spread. Rule 0 is a chooseleaf firstn over
+// the hosts (or a choose firstn over the devices) and, if __ec__ is
+// set, rule 1 is the same with indep. Return NULL if
+// crush_generate() fails.
+static inline crush_map *make_test_map(int hosts, int devices, double weight_spread = 0,
+                                       int ec = 0)
+{
+  crush_generator g;
+  crush_generator_init(&g);
+  g.level_count = 0;
+  g.failure_domain = CRUSH_GENERATOR_OSD;
+  if (hosts > 0) {
+    g.level_count = 1;
+    g.levels[0].type = CRUSH_GENERATOR_HOST;
+    g.levels[0].count = hosts;
+    g.levels[0].alg = CRUSH_BUCKET_STRAW2;
+    g.failure_domain = CRUSH_GENERATOR_HOST;
+  }
+  g.devices = devices;
+  g.weight_spread = weight_spread;
+  g.ec = ec;
+  crush_map *m = NULL;
+  if (crush_generate(&g, &m) < 0)
+    return NULL;
+  return m;
+}
+
+// The hierarchy of crush_generator_init(): rule 0 is
+// CRUSH_GENERATOR_REPLICATED_RULE and, if __ec__ is set, rule 1 is
+// CRUSH_GENERATOR_EC_RULE. If __g__ is not NULL it is set to the
+// generator of the map. Return NULL if crush_generate() fails.
+static inline crush_map *make_generated_map(int ec = 0, crush_generator *g = NULL)
+{
+  crush_generator generator;
+  if (g == NULL)
+    g = &generator;
+  crush_generator_init(g);
+  g->ec = ec;
+  crush_map *m = NULL;
+  if (crush_generate(g, &m) < 0)
+    return NULL;
+  return m;
+}
+
+// Add to __root__ a host of algorithm __alg__ containing __size__
+// devices of weight __weight__, numbered from __first__. Return 0
+// on success, < 0 on error.
+static inline int add_test_host(crush_map *m, crush_bucket *root, int alg, int first, int size,
+                                int weight)
+{
+  std::vector<int> items(size), weights(size, weight);
+  for (int i = 0; i < size; i++)
+    items[i] = first + i;
+  crush_bucket *b = crush_make_bucket(m, alg, CRUSH_HASH_DEFAULT, CRUSH_GENERATOR_HOST,
+                                      size, items.data(), weights.data());
+  if (b == NULL)
+    return -ENOMEM;
+  int id;
+  int err = crush_add_bucket(m, 0, b, &id);
+  if (err < 0) {
+    crush_destroy_bucket(b);
+    return err;
+  }
+  return crush_bucket_add_item(m, root, id, b->weight);
+}
+
+// Add the rule __ruleno__ taking __root__ and choosing with __op__
+// items of type __type__. Return __ruleno__, or < 0 on error.
+static inline int add_test_rule(crush_map *m, int root, int ruleno, int op, int type)
+{
+  crush_rule *rule = crush_make_rule(3, ruleno, 0, 0, 0);
+  if (rule == NULL)
+    return -ENOMEM;
+  crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+  crush_rule_set_step(rule, 1, op, 0, type);
+  crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+  int err = crush_add_rule(m, rule, ruleno);
+  if (err < 0)
+    crush_destroy_rule(rule);
+  return err;
+}
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/builder.h"
+#include "crush/generator.h"
+#include "crush/hash.h"
+#include "crush/mapper.h"
+#include "crush/prune.h"
+#include "crush/trace.h"
+}
+
+#include "test_map.h"
+
+static void count_choose(void *arg, int bucket, int x, int r, int item)
+{
+  (*(int *)arg)++;
+}
+
+static void count_pruned(void *arg, int bucket, int item, int r, unsigned int ftotal,
+                         enum crush_trace_reason reason)
+{
+  if (reason == CRUSH_TRACE_PRUNED)
+    (*(int *)arg)++;
+}
+
+struct rack_rejects {
+  const crush_map *m;
+  int reasons[CRUSH_TRACE_PRUNED + 1];
+};
+
+static void count_rack_rejects(void *arg, int bucket, int item, int r, unsigned int ftotal,
+                               enum crush_trace_reason reason)
+{
+  rack_rejects *rejects = (rack_rejects *)arg;
+  if (item < 0 && rejects->m->buckets[-1 - item]->type == CRUSH_GENERATOR_RACK)
+    rejects->reasons[reason]++;
+}
+
+class prune : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_generated_map(1);
+    ASSERT_TRUE(m != NULL);
+    root = m->rules[CRUSH_GENERATOR_REPLICATED_RULE]->steps[0].arg1;
+    rules.push_back(CRUSH_GENERATOR_REPLICATED_RULE);
+    rules.push_back(CRUSH_GENERATOR_EC_RULE);
+    rules.push_back(add_rule(CRUSH_RULE_CHOOSELEAF_FIRSTN, CRUSH_GENERATOR_RACK));
+    rules.push_back(add_rule(CRUSH_RULE_CHOOSELEAF_INDEP, CRUSH_GENERATOR_RACK));
+    rules.push_back(add_rule(CRUSH_RULE_CHOOSE_FIRSTN, CRUSH_GENERATOR_OSD));
+    rules.push_back(add_rule(CRUSH_RULE_CHOOSE_INDEP, CRUSH_GENERATOR_OSD));
+
+    // the last devices have no weight, the first host, two hosts of
+    // the second rack and the last rack are out, 5% of the other
+    // devices are out and a few are half out
+    weight_max = m->max_devices - 3;
+    weights.assign(weight_max, 0x10000);
+    for (int d = 0; d < 8; d++) {
+      weights[d] = 0;
+      weights[9 * 8 + d] = 0;
+      weights[10 * 8 + d] = 0;
+    }
+    for (int d = 24 * 8; d < weight_max; d++)
+      weights[d] = 0;
+    for (int d = 0; d < weight_max; d += 20)
+      weights[d] = 0;
+    for (int d = 7; d < weight_max; d += 30)
+      if (weights[d] != 0)
+        weights[d] = 0x8000;
+    pruned.resize(m->max_buckets);
+  }
+
+  virtual void TearDown() {
+    crush_destroy(m);
+  }
+
+  int add_rule(int op, int type) {
+    crush_rule *rule = crush_make_rule(3, 0, 0, 0, 0);
+    crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, root, 0);
+    crush_rule_set_step(rule, 1, op, 0, type);
+    crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+    return crush_add_rule(m, rule, -1);
+  }
+
+  // map x with the rules, with or without pruning, count the items
+  // drawn from buckets and return the results followed by the
+  // choose_tries histogram
+  std::vector<int> map_all(bool pruning, int result_max, int *chooses) {
+    std::vector<int> out;
+    std::vector<__u32> tries(m->choose_total_tries + 2);
+    std::vector<char> cwin(crush_work_size(m, result_max));
+    std::vector<int> result(result_max);
+    crush_trace_ops ops = { NULL, count_choose, NULL, NULL, NULL };
+
+    crush_init_workspace(m, &cwin[0]);
+    crush_choose_tries_attach(&cwin[0], &tries[0], tries.size());
+    crush_trace_attach(&cwin[0], &ops, chooses);
+    if (pruning)
+      crush_prune_attach(&cwin[0], &pruned[0]);
+    for (size_t i = 0; i < rules.size(); i++)
+      for (int x = 0; x < 500; x++) {
+        int len = crush_do_rule(m, rules[i], x, &result[0], result_max,
+                                &weights[0], weight_max, &cwin[0], NULL);
+        out.push_back(len);
+        out.insert(out.end(), result.begin(), result.begin() + len);
+      }
+    out.insert(out.end(), tries.begin(), tries.end());
+    return out;
+  }
+
+  void check(int result_max) {
+    int chooses = 0, pruned_chooses = 0;
+
+    EXPECT_EQ(map_all(false, result_max, &chooses),
+              map_all(true, result_max, &pruned_chooses));
+    EXPECT_LT(pruned_chooses, chooses);
+  }
+
+  crush_map *m;
+  int root;
+  std::vector<int> rules;
+  std::vector<__u32> weights;
+  int weight_max;
+  std::vector<__u8> pruned;
+};
+
+TEST_F(prune, compute) {
+  // the first host, two hosts of the second rack, the last rack and
+  // its hosts
+  EXPECT_EQ(12, crush_prune_compute(m, &weights[0], weight_max, &pruned[0]));
+  EXPECT_EQ(1, pruned[7]); // the first host, after the 4 racks
+  EXPECT_EQ(0, pruned[-1 - root]);
+
+  // only the devices < weight_max are in: all but the first host and
+  // the buckets above it
+  weights.assign(weight_max, 0x10000);
+  EXPECT_EQ(m->max_buckets - 5, crush_prune_compute(m, &weights[0], 8, &pruned[0]));
+  EXPECT_EQ(0, pruned[-1 - root]);
+
+  // an empty bucket is pruned, a bucket with an unknown item is not
+  crush_bucket *empty = crush_make_bucket(m, CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT,
+                                          CRUSH_GENERATOR_HOST, 0, NULL, NULL);
+  int id;
+  ASSERT_EQ(0, crush_add_bucket(m, 0, empty, &id));
+  pruned.resize(m->max_buckets);
+  weights.assign(weight_max, 0x10000);
+  EXPECT_EQ(1, crush_prune_compute(m, &weights[0], weight_max, &pruned[0]));
+  EXPECT_EQ(1, pruned[-1 - id]);
+  ASSERT_EQ(0, crush_bucket_add_item(m, empty, m->max_devices, 0));
+  EXPECT_EQ(0, crush_prune_compute(m, &weights[0], weight_max, &pruned[0]));
+}
+
+TEST_F(prune, same_mappings) {
+  ASSERT_LT(0, crush_prune_compute(m, &weights[0], weight_max, &pruned[0]));
+  check(3);
+  check(6);
+}
+
+TEST_F(prune, legacy_tunables) {
+  // the local retries disable the pruning of choose steps, not of
+  // chooseleaf steps
+  set_legacy_crush_map(m);
+  ASSERT_LT(0, crush_prune_compute(m, &weights[0], weight_max, &pruned[0]));
+  check(3);
+  check(6);
+}
+
+TEST_F(prune, detach) {
+  std::vector<char> cwin(crush_work_size(m, 3));
+  std::vector<int> result(3);
+  int skipped = 0;
+  crush_trace_ops ops = { NULL, NULL, NULL, count_pruned, NULL };
+
+  crush_prune_compute(m, &weights[0], weight_max, &pruned[0]);
+  crush_init_workspace(m, &cwin[0]);
+  crush_trace_attach(&cwin[0], &ops, &skipped);
+  crush_prune_attach(&cwin[0], &pruned[0]);
+  crush_prune_attach(&cwin[0], NULL);
+  for (int x = 0; x < 100; x++)
+    crush_do_rule(m, rules[4], x, &result[0], 3, &weights[0], weight_max, &cwin[0], NULL);
+  EXPECT_EQ(0, skipped);
+  crush_prune_attach(&cwin[0], &pruned[0]);
+  for (int x = 0; x < 100; x++)
+    crush_do_rule(m, rules[4], x, &result[0], 3, &weights[0], weight_max, &cwin[0], NULL);
+  EXPECT_LT(0, skipped);
+  crush_init_workspace(m, &cwin[0]);
+  EXPECT_EQ(NULL, ((crush_work *)&cwin[0])->pruned);
+}
+
+TEST_F(prune, chooseleaf_trace) {
+  // the racks skipped by the chooseleaf steps are reported as pruned
+  // instead of without leaf
+  std::vector<char> cwin(crush_work_size(m, 6));
+  std::vector<int> result(6);
+  crush_trace_ops ops = { NULL, NULL, NULL, count_rack_rejects, NULL };
+
+  ASSERT_LT(0, crush_prune_compute(m, &weights[0], weight_max, &pruned[0]));
+  for (int i = 2; i < 4; i++) {
+    rack_rejects rejects[2] = {};
+    for (int pruning = 0; pruning < 2; pruning++) {
+      rejects[pruning].m = m;
+      crush_init_workspace(m, &cwin[0]);
+      crush_trace_attach(&cwin[0], &ops, &rejects[pruning]);
+      if (pruning)
+        crush_prune_attach(&cwin[0], &pruned[0]);
+      for (int x = 0; x < 500; x++)
+        crush_do_rule(m, rules[i], x, &result[0], 6, &weights[0], weight_max, &cwin[0],
+                      NULL);
+    }
+    EXPECT_EQ(0, rejects[0].reasons[CRUSH_TRACE_PRUNED]) << i;
+    EXPECT_LT(0, rejects[1].reasons[CRUSH_TRACE_PRUNED]) << i;
+    EXPECT_EQ(rejects[0].reasons[CRUSH_TRACE_NO_LEAF],
+              rejects[1].reasons[CRUSH_TRACE_NO_LEAF] + rejects[1].reasons[CRUSH_TRACE_PRUNED])
+        << i;
+  }
+}
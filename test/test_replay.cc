@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/generator.h"
+#include "crush/replay.h"
+}
+
+#include "test_map.h"
+
+struct call {
+  int ruleno;
+  int x;
+  int result_max;
+  std::vector<int> result;
+};
+
+class replay : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_generated_map(1);
+    ASSERT_TRUE(m != NULL);
+    cwin.resize(crush_work_size(m, 6));
+    crush_init_workspace(m, &cwin[0]);
+    recorder = crush_recorder_create();
+    ASSERT_TRUE(recorder != NULL);
+  }
+
+  virtual void TearDown() {
+    crush_recorder_destroy(recorder);
+    crush_destroy(m);
+  }
+
+  call do_rule(int ruleno, int x, int result_max, const std::vector<__u32> &weights) {
+    call c;
+    c.ruleno = ruleno;
+    c.x = x;
+    c.result_max = result_max;
+    c.result.resize(result_max);
+    int len = crush_do_rule(m, ruleno, x, &c.result[0], result_max,
+                            &weights[0], weights.size(), &cwin[0], NULL);
+    c.result.resize(len);
+    return c;
+  }
+
+  crush_map *m;
+  std::vector<char> cwin;
+  crush_recorder *recorder;
+};
+
+TEST_F(replay, record) {
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  std::vector<__u32> reweighted(weights);
+  reweighted[3] = 0;
+  std::vector<call> calls;
+
+  // not recorded until attached
+  do_rule(CRUSH_GENERATOR_REPLICATED_RULE, 1, 3, weights);
+  crush_recorder_attach(&cwin[0], recorder);
+  for (int x = 0; x < 100; x++)
+    calls.push_back(do_rule(CRUSH_GENERATOR_REPLICATED_RULE, x, 3, weights));
+  for (int x = 0; x < 50; x++)
+    calls.push_back(do_rule(CRUSH_GENERATOR_EC_RULE, x * 1000, 6, weights));
+  // the content changed, the pointer did not
+  ASSERT_EQ(0, crush_recorder_epoch(recorder, 42, &reweighted[0], reweighted.size()));
+  for (int x = 0; x < 100; x++)
+    calls.push_back(do_rule(CRUSH_GENERATOR_REPLICATED_RULE, x, 3, reweighted));
+  // an epoch change detected by crush_recorder_add()
+  calls.push_back(do_rule(CRUSH_GENERATOR_REPLICATED_RULE, 7, 2, weights));
+  crush_recorder_attach(&cwin[0], NULL);
+  do_rule(CRUSH_GENERATOR_REPLICATED_RULE, 1, 3, weights);
+  EXPECT_EQ((__u64)calls.size(), crush_recorder_count(recorder));
+
+  void *buffer;
+  size_t length;
+  ASSERT_EQ(0, crush_recorder_serialize(recorder, &buffer, &length));
+  crush_replay *r;
+  ASSERT_EQ(0, crush_replay_open(buffer, length, &r));
+  for (int pass = 0; pass < 2; pass++) {
+    crush_replay_record record;
+    for (size_t i = 0; i < calls.size(); i++) {
+      ASSERT_EQ(1, crush_replay_next(r, &record));
+      EXPECT_EQ(calls[i].ruleno, record.ruleno);
+      EXPECT_EQ(calls[i].x, record.x);
+      EXPECT_EQ(calls[i].result_max, record.result_max);
+      if (i < 150)
+        EXPECT_EQ(0u, record.epoch);
+      else if (i < 250)
+        EXPECT_EQ(42u, record.epoch);
+      else
+        EXPECT_EQ(43u, record.epoch);
+      ASSERT_EQ(m->max_devices, record.weight_max);
+      // replaying the call gives the same mapping
+      std::vector<__u32> w(record.weights, record.weights + record.weight_max);
+      call c = do_rule(record.ruleno, record.x, record.result_max, w);
+      EXPECT_EQ(calls[i].result, c.result);
+    }
+    EXPECT_EQ(0, crush_replay_next(r, &record));
+    crush_replay_rewind(r);
+  }
+  crush_replay_close(r);
+  free(buffer);
+}
+
+TEST_F(replay, compact) {
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  crush_recorder_attach(&cwin[0], recorder);
+  do_rule(CRUSH_GENERATOR_REPLICATED_RULE, 1, 3, weights);
+  void *buffer;
+  size_t length;
+  ASSERT_EQ(0, crush_recorder_serialize(recorder, &buffer, &length));
+  free(buffer);
+  size_t first = length;
+  // the same rule and result_max and a small x: a tag and a byte
+  do_rule(CRUSH_GENERATOR_REPLICATED_RULE, 2, 3, weights);
+  ASSERT_EQ(0, crush_recorder_serialize(recorder, &buffer, &length));
+  free(buffer);
+  EXPECT_EQ(first + 2, length);
+}
+
+TEST_F(replay, no_weights) {
+  crush_recorder_add(recorder, 0, -1, 3, NULL, 0);
+  void *buffer;
+  size_t length;
+  ASSERT_EQ(0, crush_recorder_serialize(recorder, &buffer, &length));
+  crush_replay *r;
+  ASSERT_EQ(0, crush_replay_open(buffer, length, &r));
+  crush_replay_record record;
+  ASSERT_EQ(1, crush_replay_next(r, &record));
+  EXPECT_EQ(-1, record.x);
+  EXPECT_TRUE(record.weights == NULL);
+  EXPECT_EQ(0, record.weight_max);
+  EXPECT_EQ(0, crush_replay_next(r, &record));
+  crush_replay_close(r);
+  free(buffer);
+}
+
+TEST_F(replay, corrupted) {
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  crush_recorder_add(recorder, 0, 1, 3, &weights[0], weights.size());
+  void *buffer;
+  size_t length;
+  ASSERT_EQ(0, crush_recorder_serialize(recorder, &buffer, &length));
+  unsigned char *data = (unsigned char *)buffer;
+  crush_replay *r;
+  crush_replay_record record;
+
+  EXPECT_EQ(-EINVAL, crush_replay_open(buffer, 4, &r));
+  data[0] ^= 1;
+  EXPECT_EQ(-EINVAL, crush_replay_open(buffer, length, &r));
+  data[0] ^= 1;
+
+  // truncated in the middle of the weights
+  ASSERT_EQ(0, crush_replay_open(buffer, length / 2, &r));
+  EXPECT_EQ(-EINVAL, crush_replay_next(r, &record));
+  crush_replay_close(r);
+
+  // an unknown tag
+  data[8] = 7;
+  ASSERT_EQ(0, crush_replay_open(buffer, length, &r));
+  EXPECT_EQ(-EINVAL, crush_replay_next(r, &record));
+  crush_replay_close(r);
+
+  // a SAME record without a CALL before it
+  data[8] = 2;
+  ASSERT_EQ(0, crush_replay_open(buffer, length, &r));
+  EXPECT_EQ(-EINVAL, crush_replay_next(r, &record));
+  crush_replay_close(r);
+  free(buffer);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_replay && valgrind --tool=memcheck test/unittest_replay"
+// End:
@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/simulate.h"
+}
+
+#include "test_map.h"
+
+class SimulateTest : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_test_map(5, 4);
+    ASSERT_TRUE(m != NULL);
+    weights.assign(m->max_devices, 0x10000);
+    capacities.assign(m->max_devices, 1e12);
+    memset(&params, '\0', sizeof(params));
+    params.ruleno = 0;
+    params.result_max = 3;
+    params.weights = &weights[0];
+    params.weight_max = weights.size();
+    params.pool = 1;
+    params.pg_num = 256;
+    params.capacities = &capacities[0];
+    params.full_ratio = 0.95;
+    params.max_objects = 100000;
+    params.seed = 42;
+    params.size.alg = CRUSH_SIZE_FIXED;
+    params.size.a = 4096;
+  }
+  virtual void TearDown() {
+    crush_destroy(m);
+  }
+  crush_map *m;
+  std::vector<__u32> weights;
+  std::vector<double> capacities;
+  struct crush_fill_params params;
+};
+
+TEST_F(SimulateTest, invalid) {
+  struct crush_fill_result result;
+  params.ruleno = 1;
+  EXPECT_EQ(-EINVAL, crush_simulate_fill(m, &params, &result, NULL));
+  params.ruleno = 0;
+  params.pg_num = 0;
+  EXPECT_EQ(-EINVAL, crush_simulate_fill(m, &params, &result, NULL));
+  params.pg_num = 256;
+  params.size.alg = CRUSH_SIZE_HISTOGRAM;
+  EXPECT_EQ(-EINVAL, crush_simulate_fill(m, &params, &result, NULL));
+}
+
+TEST_F(SimulateTest, not_full) {
+  struct crush_fill_result result;
+  std::vector<double> device_bytes(m->max_devices);
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &result, &device_bytes[0]));
+  EXPECT_EQ(-1, result.device);
+  EXPECT_EQ(params.max_objects, result.objects);
+  EXPECT_EQ(params.max_objects * params.size.a * params.result_max, result.bytes);
+  double total = 0;
+  for (int d = 0; d < m->max_devices; d++) {
+    EXPECT_LT(0, device_bytes[d]);
+    total += device_bytes[d];
+  }
+  EXPECT_EQ(result.bytes, total);
+  EXPECT_DOUBLE_EQ(result.bytes / (1e12 * m->max_devices), result.fill);
+}
+
+TEST_F(SimulateTest, threads) {
+  struct crush_fill_result expected, result;
+  std::vector<double> expected_bytes(m->max_devices), device_bytes(m->max_devices);
+  params.size.alg = CRUSH_SIZE_EXPONENTIAL;
+  params.size.a = 1e6;
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &expected, &expected_bytes[0]));
+  params.threads = 4;
+  params.batch_size = 1000;
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &result, &device_bytes[0]));
+  EXPECT_EQ(expected.objects, result.objects);
+  EXPECT_EQ(expected.bytes, result.bytes);
+  for (int d = 0; d < m->max_devices; d++)
+    EXPECT_EQ(expected_bytes[d], device_bytes[d]);
+}
+
+TEST_F(SimulateTest, full) {
+  struct crush_fill_result result;
+  std::vector<double> device_bytes(m->max_devices);
+  capacities.assign(m->max_devices, 1e9);
+  params.full_ratio = 0.8;
+  params.max_objects = 1ULL << 40;
+  params.size.alg = CRUSH_SIZE_LOGNORMAL;
+  params.size.a = log(1e6);
+  params.size.b = 1;
+  params.threads = 2;
+  params.batch_size = 100000;
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &result, &device_bytes[0]));
+  ASSERT_LE(0, result.device);
+  EXPECT_LT(0u, result.objects);
+  EXPECT_GT(params.max_objects, result.objects);
+  EXPECT_LE(0.8 * 1e9, device_bytes[result.device]);
+  // the imbalance between devices leaves some space unused
+  EXPECT_LT(0.5, result.fill);
+  EXPECT_GT(0.8, result.fill);
+
+  // the last object filled the device, whatever the batches
+  struct crush_fill_result other;
+  params.threads = 1;
+  params.batch_size = 7777;
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &other, NULL));
+  EXPECT_EQ(result.device, other.device);
+  EXPECT_EQ(result.objects, other.objects);
+  EXPECT_EQ(result.bytes, other.bytes);
+  params.max_objects = result.objects - 1;
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &other, &device_bytes[0]));
+  EXPECT_EQ(-1, other.device);
+  for (int d = 0; d < m->max_devices; d++)
+    EXPECT_GT(0.8 * 1e9, device_bytes[d]);
+}
+
+TEST_F(SimulateTest, histogram) {
+  struct crush_fill_result result;
+  double sizes[] = { 1000, 3000 };
+  double frequencies[] = { 3, 1 };
+  params.size.alg = CRUSH_SIZE_HISTOGRAM;
+  params.size.histogram_size = 2;
+  params.size.sizes = sizes;
+  params.size.frequencies = frequencies;
+  ASSERT_EQ(0, crush_simulate_fill(m, &params, &result, NULL));
+  double mean = result.bytes / result.objects / params.result_max;
+  EXPECT_NEAR(1500, mean, 15);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_simulate && valgrind --tool=memcheck test/unittest_simulate"
+// End:
@@ -0,0 +1,78 @@
+#include <errno.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/stats.h"
+}
+
+#include "test_map.h"
+
+static const int hosts = 5;
+static const int devices_per_host = 4;
+
+TEST(stats, counters) {
+  crush_map *m = make_test_map(hosts, devices_per_host, 0, 1);
+  ASSERT_TRUE(m != NULL);
+  const int result_max = 3;
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  crush_stats stats[2];
+  crush_stats_reset(stats, 2);
+  int r = crush_stats_attach(&cwin[0], stats, 2);
+#ifndef CRUSH_STATS
+  EXPECT_EQ(-EOPNOTSUPP, r);
+  crush_destroy(m);
+  GTEST_SKIP() << "libcrush is built without CRUSH_STATS";
+#endif
+  ASSERT_EQ(0, r);
+
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  weights[0] = 0;
+  weights[5] = 0;
+  const int values = 1000;
+  int result[result_max];
+  for (int ruleno = 0; ruleno < 2; ruleno++)
+    for (int x = 0; x < values; x++)
+      crush_do_rule(m, ruleno, x, result, result_max, &weights[0], weights.size(),
+                    &cwin[0], NULL);
+
+  for (int ruleno = 0; ruleno < 2; ruleno++) {
+    const crush_stats &s = stats[ruleno];
+    EXPECT_EQ((__u64)values, s.mappings);
+    // a host and a device is drawn for each replica, at least
+    EXPECT_GE(s.bucket_choose[CRUSH_BUCKET_STRAW2], (__u64)(2 * result_max * values));
+    EXPECT_EQ(0u, s.bucket_choose[CRUSH_BUCKET_LIST]);
+    EXPECT_GE(s.hashes, s.bucket_choose[CRUSH_BUCKET_STRAW2] * devices_per_host);
+    // the hosts are directly under the root
+    EXPECT_EQ(0u, s.descents);
+    EXPECT_GT(s.rejects_out, 0u);
+    EXPECT_GT(s.retries_total, 0u);
+  }
+  // with 5 hosts and 3 replicas, hosts already chosen are drawn again
+  EXPECT_GT(stats[0].collisions, 0u);
+
+  // the counters are not modified once detached
+  crush_stats before = stats[0];
+  ASSERT_EQ(0, crush_stats_attach(&cwin[0], NULL, 0));
+  crush_do_rule(m, 0, 1, result, result_max, &weights[0], weights.size(), &cwin[0], NULL);
+  EXPECT_EQ(before.mappings, stats[0].mappings);
+
+  // aggregate the counters of the two rules
+  crush_stats total;
+  crush_stats_reset(&total, 1);
+  crush_stats_add(&total, &stats[0], 1);
+  crush_stats_add(&total, &stats[1], 1);
+  EXPECT_EQ((__u64)(2 * values), total.mappings);
+  EXPECT_EQ(stats[0].hashes + stats[1].hashes, total.hashes);
+  EXPECT_EQ(stats[0].skips + stats[1].skips, total.skips);
+
+  crush_destroy(m);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_stats && valgrind --tool=memcheck test/unittest_stats"
+// End:
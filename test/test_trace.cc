@@ -0,0 +1,150 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "crush/mapper.h"
+#include "crush/trace.h"
+}
+
+#include "test_map.h"
+
+struct counts {
+  int steps;
+  int chooses;
+  int collides;
+  int rejects_out;
+  std::vector<int> emitted;
+};
+
+static void count_step(void *arg, int ruleno, int step, int op, int arg1, int arg2)
+{
+  ((counts *)arg)->steps++;
+}
+
+static void count_choose(void *arg, int bucket, int x, int r, int item)
+{
+  ((counts *)arg)->chooses++;
+}
+
+static void count_collide(void *arg, int bucket, int item, int r, unsigned int ftotal)
+{
+  ((counts *)arg)->collides++;
+}
+
+static void count_reject(void *arg, int bucket, int item, int r, unsigned int ftotal,
+                         enum crush_trace_reason reason)
+{
+  if (reason == CRUSH_TRACE_OUT)
+    ((counts *)arg)->rejects_out++;
+}
+
+static void count_emit(void *arg, int item)
+{
+  ((counts *)arg)->emitted.push_back(item);
+}
+
+TEST(trace, callbacks) {
+  crush_map *m = make_test_map(4, 2);
+  ASSERT_TRUE(m != NULL);
+  const int result_max = 3;
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  weights[3] = 0;
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  crush_trace_ops ops = {};
+  ops.step = count_step;
+  ops.choose = count_choose;
+  ops.collide = count_collide;
+  ops.reject = count_reject;
+  ops.emit = count_emit;
+
+  counts total = {};
+  for (int x = 0; x < 100; x++) {
+    int expected[result_max], result[result_max];
+    crush_trace_attach(&cwin[0], NULL, NULL);
+    int expected_len = crush_do_rule(m, 0, x, expected, result_max, &weights[0], weights.size(),
+                                     &cwin[0], NULL);
+    counts c = {};
+    crush_trace_attach(&cwin[0], &ops, &c);
+    int len = crush_do_rule(m, 0, x, result, result_max, &weights[0], weights.size(),
+                            &cwin[0], NULL);
+    ASSERT_EQ(expected_len, len);
+    ASSERT_EQ(len, (int)c.emitted.size());
+    for (int i = 0; i < len; i++) {
+      ASSERT_EQ(expected[i], result[i]);
+      ASSERT_EQ(result[i], c.emitted[i]);
+    }
+    EXPECT_EQ(3, c.steps);
+    // a host and a device for each replica
+    EXPECT_GE(c.chooses, 2 * len);
+    total.chooses += c.chooses;
+    total.collides += c.collides;
+    total.rejects_out += c.rejects_out;
+  }
+  EXPECT_GT(total.collides, 0);
+  EXPECT_GT(total.rejects_out, 0);
+
+  // a partial table is fine
+  crush_trace_ops emit_only = {};
+  emit_only.emit = count_emit;
+  counts c = {};
+  crush_trace_attach(&cwin[0], &emit_only, &c);
+  int result[result_max];
+  int len = crush_do_rule(m, 0, 1, result, result_max, &weights[0], weights.size(),
+                          &cwin[0], NULL);
+  EXPECT_EQ(len, (int)c.emitted.size());
+  EXPECT_EQ(0, c.steps);
+
+  crush_destroy(m);
+}
+
+TEST(trace, explain) {
+  crush_map *m = make_test_map(4, 2);
+  ASSERT_TRUE(m != NULL);
+  const int result_max = 3;
+  std::vector<__u32> weights(m->max_devices, 0x10000);
+  weights[3] = 0;
+  char *json = NULL;
+  EXPECT_EQ(-EINVAL, crush_explain(m, 1, 0, result_max, &weights[0], weights.size(), NULL,
+                                   &json));
+
+  std::vector<char> cwin(crush_work_size(m, result_max));
+  crush_init_workspace(m, &cwin[0]);
+  int out = 0;
+  for (int x = 0; x < 100; x++) {
+    int result[result_max];
+    int len = crush_do_rule(m, 0, x, result, result_max, &weights[0], weights.size(),
+                            &cwin[0], NULL);
+    ASSERT_EQ(len, crush_explain(m, 0, x, result_max, &weights[0], weights.size(), NULL,
+                                 &json));
+    std::string s(json);
+    free(json);
+    std::ostringstream prefix;
+    prefix << "{\"rule\":0,\"x\":" << x << ",\"steps\":["
+           << "{\"step\":0,\"op\":\"take\",\"arg1\":-1,\"arg2\":0,\"events\":[]},"
+           << "{\"step\":1,\"op\":\"chooseleaf_firstn\",\"arg1\":0,\"arg2\":1,\"events\":["
+           << "{\"event\":\"choose\",\"bucket\":-1,\"r\":0,";
+    ASSERT_EQ(0u, s.find(prefix.str())) << s;
+    std::ostringstream suffix;
+    suffix << "],\"result\":[";
+    for (int i = 0; i < len; i++)
+      suffix << (i > 0 ? "," : "") << result[i];
+    suffix << "]}";
+    ASSERT_EQ(s.size() - suffix.str().size(), s.rfind(suffix.str())) << s;
+    if (s.find("\"reason\":\"out\"") != std::string::npos)
+      out++;
+  }
+  EXPECT_GT(out, 0);
+
+  crush_destroy(m);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_trace && valgrind --tool=memcheck test/unittest_trace"
+// End:
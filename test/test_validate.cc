@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "crush/builder.h"
+#include "crush/generator.h"
+#include "crush/hash.h"
+#include "crush/validate.h"
+}
+
+#include "test_map.h"
+
+class validate : public ::testing::Test {
+protected:
+  virtual void SetUp() {
+    m = make_generated_map();
+    ASSERT_TRUE(m != NULL);
+    ASSERT_EQ(0, crush_executor_create(4, &executor));
+    root = m->rules[CRUSH_GENERATOR_REPLICATED_RULE]->steps[0].arg1;
+  }
+
+  virtual void TearDown() {
+    crush_executor_destroy(executor);
+    crush_destroy(m);
+  }
+
+  // the same problem found with and without executor
+  crush_validate_error check() {
+    crush_validate_error error, parallel;
+    int err = crush_map_validate(m, NULL, &error);
+    EXPECT_EQ(err, crush_map_validate(m, executor, &parallel));
+    EXPECT_EQ(error.code, parallel.code);
+    EXPECT_EQ(error.bucket, parallel.bucket);
+    EXPECT_EQ(error.position, parallel.position);
+    EXPECT_EQ(error.item, parallel.item);
+    EXPECT_EQ(error.rule, parallel.rule);
+    EXPECT_EQ(error.step, parallel.step);
+    EXPECT_EQ(error.code == CRUSH_VALID ? 0 : -EINVAL, err);
+    return error;
+  }
+
+  // a bucket of the last level, containing devices
+  crush_bucket *leaf(int n) {
+    for (int b = 0; b < m->max_buckets; b++)
+      if (m->buckets[b] != NULL && m->buckets[b]->items[0] >= 0 && n-- == 0)
+        return m->buckets[b];
+    return NULL;
+  }
+
+  crush_bucket *last_leaf() {
+    for (int b = m->max_buckets - 1; b >= 0; b--)
+      if (m->buckets[b] != NULL && m->buckets[b]->items[0] >= 0)
+        return m->buckets[b];
+    return NULL;
+  }
+
+  crush_map *m;
+  crush_executor *executor;
+  int root;
+};
+
+TEST_F(validate, valid) {
+  EXPECT_EQ(CRUSH_VALID, check().code);
+  EXPECT_EQ(0, crush_map_validate(m, NULL, NULL));
+  EXPECT_STREQ("bucket in a cycle", crush_validate_code_name(CRUSH_INVALID_CYCLE));
+}
+
+TEST_F(validate, bucket) {
+  crush_bucket *b = leaf(3);
+  int id = b->id;
+
+  b->id = id - 1;
+  crush_validate_error error = check();
+  EXPECT_EQ(CRUSH_INVALID_BUCKET_ID, error.code);
+  EXPECT_EQ(id, error.bucket);
+  EXPECT_EQ(id - 1, error.item);
+  b->id = id;
+
+  b->hash = 42;
+  EXPECT_EQ(CRUSH_INVALID_BUCKET_ALG, check().code);
+  b->hash = CRUSH_HASH_RJENKINS1;
+
+  __u32 *weights = ((crush_bucket_straw2 *)b)->item_weights;
+  ((crush_bucket_straw2 *)b)->item_weights = NULL;
+  EXPECT_EQ(CRUSH_INVALID_BUCKET_SIZE, check().code);
+  ((crush_bucket_straw2 *)b)->item_weights = weights;
+
+  __u32 weight = weights[1];
+  weights[0] = weights[1] = 0x90000000;
+  error = check();
+  EXPECT_EQ(CRUSH_INVALID_WEIGHT, error.code);
+  EXPECT_EQ(id, error.bucket);
+  weights[0] = weights[1] = weight;
+  EXPECT_EQ(CRUSH_VALID, check().code);
+}
+
+TEST_F(validate, tree) {
+  // a single item, with weights on nodes crush_do_rule() would reach
+  // if the tree had 8 nodes
+  int item = 0, weight = 0x10000;
+  crush_bucket_tree *tree = crush_make_tree_bucket(CRUSH_HASH_RJENKINS1, CRUSH_GENERATOR_HOST,
+                                                   1, &item, &weight);
+  ASSERT_TRUE(tree != NULL);
+  EXPECT_EQ(2, tree->num_nodes);
+  EXPECT_EQ(1, crush_tree_bucket_valid(tree));
+  tree->node_weights = (__u32 *)realloc(tree->node_weights, sizeof(__u32) * 8);
+  tree->num_nodes = 8;
+  for (int n = 0; n < 8; n++)
+    tree->node_weights[n] = 0;
+  tree->node_weights[1] = 0x10000;
+  tree->node_weights[4] = tree->node_weights[6] = 0xffffffff;
+  int id;
+  ASSERT_EQ(0, crush_add_bucket(m, 0, (crush_bucket *)tree, &id));
+  crush_validate_error error = check();
+  EXPECT_EQ(CRUSH_INVALID_BUCKET_SIZE, error.code);
+  EXPECT_EQ(id, error.bucket);
+
+  // the right number of nodes but a weight on a leaf without item
+  int items[3] = { 1, 2, 3 }, weights[3] = { 0x10000, 0x10000, 0x10000 };
+  crush_bucket_tree *three = crush_make_tree_bucket(CRUSH_HASH_RJENKINS1, CRUSH_GENERATOR_HOST,
+                                                    3, items, weights);
+  ASSERT_TRUE(three != NULL);
+  EXPECT_EQ(8, three->num_nodes);
+  EXPECT_EQ(1, crush_tree_bucket_valid(three));
+  three->node_weights[7] = 1;
+  EXPECT_EQ(0, crush_tree_bucket_valid(three));
+  three->node_weights[7] = 0;
+  three->num_nodes = 16;
+  EXPECT_EQ(0, crush_tree_bucket_valid(three));
+  three->num_nodes = 8;
+  crush_destroy_bucket((crush_bucket *)three);
+}
+
+TEST_F(validate, item) {
+  crush_bucket *b = leaf(0);
+  int device = b->items[1];
+
+  b->items[1] = m->max_devices;
+  crush_validate_error error = check();
+  EXPECT_EQ(CRUSH_INVALID_ITEM, error.code);
+  EXPECT_EQ(b->id, error.bucket);
+  EXPECT_EQ(1, error.position);
+  EXPECT_EQ(m->max_devices, error.item);
+
+  b->items[1] = -1 - m->max_buckets;
+  EXPECT_EQ(CRUSH_INVALID_ITEM, check().code);
+  b->items[1] = -0x7fffffff - 1;
+  EXPECT_EQ(CRUSH_INVALID_ITEM, check().code);
+
+  // the first bucket in map->buckets is reported, whatever the worker
+  crush_bucket *last = last_leaf();
+  ASSERT_NE(b, last);
+  int other = last->items[0];
+  last->items[0] = -1 - m->max_buckets;
+  error = check();
+  EXPECT_EQ(b->id, error.bucket);
+  last->items[0] = other;
+  b->items[1] = device;
+  EXPECT_EQ(CRUSH_VALID, check().code);
+}
+
+TEST_F(validate, cycle) {
+  // a leaf bucket contains the root
+  crush_bucket *b = leaf(5);
+  int device = b->items[2];
+  b->items[2] = root;
+  crush_validate_error error = check();
+  EXPECT_EQ(CRUSH_INVALID_CYCLE, error.code);
+  // the item that closes the cycle
+  EXPECT_NE(0, error.bucket);
+  EXPECT_GT(0, error.item);
+  EXPECT_EQ(error.item, m->buckets[-1 - error.bucket]->items[error.position]);
+
+  // a bucket contains itself
+  b->items[2] = b->id;
+  error = check();
+  EXPECT_EQ(CRUSH_INVALID_CYCLE, error.code);
+  EXPECT_EQ(b->id, error.bucket);
+  EXPECT_EQ(2, error.position);
+  EXPECT_EQ(b->id, error.item);
+  b->items[2] = device;
+  EXPECT_EQ(CRUSH_VALID, check().code);
+}
+
+TEST_F(validate, rule) {
+  crush_rule *rule = m->rules[CRUSH_GENERATOR_REPLICATED_RULE];
+  int op = rule->steps[1].op;
+
+  rule->steps[1].op = 5;
+  crush_validate_error error = check();
+  EXPECT_EQ(CRUSH_INVALID_RULE_STEP, error.code);
+  EXPECT_EQ(CRUSH_GENERATOR_REPLICATED_RULE, error.rule);
+  EXPECT_EQ(1, error.step);
+  rule->steps[1].op = op;
+
+  rule->steps[0].arg1 = -1 - m->max_buckets;
+  error = check();
+  EXPECT_EQ(CRUSH_INVALID_RULE_TAKE, error.code);
+  EXPECT_EQ(0, error.step);
+  EXPECT_EQ(-1 - m->max_buckets, error.item);
+  rule->steps[0].arg1 = root;
+  EXPECT_EQ(CRUSH_VALID, check().code);
+}
+
+// Local Variables:
+// compile-command: "cd ../build ; make unittest_validate && valgrind --tool=memcheck test/unittest_validate"
+// End:
@@ -0,0 +1,335 @@
+/*
+ * Tell how many PGs move when a crush map, or the weights of its
+ * devices, change: compare the mappings of the PGs of a pool with
+ * crush_diff() for one or all rules and print the PGs moved, the
+ * replicas each device receives and loses and the devices that move
+ * the most.
+ *
+ *   crush_diff OLD NEW [options]
+ *
+ * The maps are in the binary format of crushtool -o or the text
+ * format of crushtool -d, see crush_load(). A weight file has one
+ * device and its reweight, in [0,1], per line.
+ *
+ * LGPL2
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crush.h"
+#include "diff.h"
+#include "load.h"
+
+struct options {
+	const char *old_path;
+	const char *new_path;
+	const char *old_weights;
+	const char *new_weights;
+	int rule;            /* -1 for all rules */
+	int num_rep;         /* 0 for the rule default */
+	int pool;
+	int pg_num;
+	int samples;
+	__u64 seed;
+	int threads;
+	int top;             /* 0 for all devices */
+	int json;
+};
+
+struct mover {
+	int device;
+	double in;
+	double out;
+};
+
+static int compare_movers(const void *a, const void *b)
+{
+	const struct mover *x = a, *y = b;
+	double dx = x->in + x->out, dy = y->in + y->out;
+
+	if (dx != dy)
+		return dx < dy ? 1 : -1;
+	return x->device - y->device;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: crush_diff OLD NEW [options]\n"
+		"  --rule N                only compare rule N (all rules in both maps)\n"
+		"  --num-rep N             the number of replicas (3, within the sizes of the rule)\n"
+		"  --pool N                the pool of the PGs (0)\n"
+		"  --pg-num N              the number of PGs of the pool (4096)\n"
+		"  --old-weights FILE      the reweights of the devices with OLD (all 1)\n"
+		"  --new-weights FILE      the reweights of the devices with NEW (all 1)\n"
+		"  --sample N              estimate from N PGs drawn at random (compare all PGs)\n"
+		"  --seed N                the seed of the PGs drawn (0)\n"
+		"  --threads N             compare on N threads (the number of processors)\n"
+		"  --top N                 print the N devices that move the most, 0 for all (10)\n"
+		"  --format text|json      the output format (text)\n");
+	exit(2);
+}
+
+static int int_value(const char *value)
+{
+	char *end;
+	long v;
+
+	v = strtol(value, &end, 10);
+	if (*end != '\0' || end == value || v < -0x7fffffffL - 1 || v > 0x7fffffffL)
+		usage();
+	return (int)v;
+}
+
+static struct crush_map *load(const char *path)
+{
+	struct crush_map *map;
+	int line = 0;
+	int err = crush_load_file(path, &map, &line);
+
+	if (err < 0) {
+		if (err == -EINVAL && line > 0)
+			fprintf(stderr, "%s:%d: invalid crush map\n", path, line);
+		else
+			fprintf(stderr, "%s: %s\n", path, strerror(-err));
+		exit(1);
+	}
+	return map;
+}
+
+/* all devices in (0x10000), then the reweights of __path__ if not NULL */
+static __u32 *load_weights(const char *path, int max_devices)
+{
+	__u32 *weights = malloc(sizeof(__u32) * (max_devices + 1));
+	char line[256];
+	FILE *f;
+	int d, number = 0;
+
+	if (weights == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (d = 0; d < max_devices; d++)
+		weights[d] = 0x10000;
+	if (path == NULL)
+		return weights;
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *comment = strchr(line, '#');
+		char extra[2];
+		double weight;
+		int n;
+
+		number++;
+		if (comment != NULL)
+			*comment = '\0';
+		n = sscanf(line, "%d %lf %1s", &d, &weight, extra);
+		if (n <= 0)
+			continue;
+		if (n != 2 || d < 0 || d >= max_devices || weight < 0 || weight > 1) {
+			fprintf(stderr, "%s:%d: expected a device and a weight in [0,1]\n",
+				path, number);
+			exit(1);
+		}
+		weights[d] = weight * 0x10000;
+	}
+	fclose(f);
+	return weights;
+}
+
+static void report(const struct options *o, int ruleno, int num_rep,
+		   const struct crush_diff_result *r, const __u64 *device_in,
+		   const __u64 *device_out, int max_devices, int first)
+{
+	/* sampled counts are scaled to the pool */
+	double scale = o->samples > 0 ? (double)o->pg_num / o->samples : 1;
+	struct mover *movers = malloc(sizeof(*movers) * (max_devices + 1));
+	int count = 0, d, i;
+
+	if (movers == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (d = 0; d < max_devices; d++)
+		if (device_in[d] > 0 || device_out[d] > 0) {
+			movers[count].device = d;
+			movers[count].in = device_in[d] * scale;
+			movers[count].out = device_out[d] * scale;
+			count++;
+		}
+	qsort(movers, count, sizeof(*movers), compare_movers);
+	if (o->top > 0 && count > o->top)
+		count = o->top;
+
+	if (o->json) {
+		printf("%s{\"rule\":%d,\"num_rep\":%d,\"pg_num\":%d,\"sampled\":%s,"
+		       "\"compared\":%d,\"moved\":%.0f,\"moved_ratio\":%.6f,"
+		       "\"moved_low\":%.6f,\"moved_high\":%.6f,\"replicas_moved\":%.0f,"
+		       "\"top_movers\":[",
+		       first ? "" : ",", ruleno, num_rep, o->pg_num,
+		       o->samples > 0 ? "true" : "false", r->pgs, r->moved * scale,
+		       r->moved_ratio, r->moved_low, r->moved_high,
+		       r->replicas_moved * scale);
+		for (i = 0; i < count; i++)
+			printf("%s{\"device\":%d,\"in\":%.0f,\"out\":%.0f}", i ? "," : "",
+			       movers[i].device, movers[i].in, movers[i].out);
+		printf("]}");
+	} else {
+		if (o->samples > 0)
+			printf("rule %d num_rep %d: ~%.0f/%d PGs moved (%.2f%%, 95%% CI %.2f%%-%.2f%%"
+			       " from %d samples), ~%.0f replicas moved\n",
+			       ruleno, num_rep, r->moved * scale, o->pg_num,
+			       100 * r->moved_ratio, 100 * r->moved_low, 100 * r->moved_high,
+			       r->pgs, r->replicas_moved * scale);
+		else
+			printf("rule %d num_rep %d: %d/%d PGs moved (%.2f%%), %llu replicas moved\n",
+			       ruleno, num_rep, r->moved, o->pg_num, 100 * r->moved_ratio,
+			       (unsigned long long)r->replicas_moved);
+		for (i = 0; i < count; i++)
+			printf("  device %d:\tin %.0f\tout %.0f\n", movers[i].device,
+			       movers[i].in, movers[i].out);
+	}
+	free(movers);
+}
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct crush_map *old_map, *new_map;
+	struct crush_diff_params params;
+	__u32 *old_weights, *new_weights;
+	__u64 *device_in, *device_out;
+	int max_devices, max_rules, ruleno, first = 1, paths = 0;
+	int i, err, status = 0;
+
+	memset(&o, 0, sizeof(o));
+	o.rule = -1;
+	o.pg_num = 4096;
+	o.top = 10;
+	o.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 1; i < argc; i++) {
+		const char *option = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (option[0] != '-') {
+			if (paths == 0)
+				o.old_path = option;
+			else if (paths == 1)
+				o.new_path = option;
+			else
+				usage();
+			paths++;
+			continue;
+		}
+		if (value == NULL)
+			usage();
+		if (strcmp(option, "--rule") == 0)
+			o.rule = int_value(value);
+		else if (strcmp(option, "--num-rep") == 0)
+			o.num_rep = int_value(value);
+		else if (strcmp(option, "--pool") == 0)
+			o.pool = int_value(value);
+		else if (strcmp(option, "--pg-num") == 0)
+			o.pg_num = int_value(value);
+		else if (strcmp(option, "--old-weights") == 0)
+			o.old_weights = value;
+		else if (strcmp(option, "--new-weights") == 0)
+			o.new_weights = value;
+		else if (strcmp(option, "--sample") == 0)
+			o.samples = int_value(value);
+		else if (strcmp(option, "--seed") == 0)
+			o.seed = strtoull(value, NULL, 10);
+		else if (strcmp(option, "--threads") == 0)
+			o.threads = int_value(value);
+		else if (strcmp(option, "--top") == 0)
+			o.top = int_value(value);
+		else if (strcmp(option, "--format") == 0) {
+			if (strcmp(value, "json") == 0)
+				o.json = 1;
+			else if (strcmp(value, "text") != 0)
+				usage();
+		} else
+			usage();
+		i++;
+	}
+	if (o.new_path == NULL || o.pg_num < 1 || o.samples < 0 || o.threads < 1 ||
+	    o.top < 0 || o.num_rep < 0)
+		usage();
+
+	old_map = load(o.old_path);
+	new_map = load(o.new_path);
+	max_devices = old_map->max_devices > new_map->max_devices ?
+		old_map->max_devices : new_map->max_devices;
+	max_rules = old_map->max_rules < new_map->max_rules ?
+		old_map->max_rules : new_map->max_rules;
+	old_weights = load_weights(o.old_weights, old_map->max_devices);
+	new_weights = load_weights(o.new_weights, new_map->max_devices);
+	device_in = malloc(sizeof(__u64) * (max_devices + 1));
+	device_out = malloc(sizeof(__u64) * (max_devices + 1));
+	if (device_in == NULL || device_out == NULL) {
+		perror("malloc");
+		return 1;
+	}
+	if (o.rule >= 0 && (o.rule >= max_rules || old_map->rules[o.rule] == NULL ||
+			    new_map->rules[o.rule] == NULL)) {
+		fprintf(stderr, "rule %d is not in both maps\n", o.rule);
+		return 1;
+	}
+
+	memset(&params, 0, sizeof(params));
+	params.old_weights = old_weights;
+	params.old_weight_max = old_map->max_devices;
+	params.new_weights = new_weights;
+	params.new_weight_max = new_map->max_devices;
+	params.pool = o.pool;
+	params.pg_num = o.pg_num;
+	params.samples = o.samples;
+	params.seed = o.seed;
+	params.threads = o.threads;
+	if (o.json)
+		printf("{\"rules\":[");
+	for (ruleno = 0; ruleno < max_rules; ruleno++) {
+		const struct crush_rule *rule = new_map->rules[ruleno];
+		struct crush_diff_result result;
+
+		if (rule == NULL || old_map->rules[ruleno] == NULL ||
+		    (o.rule >= 0 && o.rule != ruleno))
+			continue;
+		params.ruleno = ruleno;
+		params.result_max = o.num_rep;
+		if (params.result_max == 0) {
+			params.result_max = 3;
+			if (params.result_max < rule->mask.min_size)
+				params.result_max = rule->mask.min_size;
+			if (params.result_max > rule->mask.max_size && rule->mask.max_size > 0)
+				params.result_max = rule->mask.max_size;
+		}
+		err = crush_diff(old_map, new_map, &params, &result, device_in, device_out);
+		if (err < 0) {
+			fprintf(stderr, "rule %d: %s\n", ruleno, strerror(-err));
+			status = 1;
+			break;
+		}
+		report(&o, ruleno, params.result_max, &result, device_in, device_out,
+		       max_devices, first);
+		first = 0;
+	}
+	if (o.json)
+		printf("]}\n");
+
+	free(device_in);
+	free(device_out);
+	free(old_weights);
+	free(new_weights);
+	crush_destroy(old_map);
+	crush_destroy(new_map);
+	return status;
+}
@@ -0,0 +1,642 @@
+/*
+ * Map a range of x with the rules of a crush map, on several
+ * threads, and report what crushtool --test reports: the mappings,
+ * the number of results of each size, the mappings with fewer
+ * results than requested, the utilization of the devices and the
+ * histogram of the tries needed to place an item.
+ *
+ *   crush_test -i MAP [options]
+ *
+ * The map is in the binary format of crushtool -o or the text
+ * format of crushtool -d, see crush_load().
+ *
+ * LGPL2
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crush.h"
+#include "mapper.h"
+#include "executor.h"
+#include "load.h"
+
+/* the x mapped at a time by a worker */
+#define CRUSH_TEST_GRAIN 1024
+
+struct options {
+	const char *input;
+	int rule;            /* -1 for all rules */
+	int min_rep;         /* 0 for the min_size of the rule */
+	int max_rep;         /* 0 for the max_size of the rule */
+	int min_x;
+	int max_x;
+	int threads;
+	int json;
+	int show_mappings;
+	int show_statistics;
+	int show_bad_mappings;
+	int show_utilization;
+	int show_choose_tries;
+};
+
+struct bad_mapping {
+	int x;
+	int size;
+	int *result;
+};
+
+/* what a worker counts */
+struct worker {
+	void *cwin;
+	__u64 *stored;       /* per device */
+	__u64 *sizes;        /* per result size */
+	__u32 *choose_tries;
+	struct bad_mapping *bad;
+	int bad_count;
+	int bad_capacity;
+	int error;
+};
+
+/* what the workers map */
+struct tester {
+	const struct crush_map *map;
+	const __u32 *weights;
+	int ruleno;
+	int num_rep;
+	int min_x;
+	int *mappings;       /* num_rep results per x, if not NULL */
+	int *mapping_sizes;  /* the number of results per x, if mappings is not NULL */
+	struct worker *workers; /* [workers] */
+};
+
+/* map the x [min_x + begin, min_x + end[ */
+static void work(void *arg, int worker, __s64 begin, __s64 end)
+{
+	const struct tester *te = arg;
+	const struct crush_map *map = te->map;
+	struct worker *w = &te->workers[worker];
+	int result[te->num_rep];
+	__s64 n;
+	int x, i, size;
+
+	if (w->error < 0)
+		return;
+	/* counted from min_x: x would overflow past INT_MAX */
+	for (n = begin; n < end; n++) {
+		x = te->min_x + n;
+		size = crush_do_rule(map, te->ruleno, x, result, te->num_rep,
+				     te->weights, map->max_devices, w->cwin, NULL);
+		w->sizes[size]++;
+		for (i = 0; i < size; i++)
+			if (result[i] >= 0 && result[i] < map->max_devices)
+				w->stored[result[i]]++;
+		if (te->mappings != NULL) {
+			memcpy(&te->mappings[n * te->num_rep], result, sizeof(int) * size);
+			te->mapping_sizes[n] = size;
+		}
+		/* indep rules leave holes where they fail */
+		for (i = 0; i < size && result[i] != CRUSH_ITEM_NONE; i++)
+			;
+		if (i == te->num_rep)
+			continue;
+		if (w->bad_count == w->bad_capacity) {
+			struct bad_mapping *bad;
+
+			w->bad_capacity = w->bad_capacity ? w->bad_capacity * 2 : 16;
+			bad = realloc(w->bad, sizeof(*bad) * w->bad_capacity);
+			if (bad == NULL) {
+				w->error = -ENOMEM;
+				break;
+			}
+			w->bad = bad;
+		}
+		w->bad[w->bad_count].x = x;
+		w->bad[w->bad_count].size = size;
+		w->bad[w->bad_count].result = malloc(sizeof(int) * (size ? size : 1));
+		if (w->bad[w->bad_count].result == NULL) {
+			w->error = -ENOMEM;
+			break;
+		}
+		memcpy(w->bad[w->bad_count].result, result, sizeof(int) * size);
+		w->bad_count++;
+	}
+}
+
+static int compare_bad(const void *a, const void *b)
+{
+	const struct bad_mapping *x = a, *y = b;
+
+	return (x->x > y->x) - (x->x < y->x);
+}
+
+/* the tries of a rule can exceed choose_total_tries with set_choose_tries */
+static int choose_tries_max(const struct crush_map *map, const struct crush_rule *rule)
+{
+	int max = map->choose_total_tries;
+	__u32 i;
+
+	for (i = 0; i < rule->len; i++)
+		if ((rule->steps[i].op == CRUSH_RULE_SET_CHOOSE_TRIES ||
+		     rule->steps[i].op == CRUSH_RULE_SET_CHOOSELEAF_TRIES) &&
+		    rule->steps[i].arg1 > max)
+			max = rule->steps[i].arg1;
+	return max + 1;
+}
+
+/* add the weight of the devices under __item__ to __expected__ */
+static void device_weights(const struct crush_map *map, int item, double weight,
+			   double *expected, int depth)
+{
+	const struct crush_bucket *b;
+	__u32 i;
+
+	if (item >= 0) {
+		if (item < map->max_devices && expected[item] == 0)
+			expected[item] = weight;
+		return;
+	}
+	if (-1 - item >= map->max_buckets || depth > CRUSH_MAX_DEPTH)
+		return;
+	b = map->buckets[-1 - item];
+	if (b == NULL)
+		return;
+	for (i = 0; i < b->size; i++)
+		device_weights(map, b->items[i],
+			       crush_get_bucket_item_weight(b, i) / (double)0x10000,
+			       expected, depth + 1);
+}
+
+/*
+ * The number of results each device should store: the devices
+ * under the buckets the rule takes, in proportion to their crush
+ * weight and reweight.
+ */
+static void expected_stored(const struct crush_map *map, const struct crush_rule *rule,
+			    const __u32 *weights, __u64 total, double *expected)
+{
+	double sum = 0;
+	__u32 i;
+	int d;
+
+	memset(expected, 0, sizeof(double) * map->max_devices);
+	for (i = 0; i < rule->len; i++)
+		if (rule->steps[i].op == CRUSH_RULE_TAKE)
+			device_weights(map, rule->steps[i].arg1, 1, expected, 0);
+	for (d = 0; d < map->max_devices; d++) {
+		expected[d] *= weights[d] / (double)0x10000;
+		sum += expected[d];
+	}
+	for (d = 0; d < map->max_devices; d++)
+		expected[d] = sum > 0 ? total * expected[d] / sum : 0;
+}
+
+static void print_result(const int *result, int size, int json)
+{
+	int i;
+
+	printf("[");
+	for (i = 0; i < size; i++) {
+		if (json && result[i] == CRUSH_ITEM_NONE)
+			printf("%snull", i ? "," : "");
+		else
+			printf("%s%d", i ? "," : "", result[i]);
+	}
+	printf("]");
+}
+
+struct report {
+	const struct options *o;
+	const struct crush_map *map;
+	int ruleno;
+	int num_rep;
+	__u64 x_count;
+	int *mappings;
+	int *mapping_sizes;
+	__u64 *stored;
+	__u64 *sizes;
+	double *expected;
+	__u32 *choose_tries;
+	int choose_tries_max;
+	struct bad_mapping *bad; /* ordered by x */
+	int bad_count;
+};
+
+static void report_text(const struct report *r)
+{
+	const struct options *o = r->o;
+	__u64 stored = 0;
+	__s64 n;
+	int i, d;
+
+	if (o->show_mappings)
+		for (n = 0; n < (__s64)r->x_count; n++) {
+			printf("CRUSH rule %d x %d ", r->ruleno, (int)(o->min_x + n));
+			print_result(&r->mappings[n * r->num_rep], r->mapping_sizes[n], 0);
+			printf("\n");
+		}
+	if (o->show_bad_mappings)
+		for (i = 0; i < r->bad_count; i++) {
+			printf("bad mapping rule %d x %d num_rep %d result ",
+			       r->ruleno, r->bad[i].x, r->num_rep);
+			print_result(r->bad[i].result, r->bad[i].size, 0);
+			printf("\n");
+		}
+	if (o->show_statistics)
+		for (i = 0; i <= r->num_rep; i++)
+			if (r->sizes[i] > 0)
+				printf("rule %d num_rep %d result size == %d:\t%llu/%llu\n",
+				       r->ruleno, r->num_rep, i,
+				       (unsigned long long)r->sizes[i],
+				       (unsigned long long)r->x_count);
+	if (o->show_utilization) {
+		for (d = 0; d < r->map->max_devices; d++)
+			stored += r->stored[d];
+		for (d = 0; d < r->map->max_devices; d++)
+			if (r->stored[d] > 0 || r->expected[d] > 0)
+				printf("  device %d:\t\t stored : %llu\t expected : %.2f\n",
+				       d, (unsigned long long)r->stored[d], r->expected[d]);
+	}
+	if (o->show_choose_tries)
+		for (i = 0; i < r->choose_tries_max; i++)
+			if (r->choose_tries[i] > 0)
+				printf("%2d: %5u\n", i, r->choose_tries[i]);
+}
+
+static void report_json(const struct report *r, int first)
+{
+	const struct options *o = r->o;
+	const char *sep = "";
+	__s64 n;
+	int i, d;
+
+	printf("%s{\"rule\":%d,\"num_rep\":%d,\"x_count\":%llu",
+	       first ? "" : ",", r->ruleno, r->num_rep, (unsigned long long)r->x_count);
+	if (o->show_statistics) {
+		printf(",\"sizes\":{");
+		for (i = 0; i <= r->num_rep; i++)
+			if (r->sizes[i] > 0) {
+				printf("%s\"%d\":%llu", sep, i, (unsigned long long)r->sizes[i]);
+				sep = ",";
+			}
+		printf("}");
+	}
+	if (o->show_mappings) {
+		printf(",\"mappings\":[");
+		for (n = 0; n < (__s64)r->x_count; n++) {
+			printf("%s{\"x\":%d,\"result\":", n ? "," : "", (int)(o->min_x + n));
+			print_result(&r->mappings[n * r->num_rep], r->mapping_sizes[n], 1);
+			printf("}");
+		}
+		printf("]");
+	}
+	if (o->show_bad_mappings) {
+		sep = "";
+		printf(",\"bad_mappings\":[");
+		for (i = 0; i < r->bad_count; i++) {
+			printf("%s{\"x\":%d,\"result\":", i ? "," : "", r->bad[i].x);
+			print_result(r->bad[i].result, r->bad[i].size, 1);
+			printf("}");
+		}
+		printf("]");
+	}
+	if (o->show_utilization) {
+		sep = "";
+		printf(",\"utilization\":[");
+		for (d = 0; d < r->map->max_devices; d++)
+			if (r->stored[d] > 0 || r->expected[d] > 0) {
+				printf("%s{\"device\":%d,\"stored\":%llu,\"expected\":%.2f}",
+				       sep, d, (unsigned long long)r->stored[d], r->expected[d]);
+				sep = ",";
+			}
+		printf("]");
+	}
+	if (o->show_choose_tries) {
+		printf(",\"choose_tries\":[");
+		for (i = 0; i < r->choose_tries_max; i++)
+			printf("%s%u", i ? "," : "", r->choose_tries[i]);
+		printf("]");
+	}
+	printf("}");
+}
+
+/* map the x range with rule __ruleno__ and __num_rep__ results, then report */
+static int test_rule(const struct options *o, struct crush_executor *executor,
+		     const struct crush_map *map, const __u32 *weights,
+		     int ruleno, int num_rep, int first)
+{
+	const struct crush_rule *rule = map->rules[ruleno];
+	const int workers = crush_executor_workers(executor);
+	struct tester te;
+	struct report r;
+	__u64 x_count = (__s64)o->max_x - o->min_x + 1;
+	int err = 0;
+	int t, i, d;
+
+	memset(&r, 0, sizeof(r));
+	memset(&te, 0, sizeof(te));
+	r.o = o;
+	r.map = map;
+	r.ruleno = ruleno;
+	r.num_rep = num_rep;
+	r.x_count = x_count;
+	r.choose_tries_max = choose_tries_max(map, rule);
+	r.stored = calloc(map->max_devices + 1, sizeof(__u64));
+	r.sizes = calloc(num_rep + 1, sizeof(__u64));
+	r.expected = calloc(map->max_devices + 1, sizeof(double));
+	r.choose_tries = calloc(r.choose_tries_max, sizeof(__u32));
+	if (o->show_mappings) {
+		r.mappings = malloc(sizeof(int) * num_rep * x_count);
+		r.mapping_sizes = malloc(sizeof(int) * x_count);
+	}
+	te.workers = calloc(workers, sizeof(*te.workers));
+	if (r.stored == NULL || r.sizes == NULL || r.expected == NULL ||
+	    r.choose_tries == NULL || te.workers == NULL ||
+	    (o->show_mappings && (r.mappings == NULL || r.mapping_sizes == NULL))) {
+		err = -ENOMEM;
+		goto out;
+	}
+	te.map = map;
+	te.weights = weights;
+	te.ruleno = ruleno;
+	te.num_rep = num_rep;
+	te.min_x = o->min_x;
+	te.mappings = r.mappings;
+	te.mapping_sizes = r.mapping_sizes;
+	for (t = 0; t < workers; t++) {
+		struct worker *w = &te.workers[t];
+
+		w->cwin = malloc(crush_work_size(map, num_rep));
+		w->stored = calloc(map->max_devices + 1, sizeof(__u64));
+		w->sizes = calloc(num_rep + 1, sizeof(__u64));
+		w->choose_tries = calloc(r.choose_tries_max, sizeof(__u32));
+		if (w->cwin == NULL || w->stored == NULL || w->sizes == NULL ||
+		    w->choose_tries == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+		crush_init_workspace(map, w->cwin);
+		crush_choose_tries_attach(w->cwin, w->choose_tries, r.choose_tries_max);
+	}
+	err = crush_parallel_for(executor, x_count, CRUSH_TEST_GRAIN, work, &te);
+	if (err < 0)
+		goto out;
+	for (t = 0; t < workers; t++) {
+		struct worker *w = &te.workers[t];
+
+		if (w->error < 0)
+			err = w->error;
+		for (d = 0; d < map->max_devices; d++)
+			r.stored[d] += w->stored[d];
+		for (i = 0; i <= num_rep; i++)
+			r.sizes[i] += w->sizes[i];
+		for (i = 0; i < r.choose_tries_max; i++)
+			r.choose_tries[i] += w->choose_tries[i];
+		r.bad_count += w->bad_count;
+	}
+	if (err < 0)
+		goto out;
+	/* the workers took the x in any order */
+	if (r.bad_count > 0) {
+		r.bad = malloc(sizeof(*r.bad) * r.bad_count);
+		if (r.bad == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+		for (t = 0, i = 0; t < workers; t++) {
+			memcpy(r.bad + i, te.workers[t].bad,
+			       sizeof(*r.bad) * te.workers[t].bad_count);
+			i += te.workers[t].bad_count;
+		}
+		qsort(r.bad, r.bad_count, sizeof(*r.bad), compare_bad);
+	}
+	if (o->show_utilization) {
+		__u64 total = 0;
+
+		for (d = 0; d < map->max_devices; d++)
+			total += r.stored[d];
+		expected_stored(map, rule, weights, total, r.expected);
+	}
+	if (o->json)
+		report_json(&r, first);
+	else
+		report_text(&r);
+out:
+	for (t = 0; te.workers && t < workers; t++) {
+		for (i = 0; i < te.workers[t].bad_count; i++)
+			free(te.workers[t].bad[i].result);
+		free(te.workers[t].bad);
+		free(te.workers[t].cwin);
+		free(te.workers[t].stored);
+		free(te.workers[t].sizes);
+		free(te.workers[t].choose_tries);
+	}
+	free(te.workers);
+	free(r.bad);
+	free(r.stored);
+	free(r.sizes);
+	free(r.expected);
+	free(r.choose_tries);
+	free(r.mappings);
+	free(r.mapping_sizes);
+	return err;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: crush_test -i MAP [options]\n"
+		"  -i, --input MAP         the map, binary or text\n"
+		"  --rule N                only test rule N (all rules)\n"
+		"  --num-rep N             map N results (from min_size to max_size of each rule)\n"
+		"  --min-rep N             map from N results\n"
+		"  --max-rep N             map up to N results\n"
+		"  --min-x N               the first x (0)\n"
+		"  --max-x N               the last x (1023)\n"
+		"  --x N                   only map N\n"
+		"  --weight DEVICE W       set the reweight of DEVICE to W, in [0,1]\n"
+		"  --threads N             map on N threads (the number of processors)\n"
+		"  --format text|json      the output format (text)\n"
+		"  --show-mappings         print each mapping\n"
+		"  --show-statistics       print how many mappings have each size\n"
+		"  --show-bad-mappings     print the mappings with fewer results than requested or holes\n"
+		"  --show-utilization      print the results stored by each device\n"
+		"  --show-choose-tries     print how many tries placing an item took\n");
+	exit(2);
+}
+
+static int int_value(const char *value)
+{
+	char *end;
+	long v;
+
+	if (value == NULL)
+		usage();
+	v = strtol(value, &end, 10);
+	if (*end != '\0' || end == value || v < -0x7fffffffL - 1 || v > 0x7fffffffL)
+		usage();
+	return (int)v;
+}
+
+int main(int argc, char **argv)
+{
+	struct options o;
+	struct crush_map *map = NULL;
+	struct crush_executor *executor = NULL;
+	__u32 *weights = NULL;
+	struct { int device; double weight; } *reweights = NULL;
+	int reweight_count = 0;
+	int ruleno, num_rep, first = 1, line = 0;
+	int i, err, status = 0;
+
+	memset(&o, 0, sizeof(o));
+	o.rule = -1;
+	o.max_x = 1023;
+	o.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 1; i < argc; i++) {
+		const char *option = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(option, "--show-mappings") == 0)
+			o.show_mappings = 1;
+		else if (strcmp(option, "--show-statistics") == 0)
+			o.show_statistics = 1;
+		else if (strcmp(option, "--show-bad-mappings") == 0)
+			o.show_bad_mappings = 1;
+		else if (strcmp(option, "--show-utilization") == 0)
+			o.show_utilization = 1;
+		else if (strcmp(option, "--show-choose-tries") == 0)
+			o.show_choose_tries = 1;
+		else if (value == NULL)
+			usage();
+		else if (strcmp(option, "-i") == 0 || strcmp(option, "--input") == 0)
+			o.input = argv[++i];
+		else if (strcmp(option, "--rule") == 0)
+			o.rule = int_value(argv[++i]);
+		else if (strcmp(option, "--num-rep") == 0)
+			o.min_rep = o.max_rep = int_value(argv[++i]);
+		else if (strcmp(option, "--min-rep") == 0)
+			o.min_rep = int_value(argv[++i]);
+		else if (strcmp(option, "--max-rep") == 0)
+			o.max_rep = int_value(argv[++i]);
+		else if (strcmp(option, "--min-x") == 0)
+			o.min_x = int_value(argv[++i]);
+		else if (strcmp(option, "--max-x") == 0)
+			o.max_x = int_value(argv[++i]);
+		else if (strcmp(option, "--x") == 0)
+			o.min_x = o.max_x = int_value(argv[++i]);
+		else if (strcmp(option, "--threads") == 0)
+			o.threads = int_value(argv[++i]);
+		else if (strcmp(option, "--format") == 0) {
+			value = argv[++i];
+			if (strcmp(value, "json") == 0)
+				o.json = 1;
+			else if (strcmp(value, "text") != 0)
+				usage();
+		} else if (strcmp(option, "--weight") == 0) {
+			if (i + 2 >= argc)
+				usage();
+			void *grown = realloc(reweights, sizeof(*reweights) * (reweight_count + 1));
+
+			if (grown == NULL) {
+				perror("realloc");
+				status = 1;
+				goto out;
+			}
+			reweights = grown;
+			reweights[reweight_count].device = int_value(argv[++i]);
+			reweights[reweight_count].weight = atof(argv[++i]);
+			if (reweights[reweight_count].weight < 0 ||
+			    reweights[reweight_count].weight > 1)
+				usage();
+			reweight_count++;
+		} else
+			usage();
+	}
+	if (o.input == NULL || o.min_x > o.max_x || o.threads < 1 || o.min_rep < 0 ||
+	    o.max_rep < 0 || (o.min_rep && o.max_rep && o.min_rep > o.max_rep))
+		usage();
+	if (!o.show_mappings && !o.show_bad_mappings && !o.show_utilization &&
+	    !o.show_choose_tries)
+		o.show_statistics = 1;
+	/* a thread maps at least CRUSH_TEST_GRAIN x */
+	if ((__s64)o.max_x - o.min_x + 1 < (__s64)o.threads * CRUSH_TEST_GRAIN)
+		o.threads = ((__s64)o.max_x - o.min_x) / CRUSH_TEST_GRAIN + 1;
+
+	err = crush_load_file(o.input, &map, &line);
+	if (err < 0) {
+		if (err == -EINVAL && line > 0)
+			fprintf(stderr, "%s:%d: invalid crush map\n", o.input, line);
+		else
+			fprintf(stderr, "%s: %s\n", o.input, strerror(-err));
+		map = NULL;
+		status = 1;
+		goto out;
+	}
+	weights = malloc(sizeof(__u32) * (map->max_devices + 1));
+	if (weights == NULL) {
+		perror("malloc");
+		status = 1;
+		goto out;
+	}
+	for (i = 0; i < map->max_devices; i++)
+		weights[i] = 0x10000;
+	for (i = 0; i < reweight_count; i++) {
+		if (reweights[i].device < 0 || reweights[i].device >= map->max_devices) {
+			fprintf(stderr, "device %d is not in the map\n", reweights[i].device);
+			status = 1;
+			goto out;
+		}
+		weights[reweights[i].device] = reweights[i].weight * 0x10000;
+	}
+	if (o.rule >= 0 && (o.rule >= (int)map->max_rules || map->rules[o.rule] == NULL)) {
+		fprintf(stderr, "rule %d is not in the map\n", o.rule);
+		status = 1;
+		goto out;
+	}
+
+	if (o.threads > 1) {
+		err = crush_executor_create(o.threads, &executor);
+		if (err < 0) {
+			fprintf(stderr, "crush_executor_create: %s\n", strerror(-err));
+			status = 1;
+			goto out;
+		}
+	}
+
+	if (o.json)
+		printf("{\"rules\":[");
+	for (ruleno = 0; ruleno < (int)map->max_rules && status == 0; ruleno++) {
+		const struct crush_rule *rule = map->rules[ruleno];
+		int min_rep, max_rep;
+
+		if (rule == NULL || (o.rule >= 0 && o.rule != ruleno))
+			continue;
+		min_rep = o.min_rep ? o.min_rep : rule->mask.min_size;
+		max_rep = o.max_rep ? o.max_rep : rule->mask.max_size;
+		if (min_rep < 1)
+			min_rep = 1;
+		for (num_rep = min_rep; num_rep <= max_rep; num_rep++) {
+			err = test_rule(&o, executor, map, weights, ruleno, num_rep, first);
+			if (err < 0) {
+				fprintf(stderr, "rule %d: %s\n", ruleno, strerror(-err));
+				status = 1;
+				break;
+			}
+			first = 0;
+		}
+	}
+	if (o.json)
+		printf("]}\n");
+out:
+	if (executor)
+		crush_executor_destroy(executor);
+	free(reweights);
+	free(weights);
+	if (map)
+		crush_destroy(map);
+	return status;
+}